@@ -0,0 +1,171 @@
+// One host thread driving many jobs: each job is a chain of dependent
+// add_arrays dispatches on its own buffers. Runs the jobs one after another
+// with a blocking Engine::wait per dispatch, then all at once as Tasks on
+// an EventLoop, under a blocking and a spin-then-block WaitPolicy.
+//
+//   event_loop_bench [--jobs N] [--depth N] [--elements N] [--spin-us N]
+//
+// On the host backend every launch completes before launch() returns, so
+// the modes only differ on a GPU agent.
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/engine.h"
+#include "hansa/task.h"
+
+using hansa::Engine;
+
+namespace {
+
+struct Options {
+  int jobs = 256;
+  int depth = 4;
+  int elements = 1 << 16;
+  int spin_us = 50;
+};
+
+struct AddArgs {
+  int *a;
+  int *b;
+  int *out;
+};
+
+/// A job's buffers: each step adds b into out, reading the previous
+/// step's out, so the steps must run in order.
+struct Job {
+  Job(Engine &engine, int elements)
+      : a(engine, elements), b(engine, elements), out(engine, elements) {}
+
+  hansa::DeviceBuffer<int> a, b, out;
+};
+
+hansa::Task<int>
+run_job(Engine &engine, const Engine::KernelDispatchConfig &cfg, Job &job,
+        int depth) {
+  for (int step = 0; step < depth; ++step) {
+    int *in = step == 0 ? job.a.data() : job.out.data();
+    const AddArgs args{in, job.b.data(), job.out.data()};
+    const int status = co_await engine.launch(cfg, args);
+    if (status != 0) co_return -1;
+  }
+  co_return 0;
+}
+
+hansa::Task<>
+spawn_job(Engine &engine, const Engine::KernelDispatchConfig &cfg, Job &job,
+          int depth, int *failures) {
+  const int status = co_await run_job(engine, cfg, job, depth);
+  if (status != 0) ++*failures;
+}
+
+void
+report(const char *mode, const Options &opts, double seconds,
+       uint64_t blocked_waits) {
+  const double dispatches = double(opts.jobs) * opts.depth;
+  std::cout << std::left << std::setw(28) << mode << std::right << std::fixed
+            << std::setprecision(2) << std::setw(9) << seconds * 1e3
+            << " ms " << std::setprecision(0) << std::setw(10)
+            << dispatches / seconds << " dispatches/s " << std::setw(8)
+            << blocked_waits << " blocked waits" << std::endl;
+}
+
+template <typename Fn>
+double
+time_s(Fn fn) {
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--jobs" && has_value) {
+      opts.jobs = std::atoi(argv[++i]);
+    } else if (arg == "--depth" && has_value) {
+      opts.depth = std::atoi(argv[++i]);
+    } else if (arg == "--elements" && has_value) {
+      opts.elements = std::atoi(argv[++i]);
+    } else if (arg == "--spin-us" && has_value) {
+      opts.spin_us = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: event_loop_bench [--jobs N] [--depth N] "
+                   "[--elements N] [--spin-us N]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  Engine engine;
+  if (0 != engine.init()) {
+    std::cerr << "ERROR: failed to initialize engine" << std::endl;
+    return 1;
+  }
+  std::vector<std::unique_ptr<Job>> jobs;
+  for (int j = 0; j < opts.jobs; ++j) {
+    jobs.push_back(std::make_unique<Job>(engine, opts.elements));
+    if (!jobs.back()->out.data()) {
+      std::cerr << "ERROR: failed to allocate job buffers" << std::endl;
+      return 1;
+    }
+  }
+  const Engine::KernelDispatchConfig cfg(
+      Engine::kKernelLibrary, "add_arrays.kd", {opts.elements, 1, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  std::cout << opts.jobs << " jobs of " << opts.depth << " dispatches, "
+            << opts.elements << " elements each" << std::endl;
+
+  // One job at a time, as the launchers in main.cpp run.
+  int failures = 0;
+  report("sequential, blocking wait", opts, time_s([&] {
+           for (auto &job : jobs) {
+             for (int step = 0; step < opts.depth; ++step) {
+               int *in = step == 0 ? job->a.data() : job->out.data();
+               const AddArgs args{in, job->b.data(), job->out.data()};
+               Engine::DispatchHandle handle;
+               if (0 != engine.post(&cfg, args, &handle)) {
+                 ++failures;
+                 break;
+               }
+               engine.wait(handle);
+             }
+           }
+         }),
+         0);
+
+  const hansa::WaitPolicy policies[] = {
+      hansa::WaitPolicy::blocking(),
+      hansa::WaitPolicy::spin_then_block(
+          std::chrono::microseconds(opts.spin_us))};
+  for (const hansa::WaitPolicy &policy : policies) {
+    hansa::EventLoop loop(policy);
+    const double seconds = time_s([&] {
+      for (auto &job : jobs) {
+        loop.spawn(spawn_job(engine, cfg, *job, opts.depth, &failures));
+      }
+      loop.run();
+    });
+    report(policy.spin.count() ? "event loop, spin then block"
+                               : "event loop, blocking",
+           opts, seconds, loop.blocked_waits());
+  }
+  if (failures) {
+    std::cerr << "ERROR: " << failures << " jobs failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}
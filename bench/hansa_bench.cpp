@@ -0,0 +1,477 @@
+// Kernel benchmark: sweeps problem sizes for each kernel and reports kernel
+// time, host launch latency, bandwidth and throughput as JSON and CSV.
+//
+//   hansa_bench [--warmup N] [--reps N] [--kernels a,b,...] [--full]
+//               [--json FILE] [--csv FILE]
+//
+// Kernel time comes from the dispatch timestamps the packet processor
+// records (hsa_amd_profiling_get_dispatch_time). On the host backend there
+// is no device clock and kernel time is wall clock from submit to
+// completion instead. Launch latency is the host time to write the packet
+// and kernargs and ring the doorbell. GB/s and GFLOP/s use the median
+// kernel time and the minimum traffic and arithmetic of each kernel.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/engine.h"
+
+using hansa::Engine;
+using hansa::DeviceBuffer;
+
+namespace {
+
+struct Options {
+  int warmup = 3;
+  int reps = 20;
+  bool full = false;
+  std::vector<std::string> kernels;
+  std::string json = "hansa_bench.json";
+  std::string csv = "hansa_bench.csv";
+};
+
+struct Stats {
+  double min, p50, p90, p99, max, mean;
+};
+
+struct Result {
+  std::string kernel;
+  std::string size;
+  double bytes;
+  double flops;
+  Stats kernel_ms;
+  Stats launch_us;
+
+  [[nodiscard]]
+  double
+  gb_per_s() const {
+    return bytes / (kernel_ms.p50 * 1e6);
+  }
+
+  [[nodiscard]]
+  double
+  gflop_per_s() const {
+    return flops / (kernel_ms.p50 * 1e6);
+  }
+};
+
+// Nearest-rank percentiles.
+Stats
+summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  const size_t n = samples.size();
+  auto rank = [&](double p) {
+    const size_t r = static_cast<size_t>(std::ceil(p * n));
+    return samples[std::clamp<size_t>(r, 1, n) - 1];
+  };
+  double sum = 0;
+  for (double s : samples) sum += s;
+  return {samples.front(), rank(0.5), rank(0.9), rank(0.99), samples.back(),
+          sum / n};
+}
+
+// The host backend runs kernels serially per work-item; skip the largest
+// sizes there unless --full is given.
+constexpr double kHostFlopBudget = 2e8;
+
+class Runner {
+ public:
+  Runner(Engine &engine, const Options &opts, bool device_timing)
+      : engine_(engine), opts_(opts), device_timing_(device_timing) {}
+
+  [[nodiscard]]
+  bool
+  skip(double flops) const {
+    return engine_.is_host() && !opts_.full && flops > kHostFlopBudget;
+  }
+
+  /// Runs warmups then repetitions of one dispatch and records the result.
+  template <typename ARGS_T>
+  int
+  run(const char *kernel, const std::string &size,
+      const Engine::KernelDispatchConfig &cfg, const ARGS_T &args,
+      double bytes, double flops) {
+    using clock = std::chrono::steady_clock;
+    std::vector<double> kernel_ms, launch_us;
+    for (int i = 0; i < opts_.warmup + opts_.reps; ++i) {
+      Engine::DispatchHandle handle;
+      const auto start = clock::now();
+      if (0 != engine_.enqueue(&cfg, args, &handle)) return -1;
+      // The host backend executes on submit, which belongs to the kernel.
+      if (!engine_.is_host()) engine_.submit();
+      const auto launched = clock::now();
+      double device_ns = 0;
+      engine_.wait(handle, &device_ns);
+      const auto done = clock::now();
+      if (i < opts_.warmup) continue;
+
+      launch_us.push_back(
+          std::chrono::duration<double, std::micro>(launched - start).count());
+      kernel_ms.push_back(
+          device_timing_
+              ? device_ns * 1e-6
+              : std::chrono::duration<double, std::milli>(done - launched)
+                    .count());
+    }
+
+    Result result{kernel,
+                  size,
+                  bytes,
+                  flops,
+                  summarize(kernel_ms),
+                  summarize(launch_us)};
+    std::cout << std::left << std::setw(24) << kernel << std::setw(12) << size
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << result.kernel_ms.p50 << " ms"
+              << std::setw(10) << result.kernel_ms.p99 << " ms p99"
+              << std::setw(9) << result.launch_us.p50 << " us launch"
+              << std::setw(10) << result.gb_per_s() << " GB/s"
+              << std::setw(10) << result.gflop_per_s() << " GFLOP/s"
+              << std::defaultfloat << std::endl;
+    results_.push_back(result);
+    return 0;
+  }
+
+  [[nodiscard]]
+  const std::vector<Result> &
+  results() const {
+    return results_;
+  }
+
+  Engine &
+  engine() {
+    return engine_;
+  }
+
+ private:
+  Engine &engine_;
+  const Options &opts_;
+  bool device_timing_;
+  std::vector<Result> results_;
+};
+
+int
+bench_add_arrays(Runner &runner) {
+  struct args_t {
+    int *input_a;
+    int *input_b;
+    int *output;
+  };
+  // The kernel has no bounds check, so sizes are multiples of 64.
+  for (int n : {1 << 16, 1 << 20, 1 << 24}) {
+    const double flops = n;
+    if (runner.skip(flops)) continue;
+    DeviceBuffer<int> a(runner.engine(), n), b(runner.engine(), n),
+        out(runner.engine(), n);
+    std::vector<int> host(n);
+    for (int i = 0; i < n; ++i) host[i] = i;
+    if (a.copy_from(host.data()) || b.copy_from(host.data())) return -1;
+
+    args_t args{a.data(), b.data(), out.data()};
+    Engine::KernelDispatchConfig cfg("libkernels.so", "add_arrays.kd",
+                                     {n, 1, 1}, {64, 1, 1}, sizeof(args_t));
+    if (0 != runner.run("add_arrays", std::to_string(n), cfg, args,
+                        3.0 * n * sizeof(int), flops)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+std::string
+image_size(int side) {
+  return std::to_string(side) + "x" + std::to_string(side);
+}
+
+int
+fill_image(DeviceBuffer<unsigned char> *image) {
+  std::vector<unsigned char> pixels(image->count());
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    pixels[i] = (i * 7 + i / 3) & 0xff;
+  }
+  return image->copy_from(pixels.data());
+}
+
+int
+bench_color_to_grayscale(Runner &runner) {
+  struct args_t {
+    unsigned char *img_out;
+    unsigned char *img_in;
+    int width;
+    int height;
+  };
+  for (int side : {512, 1024, 2048, 4096}) {
+    const int pixels = side * side;
+    // 3 multiplies and 2 adds per pixel
+    const double flops = 5.0 * pixels;
+    if (runner.skip(flops)) continue;
+    DeviceBuffer<unsigned char> in(runner.engine(), pixels * 3),
+        out(runner.engine(), pixels);
+    if (fill_image(&in)) return -1;
+
+    args_t args{out.data(), in.data(), side, side};
+    Engine::KernelDispatchConfig cfg("libkernels.so", "color_to_grayscale.kd",
+                                     {pixels, 1, 1}, {64, 1, 1},
+                                     sizeof(args_t));
+    if (0 != runner.run("color_to_grayscale", image_size(side), cfg, args,
+                        4.0 * pixels, flops)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int
+bench_image_blur_rgb(Runner &runner) {
+  struct args_t {
+    unsigned char *img_out;
+    unsigned char *img_in;
+    int width;
+    int height;
+  };
+  for (int side : {512, 1024, 2048, 4096}) {
+    const int pixels = side * side;
+    // 9 adds and a divide per channel
+    const double flops = 30.0 * pixels;
+    if (runner.skip(flops)) continue;
+    DeviceBuffer<unsigned char> in(runner.engine(), pixels * 3),
+        out(runner.engine(), pixels * 3);
+    if (fill_image(&in)) return -1;
+
+    args_t args{out.data(), in.data(), side, side};
+    Engine::KernelDispatchConfig cfg("libkernels.so", "image_blur_rgb.kd",
+                                     {side, side, 1}, {16, 16, 1},
+                                     sizeof(args_t));
+    if (0 != runner.run("image_blur_rgb", image_size(side), cfg, args,
+                        6.0 * pixels, flops)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+template <typename T>
+int
+bench_matrix_multiply(Runner &runner, const char *kernel,
+                      const std::string &symbol,
+                      const std::array<int, 3> &workgroup) {
+  struct args_t {
+    T *c;
+    const T *a;
+    const T *b;
+    int n;
+    int m;
+    int k;
+  };
+  // Square matrices, multiples of the tiled kernel's 16x16 tiles.
+  for (int n : {128, 256, 512, 1024, 2048}) {
+    const double flops = 2.0 * n * n * n;
+    if (runner.skip(flops)) continue;
+    DeviceBuffer<T> a(runner.engine(), n * n), b(runner.engine(), n * n),
+        c(runner.engine(), n * n);
+    std::vector<T> host_a(n * n), host_b(n * n);
+    for (int i = 0; i < n * n; ++i) {
+      host_a[i] = T(i % 7);
+      host_b[i] = T(i % 5);
+    }
+    if (a.copy_from(host_a.data()) || b.copy_from(host_b.data())) return -1;
+
+    args_t args{c.data(), a.data(), b.data(), n, n, n};
+    Engine::KernelDispatchConfig cfg("libkernels.so", symbol, {n, n, 1},
+                                     workgroup, sizeof(args_t));
+    if (0 != runner.run(kernel, image_size(n), cfg, args,
+                        3.0 * n * n * sizeof(T), flops)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+struct Benchmark {
+  const char *name;
+  std::function<int(Runner &)> run;
+};
+
+const std::vector<Benchmark> &
+benchmarks() {
+  static const std::vector<Benchmark> all = {
+      {"add_arrays", bench_add_arrays},
+      {"color_to_grayscale", bench_color_to_grayscale},
+      {"image_blur_rgb", bench_image_blur_rgb},
+      {"matrix_multiply_naive",
+       [](Runner &runner) {
+         return bench_matrix_multiply<int>(runner, "matrix_multiply_naive",
+                                           "matrix_multiply_naive.kd",
+                                           {64, 1, 1});
+       }},
+      {"matrix_multiply_tiled2",
+       [](Runner &runner) {
+         return bench_matrix_multiply<float>(runner, "matrix_multiply_tiled2",
+                                             "matrix_multiply_tiled2.kd",
+                                             {16, 16, 1});
+       }},
+  };
+  return all;
+}
+
+void
+write_stats_json(std::ostream &out, const char *name, const Stats &s) {
+  out << "\"" << name << "\": {\"min\": " << s.min << ", \"p50\": " << s.p50
+      << ", \"p90\": " << s.p90 << ", \"p99\": " << s.p99
+      << ", \"max\": " << s.max << ", \"mean\": " << s.mean << "}";
+}
+
+int
+write_json(const std::string &path, const std::string &agent,
+           const char *timing, const Options &opts,
+           const std::vector<Result> &results) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "ERROR: cannot write " << path << std::endl;
+    return -1;
+  }
+  out << std::setprecision(6);
+  out << "{\n  \"agent\": \"" << agent << "\",\n  \"timing\": \"" << timing
+      << "\",\n  \"warmup\": " << opts.warmup << ",\n  \"reps\": " << opts.reps
+      << ",\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    out << (i ? ",\n" : "\n") << "    {\"kernel\": \"" << r.kernel
+        << "\", \"size\": \"" << r.size << "\", \"bytes\": " << r.bytes
+        << ", \"flops\": " << r.flops << ", ";
+    write_stats_json(out, "kernel_ms", r.kernel_ms);
+    out << ", ";
+    write_stats_json(out, "launch_us", r.launch_us);
+    out << ", \"gb_per_s\": " << r.gb_per_s()
+        << ", \"gflop_per_s\": " << r.gflop_per_s() << "}";
+  }
+  out << "\n  ]\n}\n";
+  return 0;
+}
+
+int
+write_csv(const std::string &path, const std::vector<Result> &results) {
+  std::ofstream out(path);
+  if (!out) {
+    std::cerr << "ERROR: cannot write " << path << std::endl;
+    return -1;
+  }
+  out << std::setprecision(6);
+  out << "kernel,size,bytes,flops";
+  for (const char *stat : {"kernel_ms", "launch_us"}) {
+    for (const char *p : {"min", "p50", "p90", "p99", "max", "mean"}) {
+      out << "," << stat << "_" << p;
+    }
+  }
+  out << ",gb_per_s,gflop_per_s\n";
+  for (const Result &r : results) {
+    out << r.kernel << "," << r.size << "," << r.bytes << "," << r.flops;
+    for (const Stats &s : {r.kernel_ms, r.launch_us}) {
+      out << "," << s.min << "," << s.p50 << "," << s.p90 << "," << s.p99
+          << "," << s.max << "," << s.mean;
+    }
+    out << "," << r.gb_per_s() << "," << r.gflop_per_s() << "\n";
+  }
+  return 0;
+}
+
+void
+usage() {
+  std::cerr << "usage: hansa_bench [--warmup N] [--reps N] "
+               "[--kernels a,b,...] [--full] [--json FILE] [--csv FILE]\n"
+               "kernels:";
+  for (const Benchmark &b : benchmarks()) std::cerr << " " << b.name;
+  std::cerr << std::endl;
+}
+
+int
+parse_options(int argc, char **argv, Options *opts) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--full") {
+      opts->full = true;
+    } else if (arg == "--warmup" && has_value) {
+      opts->warmup = std::atoi(argv[++i]);
+    } else if (arg == "--reps" && has_value) {
+      opts->reps = std::atoi(argv[++i]);
+    } else if (arg == "--json" && has_value) {
+      opts->json = argv[++i];
+    } else if (arg == "--csv" && has_value) {
+      opts->csv = argv[++i];
+    } else if (arg == "--kernels" && has_value) {
+      std::stringstream list(argv[++i]);
+      for (std::string name; std::getline(list, name, ',');) {
+        opts->kernels.push_back(name);
+      }
+    } else {
+      return -1;
+    }
+  }
+  if (opts->warmup < 0 || opts->reps < 1) return -1;
+  for (const std::string &name : opts->kernels) {
+    const auto &all = benchmarks();
+    if (std::none_of(all.begin(), all.end(), [&](const Benchmark &b) {
+          return name == b.name;
+        })) {
+      std::cerr << "ERROR: unknown kernel " << name << std::endl;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  Options opts;
+  if (0 != parse_options(argc, argv, &opts)) {
+    usage();
+    return 1;
+  }
+
+  Engine engine;
+  if (0 != engine.init()) {
+    std::cerr << "Failed to initialize engine" << std::endl;
+    return 1;
+  }
+  const bool device_timing = engine.enable_profiling() == 0;
+  const char *timing = device_timing ? "device" : "wall-clock";
+  std::cout << "Kernel timing: " << timing << ", " << opts.warmup
+            << " warmups, " << opts.reps << " reps" << std::endl;
+
+  Runner runner(engine, opts, device_timing);
+  for (const Benchmark &b : benchmarks()) {
+    if (!opts.kernels.empty() &&
+        std::find(opts.kernels.begin(), opts.kernels.end(), b.name) ==
+            opts.kernels.end()) {
+      continue;
+    }
+    if (0 != b.run(runner)) {
+      std::cerr << "ERROR: " << b.name << " failed" << std::endl;
+      return 1;
+    }
+  }
+
+  if (0 != write_json(opts.json, engine.agent_name(), timing, opts,
+                      runner.results()) ||
+      0 != write_csv(opts.csv, runner.results())) {
+    return 1;
+  }
+  std::cout << "Wrote " << opts.json << " and " << opts.csv << std::endl;
+  return 0;
+}
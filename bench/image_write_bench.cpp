@@ -0,0 +1,122 @@
+// Image writer throughput: each format at 1, 2, 4, ... threads up to the
+// hardware's, against stbi_write_png, in MB/s of pixels written.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hansa/image_writer.h"
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "third_party/stb_image.h"
+#include "third_party/stb_image_write.h"
+
+namespace {
+
+constexpr int kReps = 3;
+
+/// A smooth gradient with noise, for when no image is given; about as
+/// compressible as a photo.
+std::vector<uint8_t>
+synthetic_image(int width, int height, int channels) {
+  std::vector<uint8_t> pixels(size_t(width) * height * channels);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < pixels.size(); ++i) {
+    seed = seed * 1664525 + 1013904223;
+    const size_t p = i / channels;
+    pixels[i] = (p % width + p / width + 40 * (i % channels)) / 8 +
+                (seed >> 29);
+  }
+  return pixels;
+}
+
+template <typename Fn>
+double
+best_ms(Fn &&fn) {
+  double best = 0;
+  for (int r = 0; r < kReps; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    if (0 != fn()) return -1;
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    if (r == 0 || ms < best) best = ms;
+  }
+  return best;
+}
+
+void
+row(const std::string &name, unsigned threads, size_t raw, size_t file,
+    double ms) {
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::setw(8) << threads << std::fixed << std::setprecision(2)
+            << std::setw(12) << ms << std::setw(12) << raw / (ms * 1000.0)
+            << std::setw(12) << double(raw) / file << std::endl;
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  int width = 4096, height = 4096, channels = 3;
+  std::vector<uint8_t> pixels;
+  if (argc > 1) {
+    unsigned char *loaded = stbi_load(argv[1], &width, &height, &channels, 0);
+    if (!loaded) {
+      std::cerr << "ERROR: Failed to load image " << argv[1] << std::endl;
+      return 1;
+    }
+    pixels.assign(loaded, loaded + size_t(width) * height * channels);
+    stbi_image_free(loaded);
+  } else {
+    pixels = synthetic_image(width, height, channels);
+  }
+  const size_t raw = pixels.size();
+  const std::string out =
+      (std::filesystem::temp_directory_path() / "hansa_image_write_bench")
+          .string();
+  std::cout << width << "x" << height << "x" << channels << ", best of "
+            << kReps << "\n"
+            << std::left << std::setw(12) << "writer" << std::right
+            << std::setw(8) << "threads" << std::setw(12) << "ms"
+            << std::setw(12) << "MB/s" << std::setw(12) << "ratio"
+            << std::endl;
+
+  const double stb_ms = best_ms([&] {
+    return stbi_write_png(out.c_str(), width, height, channels, pixels.data(),
+                          width * channels)
+               ? 0
+               : -1;
+  });
+  if (stb_ms < 0) return 1;
+  row("stb", 1, raw, std::filesystem::file_size(out), stb_ms);
+
+  const unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+  const struct {
+    const char *name;
+    hansa::ImageFormat format;
+  } formats[] = {{"png", hansa::ImageFormat::kPng},
+                 {"png-stored", hansa::ImageFormat::kPngStored},
+                 {"qoi", hansa::ImageFormat::kQoi}};
+  for (const auto &f : formats) {
+    for (unsigned threads = 1;; threads = std::min(threads * 2, hardware)) {
+      hansa::ImageWriter writer(threads);
+      hansa::ImageWriteStats stats;
+      const double ms = best_ms([&] {
+        return writer.write(out, f.format, pixels.data(), width, height,
+                            channels, 0, &stats);
+      });
+      if (ms < 0) return 1;
+      row(f.name, threads, raw, stats.file_bytes, ms);
+      // QOI is one serial pass.
+      if (threads == hardware || f.format == hansa::ImageFormat::kQoi) break;
+    }
+  }
+  std::filesystem::remove(out);
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Kernarg provisioning rate: hsa_memory_allocate per launch (what
+// setup_dispatch used to do) against a KernargArena slot per launch.
+//
+// Only the kernarg memory is timed: no packet is written and nothing goes
+// through a queue, so the figures bound what provisioning costs a launch
+// rather than measure launches. submit_scaling_bench times whole launches
+// through the queue.
+
+#include <hsa/hsa.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "hansa/common.h"
+#include "hansa/kernarg_arena.h"
+
+namespace {
+
+struct Regions {
+  hsa_agent_t agent{0};
+  hsa_region_t kernarg{0};
+};
+
+hsa_status_t
+find_gpu(hsa_agent_t agent, void *data) {
+  hsa_device_type_t type;
+  hsa_status_t status = hsa_agent_get_info(agent, HSA_AGENT_INFO_DEVICE, &type);
+  if (status != HSA_STATUS_SUCCESS) return status;
+  if (type == HSA_DEVICE_TYPE_GPU) {
+    static_cast<Regions *>(data)->agent = agent;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+find_kernarg(hsa_region_t region, void *data) {
+  hsa_region_segment_t segment;
+  hsa_region_get_info(region, HSA_REGION_INFO_SEGMENT, &segment);
+  if (segment != HSA_REGION_SEGMENT_GLOBAL) return HSA_STATUS_SUCCESS;
+  hsa_region_global_flag_t flags;
+  hsa_region_get_info(region, HSA_REGION_INFO_GLOBAL_FLAGS, &flags);
+  if (flags & HSA_REGION_GLOBAL_FLAG_KERNARG) {
+    static_cast<Regions *>(data)->kernarg = region;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+// Size of the add_arrays kernarg segment: three pointers plus ImplicitArg.
+constexpr size_t kKernargSize = 288;
+constexpr int kLaunches = 200000;
+
+struct Args {
+  uint8_t bytes[24];
+};
+
+void
+report(const char *name, std::chrono::steady_clock::duration elapsed) {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  std::cout << name << ": " << static_cast<uint64_t>(kLaunches / seconds)
+            << " kernarg blocks/s, " << seconds * 1e9 / kLaunches
+            << " ns/block" << std::endl;
+}
+
+}  // namespace
+
+int
+main() {
+  hsa_status_t status = hsa_init();
+  HSA_ENFORCE("hsa_init", status);
+
+  Regions regions;
+  status = hsa_iterate_agents(find_gpu, &regions);
+  HSA_ENFORCE("hsa_iterate_agents", status);
+  HSA_ENFORCE_PTR("No GPU agent", regions.agent.handle);
+  status = hsa_agent_iterate_regions(regions.agent, find_kernarg, &regions);
+  HSA_ENFORCE("hsa_agent_iterate_regions", status);
+  HSA_ENFORCE_PTR("Failed to find kernarg memory region",
+                  regions.kernarg.handle);
+
+  Args args{};
+
+  // Before: one allocation per launch. The old code never freed it; freeing
+  // here keeps the region from running dry during the loop.
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kLaunches; ++i) {
+    void *kernarg;
+    status = hsa_memory_allocate(regions.kernarg, kKernargSize, &kernarg);
+    HSA_ENFORCE("hsa_memory_allocate", status);
+    std::memset(kernarg, 0, kKernargSize);
+    std::memcpy(kernarg, &args, sizeof(args));
+    hsa_memory_free(kernarg);
+  }
+  report("hsa_memory_allocate", std::chrono::steady_clock::now() - start);
+
+  // After: slots recycled by packet index. The completion signal is already
+  // at 0, as it would be once the previous occupant has finished.
+  hsa_signal_t done;
+  status = hsa_signal_create(0, 0, nullptr, &done);
+  HSA_ENFORCE("hsa_signal_create", status);
+  {
+    hansa::KernargArena arena;
+    if (0 != arena.init(regions.kernarg, 1024, kKernargSize)) return -1;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kLaunches; ++i) {
+      void *kernarg = arena.acquire(i, done);
+      std::memset(kernarg, 0, kKernargSize);
+      std::memcpy(kernarg, &args, sizeof(args));
+    }
+    report("KernargArena", std::chrono::steady_clock::now() - start);
+  }
+  hsa_signal_destroy(done);
+
+  hsa_shut_down();
+  return 0;
+}
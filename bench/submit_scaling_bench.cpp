@@ -0,0 +1,271 @@
+// Multi-producer submission: launches per second for 1 to N threads sharing
+// one queue.
+//
+//   submit_scaling_bench [--threads N] [--launches N] [--queue-size N]
+//                        [--engine]
+//
+// By default the producers run the submission protocol of Engine::post()
+// (hansa/aql_queue.h) against a stub queue in host memory, whose packet
+// processor is a thread that consumes packets in queue order and checks
+// that every one arrives whole and in its producer's order. No GPU needed.
+// --engine posts add_arrays through Engine::post() instead, on the GPU
+// agent or the host backend, each thread keeping a window of dispatches in
+// flight.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/aql_queue.h"
+#include "hansa/engine.h"
+
+using hansa::Engine;
+
+namespace {
+
+struct Options {
+  int threads = std::max(4u, std::thread::hardware_concurrency());
+  int launches = 200000;
+  uint32_t queue_size = 4096;
+  bool engine = false;
+};
+
+constexpr uint16_t kInvalidHeader = HSA_PACKET_TYPE_INVALID
+                                    << HSA_PACKET_HEADER_TYPE;
+constexpr uint16_t kDispatchHeader = HSA_PACKET_TYPE_KERNEL_DISPATCH
+                                     << HSA_PACKET_HEADER_TYPE;
+
+/// A queue in host memory with the interface of hansa::HsaQueue.
+class StubQueue {
+ public:
+  explicit StubQueue(uint32_t size) : packets_(size) {
+    for (hsa_kernel_dispatch_packet_t &packet : packets_) {
+      packet.header = kInvalidHeader;
+    }
+  }
+
+  uint64_t
+  add_write_index(uint64_t count) {
+    return write_index_.fetch_add(count, std::memory_order_acq_rel);
+  }
+
+  [[nodiscard]]
+  uint64_t
+  load_read_index() const {
+    return read_index_.load(std::memory_order_acquire);
+  }
+
+  [[nodiscard]]
+  uint32_t
+  size() const {
+    return packets_.size();
+  }
+
+  hsa_kernel_dispatch_packet_t *
+  packet(uint64_t index) {
+    return &packets_[index & (packets_.size() - 1)];
+  }
+
+  void
+  ring(uint64_t index) {
+    doorbell_.store(index, std::memory_order_release);
+  }
+
+  /// The packet processor: takes packets in queue order as their headers
+  /// become valid, checks each, and frees its slot, until count packets
+  /// have gone through. Returns the number of bad packets.
+  uint64_t
+  consume(uint64_t count, int producers) {
+    std::vector<uint64_t> next(producers, 0);
+    uint64_t bad = 0;
+    for (uint64_t index = 0; index < count; ++index) {
+      hsa_kernel_dispatch_packet_t *p = packet(index);
+      uint32_t header32;
+      while (((header32 = __atomic_load_n(reinterpret_cast<uint32_t *>(p),
+                                          __ATOMIC_ACQUIRE)) &
+              0xffff) == kInvalidHeader) {
+        std::this_thread::yield();
+      }
+      // Producers tag each packet with their id and sequence number.
+      const uint64_t producer = p->kernel_object;
+      const uint64_t sequence = p->reserved2;
+      if (producer >= uint64_t(producers) || sequence != next[producer] ||
+          p->grid_size_x != uint32_t(producer * 31 + sequence) ||
+          (header32 >> 16) != 1) {
+        ++bad;
+      } else {
+        ++next[producer];
+      }
+      __atomic_store_n(&p->header, kInvalidHeader, __ATOMIC_RELAXED);
+      read_index_.store(index + 1, std::memory_order_release);
+    }
+    return bad;
+  }
+
+ private:
+  std::vector<hsa_kernel_dispatch_packet_t> packets_;
+  std::atomic<uint64_t> write_index_{0};
+  std::atomic<uint64_t> read_index_{0};
+  std::atomic<uint64_t> doorbell_{0};
+};
+
+/// Runs fn(thread, launches) on threads threads, splitting launches between
+/// them, and returns the wall time from the first start to the last finish.
+template <typename Fn>
+double
+run_threads(int threads, int launches, Fn fn) {
+  std::vector<std::thread> workers;
+  std::atomic<bool> go{false};
+  for (int t = 0; t < threads; ++t) {
+    const int share = launches / threads + (t < launches % threads);
+    workers.emplace_back([&, t, share] {
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      fn(t, share);
+    });
+  }
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (std::thread &worker : workers) worker.join();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+int
+run_stub(int threads, const Options &opts, double *seconds) {
+  StubQueue queue(opts.queue_size);
+  uint64_t bad = 0;
+  std::thread processor(
+      [&] { bad = queue.consume(opts.launches, threads); });
+  *seconds = run_threads(threads, opts.launches, [&](int t, int share) {
+    // One-dimensional setup, as the consumer checks.
+    constexpr uint32_t header32 = kDispatchHeader | (1u << 16);
+    hsa_kernel_dispatch_packet_t body{};
+    body.kernel_object = t;
+    for (int i = 0; i < share; ++i) {
+      body.reserved2 = i;
+      body.grid_size_x = t * 31 + i;
+      const uint64_t index = hansa::claim_packet(queue, queue.size());
+      hansa::publish_packet(queue, index, body, header32);
+    }
+  });
+  processor.join();
+  if (bad != 0) {
+    std::cerr << "ERROR: " << bad << " packets arrived torn or out of order"
+              << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+struct AddArgs {
+  int *a;
+  int *b;
+  int *out;
+};
+
+int
+run_engine(Engine &engine, int threads, const Options &opts,
+           double *seconds) {
+  constexpr int kElements = 64;
+  constexpr size_t kInFlight = 32;
+  hansa::DeviceBuffer<int> a(engine, kElements), b(engine, kElements),
+      out(engine, kElements);
+  if (!a.data() || !b.data() || !out.data()) return -1;
+  const Engine::KernelDispatchConfig cfg(Engine::kKernelLibrary,
+                                         "add_arrays.kd", {kElements, 1, 1},
+                                         {kElements, 1, 1});
+  const AddArgs args{a.data(), b.data(), out.data()};
+  std::atomic<int> failures{0};
+  *seconds = run_threads(threads, opts.launches, [&](int, int share) {
+    std::deque<Engine::DispatchHandle> in_flight;
+    for (int i = 0; i < share; ++i) {
+      if (in_flight.size() == kInFlight) {
+        engine.wait(in_flight.front());
+        in_flight.pop_front();
+      }
+      Engine::DispatchHandle handle;
+      if (0 != engine.post(&cfg, args, &handle)) {
+        ++failures;
+        break;
+      }
+      in_flight.push_back(handle);
+    }
+    for (const Engine::DispatchHandle &handle : in_flight) {
+      engine.wait(handle);
+    }
+  });
+  return failures ? -1 : 0;
+}
+
+void
+usage() {
+  std::cerr << "usage: submit_scaling_bench [--threads N] [--launches N] "
+               "[--queue-size N] [--engine]"
+            << std::endl;
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--threads" && has_value) {
+      opts.threads = std::atoi(argv[++i]);
+    } else if (arg == "--launches" && has_value) {
+      opts.launches = std::atoi(argv[++i]);
+    } else if (arg == "--queue-size" && has_value) {
+      opts.queue_size = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--engine") {
+      opts.engine = true;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (opts.threads < 1 || opts.launches < 1 || opts.queue_size == 0 ||
+      (opts.queue_size & (opts.queue_size - 1)) != 0) {
+    std::cerr << "ERROR: threads and launches must be positive and the "
+                 "queue size a power of two"
+              << std::endl;
+    return 1;
+  }
+
+  Engine engine;
+  if (opts.engine && 0 != engine.init()) {
+    std::cerr << "ERROR: failed to initialize engine" << std::endl;
+    return 1;
+  }
+  std::cout << (opts.engine ? "Engine::post" : "stub queue") << ", "
+            << opts.launches << " launches" << std::endl;
+  double one_thread = 0;
+  for (int threads = 1; threads <= opts.threads; ++threads) {
+    double seconds;
+    const int status = opts.engine
+                           ? run_engine(engine, threads, opts, &seconds)
+                           : run_stub(threads, opts, &seconds);
+    if (status != 0) return 1;
+    const double rate = opts.launches / seconds;
+    if (threads == 1) one_thread = rate;
+    std::cout << std::setw(3) << threads << " threads: " << std::fixed
+              << std::setprecision(0) << std::setw(10) << rate
+              << " launches/s, " << std::setprecision(1) << std::setw(7)
+              << seconds * 1e9 / opts.launches << " ns/launch, "
+              << std::setprecision(2) << rate / one_thread << "x"
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,112 @@
+// Cost of one trace span: TraceSpan round trips with recording off, then
+// on, in nanoseconds and TSC ticks each, from one thread and from several
+// at once. Built without HANSA_TRACE the HANSA_TRACE_* macros expand to
+// nothing, so there is no third case to time.
+//
+//   trace_bench [--spans N] [--threads N]
+
+#include <time.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hansa/trace.h"
+
+namespace {
+
+struct Options {
+  uint64_t spans = 10000000;
+  unsigned threads = 4;
+};
+
+struct Cost {
+  double ns = 0;
+  double ticks = 0;
+};
+
+/// CPU time the calling thread has used.
+double
+thread_cpu_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/// Per-span cost of spans round trips on each of threads threads, from
+/// each thread's own CPU time so that threads sharing a core do not count
+/// each other's spans.
+Cost
+time_spans(uint64_t spans, unsigned threads) {
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t start_ticks = hansa::trace_ticks();
+  std::vector<double> cpu_ns(threads);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([spans, ns = &cpu_ns[t]] {
+      const double begin = thread_cpu_ns();
+      for (uint64_t i = 0; i < spans; ++i) {
+        hansa::TraceSpan span("bench", "i", i);
+      }
+      *ns = thread_cpu_ns() - begin;
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+  const double ticks_per_ns =
+      double(hansa::trace_ticks() - start_ticks) /
+      std::chrono::duration<double, std::nano>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  double ns = 0;
+  for (double thread_ns : cpu_ns) ns += thread_ns;
+  ns /= double(spans) * threads;
+  return {ns, ns * ticks_per_ns};
+}
+
+void
+report(const std::string &mode, unsigned threads, const Cost &cost) {
+  std::cout << std::left << std::setw(12) << mode << std::right
+            << std::setw(8) << threads << std::fixed << std::setprecision(2)
+            << std::setw(12) << cost.ns << std::setw(12) << cost.ticks
+            << std::endl;
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--spans" && has_value) {
+      opts.spans = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--threads" && has_value) {
+      opts.threads = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: trace_bench [--spans N] [--threads N]"
+                << std::endl;
+      return 1;
+    }
+  }
+  if (opts.spans == 0 || opts.threads == 0) {
+    std::cerr << "ERROR: --spans and --threads must be positive" << std::endl;
+    return 1;
+  }
+
+  std::cout << opts.spans << " spans per thread\n"
+            << std::left << std::setw(12) << "recording" << std::right
+            << std::setw(8) << "threads" << std::setw(12) << "ns/span"
+            << std::setw(12) << "ticks/span" << std::endl;
+  report("off", 1, time_spans(opts.spans, 1));
+  report("off", opts.threads, time_spans(opts.spans, opts.threads));
+  hansa::Tracer::instance().enable();
+  report("on", 1, time_spans(opts.spans, 1));
+  report("on", opts.threads, time_spans(opts.spans, opts.threads));
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Host<->device transfers: H2D and D2H bandwidth of Engine::copy_to_device
+// and copy_to_host (DMA engines, double-buffered staging) per chunk size,
+// then a kernel over a large input uploaded whole before it runs against
+// the same input streamed with Engine::stream_upload, computing on each
+// chunk while the next uploads.
+//
+//   transfer_bench [--mb N] [--reps N]
+//
+// On the host backend copies are memcpys and kernels run synchronously, so
+// only the bandwidth figures mean much there.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/engine.h"
+
+using hansa::Engine;
+
+namespace {
+
+struct Options {
+  size_t mb = 256;
+  int reps = 5;
+};
+
+struct AddArgs {
+  int *a;
+  int *b;
+  int *out;
+};
+
+template <typename Fn>
+double
+best_ms(int reps, Fn fn) {
+  double best = 0;
+  for (int r = 0; r < reps; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    if (0 != fn()) return -1;
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    best = r == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+/// out[i] = in[i] + in[i] over count ints at in.
+Engine::KernelDispatchConfig
+doubling(size_t count) {
+  return Engine::KernelDispatchConfig(
+      Engine::kKernelLibrary, "add_arrays.kd", {int(count), 1, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--mb" && has_value) {
+      opts.mb = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--reps" && has_value) {
+      opts.reps = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: transfer_bench [--mb N] [--reps N]" << std::endl;
+      return 1;
+    }
+  }
+  if (opts.mb == 0 || opts.reps < 1) {
+    std::cerr << "ERROR: --mb and --reps must be positive" << std::endl;
+    return 1;
+  }
+
+  Engine engine;
+  if (0 != engine.init()) {
+    std::cerr << "ERROR: failed to initialize engine" << std::endl;
+    return 1;
+  }
+  const size_t bytes = opts.mb << 20;
+  const size_t count = bytes / sizeof(int);
+  std::vector<int> host(count), back(count);
+  for (size_t i = 0; i < count; ++i) host[i] = int(i);
+  hansa::DeviceBuffer<int> in(engine, count), out(engine, count);
+  if (!in.data() || !out.data()) {
+    std::cerr << "ERROR: failed to allocate " << opts.mb << " MB buffers"
+              << std::endl;
+    return 1;
+  }
+
+  std::cout << opts.mb << " MB, best of " << opts.reps << "\n"
+            << std::setw(10) << "chunk KB" << std::setw(12) << "H2D GB/s"
+            << std::setw(12) << "D2H GB/s" << std::endl;
+  for (size_t chunk_kb : {256, 1024, 4096, 16384}) {
+    if (0 != engine.transfer().set_chunk_size(chunk_kb << 10)) return 1;
+    const double up =
+        best_ms(opts.reps, [&] { return in.copy_from(host.data()); });
+    const double down =
+        best_ms(opts.reps, [&] { return in.copy_to(back.data()); });
+    if (up < 0 || down < 0 || back != host) {
+      std::cerr << "ERROR: copies failed or corrupted the data" << std::endl;
+      return 1;
+    }
+    std::cout << std::fixed << std::setprecision(2) << std::setw(10)
+              << chunk_kb << std::setw(12) << bytes / (up * 1e6)
+              << std::setw(12) << bytes / (down * 1e6) << std::endl;
+  }
+
+  const double whole = best_ms(opts.reps, [&] {
+    if (0 != in.copy_from(host.data())) return -1;
+    const Engine::KernelDispatchConfig cfg = doubling(count);
+    Engine::DispatchHandle handle;
+    const AddArgs args{in.data(), in.data(), out.data()};
+    if (0 != engine.post(&cfg, args, &handle)) return -1;
+    engine.wait(handle);
+    return 0;
+  });
+  const double streamed = best_ms(opts.reps, [&] {
+    return engine.stream_upload(
+        host.data(), bytes,
+        [&](void *chunk, size_t offset, size_t size,
+            Engine::DispatchHandle *last) {
+          const Engine::KernelDispatchConfig cfg =
+              doubling(size / sizeof(int));
+          int *a = static_cast<int *>(chunk);
+          const AddArgs args{a, a, out.data() + offset / sizeof(int)};
+          return engine.post(&cfg, args, last);
+        });
+  });
+  if (whole < 0 || streamed < 0 || out.copy_to(back.data()) != 0) return 1;
+  for (size_t i = 0; i < count; ++i) {
+    if (back[i] != 2 * host[i]) {
+      std::cerr << "ERROR: streamed result wrong at " << i << std::endl;
+      return 1;
+    }
+  }
+  std::cout << std::setprecision(3) << "upload, then compute: " << whole
+            << " ms\nstreamed upload and compute: " << streamed << " ms ("
+            << engine.transfer().chunk_size() / 1024 << " KB chunks)"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,48 @@
+# Generates the assembly that embeds kernel code objects in the executable.
+#
+#   cmake -DOUTPUT=<bundle.S> -DTARGETS=<id,id,...> -DCODE_OBJECTS=<co,co,...>
+#         -P code_object_bundle.cmake
+#
+# TARGETS and CODE_OBJECTS pair up by position. Each code object is pulled in
+# with .incbin, page aligned, and the null-terminated table
+# hansa_code_object_bundle lists target ID, data and size for each; see
+# hansa/code_object_bundle.h for the C side.
+
+string(REPLACE "," ";" targets "${TARGETS}")
+string(REPLACE "," ";" code_objects "${CODE_OBJECTS}")
+list(LENGTH targets count)
+list(LENGTH code_objects co_count)
+if(NOT count EQUAL co_count)
+    message(FATAL_ERROR "${count} targets but ${co_count} code objects")
+endif()
+
+set(blobs "")
+set(table "")
+math(EXPR last "${count} - 1")
+foreach(i RANGE ${last})
+    list(GET targets ${i} target)
+    list(GET code_objects ${i} code_object)
+    string(APPEND blobs "
+    .p2align 12
+hansa_code_object_${i}:
+    .incbin \"${code_object}\"
+hansa_code_object_${i}_end:
+hansa_code_object_${i}_isa:
+    .asciz \"${target}\"
+")
+    string(APPEND table "    .quad hansa_code_object_${i}_isa, hansa_code_object_${i}, hansa_code_object_${i}_end - hansa_code_object_${i}\n")
+endforeach()
+
+file(WRITE "${OUTPUT}" "/* Generated by cmake/code_object_bundle.cmake; do not edit. */
+    .section .rodata
+${blobs}
+    .section .data.rel.ro, \"aw\"
+    .p2align 3
+    .globl hansa_code_object_bundle
+    .type hansa_code_object_bundle, @object
+hansa_code_object_bundle:
+${table}    .quad 0, 0, 0
+    .size hansa_code_object_bundle, . - hansa_code_object_bundle
+
+    .section .note.GNU-stack, \"\", @progbits
+")
@@ -0,0 +1,70 @@
+# Rewrites a kernels/*.c source so it compiles for the host backend.
+#
+#   cmake -DINPUT=<kernel.c> -DOUTPUT=<host_kernel.c> -P host_kernel.cmake
+#
+# LDS statics are marked HANSA_LDS (see hansa/host/amdgcn_shim.h), the
+# amdgpu_kernel attribute is dropped, and every kernel gets an entry point
+# that unpacks its kernarg block plus a constructor registering it with the
+# host runtime under its code object symbol name.
+
+file(READ "${INPUT}" source)
+
+string(FIND "${source}" "__builtin_amdgcn_s_barrier" barrier_pos)
+if(barrier_pos EQUAL -1)
+    set(uses_barrier 0)
+else()
+    set(uses_barrier 1)
+endif()
+
+set(ident "[A-Za-z_][A-Za-z0-9_]*")
+set(ws "[ \t\r\n]")
+string(REGEX MATCHALL "amdgpu_kernel\\)\\)${ws}*void${ws}+${ident}${ws}*\\([^)]*\\)"
+    kernels "${source}")
+
+set(wrappers "")
+foreach(kernel IN LISTS kernels)
+    string(REGEX MATCH "void${ws}+(${ident})${ws}*\\(([^)]*)\\)" unused "${kernel}")
+    set(name "${CMAKE_MATCH_1}")
+    string(REGEX REPLACE "${ws}+" " " params "${CMAKE_MATCH_2}")
+    string(REPLACE "," ";" params "${params}")
+
+    set(members "")
+    set(call_args "")
+    set(i 0)
+    foreach(param IN LISTS params)
+        string(STRIP "${param}" param)
+        if(NOT param MATCHES "^(.*[^A-Za-z0-9_])${ident}$")
+            continue()
+        endif()
+        string(STRIP "${CMAKE_MATCH_1}" type)
+        string(APPEND members "    ${type} a${i};\n")
+        list(APPEND call_args "p->a${i}")
+        math(EXPR i "${i} + 1")
+    endforeach()
+    string(REPLACE ";" ", " call_args "${call_args}")
+
+    if(members STREQUAL "")
+        set(unpack "  (void)kernarg;\n")
+    else()
+        set(unpack "  const struct {\n${members}  } *p = kernarg;\n")
+    endif()
+
+    string(APPEND wrappers "
+static void
+${name}__hansa_entry(const void *kernarg) {
+${unpack}  ${name}(${call_args});
+}
+
+__attribute__((constructor)) static void
+${name}__hansa_register(void) {
+  hansa_host_register_kernel(\"${name}.kd\",
+                             ${name}__hansa_entry, ${uses_barrier});
+}
+")
+endforeach()
+
+string(REPLACE "__attribute__((address_space(3)))" "HANSA_LDS"
+    source "${source}")
+string(REPLACE ", amdgpu_kernel))" "))" source "${source}")
+
+file(WRITE "${OUTPUT}" "#line 1 \"${INPUT}\"\n${source}${wrappers}")
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <hsa/hsa.h>
+
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+namespace hansa {
+
+/// An hsa_queue_t through the few operations packet submission needs, so
+/// the protocol below also runs against a host-memory queue in tests and
+/// benchmarks.
+class HsaQueue {
+ public:
+  explicit HsaQueue(hsa_queue_t *queue) : queue_(queue) {}
+
+  uint64_t
+  add_write_index(uint64_t count) {
+    return hsa_queue_add_write_index_scacq_screl(queue_, count);
+  }
+
+  [[nodiscard]]
+  uint64_t
+  load_read_index() const {
+    return hsa_queue_load_read_index_scacquire(queue_);
+  }
+
+  [[nodiscard]]
+  uint32_t
+  size() const {
+    return queue_->size;
+  }
+
+  hsa_kernel_dispatch_packet_t *
+  packet(uint64_t index) {
+    return static_cast<hsa_kernel_dispatch_packet_t *>(queue_->base_address) +
+           (index & (queue_->size - 1));
+  }
+
+  void
+  ring(uint64_t index) {
+    hsa_signal_store_screlease(queue_->doorbell_signal,
+                               static_cast<hsa_signal_value_t>(index));
+  }
+
+ private:
+  hsa_queue_t *queue_;
+};
+
+/// Claims the next slot of queue for one packet, safely against any number
+/// of other producers: the slot is the value of a single atomic add on the
+/// write index, so no two producers ever get the same one. Returns once
+/// the packet window slots back has been consumed, which also leaves room
+/// in the queue when window is at most its size.
+template <typename Queue>
+uint64_t
+claim_packet(Queue &queue, uint64_t window) {
+  const uint64_t index = queue.add_write_index(1);
+  while (index - queue.load_read_index() >= window) {
+    std::this_thread::yield();
+  }
+  return index;
+}
+
+/// Copies everything of body past the header into the slot of index, then
+/// publishes header32 (header and setup) with one release store and rings
+/// the doorbell.
+///
+/// The packet processor stops at the first slot whose header is still
+/// invalid, so producers may publish in any order: a packet published
+/// ahead of an earlier slot waits until that slot's producer publishes and
+/// rings in turn. The release store keeps the body from becoming visible
+/// after the header.
+template <typename Queue>
+void
+publish_packet(Queue &queue, uint64_t index,
+               const hsa_kernel_dispatch_packet_t &body, uint32_t header32) {
+  hsa_kernel_dispatch_packet_t *packet = queue.packet(index);
+  constexpr size_t aql_header_size = 4;
+  std::memcpy(reinterpret_cast<uint8_t *>(packet) + aql_header_size,
+              reinterpret_cast<const uint8_t *>(&body) + aql_header_size,
+              sizeof(*packet) - aql_header_size);
+  __atomic_store_n(reinterpret_cast<uint32_t *>(packet), header32,
+                   __ATOMIC_RELEASE);
+  queue.ring(index);
+}
+
+}  // namespace hansa
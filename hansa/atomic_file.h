@@ -0,0 +1,46 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace hansa {
+
+/// Writes data to a temporary file beside path and renames it over path,
+/// so a concurrent reader sees the old file or the new one, never half of
+/// either. The temporary name carries the pid and a per-process count, so
+/// concurrent writers, in this process or another, never share one. The
+/// directory must exist.
+inline int
+write_file_atomically(const std::string &path, std::string_view data) {
+  namespace fs = std::filesystem;
+  static std::atomic<unsigned> writes{0};
+  std::error_code ec;
+  const std::string tmp = path + ".tmp" + std::to_string(getpid()) + "." +
+                          std::to_string(writes++);
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    if (!out) {
+      std::cerr << "ERROR: Failed to write " << tmp << std::endl;
+      out.close();
+      fs::remove(tmp, ec);
+      return -1;
+    }
+  }
+  fs::rename(tmp, path, ec);
+  if (ec) {
+    std::cerr << "ERROR: Failed to replace " << path << ": " << ec.message()
+              << std::endl;
+    fs::remove(tmp, ec);
+    return -1;
+  }
+  return 0;
+}
+
+}  // namespace hansa
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <elf.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hansa/msgpack.h"
+
+namespace hansa {
+
+/// One entry of a kernel's .args metadata.
+struct KernelArgInfo {
+  std::string name;
+  /// e.g. global_buffer, by_value, hidden_block_count_x.
+  std::string value_kind;
+  uint32_t offset = 0;
+  uint32_t size = 0;
+
+  [[nodiscard]]
+  bool
+  hidden() const {
+    return value_kind.compare(0, 7, "hidden_") == 0;
+  }
+};
+
+/// What the AMDGPU code-object metadata says about one kernel.
+struct KernelMetadata {
+  std::string name;
+  /// The kernel descriptor symbol, e.g. add_arrays.kd.
+  std::string symbol;
+  uint32_t kernarg_segment_size = 0;
+  uint32_t kernarg_segment_align = 0;
+  uint32_t group_segment_fixed_size = 0;
+  uint32_t private_segment_fixed_size = 0;
+  uint32_t sgpr_count = 0;
+  uint32_t vgpr_count = 0;
+  uint32_t agpr_count = 0;
+  uint32_t wavefront_size = 0;
+  uint32_t max_flat_workgroup_size = 0;
+  /// Explicit args first, in declaration order, then hidden ones.
+  std::vector<KernelArgInfo> args;
+
+  /// The leading args the kernel's signature declares.
+  [[nodiscard]]
+  size_t
+  explicit_arg_count() const {
+    size_t n = 0;
+    while (n < args.size() && !args[n].hidden()) ++n;
+    return n;
+  }
+
+  /// One past the last byte of the explicit args.
+  [[nodiscard]]
+  uint32_t
+  explicit_args_end() const {
+    uint32_t end = 0;
+    for (size_t i = 0; i < explicit_arg_count(); ++i) {
+      end = std::max(end, args[i].offset + args[i].size);
+    }
+    return end;
+  }
+};
+
+/// ELF note type of the msgpack metadata in code object v3 and later.
+constexpr uint32_t kNoteAmdgpuMetadata = 32;
+
+/// Finds the AMDGPU metadata note of an ELF code object and decodes the
+/// kernels it describes. Returns -1 if the file is not an ELF code object
+/// or has no well-formed metadata. Pure host code, so it runs without a
+/// GPU.
+inline int
+parse_code_object_metadata(const void *elf, size_t size,
+                           std::vector<KernelMetadata> *kernels) {
+  const auto *bytes = static_cast<const uint8_t *>(elf);
+  Elf64_Ehdr ehdr;
+  if (size < sizeof(ehdr)) return -1;
+  std::memcpy(&ehdr, bytes, sizeof(ehdr));
+  if (std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr.e_shentsize != sizeof(Elf64_Shdr) ||
+      ehdr.e_shoff > size ||
+      (size - ehdr.e_shoff) / sizeof(Elf64_Shdr) < ehdr.e_shnum) {
+    return -1;
+  }
+
+  for (uint16_t s = 0; s < ehdr.e_shnum; ++s) {
+    Elf64_Shdr shdr;
+    std::memcpy(&shdr, bytes + ehdr.e_shoff + s * sizeof(shdr), sizeof(shdr));
+    if (shdr.sh_type != SHT_NOTE || shdr.sh_offset > size ||
+        shdr.sh_size > size - shdr.sh_offset) {
+      continue;
+    }
+    // Notes are a name and a descriptor, each padded to 4 bytes.
+    size_t at = shdr.sh_offset;
+    const size_t end = shdr.sh_offset + shdr.sh_size;
+    while (end - at >= sizeof(Elf64_Nhdr)) {
+      Elf64_Nhdr note;
+      std::memcpy(&note, bytes + at, sizeof(note));
+      const size_t name_at = at + sizeof(note);
+      const size_t desc_at = name_at + ((note.n_namesz + 3) & ~3u);
+      const size_t next = desc_at + ((size_t(note.n_descsz) + 3) & ~size_t(3));
+      if (next > end) break;
+      if (note.n_type == kNoteAmdgpuMetadata && note.n_namesz == 7 &&
+          std::memcmp(bytes + name_at, "AMDGPU", 7) == 0) {
+        MsgPackValue root;
+        if (!MsgPackReader::decode(bytes + desc_at, note.n_descsz, &root) ||
+            root.type != MsgPackValue::Type::kMap) {
+          return -1;
+        }
+        const MsgPackValue *list = root.find("amdhsa.kernels");
+        if (!list || list->type != MsgPackValue::Type::kArray) return -1;
+        for (const MsgPackValue &k : list->array) {
+          KernelMetadata meta;
+          meta.name = k.get_string(".name");
+          meta.symbol = k.get_string(".symbol");
+          meta.kernarg_segment_size = k.get_int(".kernarg_segment_size");
+          meta.kernarg_segment_align = k.get_int(".kernarg_segment_align");
+          meta.group_segment_fixed_size =
+              k.get_int(".group_segment_fixed_size");
+          meta.private_segment_fixed_size =
+              k.get_int(".private_segment_fixed_size");
+          meta.sgpr_count = k.get_int(".sgpr_count");
+          meta.vgpr_count = k.get_int(".vgpr_count");
+          meta.agpr_count = k.get_int(".agpr_count");
+          meta.wavefront_size = k.get_int(".wavefront_size");
+          meta.max_flat_workgroup_size =
+              k.get_int(".max_flat_workgroup_size");
+          if (const MsgPackValue *args = k.find(".args")) {
+            for (const MsgPackValue &a : args->array) {
+              meta.args.push_back({a.get_string(".name"),
+                                   a.get_string(".value_kind"),
+                                   uint32_t(a.get_int(".offset")),
+                                   uint32_t(a.get_int(".size"))});
+            }
+          }
+          kernels->push_back(std::move(meta));
+        }
+        return 0;
+      }
+      at = next;
+    }
+  }
+  return -1;
+}
+
+/// Size of an AMDHSA kernel descriptor, the object a .kd symbol names.
+constexpr size_t kKernelDescriptorSize = 64;
+
+/// Finds the bytes of the symbol named symbol, e.g. add_arrays.kd, in the
+/// file image of an ELF code object. Returns null if there is no such
+/// symbol of kKernelDescriptorSize bytes inside a section of the file.
+inline const uint8_t *
+find_kernel_descriptor(const void *elf, size_t size,
+                       const std::string &symbol) {
+  const auto *bytes = static_cast<const uint8_t *>(elf);
+  Elf64_Ehdr ehdr;
+  if (size < sizeof(ehdr)) return nullptr;
+  std::memcpy(&ehdr, bytes, sizeof(ehdr));
+  if (std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr.e_shentsize != sizeof(Elf64_Shdr) || ehdr.e_shoff > size ||
+      (size - ehdr.e_shoff) / sizeof(Elf64_Shdr) < ehdr.e_shnum) {
+    return nullptr;
+  }
+  const auto section = [&](size_t index) {
+    Elf64_Shdr shdr;
+    std::memcpy(&shdr, bytes + ehdr.e_shoff + index * sizeof(shdr),
+                sizeof(shdr));
+    return shdr;
+  };
+  const auto in_file = [&](const Elf64_Shdr &shdr) {
+    return shdr.sh_offset <= size && shdr.sh_size <= size - shdr.sh_offset;
+  };
+
+  for (uint16_t s = 0; s < ehdr.e_shnum; ++s) {
+    const Elf64_Shdr symtab = section(s);
+    if ((symtab.sh_type != SHT_SYMTAB && symtab.sh_type != SHT_DYNSYM) ||
+        !in_file(symtab) || symtab.sh_link >= ehdr.e_shnum) {
+      continue;
+    }
+    const Elf64_Shdr strtab = section(symtab.sh_link);
+    if (!in_file(strtab)) continue;
+    for (size_t i = 0; i < symtab.sh_size / sizeof(Elf64_Sym); ++i) {
+      Elf64_Sym sym;
+      std::memcpy(&sym, bytes + symtab.sh_offset + i * sizeof(sym),
+                  sizeof(sym));
+      if (sym.st_name >= strtab.sh_size ||
+          sym.st_size != kKernelDescriptorSize ||
+          sym.st_shndx >= ehdr.e_shnum) {
+        continue;
+      }
+      const char *name =
+          reinterpret_cast<const char *>(bytes + strtab.sh_offset) +
+          sym.st_name;
+      const size_t max_len = strtab.sh_size - sym.st_name;
+      if (strnlen(name, max_len) == max_len || symbol != name) continue;
+      // Symbol values are virtual addresses in the section's load image.
+      const Elf64_Shdr home = section(sym.st_shndx);
+      if (home.sh_type == SHT_NOBITS || !in_file(home) ||
+          home.sh_size < kKernelDescriptorSize || sym.st_value < home.sh_addr ||
+          sym.st_value - home.sh_addr > home.sh_size - kKernelDescriptorSize) {
+        return nullptr;
+      }
+      return bytes + home.sh_offset + (sym.st_value - home.sh_addr);
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace hansa
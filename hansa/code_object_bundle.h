@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Code objects embedded in the executable, one per target in GPU_ARCHS;
+/// see cmake/code_object_bundle.cmake, which generates the table. Weak, so
+/// binaries built without a bundle still link and simply have none.
+extern "C" {
+struct hansa_code_object_entry {
+  /// A target ID such as gfx1103 or gfx90a:xnack-.
+  const char *isa;
+  const uint8_t *data;
+  uint64_t size;
+};
+
+/// Ends with an entry whose isa is null.
+extern const hansa_code_object_entry hansa_code_object_bundle[]
+    __attribute__((weak));
+}
+
+namespace hansa {
+
+/// A processor and the settings of the target features that change code
+/// generation, as in gfx90a:sramecc+:xnack-. A feature the name leaves out
+/// is "any".
+struct TargetId {
+  std::string processor;
+  /// '+', '-', or 0 for any.
+  char sramecc = 0;
+  char xnack = 0;
+
+  /// Takes a bare target ID or a full ISA name as HSA reports it, such as
+  /// amdgcn-amd-amdhsa--gfx90a:sramecc+:xnack-.
+  static bool
+  parse(const std::string &name, TargetId *out) {
+    TargetId id;
+    const size_t dashes = name.rfind("--");
+    size_t pos = dashes == std::string::npos ? 0 : dashes + 2;
+    size_t colon = name.find(':', pos);
+    id.processor = name.substr(pos, colon - pos);
+    if (id.processor.compare(0, 3, "gfx") != 0) return false;
+    while (colon != std::string::npos) {
+      pos = colon + 1;
+      colon = name.find(':', pos);
+      const std::string feature = name.substr(pos, colon - pos);
+      if (feature.size() < 2) return false;
+      const char setting = feature.back();
+      if (setting != '+' && setting != '-') return false;
+      const std::string key = feature.substr(0, feature.size() - 1);
+      if (key == "sramecc") {
+        id.sramecc = setting;
+      } else if (key == "xnack") {
+        id.xnack = setting;
+      } else {
+        return false;
+      }
+    }
+    *out = id;
+    return true;
+  }
+
+  /// Whether code built for this target runs on agent: same processor,
+  /// and every feature this target pins has the same setting there.
+  [[nodiscard]]
+  bool
+  runs_on(const TargetId &agent) const {
+    return processor == agent.processor &&
+           (sramecc == 0 || sramecc == agent.sramecc) &&
+           (xnack == 0 || xnack == agent.xnack);
+  }
+
+  /// Pinned features; the more, the better a match.
+  [[nodiscard]]
+  int
+  specificity() const {
+    return (sramecc != 0) + (xnack != 0);
+  }
+};
+
+/// A read-only set of code objects, one per target, and the choice among
+/// them for an agent. Pure lookup, so it needs no GPU.
+class CodeObjectBundle {
+ public:
+  struct Entry {
+    std::string isa;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+  };
+
+  CodeObjectBundle() = default;
+  explicit CodeObjectBundle(std::vector<Entry> entries)
+      : entries_(std::move(entries)) {}
+
+  /// The bundle linked into this binary; empty when there is none.
+  static CodeObjectBundle
+  embedded() {
+    std::vector<Entry> entries;
+    if (hansa_code_object_bundle) {
+      for (const hansa_code_object_entry *e = hansa_code_object_bundle;
+           e->isa; ++e) {
+        entries.push_back({e->isa, e->data, size_t(e->size)});
+      }
+    }
+    return CodeObjectBundle(std::move(entries));
+  }
+
+  [[nodiscard]]
+  const std::vector<Entry> &
+  entries() const {
+    return entries_;
+  }
+
+  /// The entry for an agent's ISA name: among those whose code runs there,
+  /// the one pinning the most features, and the first of equals. Null if
+  /// none runs there or the name does not parse.
+  [[nodiscard]]
+  const Entry *
+  select(const std::string &agent_isa) const {
+    TargetId agent;
+    if (!TargetId::parse(agent_isa, &agent)) return nullptr;
+    const Entry *best = nullptr;
+    int best_specificity = -1;
+    for (const Entry &entry : entries_) {
+      TargetId target;
+      if (!TargetId::parse(entry.isa, &target) || !target.runs_on(agent)) {
+        continue;
+      }
+      if (target.specificity() > best_specificity) {
+        best = &entry;
+        best_specificity = target.specificity();
+      }
+    }
+    return best;
+  }
+
+  /// e.g. "gfx1100, gfx90a:xnack-"
+  [[nodiscard]]
+  std::string
+  targets() const {
+    std::string list;
+    for (const Entry &entry : entries_) {
+      list += (list.empty() ? "" : ", ") + entry.isa;
+    }
+    return list.empty() ? "none" : list;
+  }
+
+ private:
+  std::vector<Entry> entries_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <hsa/hsa.h>
+
+#include <iostream>
+
+#define HSA_ENFORCE(msg, rtn)                                      \
+  if (rtn != HSA_STATUS_SUCCESS) {                                 \
+    const char *err;                                               \
+    hsa_status_string(rtn, &err);                                  \
+    std::cerr << "ERROR:" << msg << ", rtn:" << rtn << ", " << err \
+              << std::endl;                                        \
+    return HSA_STATUS_ERROR;                                       \
+  }
+
+#define HSA_ENFORCE_PTR(msg, ptr)              \
+  if (!ptr) {                                  \
+    std::cerr << "ERROR:" << msg << std::endl; \
+    return -1;                                 \
+  }
@@ -0,0 +1,121 @@
+#pragma once
+
+/* Per-workgroup timestamps, recorded by kernels built with
+ * -DHANSA_PROFILE_WORKGROUPS (the HANSA_PROFILE_WORKGROUPS CMake option)
+ * and read back by hansa/workgroup_profile.h. Plain C so it can be
+ * included from both.
+ *
+ * A kernel brackets its body with HANSA_PROFILE_BEGIN() and
+ * HANSA_PROFILE_END(), where every work-item that started must arrive:
+ *
+ *   HANSA_PROFILE_BEGIN();
+ *   if (x < width) ...;
+ *   HANSA_PROFILE_END();
+ *
+ * Without the define both expand to nothing. With it, the first active
+ * lane of every wave folds a timestamp into its workgroup's record, found
+ * through the hidden hostcall_buffer arg, which the engine only sets under
+ * Engine::enable_workgroup_profiling(). The host backend times whole
+ * workgroups itself, so on the host the macros are always empty. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One per workgroup, indexed by its linear id, x fastest. */
+struct hansa_workgroup_record {
+  /* Earliest wave start and latest wave end, in ticks of the agent's
+   * constant-rate clock; start is UINT64_MAX until a wave has started. */
+  uint64_t start;
+  uint64_t end;
+  /* Raw HW_ID (gfx9) or HW_ID1 (gfx10 and later) of one of its waves. */
+  uint32_t hw_id;
+  /* Waves that reached HANSA_PROFILE_END(). */
+  uint32_t waves;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(HANSA_PROFILE_WORKGROUPS) && defined(__AMDGCN__)
+
+/* 100 MHz on every agent. Unlike s_memtime it does not follow the shader
+ * clock, so timestamps from different CUs line up, and gfx11 drops
+ * s_memtime altogether. */
+static inline uint64_t
+hansa_profile_clock(void) {
+#if defined(__GFX11__) || defined(__GFX12__)
+  return __builtin_amdgcn_s_sendmsg_rtnl(0x83); /* MSG_RTN_GET_REALTIME */
+#else
+  return __builtin_amdgcn_s_memrealtime();
+#endif
+}
+
+static inline uint32_t
+hansa_profile_hw_id(void) {
+  /* s_getreg_b32 of all 32 bits of HW_REG_HW_ID1 (23) or HW_REG_HW_ID (4). */
+#if defined(__GFX9__)
+  return __builtin_amdgcn_s_getreg((31 << 11) | 4);
+#else
+  return __builtin_amdgcn_s_getreg((31 << 11) | 23);
+#endif
+}
+
+/* The record of the calling workgroup, or null when the launch has no
+ * profile buffer. Reads the hidden args directly: block_count_x/y at
+ * offsets 0 and 4, hostcall_buffer at 80 (see ImplicitArg). */
+static inline struct hansa_workgroup_record *
+hansa_profile_record(void) {
+  typedef const __attribute__((address_space(4))) char *implicit_t;
+  const implicit_t implicit = (implicit_t)__builtin_amdgcn_implicitarg_ptr();
+  struct hansa_workgroup_record *records =
+      *(struct hansa_workgroup_record *const
+            __attribute__((address_space(4))) *)(implicit + 80);
+  if (!records) return 0;
+  const uint32_t blocks_x =
+      *(const __attribute__((address_space(4))) uint32_t *)implicit;
+  const uint32_t blocks_y =
+      *(const __attribute__((address_space(4))) uint32_t *)(implicit + 4);
+  return records + __builtin_amdgcn_workgroup_id_x() +
+         blocks_x * (__builtin_amdgcn_workgroup_id_y() +
+                     blocks_y * __builtin_amdgcn_workgroup_id_z());
+}
+
+static inline int
+hansa_profile_first_lane(void) {
+  const uint32_t lane =
+      __builtin_amdgcn_mbcnt_hi(~0u, __builtin_amdgcn_mbcnt_lo(~0u, 0u));
+  return __builtin_amdgcn_readfirstlane(lane) == lane;
+}
+
+static inline void
+hansa_profile_begin(void) {
+  struct hansa_workgroup_record *record = hansa_profile_record();
+  if (record && hansa_profile_first_lane()) {
+    __atomic_fetch_min(&record->start, hansa_profile_clock(),
+                       __ATOMIC_RELAXED);
+    record->hw_id = hansa_profile_hw_id();
+  }
+}
+
+static inline void
+hansa_profile_end(void) {
+  struct hansa_workgroup_record *record = hansa_profile_record();
+  if (record && hansa_profile_first_lane()) {
+    __atomic_fetch_max(&record->end, hansa_profile_clock(), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&record->waves, 1u, __ATOMIC_RELAXED);
+  }
+}
+
+#define HANSA_PROFILE_BEGIN() hansa_profile_begin()
+#define HANSA_PROFILE_END() hansa_profile_end()
+
+#else
+
+#define HANSA_PROFILE_BEGIN() ((void)0)
+#define HANSA_PROFILE_END() ((void)0)
+
+#endif
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <hsa/hsa.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "hansa/common.h"
+
+namespace hansa {
+
+/// A fixed sequence of kernel dispatches with explicit dependencies,
+/// captured once and replayed many times.
+///
+/// Nodes are captured through Engine::capture, which resolves the kernel
+/// and builds the packet and kernarg templates. On first replay the graph
+/// is instantiated: nodes are ordered by dependency level, kernargs move
+/// into one block of kernarg memory and the packet sequence is planned.
+/// Independent nodes of a level run concurrently; a level waits for its
+/// dependencies either through the BARRIER bit on its first packet, when
+/// every outstanding packet is a dependency, or through barrier-AND
+/// packets on exactly the dependencies it needs. Fences are agent scope
+/// except where the host is involved: first-level nodes acquire and sink
+/// nodes release at system scope.
+///
+/// A graph is ordered by default, like an ordered launch: the first packet
+/// of a replay carries the BARRIER bit, so the replay starts only once
+/// everything queued before it has completed, such as the kernel that
+/// produced its input. set_ordered(false) lets the first level overlap
+/// earlier work, for callers that know it is independent or have waited.
+///
+/// A replay must be waited on before the graph is replayed again or its
+/// args are changed, since all replays share the same kernarg memory.
+class DispatchGraph {
+ public:
+  using NodeId = uint32_t;
+
+  /// One planned AQL packet; bytes past the header are copied into the
+  /// queue as-is and header32 is published by Engine::submit.
+  struct Packet {
+    hsa_kernel_dispatch_packet_t body;
+    uint32_t header32;
+  };
+
+  DispatchGraph() : kernargs_(nullptr), instantiated_(false) {}
+  DispatchGraph(const DispatchGraph &) = delete;
+  DispatchGraph &
+  operator=(const DispatchGraph &) = delete;
+
+  ~DispatchGraph() { release(); }
+
+  /// Adds a node whose explicit args are the first args_size of its
+  /// kernarg_size bytes. deps must refer to nodes captured earlier.
+  int
+  add_node(const hsa_kernel_dispatch_packet_t &packet, uint16_t setup,
+           const void *kernargs, size_t kernarg_size, size_t args_size,
+           const std::vector<NodeId> &deps, NodeId *out) {
+    if (args_size > kernarg_size) {
+      std::cerr << "ERROR: graph node args of " << args_size
+                << " bytes exceed its " << kernarg_size << " kernarg bytes"
+                << std::endl;
+      return -1;
+    }
+    for (NodeId dep : deps) {
+      if (dep >= nodes_.size()) {
+        std::cerr << "ERROR: graph dependency on unknown node " << dep
+                  << std::endl;
+        return -1;
+      }
+    }
+    release();
+
+    Node node;
+    node.packet = packet;
+    node.setup = setup;
+    node.kernargs.assign(static_cast<const uint8_t *>(kernargs),
+                         static_cast<const uint8_t *>(kernargs) + kernarg_size);
+    node.args_size = args_size;
+    node.deps = deps;
+    std::sort(node.deps.begin(), node.deps.end());
+    node.deps.erase(std::unique(node.deps.begin(), node.deps.end()),
+                    node.deps.end());
+    *out = static_cast<NodeId>(nodes_.size());
+    nodes_.push_back(std::move(node));
+    return 0;
+  }
+
+  /// Replaces the explicit args of a node, e.g. to rebind buffers. Takes
+  /// effect on the next replay without re-planning. ARGS_T must have the
+  /// size of the args the node was captured with.
+  template <typename ARGS_T>
+  int
+  set_args(NodeId node, const ARGS_T &args) {
+    if (node < nodes_.size() && sizeof(ARGS_T) != nodes_[node].args_size) {
+      std::cerr << "ERROR: " << sizeof(ARGS_T) << "-byte args set on graph "
+                << "node " << node << ", which was captured with "
+                << nodes_[node].args_size << " bytes" << std::endl;
+      return -1;
+    }
+    return set_arg(node, 0, &args, sizeof(ARGS_T));
+  }
+
+  /// Overwrites size bytes at offset in a node's explicit args; the hidden
+  /// args after them are the engine's.
+  int
+  set_arg(NodeId node, size_t offset, const void *value, size_t size) {
+    if (node >= nodes_.size() || offset + size > nodes_[node].args_size) {
+      std::cerr << "ERROR: graph arg out of range for node " << node
+                << std::endl;
+      return -1;
+    }
+    std::memcpy(nodes_[node].kernargs.data() + offset, value, size);
+    nodes_[node].dirty = true;
+    return 0;
+  }
+
+  /// Whether a replay waits for work queued before it; true by default.
+  /// Changing it re-plans the graph on its next replay.
+  void
+  set_ordered(bool ordered) {
+    if (ordered != ordered_) release();
+    ordered_ = ordered;
+  }
+
+  [[nodiscard]]
+  bool
+  ordered() const {
+    return ordered_;
+  }
+
+  [[nodiscard]]
+  bool
+  instantiated() const {
+    return instantiated_;
+  }
+
+  [[nodiscard]]
+  size_t
+  node_count() const {
+    return nodes_.size();
+  }
+
+  /// Calls fn(packet, kernargs) for every node in capture order, which is
+  /// always a valid dependency order. Used by the host backend.
+  template <typename F>
+  void
+  for_each_node(F &&fn) const {
+    for (const Node &node : nodes_) fn(node.packet, node.kernargs.data());
+  }
+
+  /// Plans the packet sequence and moves kernargs into kernarg memory.
+  int
+  instantiate(hsa_region_t kernarg_region) {
+    release();
+    const size_t n = nodes_.size();
+
+    // Dependency levels; nodes only depend on earlier nodes.
+    std::vector<uint32_t> level(n, 0);
+    std::vector<bool> is_dep(n, false);
+    uint32_t level_count = n ? 1 : 0;
+    for (size_t i = 0; i < n; ++i) {
+      for (NodeId dep : nodes_[i].deps) {
+        level[i] = std::max(level[i], level[dep] + 1);
+        is_dep[dep] = true;
+      }
+      level_count = std::max(level_count, level[i] + 1);
+    }
+
+    // Kernargs, one aligned block per node.
+    size_t total = 0;
+    std::vector<size_t> offsets(n);
+    for (size_t i = 0; i < n; ++i) {
+      offsets[i] = total;
+      total += align_up(nodes_[i].kernargs.size(), kKernargAlignment);
+    }
+    if (total) {
+      hsa_status_t status =
+          hsa_memory_allocate(kernarg_region, total, &kernargs_);
+      HSA_ENFORCE("hsa_memory_allocate(graph kernargs)", status);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      nodes_[i].device_kernargs =
+          static_cast<uint8_t *>(kernargs_) + offsets[i];
+      nodes_[i].dirty = true;
+    }
+
+    // Walk the levels, tracking which emitted nodes may still be running.
+    std::vector<bool> outstanding(n, false);
+    size_t outstanding_count = 0;
+    std::vector<NodeId> needs_signal;
+    for (uint32_t l = 0; l < level_count; ++l) {
+      std::vector<NodeId> waits;
+      for (size_t i = 0; i < n; ++i) {
+        if (level[i] != l) continue;
+        for (NodeId dep : nodes_[i].deps) {
+          if (outstanding[dep]) waits.push_back(dep);
+        }
+      }
+      std::sort(waits.begin(), waits.end());
+      waits.erase(std::unique(waits.begin(), waits.end()), waits.end());
+
+      // Level 0 has nothing of the graph to wait for, only earlier work.
+      bool barrier_bit = l == 0 && ordered_;
+      if (!waits.empty() && waits.size() == outstanding_count) {
+        barrier_bit = true;
+      } else if (!waits.empty()) {
+        for (size_t w = 0; w < waits.size(); w += kBarrierDeps) {
+          Packet packet{};
+          packet.header32 =
+              (HSA_PACKET_TYPE_BARRIER_AND << HSA_PACKET_HEADER_TYPE) |
+              (HSA_FENCE_SCOPE_AGENT << HSA_PACKET_HEADER_ACQUIRE_FENCE_SCOPE) |
+              (HSA_FENCE_SCOPE_AGENT << HSA_PACKET_HEADER_RELEASE_FENCE_SCOPE);
+          barriers_.push_back({packets_.size(), {}});
+          for (size_t d = w; d < std::min(w + kBarrierDeps, waits.size());
+               ++d) {
+            barriers_.back().deps.push_back(waits[d]);
+            needs_signal.push_back(waits[d]);
+          }
+          packets_.push_back(packet);
+        }
+      }
+      if (barrier_bit) {
+        std::fill(outstanding.begin(), outstanding.end(), false);
+        outstanding_count = 0;
+      } else {
+        for (NodeId dep : waits) outstanding[dep] = false;
+        outstanding_count -= waits.size();
+      }
+
+      for (size_t i = 0; i < n; ++i) {
+        if (level[i] != l) continue;
+        const Node &node = nodes_[i];
+        const hsa_fence_scope_t acquire_scope =
+            l == 0 ? HSA_FENCE_SCOPE_SYSTEM : HSA_FENCE_SCOPE_AGENT;
+        const hsa_fence_scope_t release_scope =
+            is_dep[i] ? HSA_FENCE_SCOPE_AGENT : HSA_FENCE_SCOPE_SYSTEM;
+        const uint16_t header =
+            (HSA_PACKET_TYPE_KERNEL_DISPATCH << HSA_PACKET_HEADER_TYPE) |
+            (barrier_bit << HSA_PACKET_HEADER_BARRIER) |
+            (acquire_scope << HSA_PACKET_HEADER_ACQUIRE_FENCE_SCOPE) |
+            (release_scope << HSA_PACKET_HEADER_RELEASE_FENCE_SCOPE);
+        barrier_bit = false;
+
+        Packet packet{node.packet, header | (uint32_t(node.setup) << 16)};
+        packet.body.kernarg_address = node.device_kernargs;
+        dispatches_.push_back({packets_.size(), static_cast<NodeId>(i)});
+        packets_.push_back(packet);
+        outstanding[i] = true;
+        ++outstanding_count;
+        if (!is_dep[i]) {
+          sinks_.push_back(static_cast<NodeId>(i));
+          needs_signal.push_back(static_cast<NodeId>(i));
+        }
+      }
+    }
+
+    // Completion signals, only for nodes a barrier or the host waits on.
+    for (NodeId node : needs_signal) {
+      if (nodes_[node].signal.handle != 0) continue;
+      hsa_status_t status =
+          hsa_signal_create(1, 0, nullptr, &nodes_[node].signal);
+      HSA_ENFORCE("hsa_signal_create", status);
+      signals_.push_back(nodes_[node].signal);
+    }
+    for (const auto &[index, node] : dispatches_) {
+      packets_[index].body.completion_signal = nodes_[node].signal;
+    }
+    for (const auto &barrier : barriers_) {
+      auto packet = reinterpret_cast<hsa_barrier_and_packet_t *>(
+          &packets_[barrier.packet].body);
+      for (size_t d = 0; d < barrier.deps.size(); ++d) {
+        packet->dep_signal[d] = nodes_[barrier.deps[d]].signal;
+      }
+    }
+
+    instantiated_ = true;
+    return 0;
+  }
+
+  /// Copies changed kernargs to kernarg memory and re-arms the completion
+  /// signals. Returns the packets to write into the queue.
+  const std::vector<Packet> &
+  prepare_replay() {
+    for (Node &node : nodes_) {
+      if (!node.dirty) continue;
+      std::memcpy(node.device_kernargs, node.kernargs.data(),
+                  node.kernargs.size());
+      node.dirty = false;
+    }
+    for (hsa_signal_t signal : signals_) hsa_signal_store_relaxed(signal, 1);
+    return packets_;
+  }
+
+  /// Blocks until every sink node of the last replay has completed.
+  hsa_signal_value_t
+  wait() const {
+    hsa_signal_value_t value = 0;
+    for (NodeId node : sinks_) {
+      value |= hsa_signal_wait_acquire(nodes_[node].signal,
+                                       HSA_SIGNAL_CONDITION_LT, 1, UINT64_MAX,
+                                       HSA_WAIT_STATE_BLOCKED);
+    }
+    return value;
+  }
+
+ private:
+  static constexpr size_t kKernargAlignment = 64;
+  static constexpr size_t kBarrierDeps = 5;
+
+  struct Node {
+    hsa_kernel_dispatch_packet_t packet;
+    uint16_t setup = 0;
+    std::vector<uint8_t> kernargs;
+    /// The leading kernarg bytes set_args may replace.
+    size_t args_size = 0;
+    std::vector<NodeId> deps;
+    uint8_t *device_kernargs = nullptr;
+    hsa_signal_t signal{0};
+    bool dirty = true;
+  };
+
+  struct Barrier {
+    size_t packet;
+    std::vector<NodeId> deps;
+  };
+
+  static constexpr size_t
+  align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+  /// Drops the instantiated plan; captured nodes are kept.
+  void
+  release() {
+    for (hsa_signal_t signal : signals_) hsa_signal_destroy(signal);
+    signals_.clear();
+    if (kernargs_) hsa_memory_free(kernargs_);
+    kernargs_ = nullptr;
+    for (Node &node : nodes_) {
+      node.signal.handle = 0;
+      node.device_kernargs = nullptr;
+    }
+    packets_.clear();
+    dispatches_.clear();
+    barriers_.clear();
+    sinks_.clear();
+    instantiated_ = false;
+  }
+
+  std::vector<Node> nodes_;
+
+  void *kernargs_;
+  std::vector<hsa_signal_t> signals_;
+  std::vector<Packet> packets_;
+  std::vector<std::pair<size_t, NodeId>> dispatches_;
+  std::vector<Barrier> barriers_;
+  std::vector<NodeId> sinks_;
+  bool instantiated_;
+  bool ordered_ = true;
+};
+
+}  // namespace hansa
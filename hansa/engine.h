@@ -0,0 +1,1903 @@
+#pragma once
+
+#include <hsa/hsa.h>
+#include <hsa/hsa_ext_amd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hansa/aql_queue.h"
+#include "hansa/code_object.h"
+#include "hansa/code_object_bundle.h"
+#include "hansa/common.h"
+#include "hansa/dispatch_graph.h"
+#include "hansa/host/host_backend.h"
+#include "hansa/kernarg_arena.h"
+#include "hansa/kernel_cache.h"
+#include "hansa/launch_shape.h"
+#include "hansa/memory_pool.h"
+#include "hansa/occupancy.h"
+#include "hansa/signal_pool.h"
+#include "hansa/task.h"
+#include "hansa/trace.h"
+#include "hansa/transfer.h"
+#include "hansa/wait_policy.h"
+#include "hansa/workgroup_profile.h"
+
+namespace hansa {
+
+class Engine;
+
+#pragma pack(push, 1)
+typedef struct ImplicitArg_s {
+  uint32_t block_count_x;
+  uint32_t block_count_y;
+  uint32_t block_count_z;
+
+  uint16_t group_size_x;
+  uint16_t group_size_y;
+  uint16_t group_size_z;
+
+  uint16_t remainder_x;
+  uint16_t remainder_y;
+  uint16_t remainder_z;
+
+  uint64_t tool_correlation_id;
+  uint64_t reserved_1;
+
+  uint64_t global_offset_x;
+  uint64_t global_offset_y;
+  uint64_t global_offset_z;
+
+  uint16_t grid_dims;
+
+  uint16_t reserved_2;
+  uint16_t reserved_3;
+  uint16_t reserved_4;
+
+  uint64_t printf_buffer;
+  uint64_t hostcall_buffer;
+  uint64_t multigrid_sync_arg;
+  uint64_t heap_v1;
+  uint64_t default_queue;
+  uint64_t completion_action;
+  uint32_t dynamic_lds_size;
+  uint32_t private_base;
+  uint32_t shared_base;
+} ImplicitArg;
+#pragma pack(pop)
+
+/// Where the value of a hidden kernel argument lives in ImplicitArg.
+struct ImplicitArgField {
+  const char *value_kind;
+  size_t offset;
+  size_t size;
+};
+
+#define HANSA_IMPLICIT_FIELD(kind, field) \
+  {kind, offsetof(ImplicitArg, field), sizeof(ImplicitArg::field)}
+
+/// Null for hidden args the engine leaves zero, such as the queue pointer.
+inline const ImplicitArgField *
+find_implicit_arg(const std::string &value_kind) {
+  static const ImplicitArgField fields[] = {
+      HANSA_IMPLICIT_FIELD("hidden_block_count_x", block_count_x),
+      HANSA_IMPLICIT_FIELD("hidden_block_count_y", block_count_y),
+      HANSA_IMPLICIT_FIELD("hidden_block_count_z", block_count_z),
+      HANSA_IMPLICIT_FIELD("hidden_group_size_x", group_size_x),
+      HANSA_IMPLICIT_FIELD("hidden_group_size_y", group_size_y),
+      HANSA_IMPLICIT_FIELD("hidden_group_size_z", group_size_z),
+      HANSA_IMPLICIT_FIELD("hidden_remainder_x", remainder_x),
+      HANSA_IMPLICIT_FIELD("hidden_remainder_y", remainder_y),
+      HANSA_IMPLICIT_FIELD("hidden_remainder_z", remainder_z),
+      HANSA_IMPLICIT_FIELD("hidden_global_offset_x", global_offset_x),
+      HANSA_IMPLICIT_FIELD("hidden_global_offset_y", global_offset_y),
+      HANSA_IMPLICIT_FIELD("hidden_global_offset_z", global_offset_z),
+      HANSA_IMPLICIT_FIELD("hidden_grid_dims", grid_dims),
+      HANSA_IMPLICIT_FIELD("hidden_printf_buffer", printf_buffer),
+      HANSA_IMPLICIT_FIELD("hidden_hostcall_buffer", hostcall_buffer),
+      HANSA_IMPLICIT_FIELD("hidden_multigrid_sync_arg", multigrid_sync_arg),
+      HANSA_IMPLICIT_FIELD("hidden_heap_v1", heap_v1),
+      HANSA_IMPLICIT_FIELD("hidden_default_queue", default_queue),
+      HANSA_IMPLICIT_FIELD("hidden_completion_action", completion_action),
+      HANSA_IMPLICIT_FIELD("hidden_dynamic_lds_size", dynamic_lds_size),
+      HANSA_IMPLICIT_FIELD("hidden_private_base", private_base),
+      HANSA_IMPLICIT_FIELD("hidden_shared_base", shared_base),
+  };
+  for (const ImplicitArgField &f : fields) {
+    if (value_kind == f.value_kind) return &f;
+  }
+  return nullptr;
+}
+
+#undef HANSA_IMPLICIT_FIELD
+
+/// Copies implicit into the hidden args of a kernarg block, at the offsets
+/// the kernel's metadata gives them.
+inline void
+write_hidden_args(const KernelMetadata &meta, const ImplicitArg &implicit,
+                  void *kernarg) {
+  for (const KernelArgInfo &arg : meta.args) {
+    if (!arg.hidden()) continue;
+    const ImplicitArgField *field = find_implicit_arg(arg.value_kind);
+    if (!field || arg.size > field->size) continue;
+    std::memcpy(static_cast<uint8_t *>(kernarg) + arg.offset,
+                reinterpret_cast<const uint8_t *>(&implicit) + field->offset,
+                arg.size);
+  }
+}
+
+/// Whether a host struct of the given size and alignment can hold the
+/// explicit args meta declares: it must cover them, and may only add tail
+/// padding.
+inline bool
+args_struct_fits(size_t size, size_t align, const KernelMetadata &meta) {
+  const size_t end = meta.explicit_args_end();
+  return size >= end && size < end + align;
+}
+
+class PreparedLaunch;
+
+/// The memory an Engine hands out, each kind cached by its own
+/// CachingAllocator.
+enum class MemoryKind {
+  /// VRAM on the GPU agent; not host-accessible on discrete GPUs.
+  kDeviceLocal,
+  /// Fine-grained system memory, coherent between host and device.
+  kHostCoherent,
+  /// Pinned system memory the device can read, for copies and inputs.
+  kStaging,
+};
+
+constexpr size_t kMemoryKinds = 3;
+
+inline const char *
+memory_kind_name(MemoryKind kind) {
+  switch (kind) {
+    case MemoryKind::kDeviceLocal:
+      return "device-local";
+    case MemoryKind::kHostCoherent:
+      return "host-coherent";
+    default:
+      return "staging";
+  }
+}
+
+/// The allocatable global pools of one agent.
+struct AgentMemoryPools {
+  hsa_amd_memory_pool_t coarse{0};
+  hsa_amd_memory_pool_t fine{0};
+};
+
+inline hsa_status_t
+get_agent_callback(hsa_agent_t agent, void *data);
+
+inline hsa_status_t
+get_region_callback(hsa_region_t region, void *data);
+
+inline hsa_status_t
+get_memory_pool_callback(hsa_amd_memory_pool_t pool, void *data);
+
+/// Launches kernels/ on the first GPU agent, or on the host backend when
+/// there is none.
+class Engine {
+ public:
+  /// The code file kernels/ is built into, and the one an embedded code
+  /// object stands in for.
+  static constexpr const char *kKernelLibrary = "libkernels.so";
+
+  class KernelDispatchConfig {
+   public:
+    KernelDispatchConfig()
+        : grid_size{0}, workgroup_size{0}, kernel_arg_size_(0) {}
+
+    KernelDispatchConfig(std::string code_file_name, std::string kernel_symbol,
+                         const std::array<int, 3> &grid_size,
+                         const std::array<int, 3> &workgroup_size,
+                         const int kernel_arg_size = 0)
+        : code_file_name(std::move(code_file_name)),
+          kernel_symbol(std::move(kernel_symbol)),
+          grid_size(grid_size),
+          workgroup_size(workgroup_size),
+          kernel_arg_size_(kernel_arg_size) {}
+
+    std::string code_file_name;
+    std::string kernel_symbol;
+
+    /// The problem, in work-items; the engine derives block counts and
+    /// remainders from it.
+    std::array<int, 3> grid_size;
+    std::array<int, 3> workgroup_size;
+    int kernel_arg_size_;
+    /// kPersistent shrinks the grid to what the device holds at once, for
+    /// kernels that loop over grid_size with a grid stride.
+    LaunchMode mode = LaunchMode::kExact;
+    /// LDS per workgroup beyond the kernel's static LDS, for kernels that
+    /// size their tiles at launch time.
+    uint32_t dynamic_lds_size = 0;
+    /// Whether the dispatch waits for every earlier packet on the queue to
+    /// finish before it starts (the AQL barrier bit). Dispatches that share
+    /// no memory with the ones before them, such as the tiles of a
+    /// TiledImage, clear it so the device may overlap them.
+    bool ordered = true;
+
+    /// Lets the engine pick the workgroup shape with the best estimated
+    /// occupancy for the kernel's register and LDS use on this agent.
+    static constexpr std::array<int, 3> kAutoWorkgroup{0, 0, 0};
+
+    [[nodiscard]]
+    size_t
+    size() const {
+      return kernel_arg_size_;
+    }
+
+    [[nodiscard]]
+    bool
+    auto_workgroup() const {
+      return workgroup_size == kAutoWorkgroup;
+    }
+  };
+
+ public:
+  friend hsa_status_t
+  get_agent_callback(hsa_agent_t agent, void *data);
+
+  friend hsa_status_t
+  get_region_callback(hsa_region_t region, void *data);
+
+  friend class PreparedLaunch;
+
+  Engine()
+      : agent_(0),
+        cpu_agent_(0),
+        queue_size_(0),
+        queue_(nullptr),
+        system_region_(0),
+        kernarg_region_(0),
+        local_region_(0),
+        gpu_local_region_(0),
+        hsa_initialized_(false),
+        profiling_(false),
+        timestamp_ns_(0) {}
+
+  Engine(const Engine &) = delete;
+  Engine &
+  operator=(const Engine &) = delete;
+
+  ~Engine() { shutdown(); }
+
+  /// Uses the first GPU agent. Without one, or with HANSA_BACKEND=host,
+  /// kernels run on the host backend instead.
+  int
+  init() {
+    const char *backend = std::getenv("HANSA_BACKEND");
+    if (backend && std::string(backend) == "host") return init_host();
+
+    hsa_status_t status = hsa_init();
+    if (status != HSA_STATUS_SUCCESS) return init_host();
+    hsa_initialized_ = true;
+
+    status = hsa_iterate_agents(get_agent_callback, this);
+    HSA_ENFORCE("hsa_iterate_agents", status);
+    if (agent_.handle == 0) {
+      shutdown();
+      return init_host();
+    }
+
+    char agent_name[64];
+
+    status = hsa_agent_get_info(agent_, HSA_AGENT_INFO_NAME, agent_name);
+    HSA_ENFORCE("hsa_agent_get_info(HSA_AGENT_INFO_NAME)", status);
+
+    std::cout << "Using agent: " << agent_name << std::endl;
+    agent_name_ = agent_name;
+    query_limits();
+    use_embedded_code_object();
+
+    status =
+        hsa_agent_get_info(agent_, HSA_AGENT_INFO_QUEUE_MAX_SIZE, &queue_size_);
+    HSA_ENFORCE("hsa_agent_get_info(HSA_AGENT_INFO_QUEUE_MAX_SIZE", status);
+
+    status =
+        hsa_queue_create(agent_, queue_size_, HSA_QUEUE_TYPE_MULTI, nullptr,
+                         nullptr, UINT32_MAX, UINT32_MAX, &queue_);
+
+    HSA_ENFORCE("hsa_queue_create", status);
+
+    status = hsa_agent_iterate_regions(agent_, get_region_callback, this);
+    HSA_ENFORCE("hsa_agent_iterate_regions", status);
+    HSA_ENFORCE_PTR("Failed to find kernarg memory region",
+                    kernarg_region_.handle)
+
+    if (0 != kernargs_.init(kernarg_region_,
+                            std::min(queue_size_, kMaxKernargSlots),
+                            kKernargSlotSize)) {
+      return -1;
+    }
+
+    AgentMemoryPools gpu_pools, cpu_pools;
+    status = hsa_amd_agent_iterate_memory_pools(
+        agent_, get_memory_pool_callback, &gpu_pools);
+    HSA_ENFORCE("hsa_amd_agent_iterate_memory_pools(gpu)", status);
+    status = hsa_amd_agent_iterate_memory_pools(
+        cpu_agent_, get_memory_pool_callback, &cpu_pools);
+    HSA_ENFORCE("hsa_amd_agent_iterate_memory_pools(cpu)", status);
+    HSA_ENFORCE_PTR("Failed to find device memory pool",
+                    gpu_pools.coarse.handle)
+    HSA_ENFORCE_PTR("Failed to find host memory pool", cpu_pools.fine.handle)
+
+    backing_[size_t(MemoryKind::kDeviceLocal)] =
+        std::make_unique<AmdMemoryPool>(gpu_pools.coarse);
+    backing_[size_t(MemoryKind::kHostCoherent)] =
+        std::make_unique<AmdMemoryPool>(cpu_pools.fine,
+                                        std::vector<hsa_agent_t>{agent_});
+    backing_[size_t(MemoryKind::kStaging)] = std::make_unique<AmdMemoryPool>(
+        cpu_pools.coarse.handle ? cpu_pools.coarse : cpu_pools.fine,
+        std::vector<hsa_agent_t>{agent_});
+    init_allocators();
+
+    return transfer_.init(agent_, cpu_agent_,
+                          &allocator(MemoryKind::kStaging));
+  }
+
+  /// Destroys the queue, signals, kernarg memory and loaded code objects,
+  /// then shuts HSA down. Dispatches still in flight must be waited on
+  /// first.
+  void
+  shutdown() {
+    transfer_.reset();
+    for (auto &allocator : allocators_) allocator.reset();
+    for (auto &backing : backing_) backing.reset();
+    kernel_cache_.clear();
+    host_pending_.clear();
+    if (!hsa_initialized_) return;
+    pending_.clear();
+    signals_.clear();
+    kernargs_.reset();
+    if (queue_) hsa_queue_destroy(queue_);
+    queue_ = nullptr;
+    agent_.handle = 0;
+    hsa_shut_down();
+    hsa_initialized_ = false;
+  }
+
+  int
+  init_host() {
+    host_ = std::make_unique<hansa::HostBackend>();
+    agent_name_ = "host";
+    for (auto &backing : backing_) {
+      backing = std::make_unique<HostMemoryPool>();
+    }
+    init_allocators();
+    // Nominal: a host thread stands in for a CU, so auto workgroups still
+    // get a GPU-like shape.
+    limits_ = AgentLimits::for_isa(agent_name_);
+    limits_.compute_units = host_->thread_count();
+    std::cout << "Using agent: host (" << host_->thread_count()
+              << " threads)" << std::endl;
+    return 0;
+  }
+
+  [[nodiscard]]
+  bool
+  is_host() const {
+    return host_ != nullptr;
+  }
+
+  [[nodiscard]]
+  const std::string &
+  agent_name() const {
+    return agent_name_;
+  }
+
+  /// What bounds occupancy on the agent, from its HSA agent info.
+  [[nodiscard]]
+  const AgentLimits &
+  limits() const {
+    return limits_;
+  }
+
+  /// The occupancy estimate of the last launch of each kernel symbol.
+  [[nodiscard]]
+  const std::map<std::string, Occupancy> &
+  occupancy() const {
+    return occupancy_;
+  }
+
+  /// Records start and end timestamps for every dispatch on the queue, read
+  /// back by wait(). Fails on the host backend, which has no device clock.
+  int
+  enable_profiling() {
+    if (host_) return -1;
+    hsa_status_t status = hsa_amd_profiling_set_profiler_enabled(queue_, 1);
+    HSA_ENFORCE("hsa_amd_profiling_set_profiler_enabled", status);
+
+    uint64_t frequency = 0;
+    status =
+        hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY, &frequency);
+    HSA_ENFORCE("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP_FREQUENCY)",
+                status);
+    timestamp_ns_ = 1e9 / double(frequency);
+
+    // Dispatch times are in system timestamp ticks; one read between two
+    // host clock reads places them on the host's timeline for the trace.
+    const uint64_t before = hansa::trace_now_ns();
+    status = hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP,
+                                 &device_epoch_ticks_);
+    HSA_ENFORCE("hsa_system_get_info(HSA_SYSTEM_INFO_TIMESTAMP)", status);
+    device_epoch_ns_ = before + (hansa::trace_now_ns() - before) / 2;
+    profiling_ = true;
+    return 0;
+  }
+
+  /// Gives every PreparedLaunch prepared from now on a record per
+  /// workgroup, passed in the hostcall_buffer hidden arg, and keeps the
+  /// records of each kernel's last dispatch in workgroup_traces(). Kernels
+  /// only fill them in when built with HANSA_PROFILE_WORKGROUPS; the host
+  /// backend always does.
+  void
+  enable_workgroup_profiling() {
+    workgroup_profiling_ = true;
+  }
+
+  /// The workgroup records of the last profiled dispatch of each kernel
+  /// symbol.
+  [[nodiscard]]
+  const std::map<std::string, WorkgroupTrace> &
+  workgroup_traces() const {
+    return workgroup_traces_;
+  }
+
+  /// Identifies one enqueued dispatch. Every handle must be waited on, which
+  /// recycles its completion signal and kernarg slot.
+  struct DispatchHandle {
+    hsa_signal_t signal{0};
+    uint64_t packet_index = 0;
+    /// The name the kernel was interned under, for its device span.
+    const char *trace_name = "kernel";
+  };
+
+  /// Writes a dispatch packet into the next free queue slot, with its own
+  /// completion signal, but leaves its header invalid. The packet becomes
+  /// visible to the device on the next submit().
+  template <typename ARGS_T>
+  int
+  enqueue(const KernelDispatchConfig *cfg, const ARGS_T &args,
+          DispatchHandle *handle) {
+    HANSA_TRACE_SPAN("enqueue");
+    hansa::KernelObject kernel;
+    size_t kernarg_size;
+    if (0 != resolve<ARGS_T>(cfg, &kernel, &kernarg_size)) return -1;
+    KernelDispatchConfig shaped;
+    cfg = shape(cfg, kernel, &shaped);
+
+    if (host_) {
+      HostLaunch launch;
+      launch.kernargs.resize(kernarg_size);
+      write_kernargs(cfg, args, kernel.metadata, launch.kernargs.data(),
+                     kernarg_size);
+      write_packet_body(cfg, kernel, nullptr, &launch.packet);
+      host_pending_.push_back(std::move(launch));
+      *handle = DispatchHandle{};
+      return 0;
+    }
+
+    // An unpublished batch may not wrap around the kernarg ring or the
+    // queue: its own packets would have to complete to free the slots.
+    if (pending_.size() >=
+        std::min<size_t>(kernargs_.slot_count(), queue_->size)) {
+      submit();
+    }
+
+    if (0 != signals_.acquire(&handle->signal)) return -1;
+    handle->packet_index = reserve_packet();
+    hsa_kernel_dispatch_packet_t *packet = packet_at(handle->packet_index);
+    handle->trace_name = kernel.name ? kernel.name : "kernel";
+
+    // kernel args, from the arena slot owned by this packet
+    HANSA_TRACE_SPAN("write kernargs");
+    void *kernarg = kernargs_.acquire(handle->packet_index, handle->signal);
+    write_kernargs(cfg, args, kernel.metadata, kernarg, kernarg_size);
+
+    const uint16_t setup = write_packet_body(cfg, kernel, kernarg, packet);
+    packet->completion_signal = handle->signal;
+
+    pending_.push_back({packet, dispatch_header32(setup, cfg->ordered),
+                        handle->packet_index});
+    return 0;
+  }
+
+  /// Enqueues one dispatch and publishes it at once. Unlike enqueue(), any
+  /// number of threads may post on one engine at the same time: the queue
+  /// slot comes from an atomic add on the write index and everything else
+  /// the dispatch needs lives in a context on the caller's stack. Waiting
+  /// on the handle is safe from any thread too, as long as no thread is in
+  /// the middle of an enqueue() batch, which stays single-threaded.
+  ///
+  /// On the host backend the kernel runs before post() returns, one posted
+  /// launch at a time.
+  template <typename ARGS_T>
+  int
+  post(const KernelDispatchConfig *cfg, const ARGS_T &args,
+       DispatchHandle *handle) {
+    HANSA_TRACE_SPAN("post");
+    LaunchContext context;
+    size_t kernarg_size;
+    {
+      // The kernel cache and occupancy estimates are shared.
+      std::lock_guard<std::mutex> lock(launch_mutex_);
+      if (0 != resolve<ARGS_T>(cfg, &context.kernel, &kernarg_size)) {
+        return -1;
+      }
+      cfg = shape(cfg, context.kernel, &context.shaped);
+      if (host_) {
+        std::vector<uint8_t> kernargs(kernarg_size);
+        write_kernargs(cfg, args, context.kernel.metadata, kernargs.data(),
+                       kernarg_size);
+        write_packet_body(cfg, context.kernel, nullptr, &context.body);
+        run_host(context.body, kernargs.data());
+        *handle = DispatchHandle{};
+        return 0;
+      }
+    }
+
+    if (0 != signals_.acquire(&handle->signal)) return -1;
+    // Within the kernarg ring, the slot's previous packet has been
+    // published, so waiting for it cannot wait on this one.
+    hansa::HsaQueue queue(queue_);
+    handle->packet_index = hansa::claim_packet(queue, kernargs_.slot_count());
+    handle->trace_name = context.kernel.name ? context.kernel.name : "kernel";
+
+    HANSA_TRACE_SPAN("write kernargs");
+    void *kernarg = kernargs_.acquire(handle->packet_index, handle->signal);
+    write_kernargs(cfg, args, context.kernel.metadata, kernarg, kernarg_size);
+    const uint16_t setup =
+        write_packet_body(cfg, context.kernel, kernarg, &context.body);
+    context.body.completion_signal = handle->signal;
+    hansa::publish_packet(queue, handle->packet_index, context.body,
+                          dispatch_header32(setup, cfg->ordered));
+    return 0;
+  }
+
+  /// A posted dispatch for a Task to co_await; see launch(). Resumes the
+  /// task with post()'s status once the dispatch completes. One that is
+  /// never awaited is waited on when it goes out of scope.
+  class Launch {
+   public:
+    Launch(Launch &&other) noexcept
+        : engine_(std::exchange(other.engine_, nullptr)),
+          handle_(other.handle_),
+          status_(other.status_) {}
+    Launch(const Launch &) = delete;
+    Launch &
+    operator=(const Launch &) = delete;
+    Launch &
+    operator=(Launch &&) = delete;
+
+    ~Launch() {
+      if (engine_) engine_->wait(handle_);
+    }
+
+    [[nodiscard]]
+    bool
+    await_ready() const {
+      // Failed posts and host backend launches are done already.
+      return !engine_ || handle_.signal.handle == 0 ||
+             hsa_signal_load_scacquire(handle_.signal) < 1;
+    }
+
+    template <typename Promise>
+    void
+    await_suspend(std::coroutine_handle<Promise> awaiting) {
+      awaiting.promise().loop->park(handle_.signal, awaiting);
+    }
+
+    int
+    await_resume() {
+      // Recycles the signal and kernarg slot; the dispatch is done.
+      if (engine_) std::exchange(engine_, nullptr)->wait(handle_);
+      return status_;
+    }
+
+   private:
+    friend class Engine;
+
+    explicit Launch(Engine *engine) : engine_(engine) {}
+
+    Engine *engine_;
+    DispatchHandle handle_;
+    int status_ = 0;
+  };
+
+  /// Posts a dispatch, as post() does, and returns it for a Task running
+  /// on an EventLoop to co_await:
+  ///
+  ///   int status = co_await engine.launch(cfg, args);
+  ///
+  /// The dispatch is in flight from the call on, so a task can launch
+  /// several and then await each.
+  template <typename ARGS_T>
+  Launch
+  launch(const KernelDispatchConfig &cfg, const ARGS_T &args) {
+    Launch launch(this);
+    launch.status_ = post(&cfg, args, &launch.handle_);
+    if (launch.status_ != 0) launch.engine_ = nullptr;
+    return launch;
+  }
+
+  /// How wait() waits for a dispatch; blocking by default.
+  void
+  set_wait_policy(const hansa::WaitPolicy &policy) {
+    wait_policy_ = policy;
+  }
+
+  [[nodiscard]]
+  const hansa::WaitPolicy &
+  wait_policy() const {
+    return wait_policy_;
+  }
+
+  /// Records a launch into graph instead of submitting it. The node runs
+  /// after every node in deps has completed.
+  template <typename ARGS_T>
+  int
+  capture(hansa::DispatchGraph *graph, const KernelDispatchConfig *cfg,
+          const ARGS_T &args,
+          const std::vector<hansa::DispatchGraph::NodeId> &deps,
+          hansa::DispatchGraph::NodeId *node) {
+    hansa::KernelObject kernel;
+    size_t kernarg_size;
+    if (0 != resolve<ARGS_T>(cfg, &kernel, &kernarg_size)) return -1;
+    KernelDispatchConfig shaped;
+    cfg = shape(cfg, kernel, &shaped);
+
+    std::vector<uint8_t> kernarg(kernarg_size);
+    write_kernargs(cfg, args, kernel.metadata, kernarg.data(), kernarg_size);
+
+    hsa_kernel_dispatch_packet_t packet;
+    const uint16_t setup = write_packet_body(cfg, kernel, nullptr, &packet);
+    return graph->add_node(packet, setup, kernarg.data(), kernarg_size,
+                           sizeof(ARGS_T), deps, node);
+  }
+
+  /// Submits every packet of graph as one batch. The graph is planned on
+  /// its first replay; later replays only copy changed args and write the
+  /// prebuilt packets. An ordered graph, the default, starts once earlier
+  /// launches have completed; see DispatchGraph::set_ordered.
+  int
+  replay(hansa::DispatchGraph *graph) {
+    if (host_) {
+      // Capture order is a valid dependency order.
+      submit();
+      graph->for_each_node(
+          [this](const hsa_kernel_dispatch_packet_t &packet,
+                 const void *kernarg) { run_host(packet, kernarg); });
+      return 0;
+    }
+    if (!graph->instantiated() && 0 != graph->instantiate(kernarg_region_)) {
+      return -1;
+    }
+    for (const auto &planned : graph->prepare_replay()) {
+      const uint64_t index = reserve_packet();
+      hsa_kernel_dispatch_packet_t *packet = packet_at(index);
+      constexpr size_t aql_header_size = 4;
+      std::memcpy(reinterpret_cast<uint8_t *>(packet) + aql_header_size,
+                  reinterpret_cast<const uint8_t *>(&planned.body) +
+                      aql_header_size,
+                  sizeof(*packet) - aql_header_size);
+      pending_.push_back({packet, planned.header32, index});
+    }
+    return submit();
+  }
+
+  hsa_signal_value_t
+  wait(const hansa::DispatchGraph &graph) {
+    submit();
+    if (host_) return 0;
+    return graph.wait();
+  }
+
+  /// Resolves cfg's kernel and builds launch's packet and kernarg templates.
+  /// launch must not outlive the engine.
+  int
+  prepare(const KernelDispatchConfig &cfg, PreparedLaunch *launch);
+
+  /// Enqueues launch with its currently bound args, like enqueue(). If its
+  /// previous dispatch is still running, waits for that first.
+  int
+  dispatch(PreparedLaunch *launch);
+
+  /// Blocks until launch's last dispatch completes. Submits any pending
+  /// packets first.
+  hsa_signal_value_t
+  wait(PreparedLaunch *launch);
+
+  /// Publishes the headers of all enqueued packets in queue order and rings
+  /// the doorbell once for the whole batch.
+  int
+  submit() {
+    HANSA_TRACE_SPAN_ARG("submit", "packets",
+                         pending_.size() + host_pending_.size());
+    for (const HostLaunch &launch : host_pending_) {
+      run_host(launch.packet, launch.kernargs.data(), launch.profile);
+    }
+    host_pending_.clear();
+    if (pending_.empty()) return 0;
+
+    for (const PendingPacket &p : pending_) {
+      __atomic_store_n(reinterpret_cast<uint32_t *>(p.packet), p.header32,
+                       __ATOMIC_RELEASE);
+    }
+    hsa_signal_store_relaxed(
+        queue_->doorbell_signal,
+        static_cast<hsa_signal_value_t>(pending_.back().packet_index));
+    pending_.clear();
+    return 0;
+  }
+
+  /// Waits under wait_policy() until the dispatch completes, then recycles
+  /// its signal and kernarg slot. Submits any pending packets first. With
+  /// profiling enabled, device_ns receives the kernel execution time,
+  /// else 0.
+  hsa_signal_value_t
+  wait(const DispatchHandle &handle, double *device_ns = nullptr) {
+    submit();
+    HANSA_TRACE_SPAN("wait");
+    if (device_ns) *device_ns = 0;
+    if (host_ || handle.signal.handle == 0) return 0;
+    const hsa_signal_value_t value =
+        hansa::wait_signal(handle.signal, wait_policy_);
+    hsa_amd_profiling_dispatch_time_t time;
+    if ((device_ns || tracing()) && profiling_ &&
+        hsa_amd_profiling_get_dispatch_time(agent_, handle.signal, &time) ==
+            HSA_STATUS_SUCCESS) {
+      if (device_ns) {
+        *device_ns = double(time.end - time.start) * timestamp_ns_;
+      }
+      trace_device(handle.trace_name, time);
+    }
+    kernargs_.release(handle.packet_index, handle.signal);
+    signals_.release(handle.signal);
+    return value;
+  }
+
+  /// Single-dispatch convenience wrappers over enqueue/submit/wait.
+  template <typename ARGS_T>
+  int
+  setup_dispatch(const KernelDispatchConfig *cfg, const ARGS_T &args) {
+    std::cout << "Workgroup sizes: " << cfg->workgroup_size[0] << " "
+              << cfg->workgroup_size[1] << " " << cfg->workgroup_size[2]
+              << std::endl;
+    std::cout << "Grid sizes: " << cfg->grid_size[0] << " " << cfg->grid_size[1]
+              << " " << cfg->grid_size[2] << std::endl;
+    return enqueue(cfg, args, &last_dispatch_);
+  }
+
+  int
+  dispatch() {
+    return submit();
+  }
+
+  hsa_signal_value_t
+  wait() {
+    return wait(last_dispatch_);
+  }
+
+  CachingAllocator &
+  allocator(MemoryKind kind) {
+    return *allocators_[size_t(kind)];
+  }
+
+  /// An empty PoolBuffer if the pool is exhausted.
+  PoolBuffer
+  allocate(MemoryKind kind, size_t size) {
+    return allocator(kind).allocate_buffer(size);
+  }
+
+  /// Host-accessible memory the device can read, from the staging cache.
+  void *
+  alloc_local(int size) {
+    return allocator(MemoryKind::kStaging).allocate(size);
+  }
+
+  void
+  free_local(void *mem) {
+    allocator(MemoryKind::kStaging).free(mem);
+  }
+
+  /// Registers host memory, e.g. a decoded image, with the GPU so kernels
+  /// can read and write it in place. Sets *agent_ptr to the address the
+  /// agent uses for it.
+  int
+  pin(void *host, size_t size, void **agent_ptr) {
+    if (host_) {
+      *agent_ptr = host;
+      return 0;
+    }
+    hsa_status_t status = hsa_amd_memory_lock(host, size, &agent_, 1,
+                                              agent_ptr);
+    HSA_ENFORCE("hsa_amd_memory_lock", status);
+    return 0;
+  }
+
+  void
+  unpin(void *host) {
+    if (!host_) hsa_amd_memory_unlock(host);
+  }
+
+  /// Bytes moved by copy_to_device and copy_to_host so far.
+  [[nodiscard]]
+  uint64_t
+  bytes_copied() const {
+    return bytes_copied_;
+  }
+
+  /// Copies from host memory into memory from any of the engine's pools,
+  /// on the DMA engines through double-buffered staging. Synchronous.
+  int
+  copy_to_device(void *dst, const void *src, size_t size) {
+    bytes_copied_ += size;
+    return staged_copy(dst, src, size, true);
+  }
+
+  /// Copies from memory from any of the engine's pools into host memory,
+  /// on the DMA engines through double-buffered staging. Synchronous.
+  int
+  copy_to_host(void *dst, const void *src, size_t size) {
+    bytes_copied_ += size;
+    return staged_copy(dst, src, size, false);
+  }
+
+  /// The copier behind copy_to_device and copy_to_host, with the bandwidth
+  /// each direction has achieved so far.
+  hansa::ChunkedTransfer &
+  transfer() {
+    return transfer_;
+  }
+
+  /// Uploads size bytes of host src a chunk at a time into two device-local
+  /// chunks, and has process post the kernels for each chunk as soon as it
+  /// has landed, so computing on chunk k overlaps uploading chunk k + 1:
+  ///
+  ///   int process(void *chunk, size_t offset, size_t bytes,
+  ///               DispatchHandle *last);
+  ///
+  /// posts the kernels that read the chunk, src bytes [offset, offset +
+  /// bytes), and sets *last to the handle of the last of them, which must
+  /// not have been waited on. The upload into a device chunk waits on the
+  /// kernels of the chunk before it on the DMA engine, not on the host.
+  /// Returns once every kernel has completed.
+  template <typename Fn>
+  int
+  stream_upload(const void *src, size_t size, Fn process) {
+    HANSA_TRACE_SPAN_ARG("stream upload", "bytes", size);
+    const auto start = std::chrono::steady_clock::now();
+    bytes_copied_ += size;
+    const size_t chunk = transfer_.chunk_size();
+    std::array<PoolBuffer, 2> device;
+    for (PoolBuffer &buffer : device) {
+      buffer = allocate(MemoryKind::kDeviceLocal, chunk);
+      HSA_ENFORCE_PTR("Failed to allocate device chunk", buffer.get())
+    }
+    const size_t chunks = (size + chunk - 1) / chunk;
+    std::array<hsa_signal_t, 2> copied{};
+    // The last kernels reading each device chunk; a null signal if none.
+    std::array<DispatchHandle, 2> readers{};
+    const auto upload = [&](size_t k) {
+      const size_t slot = k % 2, offset = k * chunk;
+      const uint32_t deps = readers[slot].signal.handle != 0;
+      return transfer_.upload_async(
+          device[slot].get(), static_cast<const uint8_t *>(src) + offset,
+          std::min(chunk, size - offset), &readers[slot].signal, deps,
+          &copied[slot]);
+    };
+
+    int status = 0;
+    for (size_t k = 0; k < std::min<size_t>(chunks, 2) && status == 0; ++k) {
+      status = upload(k);
+    }
+    for (size_t k = 0; k < chunks && status == 0; ++k) {
+      const size_t slot = k % 2, offset = k * chunk;
+      if (copied[slot].handle) {
+        hansa::wait_signal(copied[slot], wait_policy_);
+      }
+      // The upload that just landed waited on these, so they are done.
+      if (readers[slot].signal.handle) wait(readers[slot]);
+      readers[slot] = DispatchHandle{};
+      status = process(device[slot].get(), offset,
+                       std::min(chunk, size - offset), &readers[slot]);
+      if (status == 0 && k + 2 < chunks) status = upload(k + 2);
+    }
+    transfer_.finish();
+    for (const DispatchHandle &reader : readers) {
+      if (reader.signal.handle) wait(reader);
+    }
+    transfer_.add_streamed(size, chunks, elapsed_ms(start));
+    return status;
+  }
+
+  /// As above, but into device memory that holds the whole input and keeps
+  /// it: each of the N srcs is uploaded into the dst beside it, size bytes
+  /// each, and
+  ///
+  ///   int process(size_t offset, size_t bytes, DispatchHandle *last);
+  ///
+  /// posts the kernels for bytes [offset, offset + bytes) of the dsts as
+  /// soon as that range has landed in all of them, while the next range
+  /// uploads. Ranges are whole multiples of granule bytes, but for the
+  /// last, so kernels can take rows or whole workgroups. Returns once every
+  /// kernel has completed.
+  template <size_t N, typename Fn>
+  int
+  stream_upload(const std::array<void *, N> &dsts,
+                const std::array<const void *, N> &srcs, size_t size,
+                size_t granule, Fn process) {
+    HANSA_TRACE_SPAN_ARG("stream upload", "bytes", N * size);
+    const auto start = std::chrono::steady_clock::now();
+    bytes_copied_ += N * size;
+    const size_t chunk = transfer_.chunk_size() / granule * granule;
+    if (chunk == 0) {
+      std::cerr << "ERROR: Stream granule of " << granule
+                << " bytes is larger than the transfer chunk" << std::endl;
+      return -1;
+    }
+    const size_t chunks = (size + chunk - 1) / chunk;
+    std::array<hsa_signal_t, N> copied{};
+    const auto upload = [&](size_t k) {
+      const size_t offset = k * chunk;
+      for (size_t i = 0; i < N; ++i) {
+        if (0 != transfer_.upload_async(
+                     static_cast<uint8_t *>(dsts[i]) + offset,
+                     static_cast<const uint8_t *>(srcs[i]) + offset,
+                     std::min(chunk, size - offset), nullptr, 0,
+                     &copied[i])) {
+          return -1;
+        }
+      }
+      return 0;
+    };
+
+    // Kernels of the last two ranges, so at most two are in flight.
+    std::array<DispatchHandle, 2> posted{};
+    int status = chunks ? upload(0) : 0;
+    for (size_t k = 0; k < chunks && status == 0; ++k) {
+      // With more srcs than staging chunks, a later copy of the range may
+      // have reused a signal, which only makes this wait longer.
+      for (hsa_signal_t signal : copied) {
+        if (signal.handle) hansa::wait_signal(signal, wait_policy_);
+      }
+      DispatchHandle &last = posted[k % 2];
+      if (last.signal.handle) wait(last);
+      last = DispatchHandle{};
+      const size_t offset = k * chunk;
+      status = process(offset, std::min(chunk, size - offset), &last);
+      if (status == 0 && k + 1 < chunks) status = upload(k + 1);
+    }
+    transfer_.finish();
+    for (const DispatchHandle &last : posted) {
+      if (last.signal.handle) wait(last);
+    }
+    transfer_.add_streamed(N * size, N * chunks, elapsed_ms(start));
+    return status;
+  }
+
+ private:
+  struct PendingPacket {
+    hsa_kernel_dispatch_packet_t *packet;
+    uint32_t header32;
+    uint64_t packet_index;
+  };
+
+  /// What one post() builds before it publishes, private to its caller.
+  struct LaunchContext {
+    hansa::KernelObject kernel;
+    KernelDispatchConfig shaped;
+    hsa_kernel_dispatch_packet_t body;
+  };
+
+  /// A host backend launch held until submit().
+  struct HostLaunch {
+    hsa_kernel_dispatch_packet_t packet;
+    std::vector<uint8_t> kernargs;
+    WorkgroupRecord *profile = nullptr;
+  };
+
+  static double
+  elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  void
+  init_allocators() {
+    for (size_t k = 0; k < kMemoryKinds; ++k) {
+      allocators_[k] = std::make_unique<CachingAllocator>(*backing_[k]);
+    }
+  }
+
+  /// On the host backend transfer_ is never initialized and memcpys.
+  int
+  staged_copy(void *dst, const void *src, size_t size, bool to_device) {
+    return to_device ? transfer_.upload(dst, src, size)
+                     : transfer_.download(dst, src, size);
+  }
+
+  /// Whether dispatch times go into the trace; never without HANSA_TRACE.
+  static bool
+  tracing() {
+#ifdef HANSA_TRACE
+    return hansa::Tracer::enabled();
+#else
+    return false;
+#endif
+  }
+
+  /// Records a dispatch's run on the device, moved onto the host clock.
+  void
+  trace_device(const char *name,
+               const hsa_amd_profiling_dispatch_time_t &time) const {
+    if (!tracing()) return;
+    const auto host_ns = [this](uint64_t ticks) {
+      return uint64_t(int64_t(device_epoch_ns_) +
+                      int64_t(ticks - device_epoch_ticks_) * timestamp_ns_);
+    };
+    hansa::Tracer::instance().record({name, host_ns(time.start),
+                                      host_ns(time.end), nullptr, 0,
+                                      hansa::TraceTrack::kDevice});
+  }
+
+  void
+  run_host(const hsa_kernel_dispatch_packet_t &packet, const void *kernarg,
+           WorkgroupRecord *profile = nullptr) {
+    HANSA_TRACE_SPAN("run on host");
+    auto kernel = reinterpret_cast<const hansa::HostKernel *>(
+        static_cast<uintptr_t>(packet.kernel_object));
+    host_->launch(*kernel, kernarg,
+                  {packet.grid_size_x, packet.grid_size_y, packet.grid_size_z},
+                  {packet.workgroup_size_x, packet.workgroup_size_y,
+                   packet.workgroup_size_z},
+                  packet.group_segment_size, profile);
+  }
+
+  /// Clears launch's workgroup records before a dispatch.
+  int
+  reset_workgroup_records(PreparedLaunch *launch);
+
+  /// Copies launch's workgroup records into workgroup_traces_.
+  int
+  collect_workgroup_records(const PreparedLaunch &launch);
+
+  /// Looks up the kernel and sizes its kernarg block for ARGS_T.
+  template <typename ARGS_T>
+  int
+  resolve(const KernelDispatchConfig *cfg, hansa::KernelObject *kernel,
+          size_t *kernarg_size) {
+    HANSA_TRACE_SPAN("resolve kernel");
+    if (host_) {
+      const hansa::HostKernel *host_kernel = host_->find(cfg->kernel_symbol);
+      if (!host_kernel) {
+        std::cerr << "ERROR: no host build of " << cfg->kernel_symbol
+                  << std::endl;
+        return -1;
+      }
+      *kernel = hansa::KernelObject{};
+      kernel->handle = reinterpret_cast<uintptr_t>(host_kernel);
+      *kernarg_size = implicit_offset<ARGS_T>() + sizeof(ImplicitArg);
+      return 0;
+    }
+
+    // executable, loaded and frozen once per code file and agent
+    if (0 != kernel_cache_.lookup(cfg->code_file_name, cfg->kernel_symbol,
+                                  agent_, kernel)) {
+      return -1;
+    }
+    if (const hansa::KernelMetadata *meta = kernel->metadata) {
+      if (!args_struct_fits(sizeof(ARGS_T), alignof(ARGS_T), *meta)) {
+        std::cerr << "ERROR: " << sizeof(ARGS_T) << "-byte args struct for "
+                  << cfg->kernel_symbol << ", whose explicit args end at "
+                  << meta->explicit_args_end() << std::endl;
+        return -1;
+      }
+      *kernarg_size =
+          std::max<size_t>(kernel->kernarg_segment_size, sizeof(ARGS_T));
+    } else {
+      *kernarg_size = std::max<size_t>(kernel->kernarg_segment_size,
+                                       implicit_offset<ARGS_T>() +
+                                           sizeof(ImplicitArg));
+    }
+    if (*kernarg_size > kernargs_.slot_size()) {
+      std::cerr << "ERROR: kernel args (" << *kernarg_size
+                << " bytes) exceed the kernarg slot size" << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  /// Serves libkernels.so from the code object embedded for the agent's
+  /// ISA, so kernels load from memory. Binaries without a bundle, or
+  /// without an entry for the ISA, load the file as before.
+  void
+  use_embedded_code_object() {
+    const CodeObjectBundle bundle = CodeObjectBundle::embedded();
+    if (bundle.entries().empty()) return;
+    hsa_isa_t isa;
+    uint32_t length = 0;
+    std::string name;
+    hsa_status_t status = hsa_agent_get_info(agent_, HSA_AGENT_INFO_ISA, &isa);
+    if (status == HSA_STATUS_SUCCESS) {
+      status = hsa_isa_get_info_alt(isa, HSA_ISA_INFO_NAME_LENGTH, &length);
+    }
+    if (status == HSA_STATUS_SUCCESS) {
+      std::vector<char> buffer(length + 1, 0);
+      status = hsa_isa_get_info_alt(isa, HSA_ISA_INFO_NAME, buffer.data());
+      name = buffer.data();
+    }
+    if (status != HSA_STATUS_SUCCESS) {
+      std::cerr << "Warning: failed to query the agent's ISA, loading "
+                << kKernelLibrary << std::endl;
+      return;
+    }
+    const CodeObjectBundle::Entry *entry = bundle.select(name);
+    if (!entry) {
+      std::cerr << "Warning: no embedded code object runs on " << name
+                << " (built for " << bundle.targets() << "), loading "
+                << kKernelLibrary << std::endl;
+      return;
+    }
+    kernel_cache_.add_image(kKernelLibrary, entry->data, entry->size);
+    std::cout << "Using embedded " << entry->isa << " code object ("
+              << entry->size << " bytes) for " << name << std::endl;
+  }
+
+  /// Fills limits_ from the agent's info; whatever the runtime does not
+  /// report keeps the default of the agent's ISA.
+  void
+  query_limits() {
+    const auto query = [this](auto attribute) {
+      uint32_t value = 0;
+      hsa_agent_get_info(agent_, hsa_agent_info_t(attribute), &value);
+      return value;
+    };
+    limits_ = AgentLimits::for_isa(agent_name_,
+                                   query(HSA_AGENT_INFO_WAVEFRONT_SIZE));
+    if (uint32_t cus = query(HSA_AMD_AGENT_INFO_COMPUTE_UNIT_COUNT)) {
+      limits_.compute_units = cus;
+    }
+    if (uint32_t simds = query(HSA_AMD_AGENT_INFO_NUM_SIMDS_PER_CU)) {
+      limits_.simds_per_cu = simds;
+    }
+    const uint32_t waves = query(HSA_AMD_AGENT_INFO_MAX_WAVES_PER_CU);
+    if (waves >= limits_.simds_per_cu) {
+      limits_.max_waves_per_simd = waves / limits_.simds_per_cu;
+    }
+    if (uint32_t size = query(HSA_AGENT_INFO_WORKGROUP_MAX_SIZE)) {
+      limits_.max_workgroup_size = size;
+    }
+  }
+
+  KernelResources
+  resources(const hansa::KernelObject &kernel) const {
+    if (kernel.metadata) {
+      return KernelResources::from_metadata(*kernel.metadata);
+    }
+    if (kernel.descriptor) {
+      return KernelResources::from_descriptor(kernel.descriptor, limits_);
+    }
+    KernelResources unknown;
+    unknown.lds_bytes = kernel.group_segment_size;
+    return unknown;
+  }
+
+  /// Resolves an auto workgroup and a persistent grid into *shaped and
+  /// returns the config to launch, recording its occupancy estimate.
+  const KernelDispatchConfig *
+  shape(const KernelDispatchConfig *cfg, const hansa::KernelObject &kernel,
+        KernelDispatchConfig *shaped) {
+    KernelResources res = resources(kernel);
+    res.lds_bytes += cfg->dynamic_lds_size;
+    Occupancy estimate;
+    if (cfg->auto_workgroup()) {
+      estimate = choose_workgroup(limits_, res, cfg->grid_size);
+      *shaped = *cfg;
+      shaped->workgroup_size = estimate.workgroup;
+      cfg = shaped;
+    } else {
+      estimate = estimate_occupancy(limits_, res, cfg->grid_size,
+                                    cfg->workgroup_size);
+    }
+    if (cfg->mode == LaunchMode::kPersistent) {
+      const LaunchShape resident = LaunchShape::persistent(
+          cfg->grid_size, cfg->workgroup_size,
+          uint64_t(estimate.workgroups_per_cu) * limits_.compute_units);
+      if (cfg != shaped) *shaped = *cfg;
+      for (int d = 0; d < 3; ++d) shaped->grid_size[d] = resident.grid[d];
+      cfg = shaped;
+      estimate = estimate_occupancy(limits_, res, cfg->grid_size,
+                                    cfg->workgroup_size);
+    }
+    occupancy_[cfg->kernel_symbol] = estimate;
+    return cfg;
+  }
+
+  template <typename ARGS_T>
+  static constexpr size_t
+  implicit_offset() {
+    return hansa::KernargArena::align_up(
+        sizeof(ARGS_T), hansa::KernargArena::kImplicitArgAlignment);
+  }
+
+  /// The hidden args of a dispatch of cfg. The device library sizes the
+  /// last workgroup of a dimension from block_count and remainder, so they
+  /// must agree with the packet's grid.
+  static ImplicitArg
+  implicit_args(const KernelDispatchConfig *cfg) {
+    const LaunchShape shape =
+        LaunchShape::exact(cfg->grid_size, cfg->workgroup_size);
+    ImplicitArg implicit{};
+
+    implicit.block_count_x = shape.block_count(0);
+    implicit.block_count_y = shape.block_count(1);
+    implicit.block_count_z = shape.block_count(2);
+
+    implicit.group_size_x = shape.workgroup[0];
+    implicit.group_size_y = shape.workgroup[1];
+    implicit.group_size_z = shape.workgroup[2];
+
+    implicit.remainder_x = shape.remainder(0);
+    implicit.remainder_y = shape.remainder(1);
+    implicit.remainder_z = shape.remainder(2);
+
+    implicit.grid_dims = shape.dims;
+    implicit.dynamic_lds_size = cfg->dynamic_lds_size;
+    return implicit;
+  }
+
+  /// Lays out the hidden args where meta says, or as an ImplicitArg block
+  /// after the explicit args when there is no metadata.
+  template <typename ARGS_T>
+  static void
+  write_kernargs(const KernelDispatchConfig *cfg, const ARGS_T &args,
+                 const hansa::KernelMetadata *meta, void *kernarg,
+                 size_t kernarg_size) {
+    std::memset(kernarg, 0, kernarg_size);
+    std::memcpy(kernarg, &args, sizeof(ARGS_T));
+    const ImplicitArg implicit = implicit_args(cfg);
+    if (meta) {
+      write_hidden_args(*meta, implicit, kernarg);
+    } else {
+      std::memcpy(static_cast<uint8_t *>(kernarg) + implicit_offset<ARGS_T>(),
+                  &implicit, sizeof(implicit));
+    }
+  }
+
+  static uint32_t
+  dispatch_header32(uint16_t setup, bool ordered) {
+    const uint16_t header =
+        (HSA_PACKET_TYPE_KERNEL_DISPATCH << HSA_PACKET_HEADER_TYPE) |
+        (uint16_t(ordered) << HSA_PACKET_HEADER_BARRIER) |
+        (HSA_FENCE_SCOPE_SYSTEM << HSA_PACKET_HEADER_ACQUIRE_FENCE_SCOPE) |
+        (HSA_FENCE_SCOPE_SYSTEM << HSA_PACKET_HEADER_RELEASE_FENCE_SCOPE);
+    return header | (uint32_t(setup) << 16);
+  }
+
+  /// Frees launch's kernarg block and signal.
+  void
+  release(PreparedLaunch *launch);
+
+  /// Fills everything but the header and completion signal, and returns
+  /// the packet setup field.
+  static uint16_t
+  write_packet_body(const KernelDispatchConfig *cfg,
+                    const hansa::KernelObject &kernel, void *kernarg,
+                    hsa_kernel_dispatch_packet_t *packet) {
+    constexpr size_t aql_header_size = 4;
+    std::memset(reinterpret_cast<uint8_t *>(packet) + aql_header_size, 0,
+                sizeof(*packet) - aql_header_size);
+    packet->kernel_object = kernel.handle;
+    packet->group_segment_size =
+        kernel.group_segment_size + cfg->dynamic_lds_size;
+    packet->private_segment_size = kernel.private_segment_size;
+    packet->kernarg_address = kernarg;
+
+    const LaunchShape shape =
+        LaunchShape::exact(cfg->grid_size, cfg->workgroup_size);
+    packet->workgroup_size_x = shape.workgroup[0];
+    packet->workgroup_size_y = shape.workgroup[1];
+    packet->workgroup_size_z = shape.workgroup[2];
+
+    packet->grid_size_x = shape.grid[0];
+    packet->grid_size_y = shape.grid[1];
+    packet->grid_size_z = shape.grid[2];
+
+    return shape.dims << HSA_KERNEL_DISPATCH_PACKET_SETUP_DIMENSIONS;
+  }
+
+  hsa_kernel_dispatch_packet_t *
+  packet_at(uint64_t packet_index) {
+    return static_cast<hsa_kernel_dispatch_packet_t *>(queue_->base_address) +
+           (packet_index & (queue_->size - 1));
+  }
+
+  /// Claims the next queue slot, waiting until the packet processor has
+  /// consumed the packet a kernarg ring back, as post() does, so the two
+  /// can share the queue.
+  uint64_t
+  reserve_packet() {
+    const uint64_t window = kernargs_.slot_count();
+    const uint64_t index = hsa_queue_add_write_index_relaxed(queue_, 1);
+    if (index - hsa_queue_load_read_index_scacquire(queue_) >= window) {
+      // Room only appears once earlier packets of this batch are visible.
+      submit();
+      while (index - hsa_queue_load_read_index_scacquire(queue_) >= window) {
+        std::this_thread::yield();
+      }
+    }
+    return index;
+  }
+
+  hsa_agent_t agent_;
+  hsa_agent_t cpu_agent_;
+  uint32_t queue_size_;
+  hsa_queue_t *queue_;
+
+  hsa_region_t system_region_;
+  hsa_region_t kernarg_region_;
+  hsa_region_t local_region_;
+  hsa_region_t gpu_local_region_;
+
+  std::array<std::unique_ptr<BackingPool>, kMemoryKinds> backing_;
+  std::array<std::unique_ptr<CachingAllocator>, kMemoryKinds> allocators_;
+  uint64_t bytes_copied_ = 0;
+  hansa::ChunkedTransfer transfer_;
+
+  std::string agent_name_;
+  AgentLimits limits_;
+  std::map<std::string, Occupancy> occupancy_;
+  bool workgroup_profiling_ = false;
+  std::map<std::string, WorkgroupTrace> workgroup_traces_;
+  hansa::WaitPolicy wait_policy_;
+  bool hsa_initialized_;
+  bool profiling_;
+  double timestamp_ns_;
+  /// A system timestamp and the trace_now_ns() it was read at.
+  uint64_t device_epoch_ticks_ = 0;
+  uint64_t device_epoch_ns_ = 0;
+
+  // Enough for the explicit args of every kernel plus ImplicitArg.
+  static constexpr size_t kKernargSlotSize = 1024;
+  static constexpr uint32_t kMaxKernargSlots = 1024;
+  hansa::KernargArena kernargs_;
+
+  hansa::SignalPool signals_;
+  std::vector<PendingPacket> pending_;
+  DispatchHandle last_dispatch_;
+
+  hansa::KernelCache kernel_cache_;
+  /// Serializes the kernel lookups and host launches of post().
+  std::mutex launch_mutex_;
+
+  std::unique_ptr<hansa::HostBackend> host_;
+  std::vector<HostLaunch> host_pending_;
+};
+
+/// A typed buffer from one of the engine's caching allocators, returned to
+/// the cache when it goes out of scope, or host memory pinned in place.
+/// Device-local by default, so the host fills and reads it through
+/// copy_from and copy_to; those are no-ops on the buffer's own host memory.
+/// data() is null when the allocation failed, and for a count of 0, which
+/// holds no memory.
+template <typename T>
+class DeviceBuffer {
+ public:
+  DeviceBuffer(Engine &engine, size_t count,
+               MemoryKind kind = MemoryKind::kDeviceLocal)
+      : engine_(&engine),
+        buffer_(count ? engine.allocate(kind, count * sizeof(T))
+                      : PoolBuffer()),
+        device_(buffer_.as<T>()),
+        host_(kind == MemoryKind::kDeviceLocal ? nullptr : device_),
+        count_(device_ ? count : 0) {}
+
+  /// Pins count elements of host memory for the lifetime of the buffer.
+  /// data() is null if they could not be pinned.
+  static DeviceBuffer
+  pin(Engine &engine, T *host, size_t count) {
+    DeviceBuffer buffer(engine, 0);
+    void *agent_ptr = nullptr;
+    if (0 == engine.pin(host, count * sizeof(T), &agent_ptr)) {
+      buffer.device_ = static_cast<T *>(agent_ptr);
+      buffer.host_ = host;
+      buffer.count_ = count;
+      buffer.pinned_ = true;
+    }
+    return buffer;
+  }
+
+  DeviceBuffer(DeviceBuffer &&other) noexcept
+      : engine_(other.engine_),
+        buffer_(std::move(other.buffer_)),
+        device_(std::exchange(other.device_, nullptr)),
+        host_(std::exchange(other.host_, nullptr)),
+        count_(other.count_),
+        pinned_(std::exchange(other.pinned_, false)) {}
+
+  DeviceBuffer &
+  operator=(DeviceBuffer &&) = delete;
+
+  ~DeviceBuffer() {
+    if (pinned_) engine_->unpin(host_);
+  }
+
+  /// The address kernels use.
+  T *
+  data() const {
+    return device_;
+  }
+
+  /// The address the host uses, or null for device-local memory.
+  T *
+  host() const {
+    return host_;
+  }
+
+  /// Where the host should produce or consume the buffer's contents: the
+  /// buffer itself when it is host-accessible, otherwise *staging resized
+  /// to fit.
+  T *
+  host_view(std::vector<T> *staging) const {
+    if (host_) return host_;
+    staging->resize(count_);
+    return staging->data();
+  }
+
+  [[nodiscard]]
+  size_t
+  count() const {
+    return count_;
+  }
+
+  int
+  copy_from(const T *src) {
+    if (src == host_) return 0;
+    return engine_->copy_to_device(data(), src, count_ * sizeof(T));
+  }
+
+  int
+  copy_to(T *dst) const {
+    if (dst == host_) return 0;
+    return engine_->copy_to_host(dst, data(), count_ * sizeof(T));
+  }
+
+ private:
+  Engine *engine_;
+  PoolBuffer buffer_;
+  T *device_;
+  T *host_;
+  size_t count_;
+  bool pinned_ = false;
+};
+
+/// A kernel launch prepared once and dispatched many times.
+///
+/// Engine::prepare resolves the kernel, fills an AQL packet template and a
+/// kernarg template with the hidden args at the offsets the code-object
+/// metadata gives them, and gives the launch its own kernarg block and
+/// completion signal. Args are bound by position and checked against the
+/// metadata, so a mismatched argument list fails at bind time instead of
+/// corrupting the kernarg segment. A dispatch copies only the argument
+/// bytes that changed since the previous one, then writes the packet body
+/// and publishes its header.
+///
+/// Without metadata, as on the host backend, the first bind lays the
+/// explicit args out at their natural alignment, like the kernel's C
+/// signature, and later binds are checked against that layout.
+///
+/// A launch has at most one dispatch in flight.
+class PreparedLaunch {
+ public:
+  PreparedLaunch() = default;
+  PreparedLaunch(const PreparedLaunch &) = delete;
+  PreparedLaunch &
+  operator=(const PreparedLaunch &) = delete;
+
+  ~PreparedLaunch() {
+    if (engine_) engine_->release(this);
+  }
+
+  /// Binds every explicit arg, in declaration order.
+  template <typename... Args>
+  int
+  bind(const Args &...args) {
+    if (!metadata_ && kernarg_.empty()) {
+      lay_out({{sizeof(Args), alignof(Args)}...});
+    }
+    if (sizeof...(Args) != slots_.size()) {
+      std::cerr << "ERROR: " << sizeof...(Args) << " args bound to "
+                << symbol_ << ", which takes " << slots_.size() << std::endl;
+      return -1;
+    }
+    size_t index = 0;
+    int failed = 0;
+    ((failed |= set_bytes(index++, &args, sizeof(Args))), ...);
+    return failed ? -1 : 0;
+  }
+
+  /// Rebinds the explicit arg at index.
+  template <typename T>
+  int
+  set(size_t index, const T &value) {
+    return set_bytes(index, &value, sizeof(T));
+  }
+
+  /// Null when the kernel's code object had no metadata.
+  [[nodiscard]]
+  const KernelMetadata *
+  metadata() const {
+    return metadata_;
+  }
+
+ private:
+  friend class Engine;
+
+  struct Slot {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  /// Forgets the kernel, keeping nothing but the engine.
+  void
+  clear() {
+    symbol_.clear();
+    trace_name_ = "kernel";
+    metadata_ = nullptr;
+    slots_.clear();
+    bound_.clear();
+    unbound_ = 0;
+    kernarg_.clear();
+    dirty_begin_ = SIZE_MAX;
+    dirty_end_ = 0;
+    packet_ = {};
+    workgroup_records_.reset();
+  }
+
+  /// Natural-alignment layout, followed by an ImplicitArg block.
+  void
+  lay_out(std::initializer_list<std::pair<size_t, size_t>> args) {
+    size_t offset = 0;
+    for (const auto &[size, align] : args) {
+      offset = KernargArena::align_up(offset, align);
+      slots_.push_back({uint32_t(offset), uint32_t(size)});
+      offset += size;
+    }
+    const size_t implicit =
+        KernargArena::align_up(offset, KernargArena::kImplicitArgAlignment);
+    kernarg_.assign(implicit + sizeof(ImplicitArg), 0);
+    std::memcpy(kernarg_.data() + implicit, &implicit_, sizeof(implicit_));
+    unbound_ = slots_.size();
+    bound_.assign(slots_.size(), false);
+  }
+
+  int
+  set_bytes(size_t index, const void *value, size_t size) {
+    if (index >= slots_.size()) {
+      std::cerr << "ERROR: " << symbol_ << " has no arg " << index
+                << std::endl;
+      return -1;
+    }
+    const Slot &slot = slots_[index];
+    if (size != slot.size) {
+      std::cerr << "ERROR: " << size << "-byte value bound to arg " << index;
+      if (metadata_) std::cerr << " (" << metadata_->args[index].name << ")";
+      std::cerr << " of " << symbol_ << ", which is " << slot.size
+                << " bytes" << std::endl;
+      return -1;
+    }
+    if (!bound_[index]) {
+      bound_[index] = true;
+      --unbound_;
+    }
+    uint8_t *dst = kernarg_.data() + slot.offset;
+    if (std::memcmp(dst, value, size) == 0) return 0;
+    std::memcpy(dst, value, size);
+    dirty_begin_ = std::min<size_t>(dirty_begin_, slot.offset);
+    dirty_end_ = std::max<size_t>(dirty_end_, slot.offset + size);
+    return 0;
+  }
+
+  Engine *engine_ = nullptr;
+  std::string symbol_;
+  /// symbol_ as the name of its device spans, when tracing.
+  const char *trace_name_ = "kernel";
+  const KernelMetadata *metadata_ = nullptr;
+  ImplicitArg implicit_{};
+  std::vector<Slot> slots_;
+  std::vector<bool> bound_;
+  size_t unbound_ = 0;
+  std::vector<uint8_t> kernarg_;
+  /// The template bytes not yet copied to kernarg_block_.
+  size_t dirty_begin_ = SIZE_MAX;
+  size_t dirty_end_ = 0;
+  hsa_kernel_dispatch_packet_t packet_{};
+  uint32_t header32_ = 0;
+  void *kernarg_block_ = nullptr;
+  hsa_signal_t signal_{0};
+  bool in_flight_ = false;
+  /// One record per workgroup under Engine::enable_workgroup_profiling().
+  PoolBuffer workgroup_records_;
+  std::array<uint32_t, 3> block_count_{1, 1, 1};
+};
+
+inline int
+Engine::prepare(const KernelDispatchConfig &cfg, PreparedLaunch *launch) {
+  HANSA_TRACE_SPAN("prepare");
+  if (launch->engine_) release(launch);
+  launch->clear();
+  hansa::KernelObject kernel;
+  if (host_) {
+    const hansa::HostKernel *host_kernel = host_->find(cfg.kernel_symbol);
+    if (!host_kernel) {
+      std::cerr << "ERROR: no host build of " << cfg.kernel_symbol
+                << std::endl;
+      return -1;
+    }
+    kernel.handle = reinterpret_cast<uintptr_t>(host_kernel);
+  } else if (0 != kernel_cache_.lookup(cfg.code_file_name, cfg.kernel_symbol,
+                                       agent_, &kernel)) {
+    return -1;
+  }
+
+  Engine::KernelDispatchConfig shaped;
+  const Engine::KernelDispatchConfig &config = *shape(&cfg, kernel, &shaped);
+  launch->engine_ = this;
+  launch->symbol_ = cfg.kernel_symbol;
+  if (tracing()) {
+    launch->trace_name_ =
+        kernel.name ? kernel.name
+                    : hansa::Tracer::instance().intern(cfg.kernel_symbol);
+  }
+  launch->metadata_ = kernel.metadata;
+  launch->implicit_ = implicit_args(&config);
+  if (workgroup_profiling_) {
+    const ImplicitArg &implicit = launch->implicit_;
+    launch->block_count_ = {implicit.block_count_x, implicit.block_count_y,
+                            implicit.block_count_z};
+    const size_t count = size_t(implicit.block_count_x) *
+                         implicit.block_count_y * implicit.block_count_z;
+    launch->workgroup_records_ = allocate(MemoryKind::kDeviceLocal,
+                                          count * sizeof(WorkgroupRecord));
+    HSA_ENFORCE_PTR("Failed to allocate workgroup records",
+                    launch->workgroup_records_.get())
+    launch->implicit_.hostcall_buffer =
+        reinterpret_cast<uintptr_t>(launch->workgroup_records_.get());
+  }
+  if (const hansa::KernelMetadata *meta = kernel.metadata) {
+    const size_t explicit_count = meta->explicit_arg_count();
+    for (size_t i = 0; i < explicit_count; ++i) {
+      launch->slots_.push_back({meta->args[i].offset, meta->args[i].size});
+    }
+    launch->unbound_ = explicit_count;
+    launch->bound_.assign(explicit_count, false);
+    launch->kernarg_.assign(
+        std::max<size_t>(meta->kernarg_segment_size, meta->explicit_args_end()),
+        0);
+    write_hidden_args(*meta, launch->implicit_, launch->kernarg_.data());
+  }
+
+  const uint16_t setup =
+      write_packet_body(&config, kernel, nullptr, &launch->packet_);
+  launch->header32_ = dispatch_header32(setup, config.ordered);
+  if (!host_ && 0 != signals_.acquire(&launch->signal_)) return -1;
+  return 0;
+}
+
+inline int
+Engine::dispatch(PreparedLaunch *launch) {
+  HANSA_TRACE_SPAN("dispatch");
+  if (!launch->engine_ || launch->unbound_ != 0 || launch->kernarg_.empty()) {
+    std::cerr << "ERROR: dispatch of " << launch->symbol_
+              << " before all of its args are bound" << std::endl;
+    return -1;
+  }
+  if (launch->in_flight_) wait(launch);
+  if (launch->workgroup_records_.get() &&
+      0 != reset_workgroup_records(launch)) {
+    return -1;
+  }
+  if (host_) {
+    host_pending_.push_back(
+        {launch->packet_, launch->kernarg_,
+         launch->workgroup_records_.as<WorkgroupRecord>()});
+    launch->in_flight_ = true;
+    return 0;
+  }
+
+  if (!launch->kernarg_block_) {
+    hsa_status_t status = hsa_memory_allocate(
+        kernarg_region_, launch->kernarg_.size(), &launch->kernarg_block_);
+    HSA_ENFORCE("hsa_memory_allocate(kernarg)", status);
+    launch->packet_.kernarg_address = launch->kernarg_block_;
+    launch->dirty_begin_ = 0;
+    launch->dirty_end_ = launch->kernarg_.size();
+  }
+  if (launch->dirty_begin_ < launch->dirty_end_) {
+    std::memcpy(static_cast<uint8_t *>(launch->kernarg_block_) +
+                    launch->dirty_begin_,
+                launch->kernarg_.data() + launch->dirty_begin_,
+                launch->dirty_end_ - launch->dirty_begin_);
+    launch->dirty_begin_ = SIZE_MAX;
+    launch->dirty_end_ = 0;
+  }
+
+  hsa_signal_store_relaxed(launch->signal_, 1);
+  launch->packet_.completion_signal = launch->signal_;
+  const uint64_t index = reserve_packet();
+  hsa_kernel_dispatch_packet_t *packet = packet_at(index);
+  constexpr size_t aql_header_size = 4;
+  std::memcpy(reinterpret_cast<uint8_t *>(packet) + aql_header_size,
+              reinterpret_cast<const uint8_t *>(&launch->packet_) +
+                  aql_header_size,
+              sizeof(*packet) - aql_header_size);
+  pending_.push_back({packet, launch->header32_, index});
+  launch->in_flight_ = true;
+  return 0;
+}
+
+inline hsa_signal_value_t
+Engine::wait(PreparedLaunch *launch) {
+  submit();
+  HANSA_TRACE_SPAN("wait");
+  if (!launch->in_flight_) return 0;
+  launch->in_flight_ = false;
+  hsa_signal_value_t value = 0;
+  if (!host_) value = hansa::wait_signal(launch->signal_, wait_policy_);
+  hsa_amd_profiling_dispatch_time_t time;
+  if (!host_ && tracing() && profiling_ &&
+      hsa_amd_profiling_get_dispatch_time(agent_, launch->signal_, &time) ==
+          HSA_STATUS_SUCCESS) {
+    trace_device(launch->trace_name_, time);
+  }
+  if (launch->workgroup_records_.get()) collect_workgroup_records(*launch);
+  return value;
+}
+
+inline int
+Engine::reset_workgroup_records(PreparedLaunch *launch) {
+  const std::vector<WorkgroupRecord> blank = blank_workgroup_records(
+      launch->workgroup_records_.size() / sizeof(WorkgroupRecord));
+  return staged_copy(launch->workgroup_records_.get(), blank.data(),
+                     blank.size() * sizeof(WorkgroupRecord), true);
+}
+
+inline int
+Engine::collect_workgroup_records(const PreparedLaunch &launch) {
+  WorkgroupTrace &trace = workgroup_traces_[launch.symbol_];
+  trace.symbol = launch.symbol_;
+  trace.isa = agent_name_;
+  // The host backend records steady_clock nanoseconds; agents their
+  // 100 MHz realtime counter.
+  trace.tick_ns = host_ ? 1 : 10;
+  trace.blocks = launch.block_count_;
+  trace.records.resize(launch.workgroup_records_.size() /
+                       sizeof(WorkgroupRecord));
+  return staged_copy(trace.records.data(), launch.workgroup_records_.get(),
+                     trace.records.size() * sizeof(WorkgroupRecord), false);
+}
+
+inline void
+Engine::release(PreparedLaunch *launch) {
+  if (launch->in_flight_) wait(launch);
+  if (launch->kernarg_block_) hsa_memory_free(launch->kernarg_block_);
+  if (launch->signal_.handle) signals_.release(launch->signal_);
+  launch->kernarg_block_ = nullptr;
+  launch->signal_.handle = 0;
+  launch->engine_ = nullptr;
+}
+
+inline hsa_status_t
+get_agent_callback(const hsa_agent_t agent, void *data) {
+  if (!data) return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+
+  hsa_device_type_t hsa_device_type;
+  hsa_status_t hsa_error_code =
+      hsa_agent_get_info(agent, HSA_AGENT_INFO_DEVICE, &hsa_device_type);
+  if (hsa_error_code != HSA_STATUS_SUCCESS) return hsa_error_code;
+
+  if (hsa_device_type == HSA_DEVICE_TYPE_GPU) {
+    auto b = static_cast<Engine *>(data);
+    b->agent_ = agent;
+  }
+  if (hsa_device_type == HSA_DEVICE_TYPE_CPU) {
+    auto b = static_cast<Engine *>(data);
+    b->cpu_agent_ = agent;
+  }
+
+  return HSA_STATUS_SUCCESS;
+}
+
+inline hsa_status_t
+get_region_callback(const hsa_region_t region, void *data) {
+  hsa_region_segment_t segment_id;
+  hsa_status_t status =
+      hsa_region_get_info(region, HSA_REGION_INFO_SEGMENT, &segment_id);
+  HSA_ENFORCE("Failed getting region info", status);
+
+  if (segment_id != HSA_REGION_SEGMENT_GLOBAL) {
+    return HSA_STATUS_SUCCESS;
+  }
+
+  hsa_region_global_flag_t flags;
+  bool host_accessible_region = false;
+  hsa_region_get_info(region, HSA_REGION_INFO_GLOBAL_FLAGS, &flags);
+  hsa_region_get_info(
+      region,
+      static_cast<hsa_region_info_t>(HSA_AMD_REGION_INFO_HOST_ACCESSIBLE),
+      &host_accessible_region);
+
+  auto b = static_cast<Engine *>(data);
+
+  if (flags & HSA_REGION_GLOBAL_FLAG_FINE_GRAINED) {
+    b->system_region_ = region;
+  }
+
+  if (flags & HSA_REGION_GLOBAL_FLAG_COARSE_GRAINED) {
+    if (host_accessible_region) {
+      b->local_region_ = region;
+    } else {
+      b->gpu_local_region_ = region;
+    }
+  }
+
+  if (flags & HSA_REGION_GLOBAL_FLAG_KERNARG) {
+    b->kernarg_region_ = region;
+  }
+
+  return HSA_STATUS_SUCCESS;
+}
+
+inline hsa_status_t
+get_memory_pool_callback(hsa_amd_memory_pool_t pool, void *data) {
+  hsa_amd_segment_t segment;
+  hsa_status_t status =
+      hsa_amd_memory_pool_get_info(pool, HSA_AMD_MEMORY_POOL_INFO_SEGMENT,
+                                   &segment);
+  HSA_ENFORCE("hsa_amd_memory_pool_get_info(SEGMENT)", status);
+  if (segment != HSA_AMD_SEGMENT_GLOBAL) return HSA_STATUS_SUCCESS;
+
+  bool alloc_allowed = false;
+  hsa_amd_memory_pool_get_info(
+      pool, HSA_AMD_MEMORY_POOL_INFO_RUNTIME_ALLOC_ALLOWED, &alloc_allowed);
+  if (!alloc_allowed) return HSA_STATUS_SUCCESS;
+
+  uint32_t flags = 0;
+  hsa_amd_memory_pool_get_info(pool, HSA_AMD_MEMORY_POOL_INFO_GLOBAL_FLAGS,
+                               &flags);
+  auto pools = static_cast<AgentMemoryPools *>(data);
+  // The kernarg pool is fine-grained too; prefer the plain one.
+  if ((flags & HSA_AMD_MEMORY_POOL_GLOBAL_FLAG_FINE_GRAINED) &&
+      (pools->fine.handle == 0 ||
+       !(flags & HSA_AMD_MEMORY_POOL_GLOBAL_FLAG_KERNARG_INIT))) {
+    pools->fine = pool;
+  }
+  if ((flags & HSA_AMD_MEMORY_POOL_GLOBAL_FLAG_COARSE_GRAINED) &&
+      pools->coarse.handle == 0) {
+    pools->coarse = pool;
+  }
+  return HSA_STATUS_SUCCESS;
+}
+
+}  // namespace hansa
@@ -0,0 +1,33 @@
+#pragma once
+
+/* Force-included when kernels/ sources are compiled for the host backend.
+ * Maps the amdgcn builtins used by the kernels onto the host runtime;
+ * LDS statics become thread-local, which is per workgroup since a worker
+ * thread runs one workgroup at a time, and dynamic LDS is a per-thread
+ * buffer the host backend sizes from the packet. */
+
+#include "hansa/host/host_abi.h"
+
+#define HANSA_LDS _Thread_local
+#define HANSA_DYNAMIC_LDS(type) ((type *)hansa_host_current->dynamic_lds)
+
+#define __builtin_amdgcn_workitem_id_x() (hansa_host_current->workitem_id[0])
+#define __builtin_amdgcn_workitem_id_y() (hansa_host_current->workitem_id[1])
+#define __builtin_amdgcn_workitem_id_z() (hansa_host_current->workitem_id[2])
+
+#define __builtin_amdgcn_workgroup_id_x() (hansa_host_current->workgroup_id[0])
+#define __builtin_amdgcn_workgroup_id_y() (hansa_host_current->workgroup_id[1])
+#define __builtin_amdgcn_workgroup_id_z() (hansa_host_current->workgroup_id[2])
+
+#define __builtin_amdgcn_workgroup_size_x() \
+  (hansa_host_current->workgroup_size[0])
+#define __builtin_amdgcn_workgroup_size_y() \
+  (hansa_host_current->workgroup_size[1])
+#define __builtin_amdgcn_workgroup_size_z() \
+  (hansa_host_current->workgroup_size[2])
+
+#define __builtin_amdgcn_grid_size_x() (hansa_host_current->grid_size[0])
+#define __builtin_amdgcn_grid_size_y() (hansa_host_current->grid_size[1])
+#define __builtin_amdgcn_grid_size_z() (hansa_host_current->grid_size[2])
+
+#define __builtin_amdgcn_s_barrier() hansa_host_barrier()
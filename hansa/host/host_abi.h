@@ -0,0 +1,43 @@
+#pragma once
+
+/* Interface between kernels compiled for the host and the host backend.
+ * Plain C so it can be included from both. */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What the amdgcn builtins return for the work-item being executed. */
+struct hansa_host_item {
+  uint32_t workitem_id[3];
+  uint32_t workgroup_id[3];
+  uint32_t workgroup_size[3];
+  uint32_t grid_size[3];
+  /* The workgroup's dynamic LDS. */
+  void *dynamic_lds;
+};
+
+/* Unpacks a kernarg block and calls the kernel. */
+typedef void (*hansa_host_entry_t)(const void *kernarg);
+
+#ifdef __cplusplus
+extern thread_local const struct hansa_host_item *hansa_host_current;
+#else
+extern _Thread_local const struct hansa_host_item *hansa_host_current;
+#endif
+
+/* Called from generated code at load time for every kernel. */
+void
+hansa_host_register_kernel(const char *symbol, hansa_host_entry_t entry,
+                           int uses_barrier);
+
+/* Suspends the current work-item until every work-item of its workgroup
+ * has reached the barrier. */
+void
+hansa_host_barrier(void);
+
+#ifdef __cplusplus
+}
+#endif
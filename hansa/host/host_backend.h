@@ -0,0 +1,256 @@
+#pragma once
+
+#include <ucontext.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hansa/host/host_abi.h"
+#include "hansa/host/thread_pool.h"
+#include "hansa/workgroup_profile.h"
+
+// Define HANSA_HOST_IMPLEMENTATION in exactly one translation unit, like
+// the stb headers, to emit the C entry points the host kernels link to.
+
+namespace hansa {
+
+/// A kernels/ function compiled for the host and registered at load time.
+struct HostKernel {
+  hansa_host_entry_t entry;
+  bool uses_barrier;
+};
+
+inline std::map<std::string, HostKernel> &
+host_kernels() {
+  static std::map<std::string, HostKernel> kernels;
+  return kernels;
+}
+
+/// Runs the work-items of one workgroup as fibers on the calling thread so
+/// that __builtin_amdgcn_s_barrier can suspend a work-item until the rest
+/// of the group catches up. Each pass of the scheduler resumes every live
+/// fiber once, which runs it up to its next barrier or to completion.
+///
+/// ucontext only bootstraps a fiber onto its stack; switches at barriers
+/// use __builtin_setjmp/__builtin_longjmp, which unlike swapcontext do not
+/// make a signal-mask syscall.
+class WorkgroupFibers {
+ public:
+  static constexpr size_t kStackSize = 64 * 1024;
+
+  void
+  run(hansa_host_entry_t entry, const void *kernarg,
+      const hansa_host_item &group, const std::array<uint32_t, 3> &extent) {
+    const size_t count = size_t(extent[0]) * extent[1] * extent[2];
+    while (fibers_.size() < count) fibers_.push_back(std::make_unique<Fiber>());
+
+    for (size_t i = 0; i < count; ++i) {
+      Fiber &f = *fibers_[i];
+      f.item = group;
+      f.item.workitem_id[0] = i % extent[0];
+      f.item.workitem_id[1] = (i / extent[0]) % extent[1];
+      f.item.workitem_id[2] = i / (size_t(extent[0]) * extent[1]);
+      f.entry = entry;
+      f.kernarg = kernarg;
+      f.started = false;
+      f.done = false;
+    }
+
+    WorkgroupFibers *outer = current_group();
+    current_group() = this;
+    for (size_t live = count; live > 0;) {
+      for (size_t i = 0; i < count; ++i) {
+        Fiber &f = *fibers_[i];
+        if (f.done) continue;
+        current_ = &f;
+        hansa_host_current = &f.item;
+        resume(f);
+        if (f.done) --live;
+      }
+    }
+    current_ = nullptr;
+    current_group() = outer;
+  }
+
+  /// Suspends the running fiber; returns when the scheduler resumes it.
+  void
+  barrier() {
+    if (current_ && __builtin_setjmp(current_->jump) == 0) {
+      jump(scheduler_jump_);
+    }
+  }
+
+  static WorkgroupFibers *&
+  current_group() {
+    thread_local WorkgroupFibers *group = nullptr;
+    return group;
+  }
+
+ private:
+  // ucontext_t points into itself, so fibers are never moved.
+  struct Fiber {
+    Fiber() : stack(new char[kStackSize]) { getcontext(&context); }
+    ucontext_t context;
+    void *jump[5];
+    hansa_host_item item;
+    hansa_host_entry_t entry;
+    const void *kernarg;
+    bool started;
+    bool done;
+    std::unique_ptr<char[]> stack;
+  };
+
+  void
+  resume(Fiber &f) {
+    if (__builtin_setjmp(scheduler_jump_) != 0) return;
+    if (f.started) jump(f.jump);
+    f.started = true;
+    f.context.uc_stack.ss_sp = f.stack.get();
+    f.context.uc_stack.ss_size = kStackSize;
+    f.context.uc_link = nullptr;
+    makecontext(&f.context, trampoline, 0);
+    setcontext(&f.context);
+  }
+
+  // __builtin_longjmp may not share a function with its __builtin_setjmp.
+  [[gnu::noinline]]
+  static void
+  jump(void **target) {
+    __builtin_longjmp(target, 1);
+  }
+
+  static void
+  trampoline() {
+    WorkgroupFibers *group = current_group();
+    Fiber *f = group->current_;
+    f->entry(f->kernarg);
+    f->done = true;
+    jump(group->scheduler_jump_);
+  }
+
+  std::vector<std::unique_ptr<Fiber>> fibers_;
+  void *scheduler_jump_[5];
+  Fiber *current_ = nullptr;
+};
+
+/// Executes kernels/ on the host: workgroups are spread over a
+/// work-stealing thread pool and the work-items of a workgroup run on the
+/// worker that owns it, as fibers when the kernel uses barriers.
+class HostBackend {
+ public:
+  explicit HostBackend(unsigned threads = 0) : pool_(threads) {}
+
+  [[nodiscard]]
+  const HostKernel *
+  find(const std::string &symbol) const {
+    auto it = host_kernels().find(symbol);
+    return it == host_kernels().end() ? nullptr : &it->second;
+  }
+
+  [[nodiscard]]
+  unsigned
+  thread_count() const {
+    return pool_.size();
+  }
+
+  ThreadPool &
+  pool() {
+    return pool_;
+  }
+
+  /// grid is in work-items, as in the AQL packet. The last workgroup of a
+  /// dimension is partial when the grid is not a multiple of the workgroup.
+  /// Each workgroup gets lds_bytes of dynamic LDS from its worker thread.
+  /// With profile, every workgroup's record gets its start and end in
+  /// steady_clock nanoseconds and its worker as hw_id.
+  void
+  launch(const HostKernel &kernel, const void *kernarg,
+         const std::array<uint32_t, 3> &grid,
+         const std::array<uint32_t, 3> &workgroup, uint32_t lds_bytes = 0,
+         WorkgroupRecord *profile = nullptr) {
+    std::array<uint32_t, 3> groups;
+    for (int d = 0; d < 3; ++d) {
+      groups[d] = (grid[d] + workgroup[d] - 1) / workgroup[d];
+    }
+    const size_t total = size_t(groups[0]) * groups[1] * groups[2];
+
+    pool_.parallel_for(total, [&](size_t g) {
+      thread_local std::vector<uint64_t> lds;
+      if (lds.size() * sizeof(uint64_t) < lds_bytes) {
+        lds.resize((lds_bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+      }
+      hansa_host_item item;
+      item.dynamic_lds = lds.data();
+      item.workgroup_id[0] = g % groups[0];
+      item.workgroup_id[1] = (g / groups[0]) % groups[1];
+      item.workgroup_id[2] = g / (size_t(groups[0]) * groups[1]);
+      std::array<uint32_t, 3> extent;
+      for (int d = 0; d < 3; ++d) {
+        item.workgroup_size[d] = workgroup[d];
+        item.grid_size[d] = grid[d];
+        extent[d] = std::min(workgroup[d],
+                             grid[d] - item.workgroup_id[d] * workgroup[d]);
+      }
+
+      const uint64_t start = profile ? clock_ns() : 0;
+      if (kernel.uses_barrier) {
+        thread_local WorkgroupFibers fibers;
+        fibers.run(kernel.entry, kernarg, item, extent);
+      } else {
+        hansa_host_current = &item;
+        for (uint32_t z = 0; z < extent[2]; ++z) {
+          item.workitem_id[2] = z;
+          for (uint32_t y = 0; y < extent[1]; ++y) {
+            item.workitem_id[1] = y;
+            for (uint32_t x = 0; x < extent[0]; ++x) {
+              item.workitem_id[0] = x;
+              kernel.entry(kernarg);
+            }
+          }
+        }
+      }
+      if (profile) {
+        profile[g] = {start, clock_ns(), ThreadPool::worker_index(), 1};
+      }
+    });
+  }
+
+ private:
+  static uint64_t
+  clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  ThreadPool pool_;
+};
+
+}  // namespace hansa
+
+#ifdef HANSA_HOST_IMPLEMENTATION
+
+extern "C" {
+
+thread_local const hansa_host_item *hansa_host_current = nullptr;
+
+void
+hansa_host_register_kernel(const char *symbol, hansa_host_entry_t entry,
+                           int uses_barrier) {
+  hansa::host_kernels()[symbol] = {entry, uses_barrier != 0};
+}
+
+void
+hansa_host_barrier(void) {
+  if (auto group = hansa::WorkgroupFibers::current_group()) group->barrier();
+}
+}
+
+#endif  // HANSA_HOST_IMPLEMENTATION
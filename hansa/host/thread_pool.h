@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hansa {
+
+/// Work-stealing pool for data-parallel loops.
+///
+/// parallel_for splits the index space into one contiguous range per
+/// worker; the calling thread is worker 0. A worker takes indices from the
+/// front of its own range and, once that is empty, steals the back half of
+/// another worker's range. Ranges are packed (begin, end) pairs updated by
+/// compare-and-swap, so owner and thieves never take a lock.
+///
+/// Calls from inside a running loop execute serially on the calling
+/// worker instead of deadlocking.
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned threads = 0)
+      : ranges_(nullptr), fn_(nullptr), generation_(0), running_(0),
+        stop_(false) {
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_ = threads;
+    ranges_.reset(new Range[size_]);
+    for (unsigned w = 1; w < size_; ++w) {
+      workers_.emplace_back([this, w] { worker_loop(w); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &
+  operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread &worker : workers_) worker.join();
+  }
+
+  [[nodiscard]]
+  unsigned
+  size() const {
+    return size_;
+  }
+
+  /// The worker running the calling thread's current parallel_for
+  /// iteration; 0 outside one.
+  static unsigned
+  worker_index() {
+    return tls_worker();
+  }
+
+  /// Calls fn(i) for every i in [0, count) and returns once all are done.
+  void
+  parallel_for(size_t count, const std::function<void(size_t)> &fn) {
+    if (count == 0) return;
+    if (tls_pool() == this || size_ == 1) {
+      for (size_t i = 0; i < count; ++i) fn(i);
+      return;
+    }
+
+    std::lock_guard<std::mutex> job(job_mutex_);
+    for (unsigned w = 0; w < size_; ++w) {
+      ranges_[w].value.store(
+          pack(count * w / size_, count * (w + 1) / size_),
+          std::memory_order_relaxed);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      running_ = size_ - 1;
+      ++generation_;
+    }
+    start_cv_.notify_all();
+
+    tls_pool() = this;
+    run(0);
+    tls_pool() = nullptr;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return running_ == 0; });
+    fn_ = nullptr;
+  }
+
+ private:
+  struct alignas(64) Range {
+    std::atomic<uint64_t> value{0};
+  };
+
+  static uint64_t
+  pack(uint64_t begin, uint64_t end) {
+    return begin | (end << 32);
+  }
+
+  static ThreadPool *&
+  tls_pool() {
+    thread_local ThreadPool *pool = nullptr;
+    return pool;
+  }
+
+  static unsigned &
+  tls_worker() {
+    thread_local unsigned worker = 0;
+    return worker;
+  }
+
+  void
+  worker_loop(unsigned w) {
+    tls_pool() = this;
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if (stop_) return;
+        seen = generation_;
+      }
+      run(w);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--running_ == 0) done_cv_.notify_one();
+      }
+    }
+  }
+
+  void
+  run(unsigned w) {
+    size_t i;
+    tls_worker() = w;
+    while (take(w, &i) || steal(w, &i)) (*fn_)(i);
+  }
+
+  bool
+  take(unsigned w, size_t *index) {
+    std::atomic<uint64_t> &range = ranges_[w].value;
+    uint64_t cur = range.load(std::memory_order_acquire);
+    for (;;) {
+      const uint32_t begin = cur, end = cur >> 32;
+      if (begin >= end) return false;
+      if (range.compare_exchange_weak(cur, pack(begin + 1, end),
+                                      std::memory_order_acq_rel)) {
+        *index = begin;
+        return true;
+      }
+    }
+  }
+
+  bool
+  steal(unsigned w, size_t *index) {
+    for (unsigned k = 1; k < size_; ++k) {
+      std::atomic<uint64_t> &victim = ranges_[(w + k) % size_].value;
+      uint64_t cur = victim.load(std::memory_order_acquire);
+      for (;;) {
+        const uint32_t begin = cur, end = cur >> 32;
+        if (begin >= end) break;
+        const uint32_t mid = end - (end - begin + 1) / 2;
+        if (victim.compare_exchange_weak(cur, pack(begin, mid),
+                                         std::memory_order_acq_rel)) {
+          ranges_[w].value.store(pack(mid + 1, end),
+                                 std::memory_order_release);
+          *index = mid;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  unsigned size_;
+  std::unique_ptr<Range[]> ranges_;
+  std::vector<std::thread> workers_;
+
+  std::mutex job_mutex_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(size_t)> *fn_;
+  uint64_t generation_;
+  unsigned running_;
+  bool stop_;
+};
+
+}  // namespace hansa
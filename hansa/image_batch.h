@@ -0,0 +1,464 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hansa/engine.h"
+#include "hansa/image_cache.h"
+#include "hansa/image_filter.h"
+#include "hansa/image_writer.h"
+#include "hansa/pipeline.h"
+#include "third_party/stb_image.h"
+
+namespace hansa {
+
+enum class ImageOp { kGrayscale, kBlur, kGrayscaleBlur };
+
+struct BatchOptions {
+  ImageOp op = ImageOp::kGrayscale;
+  /// For kBlur and kGrayscaleBlur. kBlur at radius 1 runs the 3x3
+  /// image_blur kernels and otherwise the LDS-tiled separable one;
+  /// kGrayscaleBlur always runs both steps as one fused dispatch.
+  int blur_radius = 1;
+  std::string output_dir = ".";
+  /// 0 picks half the hardware threads for each pool.
+  unsigned decoders = 0;
+  unsigned encoders = 0;
+  /// Dispatches in flight on the device, each with its own input and
+  /// output buffers; 2 double-buffers uploads against compute.
+  unsigned in_flight = 2;
+  /// Capacity of the queues between stages.
+  size_t queue_capacity = 4;
+  /// When set, images are mapped from an ImageCache in this directory,
+  /// decoded only on first use, and run through the planar kernels.
+  std::string image_cache;
+  /// Encoders already run in parallel across images, so each writes its
+  /// images on one thread.
+  ImageFormat format = ImageFormat::kPng;
+};
+
+struct BatchReport {
+  /// Images written.
+  size_t images = 0;
+  /// Images that failed to decode, process or encode, or were dropped when
+  /// the device stage failed.
+  size_t failed = 0;
+  double wall_ms = 0;
+  std::vector<StageStats> stages;
+  std::vector<QueueStats> queues;
+
+  [[nodiscard]]
+  double
+  images_per_s() const {
+    return wall_ms > 0 ? images * 1000.0 / wall_ms : 0;
+  }
+};
+
+/// Expands directories to the .jpg, .jpeg and .png files in them, sorted.
+inline std::vector<std::string>
+collect_images(const std::vector<std::string> &inputs) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> paths;
+  for (const std::string &input : inputs) {
+    std::error_code ec;
+    if (!fs::is_directory(input, ec)) {
+      paths.push_back(input);
+      continue;
+    }
+    std::vector<std::string> found;
+    for (const fs::directory_entry &entry : fs::directory_iterator(input)) {
+      std::string ext = entry.path().extension().string();
+      std::transform(ext.begin(), ext.end(), ext.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (entry.is_regular_file() &&
+          (ext == ".jpg" || ext == ".jpeg" || ext == ".png")) {
+        found.push_back(entry.path().string());
+      }
+    }
+    std::sort(found.begin(), found.end());
+    paths.insert(paths.end(), found.begin(), found.end());
+  }
+  return paths;
+}
+
+/// Streams images through decode -> upload and dispatch -> encode.
+///
+/// A pool of decoder threads feeds the device stage, which runs on the
+/// calling thread since the engine is single-threaded. It cycles through
+/// in_flight buffer slots: an image is uploaded into a slot while the
+/// dispatches in the other slots run, and a slot's result is only read
+/// back when the slot comes round again. A pool of encoder threads writes
+/// PNGs. Bounded queues between the stages apply backpressure, so the
+/// pipeline settles at the rate of its slowest stage.
+class ImageBatch {
+ public:
+  ImageBatch(Engine &engine, BatchOptions options)
+      : engine_(engine), options_(std::move(options)) {
+    const unsigned half =
+        std::max(1u, std::thread::hardware_concurrency() / 2);
+    if (options_.decoders == 0) options_.decoders = half;
+    if (options_.encoders == 0) options_.encoders = half;
+    options_.in_flight = std::max(1u, options_.in_flight);
+    options_.queue_capacity = std::max<size_t>(1, options_.queue_capacity);
+    if (!options_.image_cache.empty()) {
+      cache_ = std::make_unique<ImageCache>(options_.image_cache);
+    }
+  }
+
+  int
+  run(const std::vector<std::string> &paths, BatchReport *report) {
+    if (separable() && 0 != separable_blur(false).check(engine_.limits())) {
+      return -1;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    BoundedQueue<size_t> pending("pending", paths.size() + 1);
+    BoundedQueue<Decoded> decoded("decoded", options_.queue_capacity);
+    BoundedQueue<Encode> encode("encode", options_.queue_capacity);
+    StageMeter decode_meter("decode", options_.decoders);
+    StageMeter device_meter("upload+dispatch", 1);
+    StageMeter encode_meter("encode", options_.encoders);
+    std::atomic<size_t> written{0};
+    std::atomic<unsigned> decoding{options_.decoders};
+
+    for (size_t i = 0; i < paths.size(); ++i) pending.push(i);
+    pending.close();
+
+    std::vector<std::thread> decoders;
+    for (unsigned t = 0; t < options_.decoders; ++t) {
+      decoders.emplace_back([&] {
+        size_t index;
+        while (pending.pop(&index)) {
+          Decoded image =
+              decode_meter.measure([&] { return decode(paths[index]); });
+          if (!image.data()) continue;
+          image.index = index;
+          if (!decoded.push(std::move(image))) break;
+        }
+        // The last decoder out ends the device stage's input.
+        if (--decoding == 0) decoded.close();
+      });
+    }
+
+    std::vector<std::thread> encoders;
+    for (unsigned t = 0; t < options_.encoders; ++t) {
+      encoders.emplace_back([&] {
+        ImageWriter writer(1);
+        Encode job;
+        while (encode.pop(&job)) {
+          const bool ok = encode_meter.measure([&] {
+            if (job.planar && job.channels > 1) {
+              std::vector<unsigned char> planar = std::move(job.pixels);
+              job.pixels.resize(planar.size());
+              interleave(job.pixels.data(), planar.data(),
+                         size_t(job.width) * job.height, job.channels);
+            }
+            const std::string out = output_path(paths[job.index]);
+            return 0 == writer.write(out, options_.format, job.pixels.data(),
+                                     job.width, job.height, job.channels);
+          });
+          if (ok) ++written;
+        }
+      });
+    }
+
+    const int status = run_device_stage(&decoded, &encode, &device_meter);
+    // On failure, unblock the decoders; their remaining images are dropped.
+    decoded.close();
+    for (std::thread &t : decoders) t.join();
+    encode.close();
+    for (std::thread &t : encoders) t.join();
+
+    report->images = written;
+    report->failed = paths.size() - written;
+    report->wall_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    report->stages = {decode_meter.stats(), device_meter.stats(),
+                      encode_meter.stats()};
+    report->queues = {decoded.stats(), encode.stats()};
+    return status;
+  }
+
+ private:
+  /// Interleaved RGB from stb_image, or planar RGB mapped from the cache.
+  struct Decoded {
+    size_t index = 0;
+    std::unique_ptr<unsigned char, void (*)(void *)> pixels{nullptr,
+                                                            stbi_image_free};
+    MappedImage mapped;
+    int width = 0;
+    int height = 0;
+
+    [[nodiscard]]
+    const unsigned char *
+    data() const {
+      return mapped.is_open() ? mapped.pixels() : pixels.get();
+    }
+
+    [[nodiscard]]
+    bool
+    planar() const {
+      return mapped.is_open();
+    }
+  };
+
+  struct Encode {
+    size_t index = 0;
+    std::vector<unsigned char> pixels;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    bool planar = false;
+  };
+
+  /// One in-flight dispatch and the buffers it owns.
+  struct Slot {
+    std::optional<DeviceBuffer<unsigned char>> input;
+    std::optional<DeviceBuffer<unsigned char>> output;
+    Engine::DispatchHandle handle;
+    size_t index = 0;
+    int width = 0;
+    int height = 0;
+    bool planar = false;
+    bool busy = false;
+  };
+
+  [[nodiscard]]
+  int
+  out_channels() const {
+    return options_.op == ImageOp::kBlur ? 3 : 1;
+  }
+
+  /// Whether the op runs kernels/043-image-blur-separable.c.
+  [[nodiscard]]
+  bool
+  separable() const {
+    return options_.op == ImageOp::kGrayscaleBlur ||
+           (options_.op == ImageOp::kBlur && options_.blur_radius != 1);
+  }
+
+  [[nodiscard]]
+  SeparableBlur
+  separable_blur(bool planar) const {
+    SeparableBlur blur;
+    blur.fused_grayscale = options_.op == ImageOp::kGrayscaleBlur;
+    blur.radius = options_.blur_radius;
+    blur.planar = planar;
+    return blur;
+  }
+
+  std::string
+  output_path(const std::string &input) const {
+    const char *suffix = options_.op == ImageOp::kGrayscale ? "_grayscale"
+                         : options_.op == ImageOp::kBlur
+                             ? "_blurred"
+                             : "_grayscale_blurred";
+    const std::filesystem::path stem = std::filesystem::path(input).stem();
+    return (std::filesystem::path(options_.output_dir) / stem).string() +
+           suffix + image_extension(options_.format);
+  }
+
+  Decoded
+  decode(const std::string &path) const {
+    Decoded image;
+    if (cache_) {
+      if (0 == cache_->load(path, &image.mapped)) {
+        image.width = image.mapped.width();
+        image.height = image.mapped.height();
+      }
+      return image;
+    }
+    HANSA_TRACE_SPAN("decode image");
+    image.pixels.reset(
+        stbi_load(path.c_str(), &image.width, &image.height, nullptr, 3));
+    if (!image.pixels) {
+      std::cerr << "ERROR: Failed to load image " << path << std::endl;
+    }
+    return image;
+  }
+
+  int
+  run_device_stage(BoundedQueue<Decoded> *decoded,
+                   BoundedQueue<Encode> *encode, StageMeter *meter) {
+    std::vector<Slot> slots(options_.in_flight);
+    size_t next = 0;
+    Decoded image;
+    while (decoded->pop(&image)) {
+      Slot &slot = slots[next];
+      next = (next + 1) % slots.size();
+      const int status = meter->measure([&] {
+        if (0 != retire(&slot, encode)) return -1;
+        return dispatch(&slot, image);
+      });
+      if (status != 0) return abandon(&slots);
+    }
+    // Retire the remaining dispatches, oldest first.
+    for (size_t i = 0; i < slots.size(); ++i) {
+      Slot &slot = slots[(next + i) % slots.size()];
+      if (0 != retire(&slot, encode)) return abandon(&slots);
+    }
+    return 0;
+  }
+
+  /// Waits out the dispatches still in flight, whose results are dropped,
+  /// so their buffers are not freed while kernels write them. Returns -1.
+  int
+  abandon(std::vector<Slot> *slots) {
+    for (Slot &slot : *slots) {
+      if (slot.busy) engine_.wait(slot.handle);
+      slot.busy = false;
+    }
+    return -1;
+  }
+
+  /// Uploads image into the slot's buffers and dispatches the kernel.
+  int
+  dispatch(Slot *slot, const Decoded &image) {
+    const size_t pixels = size_t(image.width) * image.height;
+    // The caching allocator makes resizing slots for each image cheap.
+    if (!slot->input || slot->input->count() != pixels * 3) {
+      slot->input.reset();
+      slot->input.emplace(engine_, pixels * 3);
+      slot->output.reset();
+      slot->output.emplace(engine_, pixels * out_channels());
+    }
+    if (!slot->input->data() || !slot->output->data()) {
+      std::cerr << "ERROR: Failed to allocate batch buffers" << std::endl;
+      return -1;
+    }
+    if (0 != slot->input->copy_from(image.data())) return -1;
+    if (0 != (separable() ? enqueue_separable(slot, image)
+                          : enqueue_basic(slot, image))) {
+      return -1;
+    }
+    if (0 != engine_.submit()) return -1;
+    slot->index = image.index;
+    slot->width = image.width;
+    slot->height = image.height;
+    slot->planar = image.planar();
+    slot->busy = true;
+    return 0;
+  }
+
+  /// color_to_grayscale or the 3x3 image_blur.
+  int
+  enqueue_basic(Slot *slot, const Decoded &image) {
+    const size_t pixels = size_t(image.width) * image.height;
+    struct args_t {
+      unsigned char *img_out;
+      unsigned char *img_in;
+      int width;
+      int height;
+    };
+    const args_t args{slot->output->data(), slot->input->data(), image.width,
+                      image.height};
+    // The planar blur takes the channel in z.
+    const std::string suffix = image.planar() ? "_planar.kd" : ".kd";
+    const Engine::KernelDispatchConfig cfg =
+        options_.op == ImageOp::kGrayscale
+            ? Engine::KernelDispatchConfig(
+                  "libkernels.so", "color_to_grayscale" + suffix,
+                  {int(pixels), 1, 1}, {64, 1, 1}, sizeof(args_t))
+            : Engine::KernelDispatchConfig(
+                  "libkernels.so",
+                  image.planar() ? "image_blur_planar.kd" : "image_blur_rgb.kd",
+                  {image.width, image.height, image.planar() ? 3 : 1},
+                  {16, 16, 1}, sizeof(args_t));
+    return engine_.enqueue(&cfg, args, &slot->handle);
+  }
+
+  int
+  enqueue_separable(Slot *slot, const Decoded &image) {
+    const SeparableBlur blur = separable_blur(image.planar());
+    struct args_t {
+      unsigned char *img_out;
+      unsigned char *img_in;
+      int width;
+      int height;
+      int radius;
+      int planar;
+    };
+    const args_t args{slot->output->data(), slot->input->data(), image.width,
+                      image.height, blur.radius, int(blur.planar)};
+    const Engine::KernelDispatchConfig cfg =
+        blur.dispatch_config(image.width, image.height);
+    return engine_.enqueue(&cfg, args, &slot->handle);
+  }
+
+  /// Waits for the slot's dispatch, if any, and queues its result for
+  /// encoding.
+  int
+  retire(Slot *slot, BoundedQueue<Encode> *encode) {
+    if (!slot->busy) return 0;
+    slot->busy = false;
+    if (0 != engine_.wait(slot->handle)) {
+      std::cerr << "ERROR: Dispatch failed" << std::endl;
+      return -1;
+    }
+    Encode job;
+    job.index = slot->index;
+    job.width = slot->width;
+    job.height = slot->height;
+    job.channels = out_channels();
+    job.planar = slot->planar;
+    job.pixels.resize(slot->output->count());
+    if (0 != slot->output->copy_to(job.pixels.data())) return -1;
+    encode->push(std::move(job));
+    return 0;
+  }
+
+  Engine &engine_;
+  BatchOptions options_;
+  std::unique_ptr<ImageCache> cache_;
+};
+
+inline void
+print_batch_report(const BatchReport &report) {
+  std::cout << std::fixed << std::setprecision(3) << report.images
+            << " images in " << report.wall_ms << " ms, "
+            << report.images_per_s() << " images/s";
+  if (report.failed) std::cout << " (" << report.failed << " failed)";
+  std::cout << "\n"
+            << std::left << std::setw(18) << "stage" << std::right
+            << std::setw(8) << "workers" << std::setw(8) << "items"
+            << std::setw(12) << "busy ms" << std::setw(14) << "capacity/s"
+            << std::endl;
+  const StageStats *slowest = nullptr;
+  for (const StageStats &stage : report.stages) {
+    std::cout << std::left << std::setw(18) << stage.name << std::right
+              << std::setw(8) << stage.workers << std::setw(8) << stage.items
+              << std::setw(12) << stage.busy_ms << std::setw(14)
+              << stage.capacity_per_s() << std::endl;
+    if (stage.items &&
+        (!slowest || stage.capacity_per_s() < slowest->capacity_per_s())) {
+      slowest = &stage;
+    }
+  }
+  std::cout << std::left << std::setw(18) << "queue" << std::right
+            << std::setw(8) << "cap" << std::setw(8) << "max"
+            << std::setw(12) << "mean depth" << std::setw(14) << "blocked ms"
+            << std::setw(14) << "starved ms" << std::endl;
+  for (const QueueStats &queue : report.queues) {
+    std::cout << std::left << std::setw(18) << queue.name << std::right
+              << std::setw(8) << queue.capacity << std::setw(8)
+              << queue.max_depth << std::setw(12) << queue.mean_depth
+              << std::setw(14) << queue.push_wait_ms << std::setw(14)
+              << queue.pop_wait_ms << std::endl;
+  }
+  if (slowest) {
+    std::cout << "Slowest stage: " << slowest->name << " at "
+              << slowest->capacity_per_s() << " images/s" << std::endl;
+  }
+}
+
+}  // namespace hansa
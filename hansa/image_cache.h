@@ -0,0 +1,307 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hansa/atomic_file.h"
+#include "hansa/trace.h"
+#include "third_party/stb_image.h"
+
+namespace hansa {
+
+/// The first 64 bytes of an image cache file. The pixels follow at
+/// data_offset, page aligned, as one width x height plane per channel.
+struct ImageCacheHeader {
+  static constexpr char kMagic[8] = {'H', 'A', 'N', 'S', 'A', 'I', 'M', 'G'};
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint64_t kDataOffset = 4096;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t channels;
+  /// What the entry was decoded from; a mismatch makes it stale.
+  uint64_t source_size;
+  int64_t source_mtime_ns;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t reserved;
+};
+static_assert(sizeof(ImageCacheHeader) == 64);
+
+/// Splits interleaved pixels into one plane per channel.
+inline void
+deinterleave(uint8_t *planar, const uint8_t *interleaved, size_t pixels,
+             int channels) {
+  for (int c = 0; c < channels; ++c) {
+    uint8_t *plane = planar + c * pixels;
+    for (size_t i = 0; i < pixels; ++i) {
+      plane[i] = interleaved[i * channels + c];
+    }
+  }
+}
+
+inline void
+interleave(uint8_t *interleaved, const uint8_t *planar, size_t pixels,
+           int channels) {
+  for (int c = 0; c < channels; ++c) {
+    const uint8_t *plane = planar + c * pixels;
+    for (size_t i = 0; i < pixels; ++i) {
+      interleaved[i * channels + c] = plane[i];
+    }
+  }
+}
+
+/// An image cache file mapped into memory. The mapping is private and
+/// writable, so the pixels can be pinned for zero-copy access, but
+/// writes never reach the file.
+class MappedImage {
+ public:
+  MappedImage() = default;
+  MappedImage(const MappedImage &) = delete;
+  MappedImage &
+  operator=(const MappedImage &) = delete;
+  MappedImage(MappedImage &&other) noexcept { *this = std::move(other); }
+  MappedImage &
+  operator=(MappedImage &&other) noexcept {
+    if (this != &other) {
+      reset();
+      std::swap(map_, other.map_);
+      std::swap(map_size_, other.map_size_);
+    }
+    return *this;
+  }
+  ~MappedImage() { reset(); }
+
+  /// Maps path and checks its header.
+  int
+  open(const std::string &path) {
+    reset();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ImageCacheHeader)) {
+      ::close(fd);
+      return -1;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return -1;
+    map_ = map;
+    map_size_ = st.st_size;
+
+    const ImageCacheHeader &h = header();
+    if (std::memcmp(h.magic, ImageCacheHeader::kMagic, sizeof(h.magic)) !=
+            0 ||
+        h.version != ImageCacheHeader::kVersion ||
+        h.data_size != size_t(h.width) * h.height * h.channels ||
+        h.data_offset + h.data_size > map_size_) {
+      reset();
+      return -1;
+    }
+    return 0;
+  }
+
+  void
+  reset() {
+    if (map_) munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+  }
+
+  [[nodiscard]]
+  bool
+  is_open() const {
+    return map_ != nullptr;
+  }
+
+  [[nodiscard]]
+  const ImageCacheHeader &
+  header() const {
+    return *static_cast<const ImageCacheHeader *>(map_);
+  }
+
+  [[nodiscard]]
+  int
+  width() const {
+    return header().width;
+  }
+
+  [[nodiscard]]
+  int
+  height() const {
+    return header().height;
+  }
+
+  [[nodiscard]]
+  int
+  channels() const {
+    return header().channels;
+  }
+
+  /// Every plane, back to back.
+  [[nodiscard]]
+  unsigned char *
+  pixels() const {
+    return static_cast<unsigned char *>(map_) + header().data_offset;
+  }
+
+  [[nodiscard]]
+  size_t
+  bytes() const {
+    return header().data_size;
+  }
+
+  [[nodiscard]]
+  const unsigned char *
+  plane(int channel) const {
+    return pixels() + size_t(channel) * width() * height();
+  }
+
+ private:
+  void *map_ = nullptr;
+  size_t map_size_ = 0;
+};
+
+/// Decoded images kept on disk as planar RGB, so a dataset is decoded
+/// once and every later run maps it instead. An entry is keyed by its
+/// source's path and goes stale when the source's size or modification
+/// time changes.
+class ImageCache {
+ public:
+  explicit ImageCache(std::string dir) : dir_(std::move(dir)) {}
+
+  /// $HANSA_IMAGE_CACHE, else images under $XDG_CACHE_HOME/hansa or
+  /// ~/.cache/hansa.
+  static std::string
+  default_dir() {
+    if (const char *dir = std::getenv("HANSA_IMAGE_CACHE")) return dir;
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME")) {
+      return std::string(xdg) + "/hansa/images";
+    }
+    const char *home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/hansa/images";
+  }
+
+  /// <stem>-<hash of the absolute source path>.hic in the cache directory.
+  [[nodiscard]]
+  std::string
+  path_for(const std::string &source) const {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path absolute = fs::absolute(source, ec);
+    std::ostringstream name;
+    name << fs::path(source).stem().string() << "-" << std::hex
+         << std::hash<std::string>{}(absolute.string()) << ".hic";
+    return (fs::path(dir_) / name.str()).string();
+  }
+
+  /// Maps source's entry, first decoding source into it when the entry is
+  /// missing or stale. *hit says whether decode was skipped. Safe to call
+  /// from several threads.
+  int
+  load(const std::string &source, MappedImage *image, bool *hit = nullptr) {
+    HANSA_TRACE_SPAN("load image");
+    ImageCacheHeader stamp{};
+    if (0 != source_stamp(source, &stamp)) {
+      std::cerr << "ERROR: Failed to stat image " << source << std::endl;
+      return -1;
+    }
+    const std::string path = path_for(source);
+    if (0 == image->open(path) &&
+        image->header().source_size == stamp.source_size &&
+        image->header().source_mtime_ns == stamp.source_mtime_ns) {
+      if (hit) *hit = true;
+      return 0;
+    }
+    if (hit) *hit = false;
+
+    HANSA_TRACE_SPAN("decode image");
+    int width, height;
+    std::unique_ptr<unsigned char, void (*)(void *)> pixels(
+        stbi_load(source.c_str(), &width, &height, nullptr, 3),
+        stbi_image_free);
+    if (!pixels) {
+      std::cerr << "ERROR: Failed to load image " << source << std::endl;
+      return -1;
+    }
+    if (0 != write(path, stamp, pixels.get(), width, height, 3)) return -1;
+    if (0 != image->open(path)) {
+      std::cerr << "ERROR: Failed to map image cache entry " << path
+                << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  [[nodiscard]]
+  const std::string &
+  dir() const {
+    return dir_;
+  }
+
+ private:
+  static int
+  source_stamp(const std::string &source, ImageCacheHeader *stamp) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    stamp->source_size = fs::file_size(source, ec);
+    if (ec) return -1;
+    const fs::file_time_type mtime = fs::last_write_time(source, ec);
+    if (ec) return -1;
+    stamp->source_mtime_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            mtime.time_since_epoch())
+            .count();
+    return 0;
+  }
+
+  /// Writes the entry to a file of this thread's own and renames it into
+  /// place, so readers only ever map whole entries.
+  static int
+  write(const std::string &path, ImageCacheHeader header,
+        const uint8_t *interleaved, int width, int height, int channels) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+
+    std::memcpy(header.magic, ImageCacheHeader::kMagic, sizeof(header.magic));
+    header.version = ImageCacheHeader::kVersion;
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.data_offset = ImageCacheHeader::kDataOffset;
+    header.data_size = size_t(width) * height * channels;
+
+    std::vector<uint8_t> data(header.data_offset + header.data_size);
+    std::memcpy(data.data(), &header, sizeof(header));
+    deinterleave(data.data() + header.data_offset, interleaved,
+                 size_t(width) * height, channels);
+
+    return write_file_atomically(
+        path, std::string_view(reinterpret_cast<const char *>(data.data()),
+                               data.size()));
+  }
+
+  std::string dir_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "hansa/engine.h"
+
+namespace hansa {
+
+/// Dispatches of the LDS-tiled blurs in kernels/043-image-blur-separable.c:
+/// image_blur_separable, and grayscale_blur_fused, which converts to gray
+/// on the way into LDS so grayscale and blur take one dispatch.
+struct SeparableBlur {
+  /// Row sums are 16 bits in the kernels.
+  static constexpr int kMaxRadius = 128;
+
+  bool fused_grayscale = false;
+  int radius = 1;
+  bool planar = false;
+  std::array<int, 3> workgroup{16, 16, 1};
+
+  /// Input channels; the fused kernel writes one.
+  [[nodiscard]]
+  int
+  channels() const {
+    return fused_grayscale ? 1 : 3;
+  }
+
+  /// The halo tile, padded to 4 bytes, then 16-bit row sums for every
+  /// halo row; must match the kernels' layout.
+  [[nodiscard]]
+  uint32_t
+  lds_bytes() const {
+    const uint32_t halo_w = workgroup[0] + 2 * radius;
+    const uint32_t halo_h = workgroup[1] + 2 * radius;
+    const uint32_t tile = (halo_w * halo_h * channels() + 3) & ~3u;
+    return tile + workgroup[0] * halo_h * channels() * sizeof(uint16_t);
+  }
+
+  /// Whole workgroups over a width x height image.
+  [[nodiscard]]
+  Engine::KernelDispatchConfig
+  dispatch_config(int width, int height) const {
+    Engine::KernelDispatchConfig cfg(
+        "libkernels.so",
+        fused_grayscale ? "grayscale_blur_fused.kd" : "image_blur_separable.kd",
+        {(width + workgroup[0] - 1) / workgroup[0] * workgroup[0],
+         (height + workgroup[1] - 1) / workgroup[1] * workgroup[1], 1},
+        workgroup);
+    cfg.dynamic_lds_size = lds_bytes();
+    return cfg;
+  }
+
+  /// 0 when the radius is in range and the tile fits the agent's LDS.
+  [[nodiscard]]
+  int
+  check(const AgentLimits &limits) const {
+    if (radius < 0 || radius > kMaxRadius) {
+      std::cerr << "ERROR: Blur radius " << radius << " is outside 0.."
+                << kMaxRadius << std::endl;
+      return -1;
+    }
+    if (lds_bytes() > limits.lds_per_cu) {
+      std::cerr << "ERROR: Blur radius " << radius << " needs " << lds_bytes()
+                << " bytes of LDS, more than the " << limits.lds_per_cu
+                << " a " << limits.isa << " workgroup can have" << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+};
+
+}  // namespace hansa
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hansa/host/thread_pool.h"
+#include "hansa/trace.h"
+
+namespace hansa {
+
+enum class ImageFormat {
+  /// Filtered and deflated in parallel row bands.
+  kPng,
+  /// Unfiltered rows in stored deflate blocks: a valid PNG written at
+  /// memcpy speed, several times larger than kPng.
+  kPngStored,
+  /// The QOI format: one fast serial pass with a fair ratio, for
+  /// intermediate outputs.
+  kQoi,
+};
+
+/// png, png-stored or qoi.
+inline bool
+parse_image_format(const std::string &name, ImageFormat *format) {
+  if (name == "png") {
+    *format = ImageFormat::kPng;
+  } else if (name == "png-stored") {
+    *format = ImageFormat::kPngStored;
+  } else if (name == "qoi") {
+    *format = ImageFormat::kQoi;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/// The file extension, with its dot.
+inline const char *
+image_extension(ImageFormat format) {
+  return format == ImageFormat::kQoi ? ".qoi" : ".png";
+}
+
+struct ImageWriteStats {
+  /// Bytes of pixels in and of file out.
+  size_t raw_bytes = 0;
+  size_t file_bytes = 0;
+  double ms = 0;
+  /// Row bands deflated independently; 1 for serial writes.
+  size_t bands = 1;
+
+  [[nodiscard]]
+  double
+  mb_per_s() const {
+    return ms > 0 ? raw_bytes / (ms * 1000.0) : 0;
+  }
+};
+
+namespace detail {
+
+inline void
+put_be32(std::vector<uint8_t> *out, uint32_t v) {
+  out->push_back(v >> 24);
+  out->push_back(v >> 16);
+  out->push_back(v >> 8);
+  out->push_back(v);
+}
+
+inline uint8_t
+paeth(int a, int b, int c) {
+  const int p = a + b - c;
+  const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  return pb <= pc ? b : c;
+}
+
+/// Writes one line of a PNG scanline stream: a filter byte, then the
+/// filtered row. Tries all five filters and keeps the one with the
+/// smallest sum of absolute values, as libpng does; filter 0 only when
+/// !choose. Each filter is its own loop so the compiler vectorizes it.
+inline void
+filter_row(uint8_t *out, const uint8_t *row, const uint8_t *prior,
+           size_t row_bytes, int bpp, bool choose) {
+  if (!choose) {
+    out[0] = 0;
+    std::memcpy(out + 1, row, row_bytes);
+    return;
+  }
+  static thread_local std::vector<uint8_t> zeros;
+  if (!prior) {
+    zeros.assign(row_bytes, 0);
+    prior = zeros.data();
+  }
+  static thread_local std::vector<uint8_t> scratch;
+  scratch.resize(5 * row_bytes);
+  uint8_t *f[5];
+  for (int k = 0; k < 5; ++k) f[k] = scratch.data() + k * row_bytes;
+  const size_t lead = std::min<size_t>(bpp, row_bytes);
+  for (size_t i = 0; i < row_bytes; ++i) {
+    f[0][i] = row[i];
+    f[2][i] = row[i] - prior[i];
+  }
+  for (size_t i = 0; i < lead; ++i) {
+    f[1][i] = row[i];
+    f[3][i] = row[i] - (prior[i] >> 1);
+    f[4][i] = row[i] - prior[i];
+  }
+  for (size_t i = lead; i < row_bytes; ++i) {
+    f[1][i] = row[i] - row[i - bpp];
+    f[3][i] = row[i] - ((row[i - bpp] + prior[i]) >> 1);
+  }
+  for (size_t i = lead; i < row_bytes; ++i) {
+    f[4][i] = row[i] - paeth(row[i - bpp], prior[i], prior[i - bpp]);
+  }
+
+  uint64_t best_sum = UINT64_MAX;
+  int best = 0;
+  for (int k = 0; k < 5; ++k) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < row_bytes; ++i) {
+      sum += std::abs(int(int8_t(f[k][i])));
+    }
+    if (sum < best_sum) {
+      best_sum = sum;
+      best = k;
+    }
+  }
+  out[0] = best;
+  std::memcpy(out + 1, f[best], row_bytes);
+}
+
+/// A compressed row band and its part of the final zlib stream's checksum.
+struct PngBand {
+  std::vector<uint8_t> deflated;
+  uLong adler = 1;
+  size_t length = 0;
+  int status = Z_OK;
+};
+
+/// Raw deflate of one band. Every band but the last ends in a sync flush,
+/// which closes it on a byte boundary with a non-final block, so the bands
+/// concatenate into a single deflate stream. Each band is primed with the
+/// 32 KiB before it, so matches still reach across band edges.
+inline void
+deflate_band(PngBand *band, const uint8_t *stream, size_t begin, size_t end,
+             int level, bool last) {
+  z_stream z{};
+  band->status =
+      deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  if (band->status != Z_OK) return;
+  const size_t window = std::min<size_t>(begin, 32768);
+  if (window > 0 && level > 0) {
+    deflateSetDictionary(&z, stream + begin - window, window);
+  }
+  band->length = end - begin;
+  band->adler = adler32(1, stream + begin, band->length);
+  band->deflated.resize(deflateBound(&z, band->length) + 16);
+  z.next_in = const_cast<Bytef *>(stream + begin);
+  z.avail_in = band->length;
+  z.next_out = band->deflated.data();
+  z.avail_out = band->deflated.size();
+  band->status = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (band->status == (last ? Z_STREAM_END : Z_OK)) band->status = Z_OK;
+  band->deflated.resize(z.total_out);
+  deflateEnd(&z);
+}
+
+inline void
+put_chunk(std::FILE *file, const char type[4], const uint8_t *data,
+          size_t size) {
+  std::vector<uint8_t> head;
+  put_be32(&head, size);
+  head.insert(head.end(), type, type + 4);
+  uLong crc = crc32(0, reinterpret_cast<const Bytef *>(type), 4);
+  if (size > 0) crc = crc32(crc, data, size);
+  std::vector<uint8_t> tail;
+  put_be32(&tail, crc);
+  std::fwrite(head.data(), 1, head.size(), file);
+  if (size > 0) std::fwrite(data, 1, size, file);
+  std::fwrite(tail.data(), 1, tail.size(), file);
+}
+
+}  // namespace detail
+
+/// Writes kernel outputs, compressing PNGs on a pool of its own.
+///
+/// A PNG is filtered row by row in parallel, then cut into bands of whole
+/// rows that are deflated in parallel and stitched into one zlib stream:
+/// the zlib header, every band's deflate data, and the Adler-32 of the
+/// whole image combined from the bands'. Any PNG decoder reads the result.
+class ImageWriter {
+ public:
+  /// 0 threads uses every hardware thread; 1 writes serially.
+  explicit ImageWriter(unsigned threads = 0, int level = 6)
+      : pool_(threads), level_(level) {}
+
+  /// Filtered bytes per band; large enough that a band's dictionary
+  /// priming and flush cost little next to the band.
+  static constexpr size_t kBandBytes = 256 * 1024;
+
+  /// Writes width x height pixels of channels bytes each, stride bytes
+  /// apart, to path. Fills *stats when given.
+  int
+  write(const std::string &path, ImageFormat format, const uint8_t *pixels,
+        int width, int height, int channels, size_t stride = 0,
+        ImageWriteStats *stats = nullptr) {
+    if (stride == 0) stride = size_t(width) * channels;
+    HANSA_TRACE_SPAN_ARG("write image", "pixels", size_t(width) * height);
+    const auto start = std::chrono::steady_clock::now();
+    ImageWriteStats s;
+    s.raw_bytes = size_t(width) * height * channels;
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(
+        std::fopen(path.c_str(), "wb"), std::fclose);
+    if (!file) {
+      std::cerr << "ERROR: Failed to open " << path << std::endl;
+      return -1;
+    }
+    const int status =
+        format == ImageFormat::kQoi
+            ? write_qoi(file.get(), pixels, width, height, channels, stride)
+            : write_png(file.get(), format == ImageFormat::kPng ? level_ : 0,
+                        pixels, width, height, channels, stride, &s.bands);
+    s.file_bytes = std::ftell(file.get());
+    if (status != 0 || std::ferror(file.get()) ||
+        std::fclose(file.release()) != 0) {
+      std::cerr << "ERROR: Failed to write " << path << std::endl;
+      return -1;
+    }
+    s.ms = std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+               .count();
+    if (stats) *stats = s;
+    return 0;
+  }
+
+  [[nodiscard]]
+  unsigned
+  threads() const {
+    return pool_.size();
+  }
+
+ private:
+  /// Level 0 skips filtering, so each row is copied straight into stored
+  /// blocks.
+  int
+  write_png(std::FILE *file, int level, const uint8_t *pixels, int width,
+            int height, int channels, size_t stride, size_t *bands) {
+    static const uint8_t kColorType[] = {0, 0, 4, 2, 6};
+    if (channels < 1 || channels > 4) return -1;
+    const size_t row_bytes = size_t(width) * channels;
+    const size_t line = row_bytes + 1;
+
+    std::vector<uint8_t> stream(line * height);
+    const size_t rows_per_task = std::max<size_t>(1, 16384 / line);
+    const size_t tasks = (height + rows_per_task - 1) / rows_per_task;
+    pool_.parallel_for(tasks, [&](size_t t) {
+      HANSA_TRACE_SPAN("filter rows");
+      const size_t end = std::min<size_t>(height, (t + 1) * rows_per_task);
+      for (size_t y = t * rows_per_task; y < end; ++y) {
+        detail::filter_row(stream.data() + y * line, pixels + y * stride,
+                           y ? pixels + (y - 1) * stride : nullptr, row_bytes,
+                           channels, level > 0);
+      }
+    });
+
+    const size_t rows_per_band =
+        std::max<size_t>(1, std::min(kBandBytes, stream.size() /
+                                                     std::max(1u, threads())) /
+                                line);
+    const size_t count = std::max<size_t>(
+        1, (height + rows_per_band - 1) / rows_per_band);
+    std::vector<detail::PngBand> parts(count);
+    pool_.parallel_for(count, [&](size_t b) {
+      const size_t begin = b * rows_per_band * line;
+      const size_t end = std::min(stream.size(), begin + rows_per_band * line);
+      HANSA_TRACE_SPAN_ARG("deflate band", "bytes", end - begin);
+      detail::deflate_band(&parts[b], stream.data(), begin, end, level,
+                           b + 1 == count);
+    });
+    *bands = count;
+
+    std::vector<uint8_t> head;
+    detail::put_be32(&head, width);
+    detail::put_be32(&head, height);
+    head.insert(head.end(), {8, kColorType[channels], 0, 0, 0});
+    static const uint8_t kSignature[] = {0x89, 'P',  'N', 'G',
+                                         '\r', '\n', 0x1a, '\n'};
+    std::fwrite(kSignature, 1, sizeof(kSignature), file);
+    detail::put_chunk(file, "IHDR", head.data(), head.size());
+
+    // One IDAT per band; the zlib header leads the first, the Adler-32
+    // trails the last.
+    const int flevel = level == 0 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+    uint8_t cmf_flg[2] = {0x78, uint8_t(flevel << 6)};
+    cmf_flg[1] += 31 - (cmf_flg[0] * 256 + cmf_flg[1]) % 31;
+    uLong adler = 1;
+    for (size_t b = 0; b < count; ++b) {
+      detail::PngBand &band = parts[b];
+      if (band.status != Z_OK) {
+        std::cerr << "ERROR: deflate failed with " << band.status
+                  << std::endl;
+        return -1;
+      }
+      adler = adler32_combine(adler, band.adler, band.length);
+      if (b == 0) {
+        band.deflated.insert(band.deflated.begin(), cmf_flg, cmf_flg + 2);
+      }
+      if (b + 1 == count) detail::put_be32(&band.deflated, adler);
+      detail::put_chunk(file, "IDAT", band.deflated.data(),
+                        band.deflated.size());
+    }
+    detail::put_chunk(file, "IEND", nullptr, 0);
+    return 0;
+  }
+
+  /// https://qoiformat.org/qoi-specification.pdf. Gray and gray-alpha
+  /// pixels are written as RGB and RGBA.
+  static int
+  write_qoi(std::FILE *file, const uint8_t *pixels, int width, int height,
+            int channels, size_t stride) {
+    if (channels < 1 || channels > 4) return -1;
+    const int out_channels = channels % 2 == 0 ? 4 : 3;
+    std::vector<uint8_t> out = {'q', 'o', 'i', 'f'};
+    detail::put_be32(&out, width);
+    detail::put_be32(&out, height);
+    out.push_back(out_channels);
+    out.push_back(0);  // sRGB with linear alpha
+    out.reserve(out.size() + size_t(width) * height * (out_channels + 1) + 8);
+
+    std::array<std::array<uint8_t, 4>, 64> seen{};
+    std::array<uint8_t, 4> prev = {0, 0, 0, 255};
+    int run = 0;
+    for (int y = 0; y < height; ++y) {
+      const uint8_t *row = pixels + y * stride;
+      for (int x = 0; x < width; ++x) {
+        const uint8_t *p = row + size_t(x) * channels;
+        std::array<uint8_t, 4> px;
+        if (channels < 3) {
+          px = {p[0], p[0], p[0], uint8_t(channels == 2 ? p[1] : 255)};
+        } else {
+          px = {p[0], p[1], p[2], uint8_t(channels == 4 ? p[3] : 255)};
+        }
+        if (px == prev) {
+          if (++run == 62) {
+            out.push_back(0xc0 | (run - 1));
+            run = 0;
+          }
+          continue;
+        }
+        if (run > 0) {
+          out.push_back(0xc0 | (run - 1));
+          run = 0;
+        }
+        const int hash =
+            (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if (seen[hash] == px) {
+          out.push_back(hash);
+        } else {
+          seen[hash] = px;
+          if (px[3] == prev[3]) {
+            const int8_t dr = px[0] - prev[0];
+            const int8_t dg = px[1] - prev[1];
+            const int8_t db = px[2] - prev[2];
+            const int8_t dr_dg = dr - dg, db_dg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+                db <= 1) {
+              out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                       db_dg >= -8 && db_dg <= 7) {
+              out.push_back(0x80 | (dg + 32));
+              out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+            } else {
+              out.insert(out.end(), {0xfe, px[0], px[1], px[2]});
+            }
+          } else {
+            out.insert(out.end(), {0xff, px[0], px[1], px[2], px[3]});
+          }
+        }
+        prev = px;
+      }
+    }
+    if (run > 0) out.push_back(0xc0 | (run - 1));
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    return std::fwrite(out.data(), 1, out.size(), file) == out.size() ? 0
+                                                                      : -1;
+  }
+
+  ThreadPool pool_;
+  int level_;
+};
+
+}  // namespace hansa
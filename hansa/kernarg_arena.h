@@ -0,0 +1,125 @@
+#pragma once
+
+#include <hsa/hsa.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "hansa/common.h"
+
+namespace hansa {
+
+/// A fixed block of kernarg memory carved once from the kernarg region and
+/// sliced into equally sized slots.
+///
+/// Slot i serves every packet whose index is i modulo the slot count. A slot
+/// remembers the completion signal of the packet that last used it and is
+/// only handed out again once that signal has dropped below 1, so the
+/// previous kernel is guaranteed to be done reading its arguments.
+///
+/// Producers on several threads may acquire and release slots at once, as
+/// long as each acquires for a packet index within slot_count() of the
+/// queue's read index; see Engine::post().
+class KernargArena {
+ public:
+  /// Kernarg segments must be 16-byte aligned; a cache line keeps
+  /// neighbouring slots from sharing lines while the host writes them.
+  static constexpr size_t kSlotAlignment = 64;
+  /// ImplicitArg is a block of 64-bit fields following the explicit args.
+  static constexpr size_t kImplicitArgAlignment = 8;
+
+  KernargArena() : base_(nullptr), slot_size_(0), slot_mask_(0) {}
+  KernargArena(const KernargArena &) = delete;
+  KernargArena &
+  operator=(const KernargArena &) = delete;
+
+  ~KernargArena() { reset(); }
+
+  /// slot_count must be a power of two.
+  int
+  init(hsa_region_t region, uint32_t slot_count, size_t slot_size) {
+    if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0) {
+      std::cerr << "ERROR: kernarg slot count must be a power of two"
+                << std::endl;
+      return -1;
+    }
+    slot_size_ = align_up(slot_size, kSlotAlignment);
+    slot_mask_ = slot_count - 1;
+
+    hsa_status_t status =
+        hsa_memory_allocate(region, slot_size_ * slot_count, &base_);
+    HSA_ENFORCE("hsa_memory_allocate(kernarg arena)", status);
+
+    slots_.assign(slot_count, Slot{});
+    return 0;
+  }
+
+  /// Returns the slot for packet_index, first waiting for the packet that
+  /// previously owned it to complete. The slot is then owned by
+  /// completion_signal until the next packet that maps onto it.
+  void *
+  acquire(uint64_t packet_index, hsa_signal_t completion_signal) {
+    const uint64_t i = packet_index & slot_mask_;
+    Slot &slot = slots_[i];
+    uint64_t owner = __atomic_load_n(&slot.signal.handle, __ATOMIC_ACQUIRE);
+    do {
+      if (owner != 0) {
+        hsa_signal_wait_acquire(hsa_signal_t{owner}, HSA_SIGNAL_CONDITION_LT,
+                                1, UINT64_MAX, HSA_WAIT_STATE_BLOCKED);
+      }
+      // A waiter releasing the previous owner may clear it meanwhile.
+    } while (!__atomic_compare_exchange_n(
+        &slot.signal.handle, &owner, completion_signal.handle, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return static_cast<uint8_t *>(base_) + i * slot_size_;
+  }
+
+  /// Forgets the owner of a slot whose packet is known to be complete,
+  /// unless a later packet has already taken the slot over.
+  void
+  release(uint64_t packet_index, hsa_signal_t completion_signal) {
+    Slot &slot = slots_[packet_index & slot_mask_];
+    uint64_t owner = completion_signal.handle;
+    __atomic_compare_exchange_n(&slot.signal.handle, &owner, 0, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+  }
+
+  /// Frees the arena; init() may be called again afterwards.
+  void
+  reset() {
+    if (base_) hsa_memory_free(base_);
+    base_ = nullptr;
+    slots_.clear();
+  }
+
+  [[nodiscard]]
+  size_t
+  slot_size() const {
+    return slot_size_;
+  }
+
+  [[nodiscard]]
+  uint32_t
+  slot_count() const {
+    return slot_mask_ + 1;
+  }
+
+  static constexpr size_t
+  align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+ private:
+  struct Slot {
+    hsa_signal_t signal{0};
+  };
+
+  void *base_;
+  size_t slot_size_;
+  uint32_t slot_mask_;
+  std::vector<Slot> slots_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <fcntl.h>
+#include <hsa/hsa.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "hansa/code_object.h"
+#include "hansa/common.h"
+#include "hansa/trace.h"
+
+namespace hansa {
+
+/// Everything a dispatch needs from a resolved kernel symbol.
+struct KernelObject {
+  uint64_t handle = 0;
+  uint32_t group_segment_size = 0;
+  uint32_t private_segment_size = 0;
+  uint32_t kernarg_segment_size = 0;
+  /// From the code object's metadata note; null if it had none.
+  const KernelMetadata *metadata = nullptr;
+  /// The kernel descriptor in the mapped code file; null if not found.
+  const uint8_t *descriptor = nullptr;
+  /// The kernel symbol, Tracer::intern()ed once on resolution so tracing a
+  /// dispatch copies a pointer; null on the host backend.
+  const char *name = nullptr;
+};
+
+/// Caches code objects, frozen executables and resolved kernel symbols.
+///
+/// A code file is mmapped and deserialized once, one executable is created
+/// and frozen per (code file, agent), and each (code file, symbol, agent)
+/// is resolved once. Relaunching a kernel is then a map lookup. The cache
+/// only talks to the HSA C API, so it can be linked against a stub runtime.
+///
+/// A code file name can also be bound to a code object already in memory,
+/// such as one embedded in the executable; it is then loaded from there
+/// with no file I/O.
+class KernelCache {
+ public:
+  KernelCache() = default;
+  KernelCache(const KernelCache &) = delete;
+  KernelCache &
+  operator=(const KernelCache &) = delete;
+
+  ~KernelCache() { clear(); }
+
+  int
+  lookup(const std::string &code_file_name, const std::string &kernel_symbol,
+         hsa_agent_t agent, KernelObject *out) {
+    auto key = std::make_tuple(code_file_name, kernel_symbol, agent.handle);
+    auto it = kernels_.find(key);
+    if (it != kernels_.end()) {
+      *out = it->second;
+      return 0;
+    }
+
+    hsa_executable_t executable;
+    if (0 != get_executable(code_file_name, agent, &executable)) return -1;
+
+    hsa_executable_symbol_t symbol;
+    hsa_status_t status = hsa_executable_get_symbol(
+        executable, nullptr, kernel_symbol.c_str(), agent, 0, &symbol);
+    HSA_ENFORCE("hsa_executable_get_symbol", status);
+
+    KernelObject kernel;
+    const CodeFile &file = files_.at(code_file_name);
+    for (const KernelMetadata &meta : file.kernels) {
+      if (meta.symbol == kernel_symbol) kernel.metadata = &meta;
+    }
+    kernel.descriptor =
+        find_kernel_descriptor(file.data, file.size, kernel_symbol);
+    kernel.name = Tracer::instance().intern(kernel_symbol);
+    status = hsa_executable_symbol_get_info(
+        symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT, &kernel.handle);
+    HSA_ENFORCE("hsa_executable_symbol_get_info", status);
+    status = hsa_executable_symbol_get_info(
+        symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE,
+        &kernel.group_segment_size);
+    HSA_ENFORCE("hsa_executable_symbol_get_info", status);
+    status = hsa_executable_symbol_get_info(
+        symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_PRIVATE_SEGMENT_SIZE,
+        &kernel.private_segment_size);
+    HSA_ENFORCE("hsa_executable_symbol_get_info", status);
+    status = hsa_executable_symbol_get_info(
+        symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE,
+        &kernel.kernarg_segment_size);
+    HSA_ENFORCE("HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE",
+                status);
+    std::cout << "Loaded " << kernel_symbol << " from " << code_file_name
+              << ", kernel arg size: " << kernel.kernarg_segment_size
+              << std::endl;
+
+    kernels_.emplace(std::move(key), kernel);
+    *out = kernel;
+    return 0;
+  }
+
+  /// Serves code_file_name from size bytes at data, which must outlive the
+  /// cache, instead of from the file of that name. Takes effect for code
+  /// files not loaded yet.
+  void
+  add_image(const std::string &code_file_name, const void *data,
+            size_t size) {
+    images_[code_file_name] = {data, size};
+  }
+
+  /// Destroys executables before the code objects they were loaded from,
+  /// then unmaps the code files. Images added with add_image stay bound.
+  void
+  clear() {
+    kernels_.clear();
+    for (auto &[key, executable] : executables_) {
+      hsa_executable_destroy(executable);
+    }
+    executables_.clear();
+    for (auto &[name, file] : files_) {
+      hsa_code_object_destroy(file.code_object);
+      if (file.mapped) munmap(file.data, file.size);
+    }
+    files_.clear();
+  }
+
+ private:
+  struct CodeFile {
+    void *data;
+    size_t size;
+    hsa_code_object_t code_object;
+    std::vector<KernelMetadata> kernels;
+    /// Whether data is an mmap of the file, rather than an added image.
+    bool mapped;
+  };
+
+  struct Image {
+    const void *data;
+    size_t size;
+  };
+
+  int
+  get_code_object(const std::string &code_file_name,
+                  hsa_code_object_t *code_object) {
+    auto it = files_.find(code_file_name);
+    if (it != files_.end()) {
+      *code_object = it->second.code_object;
+      return 0;
+    }
+
+    auto image = images_.find(code_file_name);
+    if (image != images_.end()) {
+      return deserialize(code_file_name,
+                         const_cast<void *>(image->second.data),
+                         image->second.size, false, code_object);
+    }
+
+    int fd = open(code_file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Error: failed to load " << code_file_name << std::endl;
+      return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      std::cerr << "Error: failed to stat " << code_file_name << std::endl;
+      close(fd);
+      return -1;
+    }
+    const size_t size = st.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      std::cerr << "Error: failed to mmap " << code_file_name << std::endl;
+      return -1;
+    }
+    return deserialize(code_file_name, data, size, true, code_object);
+  }
+
+  int
+  deserialize(const std::string &code_file_name, void *data, size_t size,
+              bool mapped, hsa_code_object_t *code_object) {
+    hsa_code_object_t co;
+    hsa_status_t status = hsa_code_object_deserialize(data, size, nullptr, &co);
+    if (status != HSA_STATUS_SUCCESS && mapped) munmap(data, size);
+    HSA_ENFORCE("hsa_code_object_deserialize", status);
+
+    CodeFile file{data, size, co, {}, mapped};
+    if (0 != parse_code_object_metadata(data, size, &file.kernels)) {
+      std::cerr << "Warning: no kernel metadata in " << code_file_name
+                << ", kernel args are not checked" << std::endl;
+    }
+    files_.emplace(code_file_name, std::move(file));
+    *code_object = co;
+    return 0;
+  }
+
+  int
+  get_executable(const std::string &code_file_name, hsa_agent_t agent,
+                 hsa_executable_t *executable) {
+    auto key = std::make_pair(code_file_name, agent.handle);
+    auto it = executables_.find(key);
+    if (it != executables_.end()) {
+      *executable = it->second;
+      return 0;
+    }
+
+    HANSA_TRACE_SPAN("load code object");
+    hsa_code_object_t code_object;
+    if (0 != get_code_object(code_file_name, &code_object)) return -1;
+
+    hsa_executable_t exe;
+    hsa_status_t status = hsa_executable_create(
+        HSA_PROFILE_FULL, HSA_EXECUTABLE_STATE_UNFROZEN, nullptr, &exe);
+    HSA_ENFORCE("hsa_executable_create", status);
+
+    status = hsa_executable_load_code_object(exe, agent, code_object, nullptr);
+    if (status == HSA_STATUS_SUCCESS) {
+      status = hsa_executable_freeze(exe, nullptr);
+    }
+    if (status != HSA_STATUS_SUCCESS) hsa_executable_destroy(exe);
+    HSA_ENFORCE("hsa_executable_load_code_object/freeze", status);
+
+    executables_.emplace(std::move(key), exe);
+    *executable = exe;
+    return 0;
+  }
+
+  std::map<std::string, CodeFile> files_;
+  std::map<std::string, Image> images_;
+  std::map<std::pair<std::string, uint64_t>, hsa_executable_t> executables_;
+  std::map<std::tuple<std::string, std::string, uint64_t>, KernelObject>
+      kernels_;
+};
+
+}  // namespace hansa
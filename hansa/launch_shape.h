@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace hansa {
+
+/// How a dispatch covers its problem.
+enum class LaunchMode {
+  /// One work-item per problem element.
+  kExact,
+  /// Only as many workgroups as the device holds at once; the kernel loops
+  /// over the problem with a grid stride (see kernels/001-vector-add.c).
+  /// Spares the launch of every further workgroup and the tail of
+  /// partially filled CUs on large problems.
+  kPersistent,
+};
+
+/// The grid of a dispatch, in work-items as in the AQL packet, and what the
+/// hidden kernel args derive from it. The last workgroup of a dimension is
+/// partial when the grid is not a multiple of the workgroup; it has
+/// remainder(d) work-items, and a full workgroup's when remainder(d) is 0.
+struct LaunchShape {
+  std::array<uint32_t, 3> grid{1, 1, 1};
+  std::array<uint32_t, 3> workgroup{1, 1, 1};
+  /// 1 + the highest dimension with more than one work-item.
+  uint16_t dims = 1;
+
+  /// One work-item per element of problem.
+  static LaunchShape
+  exact(const std::array<int, 3> &problem,
+        const std::array<int, 3> &workgroup) {
+    LaunchShape shape;
+    for (int d = 0; d < 3; ++d) {
+      shape.grid[d] = uint32_t(std::max(problem[d], 1));
+      shape.workgroup[d] = uint32_t(std::max(workgroup[d], 1));
+      if (shape.grid[d] > 1) shape.dims = d + 1;
+    }
+    return shape;
+  }
+
+  /// At most max_workgroups whole workgroups, for kernels that stride over
+  /// problem. Workgroups are kept along x first, then y, then z, so a row
+  /// of the problem is covered by as few strides as possible.
+  static LaunchShape
+  persistent(const std::array<int, 3> &problem,
+             const std::array<int, 3> &workgroup, uint64_t max_workgroups) {
+    LaunchShape shape = exact(problem, workgroup);
+    uint64_t budget = std::max<uint64_t>(max_workgroups, 1);
+    for (int d = 0; d < 3; ++d) {
+      const uint64_t blocks = std::min<uint64_t>(shape.block_count(d), budget);
+      budget /= blocks;
+      // A clipped dimension gets whole workgroups; the stride covers the
+      // rest.
+      if (blocks < shape.block_count(d)) {
+        shape.grid[d] = uint32_t(blocks * shape.workgroup[d]);
+      }
+    }
+    return shape;
+  }
+
+  [[nodiscard]]
+  uint32_t
+  block_count(int d) const {
+    return (grid[d] + workgroup[d] - 1) / workgroup[d];
+  }
+
+  [[nodiscard]]
+  uint32_t
+  remainder(int d) const {
+    return grid[d] % workgroup[d];
+  }
+
+  [[nodiscard]]
+  uint64_t
+  workgroups() const {
+    return uint64_t(block_count(0)) * block_count(1) * block_count(2);
+  }
+};
+
+}  // namespace hansa
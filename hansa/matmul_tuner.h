@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hansa/atomic_file.h"
+#include "hansa/engine.h"
+
+// The variants CMake built from kernels/templates/matrix-multiply-tiled.c.in;
+// see MATMUL_TILED_VARIANTS in CMakeLists.txt, which is the only list.
+#ifndef HANSA_MATMUL_VARIANTS
+#error "HANSA_MATMUL_VARIANTS must be defined by the build; see CMakeLists.txt"
+#endif
+
+namespace hansa {
+
+/// One launchable configuration of tiled matmul: a variant, plus the tile
+/// size for variants that take it at launch time from dynamic LDS.
+struct MatmulConfig {
+  /// e.g. t32_r2, or dyn_r2.
+  std::string variant;
+  int tile = 0;
+  /// Rows of C each work-item accumulates in registers.
+  int rows = 1;
+  bool dynamic_lds = false;
+
+  /// Parses tNN_rR and dyn_rR; tile stays 0 for dyn variants.
+  static bool
+  parse(const std::string &variant, MatmulConfig *out) {
+    MatmulConfig config;
+    config.variant = variant;
+    int consumed = 0;
+    if (std::sscanf(variant.c_str(), "dyn_r%d%n", &config.rows, &consumed) ==
+            1 &&
+        size_t(consumed) == variant.size()) {
+      config.dynamic_lds = true;
+    } else if (std::sscanf(variant.c_str(), "t%d_r%d%n", &config.tile,
+                           &config.rows, &consumed) != 2 ||
+               size_t(consumed) != variant.size()) {
+      return false;
+    }
+    if (config.rows < 1) return false;
+    *out = config;
+    return true;
+  }
+
+  [[nodiscard]]
+  std::string
+  symbol() const {
+    return "matrix_multiply_tiled_" + variant + ".kd";
+  }
+
+  [[nodiscard]]
+  std::array<int, 3>
+  workgroup() const {
+    return {tile, tile / rows, 1};
+  }
+
+  /// The dispatch for C[N][K] = A[N][M] * B[M][K]: whole tiles, each
+  /// tile / rows work-items tall.
+  [[nodiscard]]
+  Engine::KernelDispatchConfig
+  dispatch_config(int N, int K) const {
+    Engine::KernelDispatchConfig cfg(
+        "libkernels.so", symbol(),
+        {(K + tile - 1) / tile * tile, (N + tile - 1) / tile * (tile / rows),
+         1},
+        workgroup());
+    if (dynamic_lds) cfg.dynamic_lds_size = 2 * tile * tile * sizeof(float);
+    return cfg;
+  }
+
+  [[nodiscard]]
+  std::string
+  name() const {
+    return dynamic_lds ? variant + "@" + std::to_string(tile) : variant;
+  }
+};
+
+/// Every configuration worth timing on an agent: each built variant, with
+/// each tile size for the dyn variants, that fits its workgroup and LDS
+/// limits.
+inline std::vector<MatmulConfig>
+matmul_candidates(const AgentLimits &limits) {
+  std::vector<MatmulConfig> candidates;
+  std::stringstream variants(HANSA_MATMUL_VARIANTS);
+  std::string variant;
+  while (std::getline(variants, variant, ',')) {
+    MatmulConfig config;
+    if (!MatmulConfig::parse(variant, &config)) continue;
+    std::vector<int> tiles = {config.tile};
+    if (config.dynamic_lds) tiles = {16, 32, 64};
+    for (int tile : tiles) {
+      config.tile = tile;
+      const uint32_t lanes = uint32_t(tile) * (tile / config.rows);
+      if (tile % config.rows != 0 || lanes > limits.max_workgroup_size ||
+          2 * tile * tile * sizeof(float) > limits.lds_per_cu) {
+        continue;
+      }
+      candidates.push_back(config);
+    }
+  }
+  return candidates;
+}
+
+/// Tuning results that outlive the process, one line per shape bucket:
+///
+///   <op> <isa> <N bucket> <M bucket> <K bucket> <variant> <tile> <ms>
+///
+/// Buckets round each dimension up to a power of two, so nearby shapes
+/// share a result. A later line for the same bucket replaces an earlier
+/// one.
+class TuningCache {
+ public:
+  struct Entry {
+    std::string variant;
+    int tile = 0;
+    double ms = 0;
+  };
+
+  explicit TuningCache(std::string path) : path_(std::move(path)) {}
+
+  /// $HANSA_TUNING_CACHE, else tuning.txt under $XDG_CACHE_HOME/hansa or
+  /// ~/.cache/hansa.
+  static std::string
+  default_path() {
+    if (const char *path = std::getenv("HANSA_TUNING_CACHE")) return path;
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME")) {
+      return std::string(xdg) + "/hansa/tuning.txt";
+    }
+    const char *home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/hansa/tuning.txt";
+  }
+
+  static uint32_t
+  bucket(int size) {
+    uint32_t b = 1;
+    while (b < uint32_t(std::max(size, 1))) b <<= 1;
+    return b;
+  }
+
+  static std::string
+  key(const std::string &op, const std::string &isa, int N, int M, int K) {
+    return op + " " + isa + " " + std::to_string(bucket(N)) + " " +
+           std::to_string(bucket(M)) + " " + std::to_string(bucket(K));
+  }
+
+  /// A missing file is an empty cache; malformed lines are skipped.
+  void
+  load() {
+    std::ifstream in(path_);
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      std::string op, isa;
+      uint32_t n, m, k;
+      Entry entry;
+      if (fields >> op >> isa >> n >> m >> k >> entry.variant >> entry.tile >>
+          entry.ms) {
+        entries_[key(op, isa, n, m, k)] = entry;
+      }
+    }
+  }
+
+  /// Replaces the cache file with the whole cache in one rename, so a
+  /// concurrent reader never sees half a file.
+  int
+  save() const {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path path(path_);
+    if (path.has_parent_path()) fs::create_directories(path.parent_path(), ec);
+    std::ostringstream out;
+    for (const auto &[k, entry] : entries_) {
+      out << k << " " << entry.variant << " " << entry.tile << " " << entry.ms
+          << "\n";
+    }
+    return write_file_atomically(path_, out.str());
+  }
+
+  [[nodiscard]]
+  const Entry *
+  find(const std::string &k) const {
+    auto it = entries_.find(k);
+    return it == entries_.end() ? nullptr : &it->second;
+  }
+
+  void
+  put(const std::string &k, const Entry &entry) {
+    entries_[k] = entry;
+  }
+
+  [[nodiscard]]
+  const std::string &
+  path() const {
+    return path_;
+  }
+
+ private:
+  std::string path_;
+  std::map<std::string, Entry> entries_;
+};
+
+/// Picks the fastest tiled matmul configuration for a shape on the engine's
+/// agent. The choice comes from the tuning cache when the shape's bucket
+/// has been tuned before; otherwise every candidate is timed on the
+/// caller's buffers and the winner is cached.
+class MatmulTuner {
+ public:
+  MatmulTuner(Engine &engine, TuningCache *cache)
+      : engine_(engine), cache_(cache) {}
+
+  /// Timed runs per candidate, after one warm-up run.
+  static constexpr int kRuns = 3;
+
+  /// C, A and B are device buffers of N x K, N x M and M x K floats.
+  /// *cached says whether the choice came from the cache.
+  int
+  select(float *C, const float *A, const float *B, int N, int M, int K,
+         MatmulConfig *out, bool *cached) {
+    const std::string key =
+        TuningCache::key("matmul", engine_.limits().isa, N, M, K);
+    const std::vector<MatmulConfig> candidates =
+        matmul_candidates(engine_.limits());
+    if (const TuningCache::Entry *entry = cache_->find(key)) {
+      for (const MatmulConfig &c : candidates) {
+        if (c.variant == entry->variant && c.tile == entry->tile) {
+          *out = c;
+          *cached = true;
+          return 0;
+        }
+      }
+      // Tuned against variants this build no longer has; tune again.
+    }
+
+    *cached = false;
+    double best_ms = 0;
+    for (const MatmulConfig &c : candidates) {
+      double ms;
+      if (0 != time(c, C, A, B, N, M, K, &ms)) continue;
+      std::cout << "  tune " << std::left << std::setw(12) << c.name()
+                << std::right << std::fixed << std::setprecision(3) << ms
+                << " ms" << std::endl;
+      if (best_ms == 0 || ms < best_ms) {
+        best_ms = ms;
+        *out = c;
+      }
+    }
+    if (best_ms == 0) {
+      std::cerr << "ERROR: No tiled matmul variant ran" << std::endl;
+      return -1;
+    }
+    cache_->put(key, {out->variant, out->tile, best_ms});
+    return cache_->save();
+  }
+
+ private:
+  /// The median of kRuns dispatches of c.
+  int
+  time(const MatmulConfig &c, float *C, const float *A, const float *B,
+       int N, int M, int K, double *ms) {
+    const Engine::KernelDispatchConfig cfg = c.dispatch_config(N, K);
+    PreparedLaunch launch;
+    if (0 != engine_.prepare(cfg, &launch)) return -1;
+    if (0 != launch.bind(C, A, B, N, M, K)) return -1;
+    std::vector<double> runs;
+    for (int r = 0; r <= kRuns; ++r) {
+      const auto start = std::chrono::steady_clock::now();
+      if (0 != engine_.dispatch(&launch) || 0 != engine_.wait(&launch)) {
+        return -1;
+      }
+      if (r == 0) continue;
+      runs.push_back(std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+    }
+    std::sort(runs.begin(), runs.end());
+    *ms = runs[runs.size() / 2];
+    return 0;
+  }
+
+  Engine &engine_;
+  TuningCache *cache_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <hsa/hsa.h>
+#include <hsa/hsa_ext_amd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace hansa {
+
+/// Where a CachingAllocator gets memory when its cache cannot serve a
+/// request, and where it returns memory on trim().
+class BackingPool {
+ public:
+  virtual ~BackingPool() = default;
+
+  /// Returns nullptr on failure.
+  virtual void *
+  allocate(size_t size) = 0;
+
+  virtual void
+  release(void *ptr, size_t size) = 0;
+};
+
+/// An hsa_amd_memory_pool_t. Memory from host pools is made accessible to
+/// the given agents so kernels can read it.
+class AmdMemoryPool : public BackingPool {
+ public:
+  explicit AmdMemoryPool(hsa_amd_memory_pool_t pool,
+                         std::vector<hsa_agent_t> agents = {})
+      : pool_(pool), agents_(std::move(agents)) {}
+
+  void *
+  allocate(size_t size) override {
+    void *ptr = nullptr;
+    hsa_status_t status = hsa_amd_memory_pool_allocate(pool_, size, 0, &ptr);
+    if (status != HSA_STATUS_SUCCESS) {
+      std::cerr << "hsa_amd_memory_pool_allocate failed, " << status
+                << std::endl;
+      return nullptr;
+    }
+    if (!agents_.empty()) {
+      status = hsa_amd_agents_allow_access(agents_.size(), agents_.data(),
+                                           nullptr, ptr);
+      if (status != HSA_STATUS_SUCCESS) {
+        std::cerr << "hsa_amd_agents_allow_access failed, " << status
+                  << std::endl;
+        hsa_amd_memory_pool_free(ptr);
+        return nullptr;
+      }
+    }
+    return ptr;
+  }
+
+  void
+  release(void *ptr, size_t) override {
+    hsa_amd_memory_pool_free(ptr);
+  }
+
+ private:
+  hsa_amd_memory_pool_t pool_;
+  std::vector<hsa_agent_t> agents_;
+};
+
+/// Page-aligned host memory. Stands in for the AMD pools on the host
+/// backend and lets the allocator be exercised without a GPU.
+class HostMemoryPool : public BackingPool {
+ public:
+  static constexpr size_t kAlignment = 4096;
+
+  void *
+  allocate(size_t size) override {
+    ++allocations_;
+    return std::aligned_alloc(kAlignment,
+                              (size + kAlignment - 1) & ~(kAlignment - 1));
+  }
+
+  void
+  release(void *ptr, size_t) override {
+    ++releases_;
+    std::free(ptr);
+  }
+
+  [[nodiscard]]
+  uint64_t
+  allocations() const {
+    return allocations_;
+  }
+
+  [[nodiscard]]
+  uint64_t
+  releases() const {
+    return releases_;
+  }
+
+ private:
+  uint64_t allocations_ = 0;
+  uint64_t releases_ = 0;
+};
+
+class CachingAllocator;
+
+/// Owns one allocation from a CachingAllocator and gives it back to the
+/// cache when destroyed.
+class PoolBuffer {
+ public:
+  PoolBuffer() = default;
+  PoolBuffer(CachingAllocator *allocator, void *ptr, size_t size)
+      : allocator_(allocator), ptr_(ptr), size_(size) {}
+  PoolBuffer(const PoolBuffer &) = delete;
+  PoolBuffer &
+  operator=(const PoolBuffer &) = delete;
+  PoolBuffer(PoolBuffer &&other) noexcept { *this = std::move(other); }
+  PoolBuffer &
+  operator=(PoolBuffer &&other) noexcept {
+    if (this != &other) {
+      reset();
+      std::swap(allocator_, other.allocator_);
+      std::swap(ptr_, other.ptr_);
+      std::swap(size_, other.size_);
+    }
+    return *this;
+  }
+  ~PoolBuffer() { reset(); }
+
+  inline void
+  reset();
+
+  [[nodiscard]]
+  void *
+  get() const {
+    return ptr_;
+  }
+
+  template <typename T>
+  T *
+  as() const {
+    return static_cast<T *>(ptr_);
+  }
+
+  [[nodiscard]]
+  size_t
+  size() const {
+    return size_;
+  }
+
+  explicit
+  operator bool() const {
+    return ptr_ != nullptr;
+  }
+
+ private:
+  CachingAllocator *allocator_ = nullptr;
+  void *ptr_ = nullptr;
+  size_t size_ = 0;
+};
+
+/// Caches memory from a BackingPool by size class so that steady-state
+/// allocation never reaches the driver.
+///
+/// Requests up to kMaxSlabBlock come from slabs: kSlabSize chunks carved
+/// into equal power-of-two blocks, one free list per block size. Requests
+/// up to kArenaSize come from buddy arenas of kArenaSize, split into
+/// power-of-two blocks and coalesced again on free. Anything larger is
+/// rounded up to kHugeGranule and cached whole. Nothing is returned to the
+/// backing pool until trim(), destruction, or a request the backing pool
+/// cannot otherwise serve. Thread-safe.
+class CachingAllocator {
+ public:
+  static constexpr size_t kMinBlock = 256;
+  static constexpr size_t kMaxSlabBlock = 64 * 1024;
+  static constexpr size_t kSlabSize = 1024 * 1024;
+  static constexpr size_t kMinBuddyBlock = 2 * kMaxSlabBlock;
+  static constexpr size_t kArenaSize = 64 * 1024 * 1024;
+  static constexpr size_t kHugeGranule = 2 * 1024 * 1024;
+
+  struct Stats {
+    uint64_t requests = 0;
+    /// Requests served without a backing allocation.
+    uint64_t hits = 0;
+    uint64_t backing_allocations = 0;
+    /// Bytes asked for by live allocations.
+    size_t in_use = 0;
+    size_t peak_in_use = 0;
+    /// Bytes held from the backing pool, cached or live.
+    size_t reserved = 0;
+    size_t peak_reserved = 0;
+
+    [[nodiscard]]
+    double
+    hit_rate() const {
+      return requests ? double(hits) / requests : 0;
+    }
+
+    /// Share of reserved memory not holding live data: rounding to size
+    /// classes plus cached free blocks.
+    [[nodiscard]]
+    double
+    fragmentation() const {
+      return reserved ? 1.0 - double(in_use) / reserved : 0;
+    }
+  };
+
+  explicit CachingAllocator(BackingPool &backing) : backing_(backing) {}
+  CachingAllocator(const CachingAllocator &) = delete;
+  CachingAllocator &
+  operator=(const CachingAllocator &) = delete;
+
+  ~CachingAllocator() {
+    for (auto &[base, slab] : slabs_) backing_.release(slab.base, kSlabSize);
+    for (auto &[base, arena] : arenas_) {
+      backing_.release(arena.base, kArenaSize);
+    }
+    for (auto &[ptr, live] : live_) {
+      if (live.kind == Kind::kHuge) backing_.release(ptr, live.block);
+    }
+    for (auto &[size, ptr] : huge_free_) backing_.release(ptr, size);
+  }
+
+  /// Returns nullptr for a size of 0, and if the backing pool is exhausted
+  /// even once the cache has given back what it holds free.
+  void *
+  allocate(size_t size) {
+    if (size == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.requests;
+    const uint64_t backing_before = stats_.backing_allocations;
+
+    Live live;
+    void *ptr = allocate_block(size, &live);
+    if (!ptr && stats_.reserved > stats_.in_use) {
+      // Free blocks of other sizes may be all the pool is missing.
+      trim_locked();
+      ptr = allocate_block(size, &live);
+    }
+    if (!ptr) return nullptr;
+
+    if (stats_.backing_allocations == backing_before) ++stats_.hits;
+    stats_.in_use += size;
+    stats_.peak_in_use = std::max(stats_.peak_in_use, stats_.in_use);
+    live_[ptr] = live;
+    return ptr;
+  }
+
+  PoolBuffer
+  allocate_buffer(size_t size) {
+    void *ptr = allocate(size);
+    return ptr ? PoolBuffer(this, ptr, size) : PoolBuffer();
+  }
+
+  void
+  free(void *ptr) {
+    if (!ptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = live_.find(ptr);
+    if (it == live_.end()) {
+      std::cerr << "ERROR: freeing memory the allocator does not own"
+                << std::endl;
+      return;
+    }
+    const Live live = it->second;
+    live_.erase(it);
+    stats_.in_use -= live.size;
+
+    switch (live.kind) {
+      case Kind::kSlab: {
+        Slab &slab = slab_of(ptr);
+        --slab.used;
+        slab_free_[class_index(live.block)].push_back(ptr);
+        break;
+      }
+      case Kind::kBuddy:
+        free_buddy_block(ptr, live.block);
+        break;
+      case Kind::kHuge:
+        huge_free_.emplace(live.block, ptr);
+        break;
+    }
+  }
+
+  /// Returns every completely free slab, arena and cached large block to
+  /// the backing pool.
+  void
+  trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trim_locked();
+  }
+
+  [[nodiscard]]
+  Stats
+  stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  /// Restarts the peaks from what is in use and reserved now, so they
+  /// measure what comes next.
+  void
+  reset_peak() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.peak_in_use = stats_.in_use;
+    stats_.peak_reserved = stats_.reserved;
+  }
+
+ private:
+  enum class Kind { kSlab, kBuddy, kHuge };
+
+  struct Live {
+    Kind kind;
+    size_t block;
+    size_t size;
+  };
+
+  struct Slab {
+    void *base;
+    size_t block;
+    uint32_t used;
+  };
+
+  static constexpr size_t kSlabClasses = 9;  // 256 B .. 64 KiB
+  static constexpr size_t kBuddyOrders = 10;  // 128 KiB .. 64 MiB
+
+  struct Arena {
+    void *base;
+    /// Free block offsets, one set per order.
+    std::array<std::set<size_t>, kBuddyOrders> free;
+  };
+
+  /// Takes a block for size from its size class, filling *live in.
+  void *
+  allocate_block(size_t size, Live *live) {
+    *live = Live{Kind::kSlab, 0, size};
+    if (size <= kMaxSlabBlock) {
+      live->block = round_up_pow2(std::max(size, kMinBlock));
+      return allocate_slab_block(live->block);
+    }
+    if (size <= kArenaSize) {
+      live->kind = Kind::kBuddy;
+      live->block = round_up_pow2(std::max(size, kMinBuddyBlock));
+      return allocate_buddy_block(live->block);
+    }
+    live->kind = Kind::kHuge;
+    live->block = (size + kHugeGranule - 1) / kHugeGranule * kHugeGranule;
+    return allocate_huge(&live->block);
+  }
+
+  void
+  trim_locked() {
+    for (auto it = slabs_.begin(); it != slabs_.end();) {
+      Slab &slab = it->second;
+      if (slab.used != 0) {
+        ++it;
+        continue;
+      }
+      auto &list = slab_free_[class_index(slab.block)];
+      const uintptr_t base = it->first;
+      list.erase(std::remove_if(list.begin(), list.end(),
+                                [&](void *p) {
+                                  const uintptr_t a =
+                                      reinterpret_cast<uintptr_t>(p);
+                                  return a >= base && a < base + kSlabSize;
+                                }),
+                 list.end());
+      release_backing(slab.base, kSlabSize);
+      it = slabs_.erase(it);
+    }
+    for (auto it = arenas_.begin(); it != arenas_.end();) {
+      if (it->second.free.back().count(0)) {
+        release_backing(it->second.base, kArenaSize);
+        it = arenas_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (auto &[size, ptr] : huge_free_) release_backing(ptr, size);
+    huge_free_.clear();
+  }
+
+  static size_t
+  round_up_pow2(size_t size) {
+    size_t p = 1;
+    while (p < size) p <<= 1;
+    return p;
+  }
+
+  static size_t
+  log2(size_t pow2) {
+    return __builtin_ctzll(pow2);
+  }
+
+  static size_t
+  class_index(size_t block) {
+    return log2(block) - log2(kMinBlock);
+  }
+
+  static size_t
+  order_of(size_t block) {
+    return log2(block) - log2(kMinBuddyBlock);
+  }
+
+  void *
+  allocate_backing(size_t size) {
+    void *ptr = backing_.allocate(size);
+    if (!ptr) return nullptr;
+    ++stats_.backing_allocations;
+    stats_.reserved += size;
+    stats_.peak_reserved = std::max(stats_.peak_reserved, stats_.reserved);
+    return ptr;
+  }
+
+  void
+  release_backing(void *ptr, size_t size) {
+    backing_.release(ptr, size);
+    stats_.reserved -= size;
+  }
+
+  Slab &
+  slab_of(void *ptr) {
+    auto it = slabs_.upper_bound(reinterpret_cast<uintptr_t>(ptr));
+    return std::prev(it)->second;
+  }
+
+  void *
+  allocate_slab_block(size_t block) {
+    auto &list = slab_free_[class_index(block)];
+    if (list.empty()) {
+      void *base = allocate_backing(kSlabSize);
+      if (!base) return nullptr;
+      slabs_[reinterpret_cast<uintptr_t>(base)] = Slab{base, block, 0};
+      // Hand out from the front of the slab first.
+      for (size_t offset = kSlabSize; offset >= block; offset -= block) {
+        list.push_back(static_cast<uint8_t *>(base) + offset - block);
+      }
+    }
+    void *ptr = list.back();
+    list.pop_back();
+    ++slab_of(ptr).used;
+    return ptr;
+  }
+
+  void *
+  allocate_buddy_block(size_t block) {
+    const size_t order = order_of(block);
+    for (size_t k = order; k < kBuddyOrders; ++k) {
+      for (auto &[base, arena] : arenas_) {
+        if (arena.free[k].empty()) continue;
+        return split(arena, k, order);
+      }
+    }
+    void *base = allocate_backing(kArenaSize);
+    if (!base) return nullptr;
+    Arena &arena = arenas_[reinterpret_cast<uintptr_t>(base)];
+    arena.base = base;
+    arena.free[kBuddyOrders - 1].insert(0);
+    return split(arena, kBuddyOrders - 1, order);
+  }
+
+  /// Takes a free block of order k and splits it down to order, freeing the
+  /// upper halves.
+  void *
+  split(Arena &arena, size_t k, size_t order) {
+    const size_t offset = *arena.free[k].begin();
+    arena.free[k].erase(arena.free[k].begin());
+    for (; k > order; --k) {
+      arena.free[k - 1].insert(offset + (kMinBuddyBlock << (k - 1)));
+    }
+    return static_cast<uint8_t *>(arena.base) + offset;
+  }
+
+  void
+  free_buddy_block(void *ptr, size_t block) {
+    auto it = std::prev(arenas_.upper_bound(reinterpret_cast<uintptr_t>(ptr)));
+    Arena &arena = it->second;
+    size_t offset = static_cast<uint8_t *>(ptr) -
+                    static_cast<uint8_t *>(arena.base);
+    for (size_t k = order_of(block); k + 1 < kBuddyOrders; ++k) {
+      const size_t buddy = offset ^ (kMinBuddyBlock << k);
+      auto found = arena.free[k].find(buddy);
+      if (found == arena.free[k].end()) {
+        arena.free[k].insert(offset);
+        return;
+      }
+      arena.free[k].erase(found);
+      offset = std::min(offset, buddy);
+    }
+    arena.free[kBuddyOrders - 1].insert(offset);
+  }
+
+  /// Reuses a cached block at most a quarter larger than *size, else
+  /// allocates. *size is updated to the block size.
+  void *
+  allocate_huge(size_t *size) {
+    auto it = huge_free_.lower_bound(*size);
+    if (it != huge_free_.end() && it->first <= *size + *size / 4) {
+      void *ptr = it->second;
+      *size = it->first;
+      huge_free_.erase(it);
+      return ptr;
+    }
+    return allocate_backing(*size);
+  }
+
+  BackingPool &backing_;
+  mutable std::mutex mutex_;
+  Stats stats_;
+
+  std::unordered_map<void *, Live> live_;
+  std::map<uintptr_t, Slab> slabs_;
+  std::array<std::vector<void *>, kSlabClasses> slab_free_;
+  std::map<uintptr_t, Arena> arenas_;
+  std::multimap<size_t, void *> huge_free_;
+};
+
+inline void
+PoolBuffer::reset() {
+  if (allocator_ && ptr_) allocator_->free(ptr_);
+  allocator_ = nullptr;
+  ptr_ = nullptr;
+  size_ = 0;
+}
+
+}  // namespace hansa
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hansa {
+
+/// A decoded MessagePack value. Only what code-object metadata needs:
+/// maps are keyed by strings, and bin and ext payloads are kept as
+/// strings.
+struct MsgPackValue {
+  enum class Type { kNil, kBool, kInt, kFloat, kString, kArray, kMap };
+
+  Type type = Type::kNil;
+  int64_t integer = 0;
+  double real = 0;
+  std::string string;
+  std::vector<MsgPackValue> array;
+  std::vector<std::pair<std::string, MsgPackValue>> map;
+
+  /// The value under key in a map, or null.
+  [[nodiscard]]
+  const MsgPackValue *
+  find(const std::string &key) const {
+    for (const auto &[k, v] : map) {
+      if (k == key) return &v;
+    }
+    return nullptr;
+  }
+
+  /// The integer under key in a map, or fallback.
+  [[nodiscard]]
+  int64_t
+  get_int(const std::string &key, int64_t fallback = 0) const {
+    const MsgPackValue *v = find(key);
+    return v && v->type == Type::kInt ? v->integer : fallback;
+  }
+
+  /// The string under key in a map, or an empty string.
+  [[nodiscard]]
+  std::string
+  get_string(const std::string &key) const {
+    const MsgPackValue *v = find(key);
+    return v && v->type == Type::kString ? v->string : std::string();
+  }
+};
+
+/// Decodes one MessagePack value from [data, data + size). Returns the
+/// number of bytes consumed, or 0 if the input is malformed or truncated.
+class MsgPackReader {
+ public:
+  MsgPackReader(const void *data, size_t size)
+      : p_(static_cast<const uint8_t *>(data)), end_(p_ + size) {}
+
+  static size_t
+  decode(const void *data, size_t size, MsgPackValue *out) {
+    MsgPackReader reader(data, size);
+    const uint8_t *begin = reader.p_;
+    if (!reader.read(out, 0)) return 0;
+    return reader.p_ - begin;
+  }
+
+ private:
+  /// Deeper nesting than any real metadata; bounds the recursion.
+  static constexpr int kMaxDepth = 64;
+
+  bool
+  take(size_t n, const uint8_t **bytes) {
+    if (size_t(end_ - p_) < n) return false;
+    *bytes = p_;
+    p_ += n;
+    return true;
+  }
+
+  /// Reads an n-byte big-endian unsigned integer.
+  bool
+  be(size_t n, uint64_t *value) {
+    const uint8_t *bytes;
+    if (!take(n, &bytes)) return false;
+    *value = 0;
+    for (size_t i = 0; i < n; ++i) *value = (*value << 8) | bytes[i];
+    return true;
+  }
+
+  bool
+  read_string(size_t n, std::string *out) {
+    const uint8_t *bytes;
+    if (!take(n, &bytes)) return false;
+    out->assign(reinterpret_cast<const char *>(bytes), n);
+    return true;
+  }
+
+  bool
+  read_array(size_t n, MsgPackValue *out, int depth) {
+    out->type = MsgPackValue::Type::kArray;
+    // Every element takes at least a byte; reject absurd counts early.
+    if (n > size_t(end_ - p_)) return false;
+    out->array.resize(n);
+    for (MsgPackValue &v : out->array) {
+      if (!read(&v, depth + 1)) return false;
+    }
+    return true;
+  }
+
+  bool
+  read_map(size_t n, MsgPackValue *out, int depth) {
+    out->type = MsgPackValue::Type::kMap;
+    if (n > size_t(end_ - p_) / 2) return false;
+    out->map.resize(n);
+    for (auto &[key, value] : out->map) {
+      MsgPackValue k;
+      if (!read(&k, depth + 1) || !read(&value, depth + 1)) return false;
+      if (k.type != MsgPackValue::Type::kString) return false;
+      key = std::move(k.string);
+    }
+    return true;
+  }
+
+  bool
+  read_signed(size_t n, MsgPackValue *out) {
+    uint64_t u;
+    if (!be(n, &u)) return false;
+    const int shift = 64 - int(n) * 8;
+    out->type = MsgPackValue::Type::kInt;
+    out->integer = int64_t(u << shift) >> shift;
+    return true;
+  }
+
+  bool
+  read(MsgPackValue *out, int depth) {
+    if (depth > kMaxDepth) return false;
+    const uint8_t *tag_byte;
+    if (!take(1, &tag_byte)) return false;
+    const uint8_t tag = *tag_byte;
+    uint64_t n;
+
+    if (tag <= 0x7f || tag >= 0xe0) {
+      out->type = MsgPackValue::Type::kInt;
+      out->integer = int8_t(tag);
+      return true;
+    }
+    if ((tag & 0xf0) == 0x80) return read_map(tag & 0x0f, out, depth);
+    if ((tag & 0xf0) == 0x90) return read_array(tag & 0x0f, out, depth);
+    if ((tag & 0xe0) == 0xa0) {
+      out->type = MsgPackValue::Type::kString;
+      return read_string(tag & 0x1f, &out->string);
+    }
+
+    switch (tag) {
+      case 0xc0:
+        out->type = MsgPackValue::Type::kNil;
+        return true;
+      case 0xc2:
+      case 0xc3:
+        out->type = MsgPackValue::Type::kBool;
+        out->integer = tag == 0xc3;
+        return true;
+      case 0xc4:  // bin 8/16/32
+      case 0xc5:
+      case 0xc6:
+      case 0xd9:  // str 8/16/32
+      case 0xda:
+      case 0xdb: {
+        const size_t width = tag <= 0xc6 ? size_t(1) << (tag - 0xc4)
+                                         : size_t(1) << (tag - 0xd9);
+        out->type = MsgPackValue::Type::kString;
+        return be(width, &n) && read_string(n, &out->string);
+      }
+      case 0xc7:  // ext 8/16/32: length, type byte, payload
+      case 0xc8:
+      case 0xc9: {
+        const uint8_t *type;
+        out->type = MsgPackValue::Type::kString;
+        return be(size_t(1) << (tag - 0xc7), &n) && take(1, &type) &&
+               read_string(n, &out->string);
+      }
+      case 0xca: {
+        uint64_t bits;
+        if (!be(4, &bits)) return false;
+        const uint32_t b32 = uint32_t(bits);
+        float f;
+        std::memcpy(&f, &b32, sizeof(f));
+        out->type = MsgPackValue::Type::kFloat;
+        out->real = f;
+        return true;
+      }
+      case 0xcb: {
+        uint64_t bits;
+        if (!be(8, &bits)) return false;
+        out->type = MsgPackValue::Type::kFloat;
+        std::memcpy(&out->real, &bits, sizeof(out->real));
+        return true;
+      }
+      case 0xcc:  // uint 8/16/32/64
+      case 0xcd:
+      case 0xce:
+      case 0xcf:
+        out->type = MsgPackValue::Type::kInt;
+        if (!be(size_t(1) << (tag - 0xcc), &n)) return false;
+        out->integer = int64_t(n);
+        return true;
+      case 0xd0:  // int 8/16/32/64
+      case 0xd1:
+      case 0xd2:
+      case 0xd3:
+        return read_signed(size_t(1) << (tag - 0xd0), out);
+      case 0xd4:  // fixext 1/2/4/8/16
+      case 0xd5:
+      case 0xd6:
+      case 0xd7:
+      case 0xd8: {
+        const uint8_t *type;
+        out->type = MsgPackValue::Type::kString;
+        return take(1, &type) &&
+               read_string(size_t(1) << (tag - 0xd4), &out->string);
+      }
+      case 0xdc:
+      case 0xdd:
+        return be(tag == 0xdc ? 2 : 4, &n) && read_array(n, out, depth);
+      case 0xde:
+      case 0xdf:
+        return be(tag == 0xde ? 2 : 4, &n) && read_map(n, out, depth);
+      default:  // 0xc1 is never used
+        return false;
+    }
+  }
+
+  const uint8_t *p_;
+  const uint8_t *end_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "hansa/code_object.h"
+
+namespace hansa {
+
+/// What bounds how many waves of a kernel a compute unit can hold.
+struct AgentLimits {
+  /// e.g. gfx1103; selects the register file model.
+  std::string isa;
+  uint32_t compute_units = 1;
+  uint32_t simds_per_cu = 4;
+  uint32_t max_waves_per_simd = 10;
+  uint32_t wavefront_size = 64;
+  uint32_t max_workgroup_size = 1024;
+  uint32_t max_workgroups_per_cu = 16;
+  uint32_t lds_per_cu = 64 * 1024;
+  /// VGPRs per lane of one SIMD, and the allocation granule, for waves of
+  /// wavefront_size lanes.
+  uint32_t vgprs_per_simd = 256;
+  uint32_t vgpr_granule = 4;
+  /// 0 on targets where SGPRs never limit occupancy.
+  uint32_t sgprs_per_simd = 800;
+  uint32_t sgpr_granule = 16;
+
+  /// A register file model from the ISA name alone; compute_units and the
+  /// other agent queries are filled in by the caller. wavefront_size 0
+  /// picks the ISA's native width.
+  static AgentLimits
+  for_isa(const std::string &isa, uint32_t wavefront_size = 0) {
+    AgentLimits limits;
+    limits.isa = isa;
+    const int major = isa.size() > 4 && isa.compare(0, 3, "gfx") == 0
+                          ? std::atoi(isa.c_str() + 3) / 100
+                          : 9;
+    if (major >= 10) {
+      // RDNA: two SIMD32s per CU and no SGPR limit. Some gfx11 parts have
+      // a 1.5x register file. A wave64 takes two wave32 slots' registers.
+      const bool big_file = isa == "gfx1100" || isa == "gfx1101" ||
+                            isa == "gfx1151";
+      limits.wavefront_size = wavefront_size ? wavefront_size : 32;
+      limits.simds_per_cu = 2;
+      limits.max_waves_per_simd = major >= 11 ? 16 : 20;
+      limits.max_workgroups_per_cu = 32;
+      limits.vgprs_per_simd = (big_file ? 1536 : 1024) * 32 /
+                              limits.wavefront_size;
+      limits.vgpr_granule = big_file ? 24 : 16;
+      if (limits.wavefront_size == 32) limits.vgpr_granule /= 2;
+      limits.sgprs_per_simd = 0;
+    } else {
+      limits.wavefront_size = 64;
+      // gfx90a and later CDNA: unified 512-entry VGPR/AGPR file.
+      const bool unified = isa >= "gfx90a" && isa != "gfx90c";
+      limits.max_waves_per_simd = unified ? 8 : 10;
+      limits.vgprs_per_simd = unified ? 512 : 256;
+      limits.vgpr_granule = unified ? 8 : 4;
+    }
+    return limits;
+  }
+};
+
+/// The per-kernel resources that occupancy depends on.
+struct KernelResources {
+  uint32_t vgprs = 32;
+  uint32_t agprs = 0;
+  uint32_t sgprs = 32;
+  uint32_t lds_bytes = 0;
+  /// 0 when the kernel does not pin it.
+  uint32_t wavefront_size = 0;
+  uint32_t max_workgroup_size = 1024;
+
+  static KernelResources
+  from_metadata(const KernelMetadata &meta) {
+    KernelResources r;
+    r.vgprs = meta.vgpr_count;
+    r.agprs = meta.agpr_count;
+    r.sgprs = meta.sgpr_count;
+    r.lds_bytes = meta.group_segment_fixed_size;
+    r.wavefront_size = meta.wavefront_size;
+    if (meta.max_flat_workgroup_size) {
+      r.max_workgroup_size = meta.max_flat_workgroup_size;
+    }
+    return r;
+  }
+
+  /// Decodes the 64-byte AMDHSA kernel descriptor. Register counts are
+  /// stored in allocation granules, so they are upper bounds; prefer
+  /// from_metadata when the code object has metadata.
+  static KernelResources
+  from_descriptor(const uint8_t descriptor[64], const AgentLimits &limits) {
+    uint32_t group_segment_fixed_size, rsrc1;
+    uint16_t properties;
+    std::memcpy(&group_segment_fixed_size, descriptor, 4);
+    std::memcpy(&rsrc1, descriptor + 48, 4);
+    std::memcpy(&properties, descriptor + 56, 2);
+    constexpr uint16_t kEnableWavefrontSize32 = 1 << 10;
+
+    KernelResources r;
+    r.lds_bytes = group_segment_fixed_size;
+    r.wavefront_size =
+        (properties & kEnableWavefrontSize32) ? 32 : limits.wavefront_size;
+    // GRANULATED_WORKITEM_VGPR_COUNT and GRANULATED_WAVEFRONT_SGPR_COUNT.
+    const uint32_t vgpr_blocks = rsrc1 & 0x3f;
+    const uint32_t sgpr_blocks = (rsrc1 >> 6) & 0xf;
+    const uint32_t vgpr_block_size =
+        r.wavefront_size == 32 || limits.vgpr_granule == 8 ? 8 : 4;
+    r.vgprs = (vgpr_blocks + 1) * vgpr_block_size;
+    r.sgprs = limits.sgprs_per_simd ? (sgpr_blocks + 1) * 8 : 0;
+    return r;
+  }
+};
+
+/// How many waves of a kernel fit on a compute unit for one workgroup
+/// shape, and how much of the machine a grid can keep busy.
+struct Occupancy {
+  std::array<int, 3> workgroup{0, 0, 0};
+  uint32_t waves_per_workgroup = 0;
+  uint32_t workgroups_per_cu = 0;
+  uint32_t waves_per_cu = 0;
+  uint32_t max_waves_per_cu = 0;
+  /// Resident over maximum waves per CU.
+  double theoretical = 0;
+  /// Like theoretical, but limited by the waves the grid provides across
+  /// all CUs, and discounting idle lanes in partial workgroups.
+  double achieved = 0;
+  /// vgpr, sgpr, lds, waves or workgroups.
+  const char *limiter = "";
+};
+
+inline uint32_t
+round_up(uint32_t value, uint32_t granule) {
+  return granule ? (value + granule - 1) / granule * granule : value;
+}
+
+/// The occupancy of a kernel for one workgroup shape. Pure host
+/// arithmetic, so it can be checked against recorded agent and kernel
+/// descriptions.
+inline Occupancy
+estimate_occupancy(const AgentLimits &agent, const KernelResources &kernel,
+                   const std::array<int, 3> &grid,
+                   const std::array<int, 3> &workgroup) {
+  Occupancy o;
+  o.workgroup = workgroup;
+  const uint32_t wave =
+      kernel.wavefront_size ? kernel.wavefront_size : agent.wavefront_size;
+  const uint32_t lanes = workgroup[0] * workgroup[1] * workgroup[2];
+  o.waves_per_workgroup = std::max(1u, (lanes + wave - 1) / wave);
+  o.max_waves_per_cu = agent.max_waves_per_simd * agent.simds_per_cu;
+
+  // Waves per SIMD under each register file; a wave64 on a wave32 file
+  // uses two lanes' worth of registers.
+  uint32_t vgpr_file = agent.vgprs_per_simd;
+  if (wave > agent.wavefront_size) vgpr_file /= wave / agent.wavefront_size;
+  const uint32_t vgprs = round_up(kernel.vgprs + kernel.agprs,
+                                  agent.vgpr_granule);
+  const uint32_t by_vgpr =
+      vgprs ? std::min(agent.max_waves_per_simd, vgpr_file / vgprs)
+            : agent.max_waves_per_simd;
+  uint32_t by_sgpr = agent.max_waves_per_simd;
+  if (agent.sgprs_per_simd && kernel.sgprs) {
+    by_sgpr = std::min(by_sgpr, agent.sgprs_per_simd /
+                                    round_up(kernel.sgprs, agent.sgpr_granule));
+  }
+
+  struct Limit {
+    const char *name;
+    uint32_t workgroups;
+  };
+  const auto per_cu = [&](uint32_t waves_per_simd) {
+    return waves_per_simd * agent.simds_per_cu / o.waves_per_workgroup;
+  };
+  const Limit limits[] = {
+      {"waves", per_cu(agent.max_waves_per_simd)},
+      {"vgpr", per_cu(by_vgpr)},
+      {"sgpr", per_cu(by_sgpr)},
+      {"lds", kernel.lds_bytes ? agent.lds_per_cu / kernel.lds_bytes
+                               : UINT32_MAX},
+      {"workgroups", agent.max_workgroups_per_cu},
+  };
+  const Limit *tightest = &limits[0];
+  for (const Limit &l : limits) {
+    if (l.workgroups < tightest->workgroups) tightest = &l;
+  }
+  o.limiter = tightest->name;
+  o.workgroups_per_cu = tightest->workgroups;
+  o.waves_per_cu = o.workgroups_per_cu * o.waves_per_workgroup;
+  o.theoretical = double(o.waves_per_cu) / o.max_waves_per_cu;
+
+  uint64_t groups = 1;
+  for (int d = 0; d < 3; ++d) {
+    groups *= (uint64_t(grid[d]) + workgroup[d] - 1) / workgroup[d];
+  }
+  const uint64_t grid_lanes = uint64_t(grid[0]) * grid[1] * grid[2];
+  const double lane_use = double(grid_lanes) / (groups * lanes);
+  const uint64_t resident =
+      std::min<uint64_t>(groups, uint64_t(o.workgroups_per_cu) *
+                                     agent.compute_units);
+  o.achieved = double(resident * o.waves_per_workgroup) * lane_use /
+               (double(o.max_waves_per_cu) * agent.compute_units);
+  return o;
+}
+
+/// The workgroup shape with the most resident waves across the machine for
+/// grid. Shapes are whole waves up to the kernel's and agent's limits, and
+/// as many dimensions as the grid has, at least a wave wide in x so that a
+/// wave's loads along a row coalesce. Ties go to shapes that divide the
+/// grid evenly, then to smaller workgroups, which balance better.
+inline Occupancy
+choose_workgroup(const AgentLimits &agent, const KernelResources &kernel,
+                 const std::array<int, 3> &grid) {
+  const int wave = kernel.wavefront_size ? kernel.wavefront_size
+                                         : agent.wavefront_size;
+  const int max_size = std::min(agent.max_workgroup_size,
+                                kernel.max_workgroup_size);
+  const int dims = grid[2] > 1 ? 3 : grid[1] > 1 ? 2 : 1;
+  const int min_x = std::min(wave, grid[0]);
+
+  Occupancy best;
+  bool best_even = false;
+  const auto consider = [&](std::array<int, 3> wg) {
+    const int size = wg[0] * wg[1] * wg[2];
+    if (size > max_size || size % wave != 0 || wg[0] < min_x) return;
+    const Occupancy o = estimate_occupancy(agent, kernel, grid, wg);
+    const bool even = grid[0] % wg[0] == 0 && grid[1] % wg[1] == 0 &&
+                      grid[2] % wg[2] == 0;
+    const int best_size = best.workgroup[0] * best.workgroup[1] *
+                          best.workgroup[2];
+    if (best.waves_per_workgroup == 0 || o.achieved > best.achieved + 1e-9 ||
+        (o.achieved > best.achieved - 1e-9 &&
+         (even > best_even || (even == best_even && size < best_size)))) {
+      best = o;
+      best_even = even;
+    }
+  };
+  for (int x = 1; x <= max_size; x *= 2) {
+    if (dims == 1) {
+      consider({x, 1, 1});
+      continue;
+    }
+    for (int y = 1; x * y <= max_size; y *= 2) {
+      if (dims == 2) {
+        consider({x, y, 1});
+        continue;
+      }
+      for (int z = 1; x * y * z <= max_size; z *= 2) consider({x, y, z});
+    }
+  }
+  if (best.waves_per_workgroup == 0) {
+    best = estimate_occupancy(agent, kernel, grid, {wave, 1, 1});
+  }
+  return best;
+}
+
+}  // namespace hansa
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace hansa {
+
+/// What a BoundedQueue saw over its lifetime.
+struct QueueStats {
+  std::string name;
+  size_t capacity = 0;
+  uint64_t pushes = 0;
+  size_t max_depth = 0;
+  /// Time-weighted average number of queued items.
+  double mean_depth = 0;
+  /// Time producers spent blocked on a full queue, i.e. backpressure.
+  double push_wait_ms = 0;
+  /// Time consumers spent blocked on an empty queue, i.e. starvation.
+  double pop_wait_ms = 0;
+};
+
+/// Multi-producer, multi-consumer FIFO between two pipeline stages. push
+/// blocks while the queue is full, so a slow stage throttles the stages
+/// feeding it instead of letting work pile up in memory.
+template <typename T>
+class BoundedQueue {
+ public:
+  BoundedQueue(std::string name, size_t capacity)
+      : capacity_(capacity), closed_(false), start_(Clock::now()),
+        last_change_(start_) {
+    stats_.name = std::move(name);
+    stats_.capacity = capacity;
+  }
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &
+  operator=(const BoundedQueue &) = delete;
+
+  /// Blocks while the queue is full. Returns false, dropping item, once
+  /// the queue is closed.
+  bool
+  push(T item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && items_.size() >= capacity_) {
+      const Clock::time_point blocked = Clock::now();
+      not_full_.wait(lock,
+                     [this] { return closed_ || items_.size() < capacity_; });
+      stats_.push_wait_ms += ms_since(blocked);
+    }
+    if (closed_) return false;
+    account_depth();
+    items_.push_back(std::move(item));
+    ++stats_.pushes;
+    stats_.max_depth = std::max(stats_.max_depth, items_.size());
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /// Blocks while the queue is empty. Returns false once it is closed and
+  /// drained.
+  bool
+  pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!closed_ && items_.empty()) {
+      const Clock::time_point blocked = Clock::now();
+      not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+      stats_.pop_wait_ms += ms_since(blocked);
+    }
+    if (items_.empty()) return false;
+    account_depth();
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  /// Wakes every waiter. Queued items can still be popped; further pushes
+  /// fail.
+  void
+  close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  [[nodiscard]]
+  QueueStats
+  stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    QueueStats stats = stats_;
+    const double elapsed = ms_since(start_);
+    const double area =
+        depth_area_ms_ + double(items_.size()) * ms_since(last_change_);
+    stats.mean_depth = elapsed > 0 ? area / elapsed : 0;
+    return stats;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  static double
+  ms_since(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t)
+        .count();
+  }
+
+  /// Integrates depth over the time since the last push or pop.
+  void
+  account_depth() {
+    const Clock::time_point now = Clock::now();
+    depth_area_ms_ += double(items_.size()) *
+                      std::chrono::duration<double, std::milli>(
+                          now - last_change_)
+                          .count();
+    last_change_ = now;
+  }
+
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  bool closed_;
+  Clock::time_point start_;
+  Clock::time_point last_change_;
+  double depth_area_ms_ = 0;
+  QueueStats stats_;
+};
+
+/// Work done by one pipeline stage, summed over its workers.
+struct StageStats {
+  std::string name;
+  unsigned workers = 0;
+  uint64_t items = 0;
+  double busy_ms = 0;
+
+  /// The rate the stage could sustain if it never waited on its
+  /// neighbours.
+  [[nodiscard]]
+  double
+  capacity_per_s() const {
+    return busy_ms > 0 ? items * workers * 1000.0 / busy_ms : 0;
+  }
+};
+
+/// Thread-safe accumulator behind a StageStats.
+class StageMeter {
+ public:
+  StageMeter(std::string name, unsigned workers) {
+    stats_.name = std::move(name);
+    stats_.workers = workers;
+  }
+
+  /// Times fn() as one item of work.
+  template <typename F>
+  auto
+  measure(F &&fn) {
+    const auto start = std::chrono::steady_clock::now();
+    struct Record {
+      StageMeter *meter;
+      std::chrono::steady_clock::time_point start;
+      ~Record() {
+        meter->add(std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count());
+      }
+    } record{this, start};
+    return fn();
+  }
+
+  void
+  add(double busy_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.items;
+    stats_.busy_ms += busy_ms;
+  }
+
+  [[nodiscard]]
+  StageStats
+  stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  StageStats stats_;
+};
+
+}  // namespace hansa
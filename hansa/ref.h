@@ -0,0 +1,617 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hansa/host/thread_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HANSA_REF_X86 1
+#include <immintrin.h>
+#endif
+
+/// Host reference implementations of the kernels in kernels/, used by the
+/// launchers to validate device output.
+///
+/// Every reference computes exactly what its kernel computes, including
+/// integer truncation and the order of floating-point accumulation, so
+/// integer results must match bit for bit and float results only differ by
+/// contraction into FMAs. Work is split into row blocks over a shared
+/// ThreadPool and the inner loops use AVX-512 or AVX2 when the CPU has
+/// them; HANSA_REF_ISA=avx512|avx2|scalar caps the instruction set.
+namespace hansa::ref {
+
+enum class Isa { kScalar, kAvx2, kAvx512 };
+
+inline Isa
+detect_isa() {
+  Isa best = Isa::kScalar;
+#ifdef HANSA_REF_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    best = Isa::kAvx2;
+  }
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    best = Isa::kAvx512;
+  }
+#endif
+  const char *cap = std::getenv("HANSA_REF_ISA");
+  if (cap && std::strcmp(cap, "scalar") == 0) best = Isa::kScalar;
+  if (cap && std::strcmp(cap, "avx2") == 0) best = std::min(best, Isa::kAvx2);
+  return best;
+}
+
+inline Isa
+isa() {
+  static const Isa selected = detect_isa();
+  return selected;
+}
+
+inline const char *
+isa_name(Isa isa) {
+  switch (isa) {
+    case Isa::kAvx512:
+      return "AVX-512";
+    case Isa::kAvx2:
+      return "AVX2";
+    default:
+      return "scalar";
+  }
+}
+
+/// Pool shared by all references; created on first use.
+inline ThreadPool &
+pool() {
+  static ThreadPool shared;
+  return shared;
+}
+
+/// Runs fn(begin, end) over [0, count) in blocks of at most grain.
+template <typename F>
+void
+for_blocks(size_t count, size_t grain, F &&fn) {
+  const size_t blocks = (count + grain - 1) / grain;
+  pool().parallel_for(blocks, [&](size_t block) {
+    const size_t begin = block * grain;
+    fn(begin, std::min(count, begin + grain));
+  });
+}
+
+namespace detail {
+
+// Scalar versions, also used for the tails of the vector loops.
+
+inline void
+add_arrays(const int *a, const int *b, int *out, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) out[i] = a[i] + b[i];
+}
+
+inline void
+color_to_grayscale(uint8_t *out, const uint8_t *in, size_t begin,
+                   size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    const uint8_t r = in[i * 3], g = in[i * 3 + 1], b = in[i * 3 + 2];
+    out[i] = uint8_t(0.299f * r + 0.587f * g + 0.114f * b);
+  }
+}
+
+/// One output pixel of image_blur_rgb, clipping the 3x3 window.
+inline void
+blur_pixel(uint8_t *out, const uint8_t *in, int width, int height, int x,
+           int y) {
+  int sum[3] = {0, 0, 0};
+  int count = 0;
+  for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ++ny) {
+    for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx) {
+      const uint8_t *p = in + (size_t(ny) * width + nx) * 3;
+      sum[0] += p[0];
+      sum[1] += p[1];
+      sum[2] += p[2];
+      ++count;
+    }
+  }
+  uint8_t *o = out + (size_t(y) * width + x) * 3;
+  for (int c = 0; c < 3; ++c) o[c] = sum[c] / count;
+}
+
+/// Interior bytes [begin, end) of row y, where the window is always full.
+/// Byte b of the row sums bytes b - 3, b and b + 3 of rows y - 1..y + 1.
+inline void
+blur_interior(uint8_t *out, const uint8_t *in, int width, int y, size_t begin,
+              size_t end) {
+  const size_t stride = size_t(width) * 3;
+  const uint8_t *r0 = in + (y - 1) * stride, *r1 = r0 + stride,
+                *r2 = r1 + stride;
+  uint8_t *o = out + y * stride;
+  for (size_t b = begin; b < end; ++b) {
+    int sum = 0;
+    for (size_t k = b - 3; k <= b + 3; k += 3) sum += r0[k] + r1[k] + r2[k];
+    o[b] = sum / 9;
+  }
+}
+
+/// C[rows] = A[rows] * B with C zeroed by the caller. The k loop is
+/// outermost per row, so every C element accumulates in the same order as
+/// the device kernels.
+template <typename T>
+void
+matmul_rows(T *C, const T *A, const T *B, int M, int K, size_t begin,
+            size_t end) {
+  for (size_t row = begin; row < end; ++row) {
+    T *c = C + row * K;
+    for (int p = 0; p < M; ++p) {
+      const T a = A[row * M + p];
+      const T *b = B + size_t(p) * K;
+      for (int j = 0; j < K; ++j) c[j] += a * b[j];
+    }
+  }
+}
+
+#ifdef HANSA_REF_X86
+
+// Division by 9 of sums up to 9 * 255, exact for that range.
+constexpr int kDiv9Multiplier = 7282;
+
+__attribute__((target("avx2"))) inline void
+add_arrays_avx2(const int *a, const int *b, int *out, size_t begin,
+                size_t end) {
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    const __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_add_epi32(va, vb));
+  }
+  add_arrays(a, b, out, i, end);
+}
+
+__attribute__((target("avx512f"))) inline void
+add_arrays_avx512(const int *a, const int *b, int *out, size_t begin,
+                  size_t end) {
+  size_t i = begin;
+  for (; i + 16 <= end; i += 16) {
+    const __m512i va = _mm512_loadu_si512(a + i);
+    const __m512i vb = _mm512_loadu_si512(b + i);
+    _mm512_storeu_si512(out + i, _mm512_add_epi32(va, vb));
+  }
+  add_arrays(a, b, out, i, end);
+}
+
+// The grayscale loops gather one 32-bit word per pixel, which reads one
+// byte past the pixel; stopping a pixel early keeps that inside the image.
+
+__attribute__((target("avx2"))) inline void
+color_to_grayscale_avx2(uint8_t *out, const uint8_t *in, size_t begin,
+                        size_t end) {
+  const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256 wr = _mm256_set1_ps(0.299f), wg = _mm256_set1_ps(0.587f),
+               wb = _mm256_set1_ps(0.114f);
+  size_t i = begin;
+  for (; i + 9 <= end; i += 8) {
+    const __m256i px =
+        _mm256_i32gather_epi32((const int *)(in + i * 3), offsets, 1);
+    const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(px, mask));
+    const __m256 g =
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 8), mask));
+    const __m256 b =
+        _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+    const __m256 y = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(wr, r), _mm256_mul_ps(wg, g)),
+        _mm256_mul_ps(wb, b));
+    const __m256i v = _mm256_cvttps_epi32(y);
+    const __m128i v16 = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                         _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(v16, v16));
+  }
+  color_to_grayscale(out, in, i, end);
+}
+
+__attribute__((target("avx512f"))) inline void
+color_to_grayscale_avx512(uint8_t *out, const uint8_t *in, size_t begin,
+                          size_t end) {
+  const __m512i offsets = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24,
+                                            27, 30, 33, 36, 39, 42, 45);
+  const __m512i mask = _mm512_set1_epi32(0xff);
+  const __m512 wr = _mm512_set1_ps(0.299f), wg = _mm512_set1_ps(0.587f),
+               wb = _mm512_set1_ps(0.114f);
+  size_t i = begin;
+  for (; i + 17 <= end; i += 16) {
+    const __m512i px = _mm512_i32gather_epi32(offsets, in + i * 3, 1);
+    const __m512 r = _mm512_cvtepi32_ps(_mm512_and_si512(px, mask));
+    const __m512 g =
+        _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(px, 8), mask));
+    const __m512 b =
+        _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(px, 16), mask));
+    const __m512 y = _mm512_add_ps(
+        _mm512_add_ps(_mm512_mul_ps(wr, r), _mm512_mul_ps(wg, g)),
+        _mm512_mul_ps(wb, b));
+    _mm_storeu_si128((__m128i *)(out + i),
+                     _mm512_cvtepi32_epi8(_mm512_cvttps_epi32(y)));
+  }
+  color_to_grayscale(out, in, i, end);
+}
+
+/// Bytes k..k+15 (k..k+31) of three rows, widened and summed.
+__attribute__((target("avx2"))) inline __m256i
+blur_column_avx2(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2,
+                 size_t k) {
+  const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r0 + k)));
+  const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r1 + k)));
+  const __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(r2 + k)));
+  return _mm256_add_epi16(_mm256_add_epi16(a, b), c);
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline __m512i
+blur_column_avx512(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2,
+                   size_t k) {
+  const __m512i a =
+      _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i *)(r0 + k)));
+  const __m512i b =
+      _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i *)(r1 + k)));
+  const __m512i c =
+      _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i *)(r2 + k)));
+  return _mm512_add_epi16(_mm512_add_epi16(a, b), c);
+}
+
+__attribute__((target("avx2"))) inline void
+blur_interior_avx2(uint8_t *out, const uint8_t *in, int width, int y,
+                   size_t begin, size_t end) {
+  const size_t stride = size_t(width) * 3;
+  const uint8_t *r0 = in + (y - 1) * stride, *r1 = r0 + stride,
+                *r2 = r1 + stride;
+  uint8_t *o = out + y * stride;
+  const __m256i div9 = _mm256_set1_epi16(kDiv9Multiplier);
+  size_t b = begin;
+  for (; b + 16 <= end; b += 16) {
+    const __m256i sum = _mm256_add_epi16(
+        _mm256_add_epi16(blur_column_avx2(r0, r1, r2, b - 3),
+                         blur_column_avx2(r0, r1, r2, b)),
+        blur_column_avx2(r0, r1, r2, b + 3));
+    const __m256i q = _mm256_mulhi_epu16(sum, div9);
+    _mm_storeu_si128((__m128i *)(o + b),
+                     _mm_packus_epi16(_mm256_castsi256_si128(q),
+                                      _mm256_extracti128_si256(q, 1)));
+  }
+  blur_interior(out, in, width, y, b, end);
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline void
+blur_interior_avx512(uint8_t *out, const uint8_t *in, int width, int y,
+                     size_t begin, size_t end) {
+  const size_t stride = size_t(width) * 3;
+  const uint8_t *r0 = in + (y - 1) * stride, *r1 = r0 + stride,
+                *r2 = r1 + stride;
+  uint8_t *o = out + y * stride;
+  const __m512i div9 = _mm512_set1_epi16(kDiv9Multiplier);
+  size_t b = begin;
+  for (; b + 32 <= end; b += 32) {
+    const __m512i sum = _mm512_add_epi16(
+        _mm512_add_epi16(blur_column_avx512(r0, r1, r2, b - 3),
+                         blur_column_avx512(r0, r1, r2, b)),
+        blur_column_avx512(r0, r1, r2, b + 3));
+    _mm256_storeu_si256((__m256i *)(o + b),
+                        _mm512_cvtepi16_epi8(_mm512_mulhi_epu16(sum, div9)));
+  }
+  blur_interior(out, in, width, y, b, end);
+}
+
+// Matrix rows are processed in column blocks so that the block of C being
+// accumulated stays in L1 while B streams past.
+constexpr int kColumnBlock = 1024;
+
+__attribute__((target("avx2"))) inline void
+matmul_rows_avx2(int *C, const int *A, const int *B, int M, int K,
+                 size_t begin, size_t end) {
+  for (size_t row = begin; row < end; ++row) {
+    int *c = C + row * K;
+    for (int j0 = 0; j0 < K; j0 += kColumnBlock) {
+      const int j1 = std::min(K, j0 + kColumnBlock);
+      for (int p = 0; p < M; ++p) {
+        const int a = A[row * M + p];
+        const int *b = B + size_t(p) * K;
+        const __m256i va = _mm256_set1_epi32(a);
+        int j = j0;
+        for (; j + 8 <= j1; j += 8) {
+          const __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+          const __m256i vc = _mm256_loadu_si256((const __m256i *)(c + j));
+          _mm256_storeu_si256((__m256i *)(c + j),
+                              _mm256_add_epi32(vc, _mm256_mullo_epi32(va, vb)));
+        }
+        for (; j < j1; ++j) c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+__attribute__((target("avx512f"))) inline void
+matmul_rows_avx512(int *C, const int *A, const int *B, int M, int K,
+                   size_t begin, size_t end) {
+  for (size_t row = begin; row < end; ++row) {
+    int *c = C + row * K;
+    for (int j0 = 0; j0 < K; j0 += kColumnBlock) {
+      const int j1 = std::min(K, j0 + kColumnBlock);
+      for (int p = 0; p < M; ++p) {
+        const int a = A[row * M + p];
+        const int *b = B + size_t(p) * K;
+        const __m512i va = _mm512_set1_epi32(a);
+        int j = j0;
+        for (; j + 16 <= j1; j += 16) {
+          const __m512i vb = _mm512_loadu_si512(b + j);
+          const __m512i vc = _mm512_loadu_si512(c + j);
+          _mm512_storeu_si512(c + j,
+                              _mm512_add_epi32(vc, _mm512_mullo_epi32(va, vb)));
+        }
+        for (; j < j1; ++j) c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+__attribute__((target("avx2,fma"))) inline void
+matmul_rows_avx2(float *C, const float *A, const float *B, int M, int K,
+                 size_t begin, size_t end) {
+  for (size_t row = begin; row < end; ++row) {
+    float *c = C + row * K;
+    for (int j0 = 0; j0 < K; j0 += kColumnBlock) {
+      const int j1 = std::min(K, j0 + kColumnBlock);
+      for (int p = 0; p < M; ++p) {
+        const float a = A[row * M + p];
+        const float *b = B + size_t(p) * K;
+        const __m256 va = _mm256_set1_ps(a);
+        int j = j0;
+        for (; j + 8 <= j1; j += 8) {
+          _mm256_storeu_ps(c + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(b + j),
+                                                  _mm256_loadu_ps(c + j)));
+        }
+        for (; j < j1; ++j) c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+__attribute__((target("avx512f"))) inline void
+matmul_rows_avx512(float *C, const float *A, const float *B, int M, int K,
+                   size_t begin, size_t end) {
+  for (size_t row = begin; row < end; ++row) {
+    float *c = C + row * K;
+    for (int j0 = 0; j0 < K; j0 += kColumnBlock) {
+      const int j1 = std::min(K, j0 + kColumnBlock);
+      for (int p = 0; p < M; ++p) {
+        const float a = A[row * M + p];
+        const float *b = B + size_t(p) * K;
+        const __m512 va = _mm512_set1_ps(a);
+        int j = j0;
+        for (; j + 16 <= j1; j += 16) {
+          _mm512_storeu_ps(c + j, _mm512_fmadd_ps(va, _mm512_loadu_ps(b + j),
+                                                  _mm512_loadu_ps(c + j)));
+        }
+        for (; j < j1; ++j) c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+#endif  // HANSA_REF_X86
+
+template <typename T>
+void
+matmul(T *C, const T *A, const T *B, int N, int M, int K) {
+  std::fill(C, C + size_t(N) * K, T(0));
+  const Isa level = isa();
+  // About 64K multiply-adds per block.
+  const size_t grain = std::max<size_t>(1, (1u << 16) / std::max(1, M * K));
+  for_blocks(N, grain, [&](size_t begin, size_t end) {
+#ifdef HANSA_REF_X86
+    if (level == Isa::kAvx512) {
+      return matmul_rows_avx512(C, A, B, M, K, begin, end);
+    }
+    if (level == Isa::kAvx2) return matmul_rows_avx2(C, A, B, M, K, begin, end);
+#endif
+    matmul_rows(C, A, B, M, K, begin, end);
+  });
+}
+
+}  // namespace detail
+
+/// kernels/001-vector-add.c
+inline void
+add_arrays(const int *input_a, const int *input_b, int *output, size_t n) {
+  const Isa level = isa();
+  for_blocks(n, 1 << 16, [&](size_t begin, size_t end) {
+#ifdef HANSA_REF_X86
+    if (level == Isa::kAvx512) {
+      return detail::add_arrays_avx512(input_a, input_b, output, begin, end);
+    }
+    if (level == Isa::kAvx2) {
+      return detail::add_arrays_avx2(input_a, input_b, output, begin, end);
+    }
+#endif
+    detail::add_arrays(input_a, input_b, output, begin, end);
+  });
+}
+
+/// kernels/002-color-to-grayscale.c
+inline void
+color_to_grayscale(uint8_t *img_out, const uint8_t *img_in, int width,
+                   int height) {
+  const Isa level = isa();
+  const size_t pixels = size_t(width) * height;
+  for_blocks(pixels, 1 << 15, [&](size_t begin, size_t end) {
+#ifdef HANSA_REF_X86
+    if (level == Isa::kAvx512) {
+      return detail::color_to_grayscale_avx512(img_out, img_in, begin, end);
+    }
+    if (level == Isa::kAvx2) {
+      return detail::color_to_grayscale_avx2(img_out, img_in, begin, end);
+    }
+#endif
+    detail::color_to_grayscale(img_out, img_in, begin, end);
+  });
+}
+
+/// kernels/003-image-blur.c
+inline void
+image_blur_rgb(uint8_t *img_out, const uint8_t *img_in, int width,
+               int height) {
+  const Isa level = isa();
+  for_blocks(height, 16, [&](size_t begin, size_t end) {
+    for (int y = begin; y < int(end); ++y) {
+      const bool edge_row = y == 0 || y == height - 1;
+      if (edge_row || width < 3) {
+        for (int x = 0; x < width; ++x) {
+          detail::blur_pixel(img_out, img_in, width, height, x, y);
+        }
+        continue;
+      }
+      detail::blur_pixel(img_out, img_in, width, height, 0, y);
+      detail::blur_pixel(img_out, img_in, width, height, width - 1, y);
+      const size_t first = 3, last = size_t(width - 1) * 3;
+#ifdef HANSA_REF_X86
+      if (level == Isa::kAvx512) {
+        detail::blur_interior_avx512(img_out, img_in, width, y, first, last);
+        continue;
+      }
+      if (level == Isa::kAvx2) {
+        detail::blur_interior_avx2(img_out, img_in, width, y, first, last);
+        continue;
+      }
+#endif
+      detail::blur_interior(img_out, img_in, width, y, first, last);
+    }
+  });
+}
+
+/// kernels/043-image-blur-separable.c, for interleaved pixels of any
+/// channel count: each output is the mean of the in-bounds part of its
+/// (2 * radius + 1)^2 window. Row sums over a sliding window, then
+/// column sums of those, which add up to the kernel's integer sums.
+inline void
+box_blur(uint8_t *img_out, const uint8_t *img_in, int width, int height,
+         int channels, int radius) {
+  const size_t row_bytes = size_t(width) * channels;
+  std::vector<uint32_t> rows(row_bytes * height);
+  for_blocks(height, 16, [&](size_t begin, size_t end) {
+    for (size_t y = begin; y < end; ++y) {
+      const uint8_t *in = img_in + y * row_bytes;
+      uint32_t *sums = rows.data() + y * row_bytes;
+      for (int c = 0; c < channels; ++c) {
+        uint32_t sum = 0;
+        for (int x = 0; x <= std::min(radius, width - 1); ++x) {
+          sum += in[x * channels + c];
+        }
+        for (int x = 0; x < width; ++x) {
+          sums[x * channels + c] = sum;
+          const int enter = x + radius + 1, leave = x - radius;
+          if (enter < width) sum += in[enter * channels + c];
+          if (leave >= 0) sum -= in[leave * channels + c];
+        }
+      }
+    }
+  });
+  const auto extent = [&](int v, int size) {
+    return std::min(v + radius, size - 1) - std::max(v - radius, 0) + 1;
+  };
+  for_blocks(height, 16, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> column(row_bytes);
+    for (int y = begin; y < int(end); ++y) {
+      std::fill(column.begin(), column.end(), 0);
+      for (int ny = std::max(y - radius, 0);
+           ny <= std::min(y + radius, height - 1); ++ny) {
+        const uint32_t *sums = rows.data() + ny * row_bytes;
+        for (size_t b = 0; b < row_bytes; ++b) column[b] += sums[b];
+      }
+      uint8_t *out = img_out + y * row_bytes;
+      const int rows_in = extent(y, height);
+      for (int x = 0; x < width; ++x) {
+        const uint32_t count = rows_in * extent(x, width);
+        for (int c = 0; c < channels; ++c) {
+          out[x * channels + c] = column[x * channels + c] / count;
+        }
+      }
+    }
+  });
+}
+
+/// grayscale_blur_fused in kernels/043-image-blur-separable.c.
+inline void
+grayscale_blur(uint8_t *img_out, const uint8_t *img_in, int width,
+               int height, int radius) {
+  std::vector<uint8_t> gray(size_t(width) * height);
+  color_to_grayscale(gray.data(), img_in, width, height);
+  box_blur(img_out, gray.data(), width, height, 1, radius);
+}
+
+/// kernels/004-matrix-multiply-naive.c
+inline void
+matrix_multiply_naive(int *C, const int *A, const int *B, int N, int M,
+                      int K) {
+  detail::matmul(C, A, B, N, M, K);
+}
+
+/// kernels/005-matrix-multiply-tiled.c
+inline void
+matrix_multiply_tiled2(float *C, const float *A, const float *B, int N, int M,
+                       int K) {
+  detail::matmul(C, A, B, N, M, K);
+}
+
+/// Compares device output against a reference. An element matches when
+/// |got - expected| <= abs_tolerance + rel_tolerance * |expected|. Prints
+/// a one-line summary and returns 0 if every element matches, else -1.
+template <typename T>
+int
+compare(const char *what, const T *got, const T *expected, size_t count,
+        double abs_tolerance = 0, double rel_tolerance = 0) {
+  size_t mismatches = 0, first = 0;
+  double max_error = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const double want = double(expected[i]);
+    const double error = std::fabs(double(got[i]) - want);
+    max_error = std::max(max_error, error);
+    if (!(error <= abs_tolerance + rel_tolerance * std::fabs(want))) {
+      if (mismatches++ == 0) first = i;
+    }
+  }
+  if (mismatches == 0) {
+    std::cout << "Check " << what << ": OK (" << count
+              << " elements, max error " << max_error << ")" << std::endl;
+    return 0;
+  }
+  std::cerr << "ERROR: " << what << " differs from host reference in "
+            << mismatches << " of " << count << " elements; first at " << first
+            << ": got " << +got[first] << ", expected " << +expected[first]
+            << std::endl;
+  return -1;
+}
+
+/// Wall-clock milliseconds taken by fn().
+template <typename F>
+double
+time_ms(F &&fn) {
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/// Prints device and host reference times and the device speedup.
+inline void
+report_speedup(const char *what, double device_ms, double host_ms) {
+  std::cout << std::fixed << std::setprecision(3) << what
+            << ": device " << device_ms << " ms, host reference " << host_ms
+            << " ms (" << pool().size() << " threads, " << isa_name(isa())
+            << "), speedup " << std::setprecision(2)
+            << host_ms / device_ms << "x" << std::defaultfloat << std::endl;
+}
+
+}  // namespace hansa::ref
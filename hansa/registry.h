@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hansa/engine.h"
+#include "hansa/image_writer.h"
+
+namespace hansa {
+
+/// What the command line asked of a kernel launcher.
+struct RunOptions {
+  /// Problem size; its meaning is up to the launcher.
+  int size;
+  int repeats;
+  /// Keep host data in pinned or host-coherent memory the kernels access
+  /// in place, instead of copying it to device-local buffers.
+  bool zero_copy;
+  /// Launch grid-stride kernels in LaunchMode::kPersistent, where the
+  /// launcher has them.
+  bool persistent;
+  /// How launchers that produce images save them.
+  ImageFormat image_format;
+};
+
+/// Filled in by a launcher. Setup covers everything before the first
+/// dispatch, including the first load of the kernel's code object.
+struct RunReport {
+  double setup_ms = 0;
+  /// A streamed upload-and-compute pass before the first dispatch, kept
+  /// out of setup_ms; 0 when the launcher ran none.
+  double streamed_ms = 0;
+  std::vector<double> run_ms;
+  /// Bytes copied between host and device memory, filled in by the caller.
+  uint64_t bytes_copied = 0;
+
+  [[nodiscard]]
+  double
+  median_run_ms() const {
+    if (run_ms.empty()) return 0;
+    std::vector<double> sorted = run_ms;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[sorted.size() / 2];
+  }
+};
+
+using KernelLauncher = int (*)(Engine &engine, const RunOptions &options,
+                               RunReport *report);
+
+struct RegisteredKernel {
+  const char *name;
+  const char *description;
+  /// 0 when the launcher takes no size.
+  int default_size;
+  KernelLauncher launch;
+};
+
+/// Launchers in registration order.
+inline std::vector<RegisteredKernel> &
+kernel_registry() {
+  static std::vector<RegisteredKernel> kernels;
+  return kernels;
+}
+
+inline const RegisteredKernel *
+find_kernel(const std::string &name) {
+  for (const RegisteredKernel &kernel : kernel_registry()) {
+    if (name == kernel.name) return &kernel;
+  }
+  return nullptr;
+}
+
+/// A column that fits every registered name with two spaces to spare.
+inline int
+kernel_name_width() {
+  size_t width = 0;
+  for (const RegisteredKernel &kernel : kernel_registry()) {
+    width = std::max(width, std::strlen(kernel.name));
+  }
+  return int(width) + 2;
+}
+
+/// Registers a launcher from a namespace-scope object's constructor.
+struct KernelRegistrar {
+  explicit KernelRegistrar(const RegisteredKernel &kernel) {
+    kernel_registry().push_back(kernel);
+  }
+};
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+
+  [[nodiscard]]
+  double
+  elapsed_ms() const {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace hansa
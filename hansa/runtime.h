@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+
+#include "hansa/engine.h"
+
+namespace hansa {
+
+/// The process-wide Engine. HSA initialization, agent and region discovery
+/// and queue creation run once, on first use, and everything is torn down
+/// at exit.
+class Runtime {
+ public:
+  /// Brings the runtime up on first call. Returns nullptr if that failed.
+  static Engine *
+  engine() {
+    Runtime &runtime = instance();
+    return runtime.status_ == 0 ? &runtime.engine_ : nullptr;
+  }
+
+  /// Time the first engine() call spent bringing the runtime up.
+  static double
+  cold_start_ms() {
+    return instance().cold_start_ms_;
+  }
+
+ private:
+  Runtime() {
+    const auto start = std::chrono::steady_clock::now();
+    status_ = engine_.init();
+    cold_start_ms_ = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  }
+
+  static Runtime &
+  instance() {
+    static Runtime runtime;
+    return runtime;
+  }
+
+  Engine engine_;
+  int status_;
+  double cold_start_ms_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <hsa/hsa.h>
+
+#include <mutex>
+#include <vector>
+
+#include "hansa/common.h"
+
+namespace hansa {
+
+/// Recycles completion signals so in-flight dispatches each get their own
+/// signal without a hsa_signal_create per launch. Safe to share between
+/// threads.
+class SignalPool {
+ public:
+  SignalPool() = default;
+  SignalPool(const SignalPool &) = delete;
+  SignalPool &
+  operator=(const SignalPool &) = delete;
+
+  ~SignalPool() { clear(); }
+
+  /// Hands out a signal armed with value 1, ready to be used as a packet's
+  /// completion signal.
+  int
+  acquire(hsa_signal_t *out) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      lock.unlock();
+      hsa_status_t status = hsa_signal_create(1, 0, nullptr, out);
+      HSA_ENFORCE("hsa_signal_create", status);
+      return 0;
+    }
+    *out = free_.back();
+    free_.pop_back();
+    hsa_signal_store_relaxed(*out, 1);
+    return 0;
+  }
+
+  /// Returns a signal whose packet has completed.
+  void
+  release(hsa_signal_t signal) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(signal);
+  }
+
+  /// Destroys every pooled signal.
+  void
+  clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (hsa_signal_t signal : free_) hsa_signal_destroy(signal);
+    free_.clear();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<hsa_signal_t> free_;
+};
+
+}  // namespace hansa
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <hsa/hsa.h>
+#include <hsa/hsa_ext_amd.h>
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hansa/wait_policy.h"
+
+namespace hansa {
+
+class EventLoop;
+
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+/// What every Task promise carries: the loop it runs on, passed down to
+/// the tasks it awaits, and the task to resume when it finishes.
+struct TaskPromiseBase {
+  EventLoop *loop = nullptr;
+  std::coroutine_handle<> continuation;
+
+  struct FinalAwaiter {
+    bool
+    await_ready() noexcept {
+      return false;
+    }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> self) noexcept {
+      const std::coroutine_handle<> next = self.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+
+    void
+    await_resume() noexcept {}
+  };
+
+  /// Tasks start when awaited or run by a loop.
+  std::suspend_always
+  initial_suspend() noexcept {
+    return {};
+  }
+
+  FinalAwaiter
+  final_suspend() noexcept {
+    return {};
+  }
+
+  /// Errors here are return codes, as everywhere else.
+  void
+  unhandled_exception() {
+    std::terminate();
+  }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+  std::optional<T> value;
+
+  Task<T>
+  get_return_object();
+
+  void
+  return_value(T v) {
+    value = std::move(v);
+  }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+  Task<void>
+  get_return_object();
+
+  void
+  return_void() {}
+};
+
+}  // namespace detail
+
+/// A coroutine that runs on an EventLoop and can co_await launches
+/// (Engine::launch) and other tasks. Lazy: nothing runs until it is
+/// awaited or handed to a loop.
+template <typename T>
+class Task {
+ public:
+  using promise_type = detail::TaskPromise<T>;
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+  Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task &
+  operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &
+  operator=(const Task &) = delete;
+
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  [[nodiscard]]
+  bool
+  done() const {
+    return !handle_ || handle_.done();
+  }
+
+  bool
+  await_ready() const noexcept {
+    return false;
+  }
+
+  /// Runs this task on the awaiting task's loop, resuming that task when
+  /// this one finishes.
+  template <typename Promise>
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+    handle_.promise().loop = awaiting.promise().loop;
+    handle_.promise().continuation = awaiting;
+    return handle_;
+  }
+
+  T
+  await_resume() {
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*handle_.promise().value);
+    }
+  }
+
+ private:
+  friend class EventLoop;
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T>
+TaskPromise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void>
+TaskPromise<void>::get_return_object() {
+  return Task<void>(
+      std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+/// Runs many tasks on the calling thread. A task that co_awaits a launch
+/// parks on its completion signal; the loop resumes whatever is ready, and
+/// when nothing is, waits on all parked signals at once: polling them for
+/// the spin of its WaitPolicy, then sleeping in hsa_amd_signal_wait_any
+/// until one fires. One thread so keeps hundreds of dispatches in flight
+/// without a thread, or a blocked wait, per job.
+class EventLoop {
+ public:
+  explicit EventLoop(WaitPolicy policy = {}) : policy_(policy) {}
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &
+  operator=(const EventLoop &) = delete;
+
+  /// Takes task over; it starts on the next run().
+  void
+  spawn(Task<> task) {
+    task.handle_.promise().loop = this;
+    ready_.push_back(task.handle_);
+    tasks_.push_back(std::move(task));
+  }
+
+  /// Runs until every spawned task has finished, then forgets them.
+  void
+  run() {
+    for (;;) {
+      while (!ready_.empty()) {
+        const std::coroutine_handle<> next = ready_.front();
+        ready_.pop_front();
+        next.resume();
+      }
+      if (parked_.empty()) break;
+      wait_any();
+    }
+    tasks_.clear();
+  }
+
+  /// Runs task to completion, along with any spawned tasks, and returns
+  /// its result.
+  template <typename T>
+  T
+  run(Task<T> task) {
+    task.handle_.promise().loop = this;
+    ready_.push_back(task.handle_);
+    run();
+    return task.await_resume();
+  }
+
+  /// Resumes awaiting once signal drops below 1.
+  void
+  park(hsa_signal_t signal, std::coroutine_handle<> awaiting) {
+    parked_.push_back({signal, awaiting});
+  }
+
+  /// Dispatches parked on their signals.
+  [[nodiscard]]
+  size_t
+  in_flight() const {
+    return parked_.size();
+  }
+
+  [[nodiscard]]
+  const WaitPolicy &
+  policy() const {
+    return policy_;
+  }
+
+  /// Times wait_any() had to sleep; every other wait was caught spinning.
+  [[nodiscard]]
+  uint64_t
+  blocked_waits() const {
+    return blocked_waits_;
+  }
+
+ private:
+  struct Parked {
+    hsa_signal_t signal;
+    std::coroutine_handle<> awaiting;
+  };
+
+  /// Moves the tasks whose signals have fired to ready_. Returns how many.
+  size_t
+  poll() {
+    size_t fired = 0;
+    for (size_t i = 0; i < parked_.size();) {
+      if (hsa_signal_load_scacquire(parked_[i].signal) < 1) {
+        ready_.push_back(parked_[i].awaiting);
+        parked_[i] = parked_.back();
+        parked_.pop_back();
+        ++fired;
+      } else {
+        ++i;
+      }
+    }
+    return fired;
+  }
+
+  void
+  wait_any() {
+    const auto start = std::chrono::steady_clock::now();
+    do {
+      if (poll() != 0) return;
+    } while (!policy_.spun_out(start));
+
+    signals_.clear();
+    for (const Parked &parked : parked_) signals_.push_back(parked.signal);
+    conditions_.assign(signals_.size(), HSA_SIGNAL_CONDITION_LT);
+    values_.assign(signals_.size(), 1);
+    hsa_signal_value_t value;
+    hsa_amd_signal_wait_any(signals_.size(), signals_.data(),
+                            conditions_.data(), values_.data(), UINT64_MAX,
+                            HSA_WAIT_STATE_BLOCKED, &value);
+    ++blocked_waits_;
+    poll();
+  }
+
+  WaitPolicy policy_;
+  std::vector<Task<>> tasks_;
+  std::deque<std::coroutine_handle<>> ready_;
+  std::vector<Parked> parked_;
+  // Scratch for hsa_amd_signal_wait_any.
+  std::vector<hsa_signal_t> signals_;
+  std::vector<hsa_signal_condition_t> conditions_;
+  std::vector<hsa_signal_value_t> values_;
+  uint64_t blocked_waits_ = 0;
+};
+
+}  // namespace hansa
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <vector>
+
+#include "hansa/engine.h"
+#include "hansa/image_filter.h"
+
+namespace hansa {
+
+/// A neighbourhood filter over interleaved 8-bit images, as TiledImage
+/// runs it: one output pixel per input pixel, computed from the input
+/// pixels at most halo away, with pixels outside the image absent. Run on
+/// a region of a larger image, it so gets every pixel at least halo from
+/// the region's inner edges exactly right.
+struct TileFilter {
+  int in_channels = 3;
+  int out_channels = 3;
+  int halo = 1;
+  /// Posts the filter over a width x height image at in, writing out, and
+  /// sets *handle to its last dispatch. The dispatches may run alongside
+  /// other tiles', so should not be ordered.
+  std::function<int(unsigned char *out, const unsigned char *in, int width,
+                    int height, Engine::DispatchHandle *handle)>
+      post;
+};
+
+/// The 3x3 image_blur_rgb of kernels/003-image-blur.c.
+inline TileFilter
+blur_rgb_filter(Engine &engine) {
+  TileFilter filter;
+  filter.post = [&engine](unsigned char *out, const unsigned char *in,
+                          int width, int height,
+                          Engine::DispatchHandle *handle) {
+    struct args_t {
+      unsigned char *img_out;
+      const unsigned char *img_in;
+      int width;
+      int height;
+    };
+    Engine::KernelDispatchConfig cfg(
+        Engine::kKernelLibrary, "image_blur_rgb.kd", {width, height, 1},
+        Engine::KernelDispatchConfig::kAutoWorkgroup);
+    cfg.ordered = false;
+    return engine.post(&cfg, args_t{out, in, width, height}, handle);
+  };
+  return filter;
+}
+
+/// image_blur_separable or grayscale_blur_fused from
+/// kernels/043-image-blur-separable.c, on interleaved RGB.
+inline TileFilter
+separable_blur_filter(Engine &engine, const SeparableBlur &blur) {
+  TileFilter filter;
+  filter.out_channels = blur.channels();
+  filter.halo = blur.radius;
+  filter.post = [&engine, blur](unsigned char *out, const unsigned char *in,
+                                int width, int height,
+                                Engine::DispatchHandle *handle) {
+    struct args_t {
+      unsigned char *img_out;
+      const unsigned char *img_in;
+      int width;
+      int height;
+      int radius;
+      int planar;
+    };
+    Engine::KernelDispatchConfig cfg = blur.dispatch_config(width, height);
+    cfg.ordered = false;
+    return engine.post(&cfg, args_t{out, in, width, height, blur.radius, 0},
+                       handle);
+  };
+  return filter;
+}
+
+struct TileOptions {
+  /// Output pixels per tile; each tile also reads a halo around them.
+  int tile_width = 2048;
+  int tile_height = 2048;
+  /// Device memory for the tiles' input and output buffers, across every
+  /// tile in flight, before the allocator rounds to its size classes.
+  size_t device_budget = size_t(256) << 20;
+  /// Tiles being uploaded, run or read back at once, budget allowing.
+  unsigned max_in_flight = 3;
+};
+
+struct TileStats {
+  size_t tiles = 0;
+  unsigned in_flight = 0;
+  /// Device bytes the tile buffers took.
+  size_t working_set = 0;
+  /// Input bytes uploaded more than once, for the halos.
+  size_t halo_bytes = 0;
+};
+
+/// Runs a TileFilter over an image too large for the device, or for the
+/// memory it may take, a tile at a time.
+///
+/// The output is cut into tiles of up to tile_width x tile_height. Each
+/// tile's input region is the tile grown by the filter's halo on every
+/// side, clipped to the image; the filter runs on the region as if it
+/// were a whole image, and only the tile's part of its output is kept.
+/// Clipping at the image edges means edge pixels see exactly the
+/// neighbours they would in one pass over the image, so the tiles stitch
+/// together without seams.
+///
+/// Tiles cycle through up to max_in_flight slots, each with device
+/// buffers for one region's input and output, as ImageBatch cycles images:
+/// a slot's tile is read back only when the slot comes round again, so
+/// one tile uploads while the others run. Peak device memory is the slots'
+/// buffers, whatever the image size.
+class TiledImage {
+ public:
+  TiledImage(Engine &engine, TileFilter filter, TileOptions options = {})
+      : engine_(engine),
+        filter_(std::move(filter)),
+        options_(std::move(options)) {}
+
+  /// Filters the width x height image at in into out, both host memory.
+  int
+  run(unsigned char *out, const unsigned char *in, int width, int height,
+      TileStats *stats = nullptr) {
+    const int tile_w = std::min(options_.tile_width, width);
+    const int tile_h = std::min(options_.tile_height, height);
+    if (tile_w < 1 || tile_h < 1 || filter_.halo < 0) {
+      std::cerr << "ERROR: Invalid tile size " << options_.tile_width << "x"
+                << options_.tile_height << std::endl;
+      return -1;
+    }
+    const size_t region_pixels =
+        size_t(std::min(tile_w + 2 * filter_.halo, width)) *
+        std::min(tile_h + 2 * filter_.halo, height);
+    const size_t slot_bytes =
+        region_pixels * (filter_.in_channels + filter_.out_channels);
+    const size_t tiles_x = (width + tile_w - 1) / tile_w;
+    const size_t tiles = tiles_x * ((height + tile_h - 1) / tile_h);
+    const size_t fit = options_.device_budget / slot_bytes;
+    if (fit == 0) {
+      std::cerr << "ERROR: A " << tile_w << "x" << tile_h
+                << " tile with a halo of " << filter_.halo << " needs "
+                << slot_bytes << " bytes of device memory, more than the "
+                << options_.device_budget << " budgeted" << std::endl;
+      return -1;
+    }
+    std::vector<Slot> slots(std::min<size_t>(
+        {fit, std::max(1u, options_.max_in_flight), tiles}));
+    for (Slot &slot : slots) {
+      slot.input.emplace(engine_, region_pixels * filter_.in_channels);
+      slot.output.emplace(engine_, region_pixels * filter_.out_channels);
+      if (!slot.input->data() || !slot.output->data()) {
+        std::cerr << "ERROR: Failed to allocate tile buffers" << std::endl;
+        return -1;
+      }
+    }
+
+    size_t uploaded = 0;
+    for (size_t t = 0; t < tiles; ++t) {
+      Slot &slot = slots[t % slots.size()];
+      if (0 != retire(&slot, out, width)) return abandon(&slots);
+      const int x = int(t % tiles_x) * tile_w;
+      const int y = int(t / tiles_x) * tile_h;
+      slot.tile = {x, y, std::min(tile_w, width - x),
+                   std::min(tile_h, height - y)};
+      if (0 != dispatch(&slot, in, width, height)) return abandon(&slots);
+      uploaded += slot.region.pixels() * filter_.in_channels;
+    }
+    // Retire the remaining tiles, oldest first.
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (0 != retire(&slots[(tiles + i) % slots.size()], out, width)) {
+        return abandon(&slots);
+      }
+    }
+    if (stats) {
+      stats->tiles = tiles;
+      stats->in_flight = slots.size();
+      stats->working_set = slots.size() * slot_bytes;
+      stats->halo_bytes =
+          uploaded - size_t(width) * height * filter_.in_channels;
+    }
+    return 0;
+  }
+
+ private:
+  struct Rect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    [[nodiscard]]
+    size_t
+    pixels() const {
+      return size_t(width) * height;
+    }
+  };
+
+  /// One tile in flight and the buffers it owns.
+  struct Slot {
+    std::optional<DeviceBuffer<unsigned char>> input;
+    std::optional<DeviceBuffer<unsigned char>> output;
+    /// Host rows of a region narrower than the image, gathered for one
+    /// copy.
+    std::vector<unsigned char> rows;
+    Engine::DispatchHandle handle;
+    Rect tile;
+    Rect region;
+    bool busy = false;
+  };
+
+  /// Uploads the slot's tile region and posts the filter over it.
+  int
+  dispatch(Slot *slot, const unsigned char *in, int width, int height) {
+    const Rect &tile = slot->tile;
+    const int x0 = std::max(tile.x - filter_.halo, 0);
+    const int y0 = std::max(tile.y - filter_.halo, 0);
+    const int x1 = std::min(tile.x + tile.width + filter_.halo, width);
+    const int y1 = std::min(tile.y + tile.height + filter_.halo, height);
+    slot->region = {x0, y0, x1 - x0, y1 - y0};
+    const Rect &region = slot->region;
+
+    const size_t pixel = filter_.in_channels;
+    const size_t row = region.width * pixel;
+    const unsigned char *src = in + (size_t(y0) * width + x0) * pixel;
+    // Full-width regions are contiguous in the image already.
+    if (region.width != width) {
+      slot->rows.resize(row * region.height);
+      for (int r = 0; r < region.height; ++r) {
+        std::memcpy(slot->rows.data() + r * row,
+                    src + size_t(r) * width * pixel, row);
+      }
+      src = slot->rows.data();
+    }
+    if (0 != engine_.copy_to_device(slot->input->data(), src,
+                                    row * region.height)) {
+      return -1;
+    }
+    if (0 != filter_.post(slot->output->data(), slot->input->data(),
+                          region.width, region.height, &slot->handle)) {
+      return -1;
+    }
+    slot->busy = true;
+    return 0;
+  }
+
+  /// Waits for the slot's tile, if any, and copies its part of the region
+  /// output into out.
+  int
+  retire(Slot *slot, unsigned char *out, int width) {
+    if (!slot->busy) return 0;
+    slot->busy = false;
+    if (0 != engine_.wait(slot->handle)) {
+      std::cerr << "ERROR: Tile dispatch failed" << std::endl;
+      return -1;
+    }
+    const Rect &tile = slot->tile;
+    const Rect &region = slot->region;
+    const size_t pixel = filter_.out_channels;
+    const size_t row = region.width * pixel;
+    // Only the region rows the tile covers come back.
+    const unsigned char *band =
+        slot->output->data() + (tile.y - region.y) * row;
+    unsigned char *dst = out + (size_t(tile.y) * width + tile.x) * pixel;
+    // A region can span the image while its tile does not, when the tile
+    // is no wider than the halo; only a full-width tile lines up.
+    if (tile.x == region.x && tile.width == width) {
+      return engine_.copy_to_host(dst, band, row * tile.height);
+    }
+    slot->rows.resize(row * tile.height);
+    if (0 != engine_.copy_to_host(slot->rows.data(), band,
+                                  row * tile.height)) {
+      return -1;
+    }
+    for (int r = 0; r < tile.height; ++r) {
+      std::memcpy(dst + size_t(r) * width * pixel,
+                  slot->rows.data() + r * row + (tile.x - region.x) * pixel,
+                  tile.width * pixel);
+    }
+    return 0;
+  }
+
+  /// Waits out the tiles still in flight, whose output is dropped, so their
+  /// buffers are not freed while kernels write them. Returns -1.
+  int
+  abandon(std::vector<Slot> *slots) {
+    for (Slot &slot : *slots) {
+      if (slot.busy) engine_.wait(slot.handle);
+      slot.busy = false;
+    }
+    return -1;
+  }
+
+  Engine &engine_;
+  TileFilter filter_;
+  TileOptions options_;
+};
+
+}  // namespace hansa
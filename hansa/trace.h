@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace hansa {
+
+/// Host spans time with the TSC where there is one: a couple of
+/// nanoseconds per read, against tens for steady_clock. Tracer converts
+/// ticks to nanoseconds when it writes the trace.
+inline uint64_t
+trace_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/// steady_clock nanoseconds, the clock device times are correlated to.
+inline uint64_t
+trace_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+enum class TraceTrack : uint8_t {
+  /// A span on the recording thread, in trace_ticks().
+  kHost,
+  /// A dispatch on the device, in trace_now_ns() nanoseconds.
+  kDevice,
+};
+
+/// One complete span. Names are string literals or Tracer::intern()ed, so
+/// recording one copies pointers, never strings.
+struct TraceEvent {
+  const char *name;
+  uint64_t begin;
+  uint64_t end;
+  /// Shown under arg_name when arg_name is set.
+  const char *arg_name;
+  uint64_t arg;
+  TraceTrack track;
+};
+
+/// A fixed ring of the newest events of one thread. Only the owning thread
+/// pushes, so a push is a store and a release of the head; once full, each
+/// push overwrites the oldest event.
+class TraceRing {
+ public:
+  static constexpr size_t kCapacity = size_t(1) << 16;
+
+  explicit TraceRing(uint32_t tid) : tid_(tid), events_(kCapacity) {}
+
+  void
+  push(const TraceEvent &event) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    events_[head & (kCapacity - 1)] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  /// Appends the events still in the ring, oldest first. Events the owner
+  /// overwrites while they are copied are dropped, not torn.
+  void
+  snapshot(std::vector<TraceEvent> *out) const {
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    const uint64_t first = head > kCapacity ? head - kCapacity : 0;
+    const size_t start = out->size();
+    for (uint64_t i = first; i < head; ++i) {
+      out->push_back(events_[i & (kCapacity - 1)]);
+    }
+    // Event i shares its slot with i + kCapacity, which may be half written
+    // once the head has reached it.
+    const uint64_t after = head_.load(std::memory_order_acquire);
+    if (after + 1 > first + kCapacity) {
+      const uint64_t lost =
+          std::min(after + 1 - kCapacity - first, head - first);
+      out->erase(out->begin() + start, out->begin() + start + lost);
+    }
+  }
+
+  [[nodiscard]]
+  uint32_t
+  tid() const {
+    return tid_;
+  }
+
+  /// Events pushed over the ring's life, kept or not.
+  [[nodiscard]]
+  uint64_t
+  pushed() const {
+    return head_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const uint32_t tid_;
+  std::atomic<uint64_t> head_{0};
+  std::vector<TraceEvent> events_;
+};
+
+/// The process's trace: a TraceRing per thread that has recorded, and the
+/// clock calibration to write them out as Chrome trace JSON, which
+/// chrome://tracing and ui.perfetto.dev open.
+///
+/// Recording is off until enable(); spans then cost two TSC reads and a
+/// push. bench/trace_bench measured about 35 ns (73 TSC ticks) per span
+/// with recording on, on a VM where one TSC read takes 16 ns, and under a
+/// nanosecond with it off. Built without HANSA_TRACE, the HANSA_TRACE_*
+/// macros are empty and nothing is recorded at all.
+class Tracer {
+ public:
+  static Tracer &
+  instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  void
+  enable() {
+    enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]]
+  static bool
+  enabled() {
+    return instance().enabled_.load(std::memory_order_relaxed);
+  }
+
+  /// The calling thread's ring, created on its first event. Rings outlive
+  /// their threads, so a pool's spans survive the pool.
+  TraceRing &
+  ring() {
+    thread_local TraceRing *ring = nullptr;
+    if (!ring) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings_.push_back(std::make_unique<TraceRing>(rings_.size() + 1));
+      ring = rings_.back().get();
+    }
+    return *ring;
+  }
+
+  void
+  record(const TraceEvent &event) {
+    ring().push(event);
+  }
+
+  /// A copy of name that lives as long as the process, for event names
+  /// built at run time, such as kernel symbols.
+  const char *
+  intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return names_.insert(name).first->c_str();
+  }
+
+  /// Writes every ring's events. Threads may keep recording meanwhile;
+  /// what they record after the rings are read is left out.
+  int
+  write_chrome_json(const std::string &path) {
+    std::vector<TraceEvent> events;
+    std::vector<std::pair<uint32_t, size_t>> ends;
+    uint64_t pushed = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto &ring : rings_) {
+        ring->snapshot(&events);
+        ends.emplace_back(ring->tid(), events.size());
+        pushed += ring->pushed();
+      }
+    }
+    const double ns_per_tick = calibrate();
+
+    std::ofstream out(path);
+    if (!out) {
+      std::cerr << "ERROR: Failed to open " << path << std::endl;
+      return -1;
+    }
+    out << std::fixed << std::setprecision(3)
+        << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+        << R"({"ph":"M","pid":1,"name":"process_name",)"
+        << R"("args":{"name":"host"}},)" << "\n"
+        << R"({"ph":"M","pid":2,"name":"process_name",)"
+        << R"("args":{"name":"device"}},)" << "\n"
+        << R"({"ph":"M","pid":2,"tid":0,"name":"thread_name",)"
+        << R"("args":{"name":"queue"}})";
+    size_t begin = 0;
+    for (const auto &[tid, end] : ends) {
+      for (; begin < end; ++begin) {
+        const TraceEvent &e = events[begin];
+        // Chrome traces count microseconds from any origin; ours is the
+        // tracer's construction.
+        double ts, dur;
+        if (e.track == TraceTrack::kHost) {
+          ts = double(int64_t(e.begin - epoch_ticks_)) * ns_per_tick;
+          dur = double(e.end - e.begin) * ns_per_tick;
+        } else {
+          ts = double(int64_t(e.begin - epoch_ns_));
+          dur = double(e.end - e.begin);
+        }
+        const bool host = e.track == TraceTrack::kHost;
+        out << ",\n{\"ph\":\"X\",\"name\":\"" << e.name << "\",\"pid\":"
+            << (host ? 1 : 2) << ",\"tid\":" << (host ? tid : 0)
+            << ",\"ts\":" << ts / 1e3 << ",\"dur\":" << dur / 1e3;
+        if (e.arg_name) {
+          out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+        }
+        out << "}";
+      }
+    }
+    out << "\n]}\n";
+    if (!out) {
+      std::cerr << "ERROR: Failed to write " << path << std::endl;
+      return -1;
+    }
+    std::cout << "Wrote " << events.size() << " trace events to " << path;
+    if (pushed > events.size()) {
+      std::cout << " (" << pushed - events.size()
+                << " older ones were overwritten)";
+    }
+    std::cout << std::endl;
+    return 0;
+  }
+
+ private:
+  Tracer() : epoch_ticks_(trace_ticks()), epoch_ns_(trace_now_ns()) {}
+
+  /// Nanoseconds per trace_ticks() tick, from the ticks and nanoseconds
+  /// elapsed since construction.
+  [[nodiscard]]
+  double
+  calibrate() const {
+#if defined(__x86_64__) || defined(__i386__)
+    const uint64_t ticks = trace_ticks() - epoch_ticks_;
+    const uint64_t ns = trace_now_ns() - epoch_ns_;
+    return ticks ? double(ns) / ticks : 1;
+#else
+    return 1;
+#endif
+  }
+
+  const uint64_t epoch_ticks_;
+  const uint64_t epoch_ns_;
+  std::atomic<bool> enabled_{false};
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<TraceRing>> rings_;
+  std::unordered_set<std::string> names_;
+};
+
+/// Records the span from its construction to its destruction on the
+/// calling thread, when tracing is enabled.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char *name, const char *arg_name = nullptr,
+                     uint64_t arg = 0)
+      : name_(Tracer::enabled() ? name : nullptr),
+        arg_name_(arg_name),
+        arg_(arg),
+        begin_(name_ ? trace_ticks() : 0) {}
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &
+  operator=(const TraceSpan &) = delete;
+
+  ~TraceSpan() {
+    if (name_) {
+      Tracer::instance().record(
+          {name_, begin_, trace_ticks(), arg_name_, arg_, TraceTrack::kHost});
+    }
+  }
+
+ private:
+  const char *name_;
+  const char *arg_name_;
+  uint64_t arg_;
+  uint64_t begin_;
+};
+
+}  // namespace hansa
+
+#ifdef HANSA_TRACE
+#define HANSA_TRACE_CONCAT_(a, b) a##b
+#define HANSA_TRACE_CONCAT(a, b) HANSA_TRACE_CONCAT_(a, b)
+/// Traces the rest of the enclosing scope as name.
+#define HANSA_TRACE_SPAN(name) \
+  ::hansa::TraceSpan HANSA_TRACE_CONCAT(hansa_trace_span_, __LINE__)(name)
+/// As HANSA_TRACE_SPAN, with one numeric arg, such as a byte count.
+#define HANSA_TRACE_SPAN_ARG(name, arg_name, arg)                    \
+  ::hansa::TraceSpan HANSA_TRACE_CONCAT(hansa_trace_span_, __LINE__)( \
+      name, arg_name, arg)
+#else
+#define HANSA_TRACE_SPAN(name) static_cast<void>(0)
+#define HANSA_TRACE_SPAN_ARG(name, arg_name, arg) static_cast<void>(0)
+#endif
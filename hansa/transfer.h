@@ -0,0 +1,284 @@
+#pragma once
+
+#include <hsa/hsa.h>
+#include <hsa/hsa_ext_amd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "hansa/common.h"
+#include "hansa/memory_pool.h"
+#include "hansa/trace.h"
+#include "hansa/wait_policy.h"
+
+namespace hansa {
+
+/// Bytes moved in one direction, and the wall time spent moving them.
+struct TransferStats {
+  uint64_t bytes = 0;
+  uint64_t chunks = 0;
+  double ms = 0;
+
+  [[nodiscard]]
+  double
+  gb_per_s() const {
+    return ms > 0 ? bytes / (ms * 1e6) : 0;
+  }
+};
+
+/// Copies between host memory and device memory on the agent's DMA
+/// engines with hsa_amd_memory_async_copy, a chunk at a time through two
+/// pinned staging chunks: while the DMA engine moves one chunk, the host
+/// fills or drains the other. A chunk's completion signal is what frees
+/// its staging chunk again.
+///
+/// Copies can wait on other signals first, so a copy into memory a kernel
+/// still reads can be issued early and start as the kernel ends; see
+/// Engine::stream_upload().
+///
+/// Until init(), e.g. on the host backend, every copy is a memcpy.
+class ChunkedTransfer {
+ public:
+  static constexpr size_t kDefaultChunkSize = 4 * 1024 * 1024;
+
+  ChunkedTransfer() = default;
+  ChunkedTransfer(const ChunkedTransfer &) = delete;
+  ChunkedTransfer &
+  operator=(const ChunkedTransfer &) = delete;
+
+  ~ChunkedTransfer() { reset(); }
+
+  /// Staging chunks come from staging, which must be pinned host memory
+  /// gpu can access.
+  int
+  init(hsa_agent_t gpu, hsa_agent_t cpu, CachingAllocator *staging,
+       size_t chunk_size = kDefaultChunkSize) {
+    gpu_ = gpu;
+    cpu_ = cpu;
+    staging_ = staging;
+    for (Slot &slot : slots_) {
+      hsa_status_t status = hsa_signal_create(0, 0, nullptr, &slot.done);
+      HSA_ENFORCE("hsa_signal_create", status);
+    }
+    return set_chunk_size(chunk_size);
+  }
+
+  /// Waits for every copy in flight, then stages chunk_size bytes at a
+  /// time. Larger chunks amortize the per-copy cost; smaller ones start
+  /// overlapping sooner.
+  int
+  set_chunk_size(size_t chunk_size) {
+    if (chunk_size == 0) {
+      std::cerr << "ERROR: Transfer chunk size must be positive" << std::endl;
+      return -1;
+    }
+    finish();
+    chunk_size_ = chunk_size;
+    if (!staging_) return 0;
+    for (Slot &slot : slots_) {
+      slot.staging = staging_->allocate_buffer(chunk_size);
+      HSA_ENFORCE_PTR("Failed to allocate staging memory", slot.staging.get())
+    }
+    return 0;
+  }
+
+  /// Waits for every copy in flight and frees the staging chunks.
+  void
+  reset() {
+    finish();
+    for (Slot &slot : slots_) {
+      if (slot.done.handle) hsa_signal_destroy(slot.done);
+      slot = Slot{};
+    }
+    staging_ = nullptr;
+  }
+
+  [[nodiscard]]
+  size_t
+  chunk_size() const {
+    return chunk_size_;
+  }
+
+  /// Copies host src to device dst; returns once dst holds it.
+  int
+  upload(void *dst, const void *src, size_t size) {
+    HANSA_TRACE_SPAN_ARG("copy to device", "bytes", size);
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t done = 0; done < size; done += chunk_size_) {
+      const size_t n = std::min(chunk_size_, size - done);
+      hsa_signal_t copied;
+      if (0 != upload_async(static_cast<uint8_t *>(dst) + done,
+                            static_cast<const uint8_t *>(src) + done, n,
+                            nullptr, 0, &copied)) {
+        return -1;
+      }
+    }
+    finish();
+    h2d_.bytes += size;
+    h2d_.chunks += (size + chunk_size_ - 1) / chunk_size_;
+    h2d_.ms += elapsed_ms(start);
+    return 0;
+  }
+
+  /// Copies device src to host dst; returns once dst holds it. The host
+  /// drains chunk k from staging while the DMA engine fills chunk k + 1.
+  int
+  download(void *dst, const void *src, size_t size) {
+    HANSA_TRACE_SPAN_ARG("copy to host", "bytes", size);
+    const auto start = std::chrono::steady_clock::now();
+    if (!staged()) {
+      std::memcpy(dst, src, size);
+    } else {
+      size_t pending = 0, pending_size = 0;
+      Slot *pending_slot = nullptr;
+      for (size_t done = 0; done < size; done += chunk_size_) {
+        const size_t n = std::min(chunk_size_, size - done);
+        Slot &slot = next_slot();
+        hsa_signal_store_relaxed(slot.done, 1);
+        hsa_status_t status = hsa_amd_memory_async_copy(
+            slot.staging.get(), cpu_, static_cast<const uint8_t *>(src) + done,
+            gpu_, n, 0, nullptr, slot.done);
+        if (status != HSA_STATUS_SUCCESS) {
+          hsa_signal_store_relaxed(slot.done, 0);
+          finish();
+          HSA_ENFORCE("hsa_amd_memory_async_copy", status);
+        }
+        if (pending_slot) drain(pending_slot, dst, pending, pending_size);
+        pending_slot = &slot;
+        pending = done;
+        pending_size = n;
+      }
+      if (pending_slot) drain(pending_slot, dst, pending, pending_size);
+    }
+    d2h_.bytes += size;
+    d2h_.chunks += (size + chunk_size_ - 1) / chunk_size_;
+    d2h_.ms += elapsed_ms(start);
+    return 0;
+  }
+
+  /// Starts copying size bytes, at most chunk_size(), of host src to
+  /// device dst once every signal in deps has dropped below 1, and sets
+  /// *copied to the signal that drops when dst holds them. src may be
+  /// reused on return. *copied stays valid until the second upload_async
+  /// after this one, which reuses its staging chunk; it is a null signal
+  /// when the copy was a memcpy, done already. Callers account for the
+  /// bytes with add_streamed(), as only they know the time to charge.
+  int
+  upload_async(void *dst, const void *src, size_t size,
+               const hsa_signal_t *deps, uint32_t dep_count,
+               hsa_signal_t *copied) {
+    if (size > chunk_size_) {
+      std::cerr << "ERROR: " << size << "-byte async upload exceeds the "
+                << chunk_size_ << "-byte transfer chunk" << std::endl;
+      return -1;
+    }
+    if (!staged()) {
+      std::memcpy(dst, src, size);
+      *copied = hsa_signal_t{0};
+      return 0;
+    }
+    Slot &slot = next_slot();
+    HANSA_TRACE_SPAN_ARG("stage chunk", "bytes", size);
+    std::memcpy(slot.staging.get(), src, size);
+    hsa_signal_store_relaxed(slot.done, 1);
+    hsa_status_t status =
+        hsa_amd_memory_async_copy(dst, gpu_, slot.staging.get(), cpu_, size,
+                                  dep_count, deps, slot.done);
+    if (status != HSA_STATUS_SUCCESS) hsa_signal_store_relaxed(slot.done, 0);
+    HSA_ENFORCE("hsa_amd_memory_async_copy", status);
+    *copied = slot.done;
+    return 0;
+  }
+
+  /// Waits for every copy in flight.
+  void
+  finish() {
+    for (Slot &slot : slots_) {
+      if (slot.done.handle) wait_signal(slot.done, WaitPolicy{});
+    }
+  }
+
+  /// Host to device through upload(), including the staging memcpy.
+  [[nodiscard]]
+  const TransferStats &
+  h2d() const {
+    return h2d_;
+  }
+
+  /// Host to device through upload_async(), timed over the streams that
+  /// issued them, kernels included, so a lower bound on bandwidth.
+  [[nodiscard]]
+  const TransferStats &
+  streamed() const {
+    return streamed_;
+  }
+
+  void
+  add_streamed(uint64_t bytes, uint64_t chunks, double ms) {
+    streamed_.bytes += bytes;
+    streamed_.chunks += chunks;
+    streamed_.ms += ms;
+  }
+
+  /// Device to host, including the staging memcpy.
+  [[nodiscard]]
+  const TransferStats &
+  d2h() const {
+    return d2h_;
+  }
+
+ private:
+  struct Slot {
+    PoolBuffer staging;
+    /// At 1 while a copy through staging is in flight.
+    hsa_signal_t done{0};
+  };
+
+  [[nodiscard]]
+  bool
+  staged() const {
+    return slots_[0].staging.get() != nullptr;
+  }
+
+  /// The slot after the last one used, once its copy has completed.
+  Slot &
+  next_slot() {
+    Slot &slot = slots_[next_];
+    next_ = (next_ + 1) % slots_.size();
+    wait_signal(slot.done, WaitPolicy{});
+    return slot;
+  }
+
+  /// Copies a completed download chunk out of staging.
+  static void
+  drain(Slot *slot, void *dst, size_t offset, size_t size) {
+    wait_signal(slot->done, WaitPolicy{});
+    HANSA_TRACE_SPAN_ARG("drain chunk", "bytes", size);
+    std::memcpy(static_cast<uint8_t *>(dst) + offset, slot->staging.get(),
+                size);
+  }
+
+  static double
+  elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  hsa_agent_t gpu_{0};
+  hsa_agent_t cpu_{0};
+  CachingAllocator *staging_ = nullptr;
+  size_t chunk_size_ = kDefaultChunkSize;
+  std::array<Slot, 2> slots_;
+  size_t next_ = 0;
+  TransferStats h2d_;
+  TransferStats streamed_;
+  TransferStats d2h_;
+};
+
+}  // namespace hansa
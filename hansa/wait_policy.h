@@ -0,0 +1,52 @@
+#pragma once
+
+#include <hsa/hsa.h>
+
+#include <chrono>
+#include <cstdint>
+
+namespace hansa {
+
+/// How a host thread waits for a completion signal: it polls the signal for
+/// up to spin, then sleeps in the runtime until the signal fires. Polling
+/// holds a core but notices completion within a memory round trip;
+/// sleeping frees the core at the cost of an interrupt and a wakeup, tens
+/// of microseconds on a short kernel.
+struct WaitPolicy {
+  /// Zero blocks at once; nanoseconds::max() never blocks.
+  std::chrono::nanoseconds spin{0};
+
+  static WaitPolicy
+  blocking() {
+    return {};
+  }
+
+  static WaitPolicy
+  spin_then_block(std::chrono::nanoseconds spin) {
+    return {spin};
+  }
+
+  /// Whether a wait that began at start has spun long enough to block.
+  [[nodiscard]]
+  bool
+  spun_out(std::chrono::steady_clock::time_point start) const {
+    return spin != std::chrono::nanoseconds::max() &&
+           std::chrono::steady_clock::now() - start >= spin;
+  }
+};
+
+/// Waits under policy until signal drops below 1 and returns its value.
+inline hsa_signal_value_t
+wait_signal(hsa_signal_t signal, const WaitPolicy &policy) {
+  if (policy.spin.count() > 0) {
+    const auto start = std::chrono::steady_clock::now();
+    do {
+      const hsa_signal_value_t value = hsa_signal_load_scacquire(signal);
+      if (value < 1) return value;
+    } while (!policy.spun_out(start));
+  }
+  return hsa_signal_wait_scacquire(signal, HSA_SIGNAL_CONDITION_LT, 1,
+                                   UINT64_MAX, HSA_WAIT_STATE_BLOCKED);
+}
+
+}  // namespace hansa
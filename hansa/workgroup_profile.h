@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hansa/device/workgroup_profile.h"
+
+namespace hansa {
+
+using WorkgroupRecord = hansa_workgroup_record;
+
+/// Records ready for a dispatch: nothing started, nothing ended.
+inline std::vector<WorkgroupRecord>
+blank_workgroup_records(size_t count) {
+  return std::vector<WorkgroupRecord>(count, {UINT64_MAX, 0, 0, 0});
+}
+
+/// Where a wave ran, decoded from the hw_id of its workgroup's record.
+struct HwLocation {
+  /// Shader engine and shader array (SA on gfx10 and later).
+  uint32_t se = 0;
+  uint32_t sh = 0;
+  /// The CU within the array; a WGP on gfx10 and later, and the worker
+  /// thread on the host backend.
+  uint32_t cu = 0;
+  uint32_t simd = 0;
+  uint32_t wave = 0;
+
+  static HwLocation
+  decode(uint32_t hw_id, const std::string &isa) {
+    HwLocation where;
+    if (isa.compare(0, 3, "gfx") != 0) {
+      where.cu = hw_id;
+      return where;
+    }
+    if (std::atoi(isa.c_str() + 3) / 100 >= 10) {
+      // HW_ID1: wave 4:0, simd 9:8, wgp 13:10, sa 16, se 20:18.
+      where.wave = hw_id & 0x1f;
+      where.simd = (hw_id >> 8) & 0x3;
+      where.cu = (hw_id >> 10) & 0xf;
+      where.sh = (hw_id >> 16) & 0x1;
+      where.se = (hw_id >> 18) & 0x7;
+    } else {
+      // HW_ID: wave 3:0, simd 5:4, cu 11:8, sh 12, se 15:13.
+      where.wave = hw_id & 0xf;
+      where.simd = (hw_id >> 4) & 0x3;
+      where.cu = (hw_id >> 8) & 0xf;
+      where.sh = (hw_id >> 12) & 0x1;
+      where.se = (hw_id >> 13) & 0x7;
+    }
+    return where;
+  }
+
+  /// Orders and identifies compute units, ignoring simd and wave.
+  [[nodiscard]]
+  uint32_t
+  unit() const {
+    return se << 16 | sh << 8 | cu;
+  }
+
+  /// e.g. se1.sh0.cu7
+  [[nodiscard]]
+  std::string
+  name() const {
+    return "se" + std::to_string(se) + ".sh" + std::to_string(sh) + ".cu" +
+           std::to_string(cu);
+  }
+};
+
+/// The workgroup records of one dispatch, with what it takes to read them
+/// away from the agent that wrote them.
+struct WorkgroupTrace {
+  std::string symbol;
+  /// Selects the hw_id layout; "host" for the host backend.
+  std::string isa;
+  double tick_ns = 1;
+  std::array<uint32_t, 3> blocks{1, 1, 1};
+  std::vector<WorkgroupRecord> records;
+
+  /// A text file: a header line, then start, end, hw_id and waves of one
+  /// workgroup per line.
+  int
+  save(const std::string &path) const {
+    std::ofstream out(path, std::ios::trunc);
+    out << "hansa-workgroups 1 " << symbol << " " << isa << " "
+        << std::setprecision(17) << tick_ns << " " << blocks[0] << " "
+        << blocks[1] << " " << blocks[2] << "\n";
+    for (const WorkgroupRecord &r : records) {
+      out << r.start << " " << r.end << " " << r.hw_id << " " << r.waves
+          << "\n";
+    }
+    if (!out) {
+      std::cerr << "ERROR: Failed to write workgroup trace " << path
+                << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  static int
+  load(const std::string &path, WorkgroupTrace *trace) {
+    std::ifstream in(path);
+    std::string magic;
+    int version = 0;
+    WorkgroupTrace t;
+    if (!(in >> magic >> version >> t.symbol >> t.isa >> t.tick_ns >>
+          t.blocks[0] >> t.blocks[1] >> t.blocks[2]) ||
+        magic != "hansa-workgroups" || version != 1) {
+      std::cerr << "ERROR: " << path << " is not a workgroup trace"
+                << std::endl;
+      return -1;
+    }
+    WorkgroupRecord r;
+    while (in >> r.start >> r.end >> r.hw_id >> r.waves) {
+      t.records.push_back(r);
+    }
+    const size_t expected = size_t(t.blocks[0]) * t.blocks[1] * t.blocks[2];
+    if (t.records.size() != expected) {
+      std::cerr << "ERROR: " << path << " has " << t.records.size()
+                << " workgroup records, expected " << expected << std::endl;
+      return -1;
+    }
+    *trace = std::move(t);
+    return 0;
+  }
+};
+
+/// Per-workgroup durations and per-CU residency over one dispatch. Only
+/// workgroups whose record has both timestamps count; the rest ran
+/// uninstrumented code.
+struct WorkgroupAnalysis {
+  static constexpr int kHistogramBins = 12;
+
+  size_t workgroups = 0;
+  size_t recorded = 0;
+  /// From the first start to the last end.
+  double span_us = 0;
+  double min_us = 0;
+  double median_us = 0;
+  double p95_us = 0;
+  double p99_us = 0;
+  double max_us = 0;
+  /// Durations in kHistogramBins equal bins from min_us to p99_us; the
+  /// last bin also holds the longest 1%, so outliers do not squeeze the
+  /// rest into one bin.
+  std::vector<size_t> histogram;
+  double bin_us = 0;
+
+  struct Unit {
+    HwLocation where;
+    size_t workgroups = 0;
+    /// Summed workgroup time; more than the span when they overlap.
+    double busy_us = 0;
+    /// Mean resident workgroups in each slice of the span.
+    std::vector<double> timeline;
+  };
+  /// In (se, sh, cu) order.
+  std::vector<Unit> units;
+
+  /// Linear ids of the longest workgroups, longest first.
+  std::vector<size_t> slowest;
+
+  /// The longest workgroup over the median one; 1 is perfectly even.
+  [[nodiscard]]
+  double
+  imbalance() const {
+    return median_us > 0 ? max_us / median_us : 0;
+  }
+};
+
+/// Works on any trace, recorded now or loaded from a file, so it needs no
+/// agent.
+inline WorkgroupAnalysis
+analyze_workgroups(const WorkgroupTrace &trace, int timeline_slices = 48,
+                   size_t slowest = 3) {
+  WorkgroupAnalysis a;
+  a.workgroups = trace.records.size();
+  a.histogram.assign(WorkgroupAnalysis::kHistogramBins, 0);
+
+  std::vector<size_t> ids;
+  uint64_t first = UINT64_MAX, last = 0;
+  for (size_t i = 0; i < trace.records.size(); ++i) {
+    const WorkgroupRecord &r = trace.records[i];
+    if (r.start == UINT64_MAX || r.end < r.start) continue;
+    ids.push_back(i);
+    first = std::min(first, r.start);
+    last = std::max(last, r.end);
+  }
+  a.recorded = ids.size();
+  if (ids.empty()) return a;
+
+  const auto duration_us = [&](size_t i) {
+    const WorkgroupRecord &r = trace.records[i];
+    return double(r.end - r.start) * trace.tick_ns / 1000;
+  };
+  std::sort(ids.begin(), ids.end(), [&](size_t x, size_t y) {
+    return duration_us(x) < duration_us(y);
+  });
+  a.span_us = double(last - first) * trace.tick_ns / 1000;
+  a.min_us = duration_us(ids.front());
+  a.median_us = duration_us(ids[ids.size() / 2]);
+  const auto percentile = [&](size_t p) {
+    return duration_us(ids[std::min(ids.size() - 1, ids.size() * p / 100)]);
+  };
+  a.p95_us = percentile(95);
+  a.p99_us = percentile(99);
+  a.max_us = duration_us(ids.back());
+  for (size_t k = 0; k < std::min(slowest, ids.size()); ++k) {
+    a.slowest.push_back(ids[ids.size() - 1 - k]);
+  }
+
+  a.bin_us = (a.p99_us - a.min_us) / WorkgroupAnalysis::kHistogramBins;
+  for (size_t i : ids) {
+    const int bin =
+        a.bin_us > 0 ? int((duration_us(i) - a.min_us) / a.bin_us) : 0;
+    ++a.histogram[std::min(bin, WorkgroupAnalysis::kHistogramBins - 1)];
+  }
+
+  // Residency: each workgroup adds the fraction of every slice it covers.
+  const double slice =
+      std::max(1.0, double(last - first) / std::max(timeline_slices, 1));
+  std::vector<std::pair<uint32_t, size_t>> by_unit;
+  for (size_t i : ids) {
+    by_unit.push_back(
+        {HwLocation::decode(trace.records[i].hw_id, trace.isa).unit(), i});
+  }
+  std::sort(by_unit.begin(), by_unit.end());
+  for (const auto &[unit, i] : by_unit) {
+    const WorkgroupRecord &r = trace.records[i];
+    if (a.units.empty() || a.units.back().where.unit() != unit) {
+      WorkgroupAnalysis::Unit u;
+      u.where = HwLocation::decode(r.hw_id, trace.isa);
+      u.timeline.assign(timeline_slices, 0);
+      a.units.push_back(std::move(u));
+    }
+    WorkgroupAnalysis::Unit &u = a.units.back();
+    ++u.workgroups;
+    u.busy_us += duration_us(i);
+    const double s = double(r.start - first), e = double(r.end - first);
+    for (int k = int(s / slice); k < timeline_slices && k * slice < e; ++k) {
+      const double overlap =
+          std::min(e, (k + 1) * slice) - std::max(s, k * slice);
+      if (overlap > 0) u.timeline[k] += overlap / slice;
+    }
+  }
+  return a;
+}
+
+/// The duration histogram, the slowest workgroups and one residency row
+/// per CU, darker where more workgroups were resident.
+inline void
+print_workgroup_report(const WorkgroupTrace &trace,
+                       const WorkgroupAnalysis &a, std::ostream &out) {
+  out << "workgroups of " << trace.symbol << " on " << trace.isa << ": "
+      << a.recorded << "/" << a.workgroups << " recorded";
+  if (a.recorded == 0) {
+    out << "; were the kernels built with HANSA_PROFILE_WORKGROUPS?"
+        << std::endl;
+    return;
+  }
+  out << std::fixed << std::setprecision(2) << ", span " << a.span_us
+      << " us\n  duration us: min " << a.min_us << ", median " << a.median_us
+      << ", p95 " << a.p95_us << ", max " << a.max_us << ", imbalance "
+      << a.imbalance() << "x\n";
+
+  const size_t peak = *std::max_element(a.histogram.begin(),
+                                        a.histogram.end());
+  for (size_t b = 0; b < a.histogram.size(); ++b) {
+    const double lo = a.min_us + b * a.bin_us;
+    const double hi = b + 1 < a.histogram.size() ? lo + a.bin_us : a.max_us;
+    out << "  " << std::setw(10) << lo << " - " << std::setw(10) << hi
+        << std::setw(8) << a.histogram[b] << " "
+        << std::string(a.histogram[b] * 40 / peak, '#') << "\n";
+  }
+
+  for (size_t i : a.slowest) {
+    const WorkgroupRecord &r = trace.records[i];
+    const uint32_t x = i % trace.blocks[0];
+    const uint32_t y = (i / trace.blocks[0]) % trace.blocks[1];
+    const uint32_t z = i / (size_t(trace.blocks[0]) * trace.blocks[1]);
+    out << "  slow: workgroup (" << x << "," << y << "," << z << ") "
+        << double(r.end - r.start) * trace.tick_ns / 1000 << " us on "
+        << HwLocation::decode(r.hw_id, trace.isa).name() << "\n";
+  }
+
+  double most = 0;
+  for (const WorkgroupAnalysis::Unit &u : a.units) {
+    for (double v : u.timeline) most = std::max(most, v);
+  }
+  static const char kShades[] = " .:-=+*#%@";
+  constexpr int kLevels = sizeof(kShades) - 2;
+  out << "  resident workgroups per CU over the span, '@' = " << most
+      << ":\n";
+  for (const WorkgroupAnalysis::Unit &u : a.units) {
+    std::string row;
+    for (double v : u.timeline) {
+      row += kShades[most > 0 ? int(v / most * kLevels + 0.5) : 0];
+    }
+    out << "  " << std::left << std::setw(14) << u.where.name() << std::right
+        << "|" << row << "| " << u.workgroups << " wg, " << u.busy_us
+        << " us\n";
+  }
+  out << std::flush;
+}
+
+}  // namespace hansa
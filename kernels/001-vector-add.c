@@ -5,3 +5,14 @@ add_arrays(int* input_a, int* input_b, int* output) {
       __builtin_amdgcn_workitem_id_x();
   output[index] = input_a[index] + input_b[index];
 }
+
+/* Grid-stride form for LaunchMode::kPersistent: covers n with any grid. */
+__attribute__((visibility("default"), amdgpu_kernel)) void
+add_arrays_grid_stride(int* input_a, int* input_b, int* output, int n) {
+  for (int index = __builtin_amdgcn_workgroup_id_x() *
+                       __builtin_amdgcn_workgroup_size_x() +
+                   __builtin_amdgcn_workitem_id_x();
+       index < n; index += __builtin_amdgcn_grid_size_x()) {
+    output[index] = input_a[index] + input_b[index];
+  }
+}
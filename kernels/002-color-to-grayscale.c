@@ -1,15 +1,57 @@
 #include <stdint.h>
 
+#include "hansa/device/workgroup_profile.h"
+
 __attribute__((visibility("default"), amdgpu_kernel))
 void color_to_grayscale(
     unsigned char* img_out, unsigned char* img_in, int width, int height) {
   int index =
       __builtin_amdgcn_workgroup_id_x() * __builtin_amdgcn_workgroup_size_x() +
       __builtin_amdgcn_workitem_id_x();
+  HANSA_PROFILE_BEGIN();
   if (index < width * height) {
     unsigned char r = img_in[index * 3];
     unsigned char g = img_in[index * 3 + 1];
     unsigned char b = img_in[index * 3 + 2];
     img_out[index] = (uint8_t)(0.299f * r + 0.587f * g + 0.114f * b);
   }
+  HANSA_PROFILE_END();
+}
+
+/* Grid-stride form for LaunchMode::kPersistent. */
+__attribute__((visibility("default"), amdgpu_kernel))
+void color_to_grayscale_grid_stride(
+    unsigned char* img_out, unsigned char* img_in, int width, int height) {
+  HANSA_PROFILE_BEGIN();
+  for (int index = __builtin_amdgcn_workgroup_id_x() *
+                       __builtin_amdgcn_workgroup_size_x() +
+                   __builtin_amdgcn_workitem_id_x();
+       index < width * height; index += __builtin_amdgcn_grid_size_x()) {
+    unsigned char r = img_in[index * 3];
+    unsigned char g = img_in[index * 3 + 1];
+    unsigned char b = img_in[index * 3 + 2];
+    img_out[index] = (uint8_t)(0.299f * r + 0.587f * g + 0.114f * b);
+  }
+  HANSA_PROFILE_END();
+}
+
+/* Planar form for hansa/image_cache.h: R, G and B are whole planes, so
+ * each channel load is contiguous across the wave instead of three bytes
+ * apart. */
+__attribute__((visibility("default"), amdgpu_kernel))
+void color_to_grayscale_planar(
+    unsigned char* img_out, const unsigned char* img_in, int width,
+    int height) {
+  int index =
+      __builtin_amdgcn_workgroup_id_x() * __builtin_amdgcn_workgroup_size_x() +
+      __builtin_amdgcn_workitem_id_x();
+  int plane = width * height;
+  HANSA_PROFILE_BEGIN();
+  if (index < plane) {
+    unsigned char r = img_in[index];
+    unsigned char g = img_in[plane + index];
+    unsigned char b = img_in[2 * plane + index];
+    img_out[index] = (uint8_t)(0.299f * r + 0.587f * g + 0.114f * b);
+  }
+  HANSA_PROFILE_END();
 }
@@ -1,23 +1,16 @@
 #include <stdint.h>
 
-__attribute__((visibility("default"), amdgpu_kernel)) void
-image_blur_rgb(unsigned char* img_out, const unsigned char* img_in, int width,
-               int height) {
-  int x =
-      __builtin_amdgcn_workgroup_id_x() * __builtin_amdgcn_workgroup_size_x() +
-      __builtin_amdgcn_workitem_id_x();
-  int y =
-      __builtin_amdgcn_workgroup_id_y() * __builtin_amdgcn_workgroup_size_y() +
-      __builtin_amdgcn_workitem_id_y();
-
-  if (x >= width || y >= height) return;
+#include "hansa/device/workgroup_profile.h"
 
+/* Apply a simple 3x3 box blur to pixel (x, y). */
+static void
+blur_pixel(unsigned char* img_out, const unsigned char* img_in, int width,
+           int height, int x, int y) {
   int idx = (y * width + x) * 3;  // Each pixel has 3 channels (R, G, B)
 
   int sum_r = 0, sum_g = 0, sum_b = 0;
   int count = 0;
 
-  // Apply a simple 3x3 box blur kernel
   for (int dy = -1; dy <= 1; dy++) {
     for (int dx = -1; dx <= 1; dx++) {
       int nx = x + dx;
@@ -37,3 +30,74 @@ image_blur_rgb(unsigned char* img_out, const unsigned char* img_in, int width,
   img_out[idx + 1] = sum_g / count;
   img_out[idx + 2] = sum_b / count;
 }
+
+__attribute__((visibility("default"), amdgpu_kernel)) void
+image_blur_rgb(unsigned char* img_out, const unsigned char* img_in, int width,
+               int height) {
+  int x =
+      __builtin_amdgcn_workgroup_id_x() * __builtin_amdgcn_workgroup_size_x() +
+      __builtin_amdgcn_workitem_id_x();
+  int y =
+      __builtin_amdgcn_workgroup_id_y() * __builtin_amdgcn_workgroup_size_y() +
+      __builtin_amdgcn_workitem_id_y();
+
+  HANSA_PROFILE_BEGIN();
+  if (x < width && y < height) {
+    blur_pixel(img_out, img_in, width, height, x, y);
+  }
+  HANSA_PROFILE_END();
+}
+
+/* Grid-stride form for LaunchMode::kPersistent, striding in x and y. */
+__attribute__((visibility("default"), amdgpu_kernel)) void
+image_blur_rgb_grid_stride(unsigned char* img_out, const unsigned char* img_in,
+                           int width, int height) {
+  int x0 =
+      __builtin_amdgcn_workgroup_id_x() * __builtin_amdgcn_workgroup_size_x() +
+      __builtin_amdgcn_workitem_id_x();
+  int y0 =
+      __builtin_amdgcn_workgroup_id_y() * __builtin_amdgcn_workgroup_size_y() +
+      __builtin_amdgcn_workitem_id_y();
+
+  HANSA_PROFILE_BEGIN();
+  for (int y = y0; y < height; y += __builtin_amdgcn_grid_size_y()) {
+    for (int x = x0; x < width; x += __builtin_amdgcn_grid_size_x()) {
+      blur_pixel(img_out, img_in, width, height, x, y);
+    }
+  }
+  HANSA_PROFILE_END();
+}
+
+/* Planar form for hansa/image_cache.h: z is the channel, and input and
+ * output are width x height planes, so neighbouring work-items read and
+ * write neighbouring bytes. */
+__attribute__((visibility("default"), amdgpu_kernel)) void
+image_blur_planar(unsigned char* img_out, const unsigned char* img_in,
+                  int width, int height) {
+  int x =
+      __builtin_amdgcn_workgroup_id_x() * __builtin_amdgcn_workgroup_size_x() +
+      __builtin_amdgcn_workitem_id_x();
+  int y =
+      __builtin_amdgcn_workgroup_id_y() * __builtin_amdgcn_workgroup_size_y() +
+      __builtin_amdgcn_workitem_id_y();
+  int c =
+      __builtin_amdgcn_workgroup_id_z() * __builtin_amdgcn_workgroup_size_z() +
+      __builtin_amdgcn_workitem_id_z();
+
+  HANSA_PROFILE_BEGIN();
+  if (x < width && y < height && c < 3) {
+    const unsigned char* in = img_in + c * width * height;
+    int sum = 0;
+    int count = 0;
+    for (int ny = y - 1; ny <= y + 1; ny++) {
+      for (int nx = x - 1; nx <= x + 1; nx++) {
+        if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
+          sum += in[ny * width + nx];
+          count++;
+        }
+      }
+    }
+    img_out[c * width * height + y * width + x] = sum / count;
+  }
+  HANSA_PROFILE_END();
+}
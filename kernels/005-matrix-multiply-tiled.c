@@ -1,5 +1,7 @@
 #include <stdint.h>
 
+#include "hansa/device/workgroup_profile.h"
+
 #define TILE_SIZE 16  // Adjust based on GPU's shared memory limits
 
 __attribute__((visibility("default"), amdgpu_kernel)) void
@@ -18,6 +20,8 @@ matrix_multiply_tiled2(float* C, const float* A, const float* B, int N, int M,
   // Accumulator for the result
   float sum = 0.0f;
 
+  HANSA_PROFILE_BEGIN();
+
   // Loop over tiles
   for (int tile = 0; tile < (M + TILE_SIZE - 1) / TILE_SIZE; tile++) {
     // Load tile elements into shared memory (manually managed)
@@ -61,4 +65,5 @@ matrix_multiply_tiled2(float* C, const float* A, const float* B, int N, int M,
   if (row < N && col < K) {
     C[row * K + col] = sum;
   }
+  HANSA_PROFILE_END();
 }
@@ -0,0 +1,160 @@
+#include <stdint.h>
+
+#include "hansa/device/workgroup_profile.h"
+
+/* Separable box blurs of any radius, tiled through LDS.
+ *
+ * A workgroup blurs one workgroup-sized tile of the output. It loads the
+ * tile and a radius-wide halo into LDS once, sums every halo row across
+ * the window into LDS, then sums those row sums down each column, so an
+ * output reads 2 * (2 * radius + 1) LDS values per channel instead of
+ * (2 * radius + 1)^2 global ones. Pixels outside the image are absent, so
+ * an output is the mean of the in-bounds part of its window, exactly what
+ * image_blur_rgb computes for radius 1. Row sums are 16 bits wide, which
+ * bounds the radius to 128.
+ *
+ * LDS comes from the launch through the hidden dynamic_lds_size arg; see
+ * hansa::SeparableBlur::lds_bytes in hansa/image_filter.h. Every work-item
+ * takes part in the tile loads, so the grid must be whole workgroups.
+ *
+ * planar selects the layout of input and output alike: RGB planes, as in
+ * hansa/image_cache.h, or interleaved RGB. */
+
+#ifdef HANSA_DYNAMIC_LDS
+#define LDS
+#else
+#define LDS __attribute__((address_space(3)))
+extern LDS float hansa_dynamic_lds[];
+#define HANSA_DYNAMIC_LDS(type) ((LDS type*)hansa_dynamic_lds)
+#endif
+
+/* Bytes of the halo tile, rounded up so the row sums after it align. */
+static int
+halo_bytes(int halo_w, int halo_h, int channels) {
+  return (halo_w * halo_h * channels + 3) & ~3;
+}
+
+/* The in-bounds part of a window's extent along one axis. */
+static int
+window(int v, int radius, int size) {
+  const int lo = v - radius < 0 ? 0 : v - radius;
+  const int hi = v + radius > size - 1 ? size - 1 : v + radius;
+  return hi - lo + 1;
+}
+
+/* Row pass: sums for every halo row and output column. */
+static void
+sum_rows(LDS uint16_t* rows, const LDS unsigned char* tile, int tile_w,
+         int halo_w, int halo_h, int radius, int channels, int item,
+         int items) {
+  const int row_bytes = tile_w * channels;
+  for (int i = item; i < row_bytes * halo_h; i += items) {
+    const int hy = i / row_bytes;
+    const LDS unsigned char* p =
+        tile + hy * halo_w * channels + (i - hy * row_bytes);
+    unsigned sum = 0;
+    for (int k = 0; k <= 2 * radius; k++) sum += p[k * channels];
+    rows[i] = sum;
+  }
+}
+
+/* Column pass for one channel of the work-item's output pixel. */
+static unsigned
+sum_column(const LDS uint16_t* rows, int tile_w, int radius, int channels,
+           int tx, int ty, int c) {
+  const LDS uint16_t* p = rows + (ty * tile_w + tx) * channels + c;
+  unsigned sum = 0;
+  for (int k = 0; k <= 2 * radius; k++) sum += p[k * tile_w * channels];
+  return sum;
+}
+
+__attribute__((visibility("default"), amdgpu_kernel)) void
+image_blur_separable(unsigned char* img_out, const unsigned char* img_in,
+                     int width, int height, int radius, int planar) {
+  const int tile_w = __builtin_amdgcn_workgroup_size_x();
+  const int tile_h = __builtin_amdgcn_workgroup_size_y();
+  const int tx = __builtin_amdgcn_workitem_id_x();
+  const int ty = __builtin_amdgcn_workitem_id_y();
+  const int item = ty * tile_w + tx, items = tile_w * tile_h;
+  const int x0 = __builtin_amdgcn_workgroup_id_x() * tile_w - radius;
+  const int y0 = __builtin_amdgcn_workgroup_id_y() * tile_h - radius;
+  const int halo_w = tile_w + 2 * radius, halo_h = tile_h + 2 * radius;
+  const int plane = width * height;
+  LDS unsigned char* tile = HANSA_DYNAMIC_LDS(unsigned char);
+  LDS uint16_t* rows =
+      (LDS uint16_t*)(tile + halo_bytes(halo_w, halo_h, 3));
+
+  HANSA_PROFILE_BEGIN();
+  for (int i = item; i < halo_w * halo_h; i += items) {
+    const int hy = i / halo_w;
+    const int gx = x0 + i - hy * halo_w, gy = y0 + hy;
+    const int inside = gx >= 0 && gx < width && gy >= 0 && gy < height;
+    for (int c = 0; c < 3; c++) {
+      const int index = planar ? c * plane + gy * width + gx
+                               : (gy * width + gx) * 3 + c;
+      tile[i * 3 + c] = inside ? img_in[index] : 0;
+    }
+  }
+  __builtin_amdgcn_s_barrier();
+  sum_rows(rows, tile, tile_w, halo_w, halo_h, radius, 3, item, items);
+  __builtin_amdgcn_s_barrier();
+
+  const int x = x0 + radius + tx, y = y0 + radius + ty;
+  if (x < width && y < height) {
+    const unsigned count =
+        window(x, radius, width) * window(y, radius, height);
+    for (int c = 0; c < 3; c++) {
+      const int index =
+          planar ? c * plane + y * width + x : (y * width + x) * 3 + c;
+      img_out[index] = sum_column(rows, tile_w, radius, 3, tx, ty, c) / count;
+    }
+  }
+  HANSA_PROFILE_END();
+}
+
+/* color_to_grayscale, then image_blur_separable on the gray image, in one
+ * dispatch: the halo is converted to gray as it is loaded, so the gray
+ * image never exists in global memory. Writes one gray plane. */
+__attribute__((visibility("default"), amdgpu_kernel)) void
+grayscale_blur_fused(unsigned char* img_out, const unsigned char* img_in,
+                     int width, int height, int radius, int planar) {
+  const int tile_w = __builtin_amdgcn_workgroup_size_x();
+  const int tile_h = __builtin_amdgcn_workgroup_size_y();
+  const int tx = __builtin_amdgcn_workitem_id_x();
+  const int ty = __builtin_amdgcn_workitem_id_y();
+  const int item = ty * tile_w + tx, items = tile_w * tile_h;
+  const int x0 = __builtin_amdgcn_workgroup_id_x() * tile_w - radius;
+  const int y0 = __builtin_amdgcn_workgroup_id_y() * tile_h - radius;
+  const int halo_w = tile_w + 2 * radius, halo_h = tile_h + 2 * radius;
+  const int plane = width * height;
+  LDS unsigned char* tile = HANSA_DYNAMIC_LDS(unsigned char);
+  LDS uint16_t* rows =
+      (LDS uint16_t*)(tile + halo_bytes(halo_w, halo_h, 1));
+
+  HANSA_PROFILE_BEGIN();
+  for (int i = item; i < halo_w * halo_h; i += items) {
+    const int hy = i / halo_w;
+    const int gx = x0 + i - hy * halo_w, gy = y0 + hy;
+    unsigned char gray = 0;
+    if (gx >= 0 && gx < width && gy >= 0 && gy < height) {
+      const int p = gy * width + gx;
+      const int step = planar ? plane : 1;
+      const unsigned char* rgb = img_in + (planar ? p : p * 3);
+      gray = (uint8_t)(0.299f * rgb[0] + 0.587f * rgb[step] +
+                       0.114f * rgb[2 * step]);
+    }
+    tile[i] = gray;
+  }
+  __builtin_amdgcn_s_barrier();
+  sum_rows(rows, tile, tile_w, halo_w, halo_h, radius, 1, item, items);
+  __builtin_amdgcn_s_barrier();
+
+  const int x = x0 + radius + tx, y = y0 + radius + ty;
+  if (x < width && y < height) {
+    const unsigned count =
+        window(x, radius, width) * window(y, radius, height);
+    img_out[y * width + x] =
+        sum_column(rows, tile_w, radius, 1, tx, ty, 0) / count;
+  }
+  HANSA_PROFILE_END();
+}
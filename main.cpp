@@ -1,101 +1,38 @@
 #include <hsa/hsa.h>
 #include <hsa/hsa_ext_amd.h>
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <random>
 #include <string>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/engine.h"
+#include "hansa/image_batch.h"
+#include "hansa/image_cache.h"
+#include "hansa/image_filter.h"
+#include "hansa/image_writer.h"
+#include "hansa/matmul_tuner.h"
+#include "hansa/ref.h"
+#include "hansa/registry.h"
+#include "hansa/runtime.h"
+#include "hansa/tiled_image.h"
+#include "hansa/workgroup_profile.h"
 #define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "third_party/stb_image.h"
-#include "third_party/stb_image_write.h"
 
-#define HSA_ENFORCE(msg, rtn)                                      \
-  if (rtn != HSA_STATUS_SUCCESS) {                                 \
-    const char *err;                                               \
-    hsa_status_string(rtn, &err);                                  \
-    std::cerr << "ERROR:" << msg << ", rtn:" << rtn << ", " << err \
-              << std::endl;                                        \
-    return HSA_STATUS_ERROR;                                       \
-  }
-
-#define HSA_ENFORCE_PTR(msg, ptr)              \
-  if (!ptr) {                                  \
-    std::cerr << "ERROR:" << msg << std::endl; \
-    return -1;                                 \
-  }
-
-class Engine;
-
-#pragma pack(push, 1)
-typedef struct ImplicitArg_s {
-  uint32_t block_count_x;
-  uint32_t block_count_y;
-  uint32_t block_count_z;
-
-  uint16_t group_size_x;
-  uint16_t group_size_y;
-  uint16_t group_size_z;
-
-  uint16_t remainder_x;
-  uint16_t remainder_y;
-  uint16_t remainder_z;
-
-  uint64_t tool_correlation_id;
-  uint64_t reserved_1;
-
-  uint64_t global_offset_x;
-  uint64_t global_offset_y;
-  uint64_t global_offset_z;
-
-  uint16_t grid_dims;
-
-  uint16_t reserved_2;
-  uint16_t reserved_3;
-  uint16_t reserved_4;
-
-  uint64_t printf_buffer;
-  uint64_t hostcall_buffer;
-  uint64_t multigrid_sync_arg;
-  uint64_t heap_v1;
-  uint64_t default_queue;
-  uint64_t completion_action;
-  uint32_t dynamic_lds_size;
-  uint32_t private_base;
-  uint32_t shared_base;
-} ImplicitArg;
-#pragma pack(pop)
-
-void
-our_hsa_free(void *mem) {
-  if (mem) hsa_memory_free(mem);
-}
-
-void *
-our_hsa_alloc(size_t size, void *param) {
-  auto region = static_cast<hsa_region_t *>(param);
-  void *p = nullptr;
-  hsa_status_t status = hsa_memory_allocate(*region, size, (void **)&p);
-  if (status != HSA_STATUS_SUCCESS) {
-    std::cerr << "hsa_memory_allocate failed, " << status << std::endl;
-    return nullptr;
-  }
-  return p;
-}
-
-hsa_status_t
-get_agent_callback(hsa_agent_t agent, void *data);
-
-hsa_status_t
-get_region_callback(hsa_region_t region, void *data);
+using hansa::Engine;
 
 class Image {
   explicit Image(std::string path)
@@ -118,603 +55,672 @@ class Image {
   unsigned char *data_;
 };
 
-class Engine {
- public:
-  class KernelDispatchConfig {
-   public:
-    KernelDispatchConfig()
-        : grid_size{0}, workgroup_size{0}, kernel_arg_size_(0) {}
-
-    KernelDispatchConfig(std::string code_file_name, std::string kernel_symbol,
-                         const std::array<int, 3> &grid_size,
-                         const std::array<int, 3> &workgroup_size,
-                         const int kernel_arg_size)
-        : code_file_name(std::move(code_file_name)),
-          kernel_symbol(std::move(kernel_symbol)),
-          grid_size(grid_size),
-          workgroup_size(workgroup_size),
-          kernel_arg_size_(kernel_arg_size) {}
-
-    std::string code_file_name;
-    std::string kernel_symbol;
-
-    std::array<int, 3> grid_size;
-    std::array<int, 3> workgroup_size;
-    int kernel_arg_size_;
-
-    [[nodiscard]]
-    size_t
-    size() const {
-      return kernel_arg_size_;
-    }
-  };
+/// Prepares the launch, binds the kernel's args in declaration order and
+/// dispatches it options.repeats times, waiting for each run. Setup ends
+/// once the launch is prepared and bound, since that is where the kernel's
+/// code object is loaded on first use, less any streamed pass.
+template <typename... Args>
+int
+launch(Engine &engine, const Engine::KernelDispatchConfig &d_param,
+       const hansa::RunOptions &options, const hansa::Stopwatch &setup,
+       hansa::RunReport *report, const Args &...args) {
+  hansa::PreparedLaunch prepared;
+  if (0 != engine.prepare(d_param, &prepared)) return -1;
+  if (0 != prepared.bind(args...)) return -1;
+  report->setup_ms = setup.elapsed_ms() - report->streamed_ms;
+  for (int r = 0; r < options.repeats; ++r) {
+    hansa::Stopwatch run;
+    if (0 != engine.dispatch(&prepared)) return -1;
+    if (0 != engine.wait(&prepared)) return -1;
+    report->run_ms.push_back(run.elapsed_ms());
+  }
+  return 0;
+}
 
- public:
-  friend hsa_status_t
-  get_agent_callback(hsa_agent_t agent, void *data);
-
-  friend hsa_status_t
-  get_region_callback(hsa_region_t region, void *data);
-
-  Engine()
-      : agent_(0),
-        cpu_agent_(0),
-        queue_size_(0),
-        queue_(nullptr),
-        signal_(0),
-        system_region_(0),
-        kernarg_region_(0),
-        local_region_(0),
-        gpu_local_region_(0),
-        aql_(nullptr),
-        packet_index_(0),
-        code_object_(0),
-        executable_(0),
-        group_static_size_(0) {}
-
-  ~Engine() = default;
-
-  int
-  init() {
-    hsa_status_t status = hsa_init();
-    HSA_ENFORCE("hsa_init", status);
-
-    status = hsa_iterate_agents(get_agent_callback, this);
-    HSA_ENFORCE("hsa_iterate_agents", status);
-
-    char agent_name[64];
-
-    status = hsa_agent_get_info(agent_, HSA_AGENT_INFO_NAME, agent_name);
-    HSA_ENFORCE("hsa_agent_get_info(HSA_AGENT_INFO_NAME)", status);
-
-    std::cout << "Using agent: " << agent_name << std::endl;
-
-    status =
-        hsa_agent_get_info(agent_, HSA_AGENT_INFO_QUEUE_MAX_SIZE, &queue_size_);
-    HSA_ENFORCE("hsa_agent_get_info(HSA_AGENT_INFO_QUEUE_MAX_SIZE", status);
-
-    status =
-        hsa_queue_create(agent_, queue_size_, HSA_QUEUE_TYPE_MULTI, nullptr,
-                         nullptr, UINT32_MAX, UINT32_MAX, &queue_);
-
-    HSA_ENFORCE("hsa_queue_create", status);
-
-    status = hsa_signal_create(1, 0, nullptr, &signal_);
-    HSA_ENFORCE("hsa_signal_create", status);
-
-    status = hsa_agent_iterate_regions(agent_, get_region_callback, this);
-    HSA_ENFORCE("hsa_agent_iterate_regions", status);
-    HSA_ENFORCE_PTR("Failed to find kernarg memory region",
-                    kernarg_region_.handle)
-
-    return 0;
-  }
-
-  template <typename ARGS_T>
-  int
-  setup_dispatch(const KernelDispatchConfig *cfg, const ARGS_T &args) {
-    packet_index_ = hsa_queue_add_write_index_relaxed(queue_, 1);
-    const uint32_t queue_mask = queue_->size - 1;
-    aql_ = static_cast<hsa_kernel_dispatch_packet_t *>(queue_->base_address) +
-           (packet_index_ & queue_mask);
-
-    constexpr size_t aql_header_size = 4;
-    memset(aql_ + aql_header_size, 0, sizeof(*aql_) - aql_header_size);
-
-    // initialize_packet
-    aql_->completion_signal = signal_;
-    aql_->workgroup_size_x = 1;
-    aql_->workgroup_size_y = 1;
-    aql_->workgroup_size_z = 1;
-    aql_->grid_size_x = 1;
-    aql_->grid_size_y = 1;
-    aql_->grid_size_z = 1;
-    aql_->group_segment_size = 0;
-    aql_->private_segment_size = 0;
-
-    // executable
-    if (0 != load_bin_from_file(cfg->code_file_name.c_str())) return -1;
-    hsa_status_t status = hsa_executable_create(
-        HSA_PROFILE_FULL, HSA_EXECUTABLE_STATE_UNFROZEN, nullptr, &executable_);
-    HSA_ENFORCE("hsa_executable_create", status);
-    // Load code object
-    status = hsa_executable_load_code_object(executable_, agent_, code_object_,
-                                             nullptr);
-    HSA_ENFORCE("hsa_executable_load_code_object", status);
-
-    // Freeze executable
-    status = hsa_executable_freeze(executable_, nullptr);
-    HSA_ENFORCE("hsa_executable_freeze", status);
-
-    // Get symbol handle
-    hsa_executable_symbol_t kernel_symbol;
-    status = hsa_executable_get_symbol(executable_, nullptr,
-                                       cfg->kernel_symbol.c_str(), agent_, 0,
-                                       &kernel_symbol);
-    HSA_ENFORCE("hsa_executable_get_symbol", status);
-
-    // Get code handle
-    uint64_t code_handle;
-    status = hsa_executable_symbol_get_info(
-        kernel_symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT, &code_handle);
-    HSA_ENFORCE("hsa_executable_symbol_get_info", status);
-    status = hsa_executable_symbol_get_info(
-        kernel_symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE,
-        &group_static_size_);
-    HSA_ENFORCE("hsa_executable_symbol_get_info", status);
-
-    uint32_t kernel_arg_size;
-    status = hsa_executable_symbol_get_info(
-        kernel_symbol, HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE,
-        &kernel_arg_size);
-    HSA_ENFORCE("HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE",
-                status);
-    std::cout << "Kernel arg size: " << kernel_arg_size << std::endl;
-
-    aql_->kernel_object = code_handle;
-
-    // kernel args
-    void *kernarg;
-    status = hsa_memory_allocate(kernarg_region_, kernel_arg_size, &kernarg);
-    HSA_ENFORCE("hsa_memory_allocate", status);
-
-    std::memset(kernarg, 0, kernel_arg_size);
-    std::memcpy(kernarg, &args, sizeof(ARGS_T));
-
-    bool dims = 1 + (cfg->grid_size[1] * cfg->workgroup_size[1] != 1) +
-                (cfg->grid_size[2] * cfg->workgroup_size[2] != 1);
-    auto implicit_args = reinterpret_cast<ImplicitArg *>(
-        reinterpret_cast<std::uint8_t *>(kernarg) + sizeof(ARGS_T));
-
-    implicit_args->block_count_x = cfg->grid_size[0];
-    implicit_args->block_count_y = cfg->grid_size[1];
-    implicit_args->block_count_z = cfg->grid_size[2];
-
-    implicit_args->group_size_x = cfg->workgroup_size[0];
-    implicit_args->group_size_y = cfg->workgroup_size[1];
-    implicit_args->group_size_z = cfg->workgroup_size[2];
-
-    implicit_args->grid_dims = dims;
-
-    aql_->kernarg_address = kernarg;
-
-    std::cout << "Workgroup sizes: " << cfg->workgroup_size[0] << " "
-              << cfg->workgroup_size[1] << " " << cfg->workgroup_size[2]
-              << std::endl;
-    aql_->workgroup_size_x = cfg->workgroup_size[0];
-    aql_->workgroup_size_y = cfg->workgroup_size[1];
-    aql_->workgroup_size_z = cfg->workgroup_size[2];
+/// Device-local buffers normally; host-coherent ones the kernel reads and
+/// writes in place under --zero-copy.
+hansa::MemoryKind
+buffer_kind(const hansa::RunOptions &options) {
+  return options.zero_copy ? hansa::MemoryKind::kHostCoherent
+                           : hansa::MemoryKind::kDeviceLocal;
+}
 
-    std::cout << "Grid sizes: " << cfg->grid_size[0] << " " << cfg->grid_size[1]
-              << " " << cfg->grid_size[2] << std::endl;
+/// The kernel's grid-stride variant under --persistent.
+std::string
+kernel_symbol(const std::string &name, const hansa::RunOptions &options) {
+  return name + (options.persistent ? "_grid_stride.kd" : ".kd");
+}
 
-    aql_->grid_size_x = cfg->grid_size[0];
-    aql_->grid_size_y = cfg->grid_size[1];
-    aql_->grid_size_z = cfg->grid_size[2];
-    return status;
+hansa::LaunchMode
+launch_mode(const hansa::RunOptions &options) {
+  return options.persistent ? hansa::LaunchMode::kPersistent
+                            : hansa::LaunchMode::kExact;
+}
+
+using StbImage = std::unique_ptr<unsigned char, void (*)(void *)>;
+
+/// Decodes data/images/teapot.jpg; null if it is missing or not RGB.
+StbImage
+load_teapot(int *width, int *height) {
+  HANSA_TRACE_SPAN("decode image");
+  int channels;
+  StbImage img(
+      stbi_load("../data/images/teapot.jpg", width, height, &channels, 0),
+      stbi_image_free);
+  if (!img) {
+    std::cout << "Failed to load image teapot.jpg" << std::endl;
+    return img;
   }
+  if (channels < 3) {
+    std::cout << "Image does not have enough channels (expected at least 3)"
+              << std::endl;
+    img.reset();
+    return img;
+  }
+  std::cout << "Loaded image teapot.jpg: " << *width << " x " << *height
+            << ", channels: " << channels << std::endl;
+  return img;
+}
 
-  void *
-  kernarg_address() {
-    return aql_->kernarg_address;
+/// The kernel input for a decoded image: pinned in place under
+/// --zero-copy, otherwise copied into a device-local buffer.
+hansa::DeviceBuffer<unsigned char>
+image_input(Engine &engine, const hansa::RunOptions &options,
+            unsigned char *pixels, size_t bytes) {
+  if (options.zero_copy) {
+    return hansa::DeviceBuffer<unsigned char>::pin(engine, pixels, bytes);
+  }
+  hansa::DeviceBuffer<unsigned char> buffer(engine, bytes);
+  if (buffer.data() && buffer.copy_from(pixels)) {
+    // Holds nothing, so the caller's data() check fails.
+    return hansa::DeviceBuffer<unsigned char>(engine, 0);
   }
+  return buffer;
+}
 
-  void *
-  alloc_local(int size) {
-    return our_hsa_alloc(size, &this->local_region_);
+/// Writes stem plus the format's extension in --image-format, compressing
+/// PNGs on a pool shared by every launcher, and reports the throughput.
+void
+save_image(const std::string &stem, const hansa::RunOptions &options,
+           const unsigned char *pixels, int width, int height, int channels) {
+  static hansa::ImageWriter writer;
+  const std::string path = stem + hansa::image_extension(options.image_format);
+  hansa::ImageWriteStats stats;
+  if (0 != writer.write(path, options.image_format, pixels, width, height,
+                        channels, 0, &stats)) {
+    std::cout << "Failed to save " << path << std::endl;
+    return;
   }
+  std::cout << std::fixed << std::setprecision(3) << "Saved " << path << ": "
+            << stats.file_bytes / 1e6 << " MB in " << stats.ms << " ms, "
+            << stats.mb_per_s() << " MB/s, " << stats.bands << " bands on "
+            << writer.threads() << " threads" << std::endl;
+}
 
-  int
-  load_bin_from_file(const char *file_name) {
-    std::ifstream inf(file_name, std::ios::binary | std::ios::ate);
-    if (!inf) {
-      std::cerr << "Error: failed to load " << file_name << std::endl;
+int
+kernel_001_vector_add(Engine &engine, const hansa::RunOptions &options,
+                      hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+
+  // The kernel has no bounds check; round up to whole workgroups.
+  const int num_elements = (options.size + 63) / 64 * 64;
+
+  const hansa::MemoryKind kind = buffer_kind(options);
+  hansa::DeviceBuffer<int> device_input_a(engine, num_elements, kind);
+  hansa::DeviceBuffer<int> device_input_b(engine, num_elements, kind);
+  hansa::DeviceBuffer<int> device_output(engine, num_elements, kind);
+
+  std::vector<int> staging_a, staging_b, staging_out;
+  int *input_a = device_input_a.host_view(&staging_a);
+  int *input_b = device_input_b.host_view(&staging_b);
+  std::iota(input_a, input_a + num_elements, 0);
+  std::iota(input_b, input_b + num_elements, 0);
+
+  std::vector<int> expected(num_elements);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::add_arrays(input_a, input_b, expected.data(), num_elements);
+  });
+
+  if (kind == hansa::MemoryKind::kDeviceLocal) {
+    // Add each chunk of the inputs as soon as it lands instead of after the
+    // whole upload; the runs below repeat the add over the whole buffers.
+    struct args_t {
+      int *a;
+      int *b;
+      int *out;
+    };
+    hansa::Stopwatch streamed;
+    const int status = engine.stream_upload<2>(
+        {device_input_a.data(), device_input_b.data()}, {input_a, input_b},
+        num_elements * sizeof(int), 64 * sizeof(int),
+        [&](size_t offset, size_t bytes, Engine::DispatchHandle *last) {
+          const size_t first = offset / sizeof(int);
+          const Engine::KernelDispatchConfig cfg(
+              "libkernels.so", "add_arrays.kd",
+              {int(bytes / sizeof(int)), 1, 1},
+              Engine::KernelDispatchConfig::kAutoWorkgroup);
+          const args_t args{device_input_a.data() + first,
+                            device_input_b.data() + first,
+                            device_output.data() + first};
+          return engine.post(&cfg, args, last);
+        });
+    if (status != 0) return -1;
+    int *output = device_output.host_view(&staging_out);
+    if (device_output.copy_to(output)) return -1;
+    report->streamed_ms = streamed.elapsed_ms();
+    if (hansa::ref::compare("add_arrays streamed", output, expected.data(),
+                            num_elements)) {
       return -1;
     }
-    const size_t size = static_cast<std::string::size_type>(inf.tellg());
-    char *ptr = static_cast<char *>(our_hsa_alloc(size, &this->system_region_));
-    HSA_ENFORCE_PTR("failed to allocate memory for code object", ptr);
-
-    inf.seekg(0, std::ios::beg);
-    std::copy(std::istreambuf_iterator<char>(inf),
-              std::istreambuf_iterator<char>(), ptr);
-
-    const hsa_status_t status =
-        hsa_code_object_deserialize(ptr, size, nullptr, &code_object_);
-    HSA_ENFORCE("hsa_code_object_deserialize", status);
-
-    return 0;
-  }
-
-  int
-  dispatch() {
-    uint16_t header =
-        (HSA_PACKET_TYPE_KERNEL_DISPATCH << HSA_PACKET_HEADER_TYPE) |
-        (1 << HSA_PACKET_HEADER_BARRIER) |
-        (HSA_FENCE_SCOPE_SYSTEM << HSA_PACKET_HEADER_ACQUIRE_FENCE_SCOPE) |
-        (HSA_FENCE_SCOPE_SYSTEM << HSA_PACKET_HEADER_RELEASE_FENCE_SCOPE);
-
-    // total dimension
-    uint16_t dim = 1;
-    if (aql_->grid_size_y > 1) dim = 2;
-    if (aql_->grid_size_z > 1) dim = 3;
-    aql_->group_segment_size = group_static_size_;
-    const uint16_t setup = dim << HSA_KERNEL_DISPATCH_PACKET_SETUP_DIMENSIONS;
-    const uint32_t header32 = header | (setup << 16);
-
-    __atomic_store_n(reinterpret_cast<uint32_t *>(aql_), header32,
-                     __ATOMIC_RELEASE);
-    hsa_signal_store_relaxed(queue_->doorbell_signal,
-                             static_cast<hsa_signal_value_t>(packet_index_));
-
-    return 0;
-  }
-
-  hsa_signal_value_t
-  wait() {
-    // return hsa_signal_wait_acquire(signal_, HSA_SIGNAL_CONDITION_EQ, 0,
-    // ~0ULL, HSA_WAIT_STATE_ACTIVE);
-    return hsa_signal_wait_acquire(signal_, HSA_SIGNAL_CONDITION_LT, 1,
-                                   UINT64_MAX, HSA_WAIT_STATE_BLOCKED);
-  }
-
- private:
-  hsa_agent_t agent_;
-  hsa_agent_t cpu_agent_;
-  uint32_t queue_size_;
-  hsa_queue_t *queue_;
-  hsa_signal_t signal_;
-
-  hsa_region_t system_region_;
-  hsa_region_t kernarg_region_;
-  hsa_region_t local_region_;
-  hsa_region_t gpu_local_region_;
-
-  hsa_kernel_dispatch_packet_t *aql_;
-  uint64_t packet_index_;
-
-  hsa_code_object_t code_object_;
-  hsa_executable_t executable_;
-  uint32_t group_static_size_;
-};
-
-hsa_status_t
-get_agent_callback(const hsa_agent_t agent, void *data) {
-  if (!data) return HSA_STATUS_ERROR_INVALID_ARGUMENT;
-
-  hsa_device_type_t hsa_device_type;
-  hsa_status_t hsa_error_code =
-      hsa_agent_get_info(agent, HSA_AGENT_INFO_DEVICE, &hsa_device_type);
-  if (hsa_error_code != HSA_STATUS_SUCCESS) return hsa_error_code;
-
-  if (hsa_device_type == HSA_DEVICE_TYPE_GPU) {
-    auto b = static_cast<Engine *>(data);
-    b->agent_ = agent;
-  }
-  if (hsa_device_type == HSA_DEVICE_TYPE_CPU) {
-    auto b = static_cast<Engine *>(data);
-    b->cpu_agent_ = agent;
+  } else if (device_input_a.copy_from(input_a) ||
+             device_input_b.copy_from(input_b)) {
+    return -1;
   }
 
-  return HSA_STATUS_SUCCESS;
+  Engine::KernelDispatchConfig d_param(
+      "libkernels.so",                        // kernel compiled object name,
+      kernel_symbol("add_arrays", options),  // name of kernel
+      {num_elements, 1, 1},                   // grid size
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  d_param.mode = launch_mode(options);
+
+  // The grid-stride variant takes the element count.
+  const int status =
+      options.persistent
+          ? launch(engine, d_param, options, setup, report,
+                   device_input_a.data(), device_input_b.data(),
+                   device_output.data(), num_elements)
+          : launch(engine, d_param, options, setup, report,
+                   device_input_a.data(), device_input_b.data(),
+                   device_output.data());
+  if (status != 0) return -1;
+
+  int *output = device_output.host_view(&staging_out);
+  if (device_output.copy_to(output)) return -1;
+
+  if (hansa::ref::compare("add_arrays", output, expected.data(),
+                          num_elements)) {
+    return -1;
+  }
+  hansa::ref::report_speedup("add_arrays", report->median_run_ms(), host_ms);
+  return 0;
 }
 
-hsa_status_t
-get_region_callback(const hsa_region_t region, void *data) {
-  hsa_region_segment_t segment_id;
-  hsa_status_t status =
-      hsa_region_get_info(region, HSA_REGION_INFO_SEGMENT, &segment_id);
-  HSA_ENFORCE("Failed getting region info", status);
+const hansa::KernelRegistrar register_001({"vector_add",
+                                           "kernels/001-vector-add.c", 1024,
+                                           kernel_001_vector_add});
 
-  if (segment_id != HSA_REGION_SEGMENT_GLOBAL) {
-    return HSA_STATUS_SUCCESS;
-  }
+/// Kernel launcher for color-to-grayscale conversion
+int
+kernel_002_color_to_grayscale(Engine &engine, const hansa::RunOptions &options,
+                              hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+
+  // Load the input image using stb_image.
+  int width, height;
+  StbImage host_img = load_teapot(&width, &height);
+  if (!host_img) return -1;
 
-  hsa_region_global_flag_t flags;
-  bool host_accessible_region = false;
-  hsa_region_get_info(region, HSA_REGION_INFO_GLOBAL_FLAGS, &flags);
-  hsa_region_get_info(
-      region,
-      static_cast<hsa_region_info_t>(HSA_AMD_REGION_INFO_HOST_ACCESSIBLE),
-      &host_accessible_region);
+  // Input image is color (3 channels) so total size = width * height * 3.
+  // It stays alive for the check.
+  hansa::DeviceBuffer<unsigned char> device_input =
+      image_input(engine, options, host_img.get(), width * height * 3);
+  // Output image is grayscale so total size = width * height.
+  hansa::DeviceBuffer<unsigned char> device_output(engine, width * height,
+                                                   buffer_kind(options));
+  if (!device_input.data() || !device_output.data()) return -1;
 
-  auto b = static_cast<Engine *>(data);
+  // Total number of pixels (each pixel gets processed by one workitem).
+  int num_pixels = width * height;
 
-  if (flags & HSA_REGION_GLOBAL_FLAG_FINE_GRAINED) {
-    b->system_region_ = region;
+  // Configure the kernel dispatch.
+  Engine::KernelDispatchConfig d_param(
+      "libkernels.so",                                // Kernel compiled object.
+      kernel_symbol("color_to_grayscale", options),  // Kernel name.
+      {num_pixels, 1, 1},                             // Grid size.
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  d_param.mode = launch_mode(options);
+
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_output.data(), device_input.data(), width, height)) {
+    return -1;
   }
 
-  if (flags & HSA_REGION_GLOBAL_FLAG_COARSE_GRAINED) {
-    if (host_accessible_region) {
-      b->local_region_ = region;
-    } else {
-      b->gpu_local_region_ = region;
-    }
+  // Copy the grayscale output from device back to host memory.
+  std::vector<unsigned char> staging_out;
+  unsigned char *host_out = device_output.host_view(&staging_out);
+  if (device_output.copy_to(host_out)) return -1;
+
+  // The weighted sum may round differently once contracted into FMAs.
+  std::vector<unsigned char> expected(width * height);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::color_to_grayscale(expected.data(), host_img.get(), width,
+                                   height);
+  });
+  if (hansa::ref::compare("color_to_grayscale", host_out, expected.data(),
+                          expected.size(), 1)) {
+    return -1;
   }
+  hansa::ref::report_speedup("color_to_grayscale", report->median_run_ms(),
+                             host_ms);
 
-  if (flags & HSA_REGION_GLOBAL_FLAG_KERNARG) {
-    b->kernarg_region_ = region;
-  }
+  save_image("teapot_grayscale", options, host_out, width, height, 1);
 
-  return HSA_STATUS_SUCCESS;
+  return 0;
 }
 
+const hansa::KernelRegistrar register_002(
+    {"color_to_grayscale", "kernels/002-color-to-grayscale.c on teapot.jpg", 0,
+     kernel_002_color_to_grayscale});
+
 int
-kernel_001_vector_add() {
-  Engine engine;
+kernel_003_image_blur_rgb(Engine &engine, const hansa::RunOptions &options,
+                          hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  int width, height;
+  StbImage host_img = load_teapot(&width, &height);
+  if (!host_img) return -1;
+
+  hansa::DeviceBuffer<unsigned char> device_input =
+      image_input(engine, options, host_img.get(), width * height * 3);
+  hansa::DeviceBuffer<unsigned char> device_output(engine, width * height * 3,
+                                                   buffer_kind(options));
+  if (!device_input.data() || !device_output.data()) return -1;
 
-  long rtn = engine.init();
-  if (rtn) {
-    std::cout << "Failed to initialize engine" << std::endl;
+  Engine::KernelDispatchConfig d_param(
+      "libkernels.so", kernel_symbol("image_blur_rgb", options),
+      {width, height, 1},  // Grid size:  Match image dimensions.
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  d_param.mode = launch_mode(options);
+
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_output.data(), device_input.data(), width, height)) {
     return -1;
   }
 
-  constexpr int num_elements = 1000;
-  std::vector<int> input_a(num_elements);
-  std::vector<int> input_b(num_elements);
-
-  std::iota(input_a.begin(), input_a.end(), 0);
-  std::iota(input_b.begin(), input_b.end(), 0);
+  std::vector<unsigned char> staging_out;
+  unsigned char *host_out = device_output.host_view(&staging_out);
+  if (device_output.copy_to(host_out)) return -1;
 
-  std::cout << "Engine init: OK" << std::endl;
-
-  struct args_t {
-    int *input_a;
-    int *input_b;
-    int *output;
-  };
-
-  auto device_input_a = (int *)engine.alloc_local(num_elements * sizeof(int));
-  auto device_input_b = (int *)engine.alloc_local(num_elements * sizeof(int));
-  auto device_output = (int *)engine.alloc_local(num_elements * sizeof(int));
-
-  memcpy(device_input_a, input_a.data(), num_elements * sizeof(int));
-  memcpy(device_input_b, input_b.data(), num_elements * sizeof(int));
+  std::vector<unsigned char> expected(width * height * 3);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::image_blur_rgb(expected.data(), host_img.get(), width, height);
+  });
+  if (hansa::ref::compare("image_blur_rgb", host_out, expected.data(),
+                          expected.size())) {
+    return -1;
+  }
+  hansa::ref::report_speedup("image_blur_rgb", report->median_run_ms(),
+                             host_ms);
 
-  args_t args{.input_a = device_input_a,
-              .input_b = device_input_b,
-              .output = device_output};
+  save_image("teapot_blurred", options, host_out, width, height, 3);
 
-  Engine::KernelDispatchConfig d_param(
-      "libkernels.so",       // kernel compiled object name,
-      "add_arrays.kd",       // name of kernel
-      {num_elements, 1, 1},  // grid size
-      {64, 1, 1},            // workgroup size
-      sizeof(args_t));
-
-  rtn = engine.setup_dispatch(&d_param, args);
-  if (rtn) return -1;
-  std::cout << "Setup dispatch: OK" << std::endl;
-
-  engine.dispatch();
-  std::cout << "Dispatch: OK" << std::endl;
-
-  rtn = engine.wait();
-  if (rtn) return -1;
-  std::cout << "Wait: OK" << std::endl;
-
-  int sum = 0;
-  for (int i = 0; i < num_elements; ++i) {
-    sum += device_output[i];
-  }
-  // Sum of numbers 0..n is n * (n - 1) / 2
-  // In our case n = 99 - sum would be 99 * 100 / 2 = 4950
-  // Since we have two arrays each that sum up to 4950,
-  // we expect the sum of those two arrays to be = 2 * 4950 = 9900
-  std::cout << "We expected the sum to be :"
-            << (num_elements - 1) * num_elements << ". Calculated sum is "
-            << std::reduce(device_output, device_output + num_elements, 0)
-            << std::endl;
   return 0;
 }
 
-/// Kernel launcher for color-to-grayscale conversion
+const hansa::KernelRegistrar register_003({"image_blur_rgb",
+                                           "kernels/003-image-blur.c on "
+                                           "teapot.jpg",
+                                           0, kernel_003_image_blur_rgb});
+
+/// kernels/003-image-blur.c on teapot.jpg a size x size tile at a time,
+/// through a device working set of at most two tiles.
 int
-kernel_002_color_to_grayscale() {
-  // Load the input image using stb_image.
-  int width, height, channels;
-  unsigned char *host_img =
-      stbi_load("../data/images/teapot.jpg", &width, &height, &channels, 0);
-  if (!host_img) {
-    std::cout << "Failed to load image teapot.png" << std::endl;
-    return -1;
-  }
-  if (channels < 3) {
-    std::cout << "Image does not have enough channels (expected at least 3)"
-              << std::endl;
-    stbi_image_free(host_img);
-    return -1;
+kernel_003_image_blur_tiled(Engine &engine, const hansa::RunOptions &options,
+                            hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  int width, height;
+  StbImage host_img = load_teapot(&width, &height);
+  if (!host_img) return -1;
+
+  hansa::TileOptions tiles;
+  tiles.tile_width = tiles.tile_height = options.size;
+  tiles.max_in_flight = 2;
+  hansa::TiledImage tiled(engine, hansa::blur_rgb_filter(engine), tiles);
+  std::vector<unsigned char> host_out(size_t(width) * height * 3);
+  hansa::TileStats stats;
+  report->setup_ms = setup.elapsed_ms();
+  for (int r = 0; r < options.repeats; ++r) {
+    hansa::Stopwatch run;
+    if (0 != tiled.run(host_out.data(), host_img.get(), width, height,
+                       &stats)) {
+      return -1;
+    }
+    report->run_ms.push_back(run.elapsed_ms());
   }
-  std::cout << "Loaded image teapot.png: " << width << " x " << height
-            << ", channels: " << channels << std::endl;
-
-  // Create a host buffer for the grayscale output (1 channel per pixel).
-  std::vector<unsigned char> host_out(width * height);
+  std::cout << stats.tiles << " tiles, " << stats.in_flight
+            << " in flight, working set " << stats.working_set / 1e6
+            << " MB, halos added " << stats.halo_bytes / 1e6 << " MB"
+            << std::endl;
 
-  // Initialize the Engine.
-  Engine engine;
-  long rtn = engine.init();
-  if (rtn) {
-    std::cout << "Failed to initialize engine" << std::endl;
-    stbi_image_free(host_img);
+  std::vector<unsigned char> expected(host_out.size());
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::image_blur_rgb(expected.data(), host_img.get(), width, height);
+  });
+  if (hansa::ref::compare("image_blur_tiled", host_out.data(),
+                          expected.data(), expected.size())) {
     return -1;
   }
-  std::cout << "Engine init: OK" << std::endl;
+  hansa::ref::report_speedup("image_blur_tiled", report->median_run_ms(),
+                             host_ms);
 
-  // Allocate device memory.
-  // Input image is color (3 channels) so total size = width * height * 3.
-  auto device_input = (unsigned char *)engine.alloc_local(
-      width * height * 3 * sizeof(unsigned char));
-  // Output image is grayscale so total size = width * height.
-  auto device_output = (unsigned char *)engine.alloc_local(
-      width * height * sizeof(unsigned char));
+  save_image("teapot_blurred_tiled", options, host_out.data(), width, height,
+             3);
+  return 0;
+}
 
-  // Copy the host input image to the device.
-  memcpy(device_input, host_img, width * height * 3 * sizeof(unsigned char));
-  // Free the host image as it's now on the device.
-  stbi_image_free(host_img);
+const hansa::KernelRegistrar register_003_tiled(
+    {"image_blur_tiled",
+     "kernels/003-image-blur.c on teapot.jpg in tiles, size is the tile edge",
+     256, kernel_003_image_blur_tiled});
 
-  // Define the arguments structure matching the kernel signature.
-  struct args_t {
-    unsigned char *img_out;
-    unsigned char *img_in;
-    int width;
-    int height;
-  };
-
-  args_t args{.img_out = device_output,
-              .img_in = device_input,
-              .width = width,
-              .height = height};
+/// data/images/teapot.jpg as planar RGB from the image cache, decoded on
+/// the first run only.
+int
+load_teapot_planar(hansa::MappedImage *image) {
+  const std::string source = "../data/images/teapot.jpg";
+  hansa::ImageCache cache(hansa::ImageCache::default_dir());
+  hansa::Stopwatch load;
+  bool hit;
+  if (0 != cache.load(source, image, &hit)) return -1;
+  std::cout << (hit ? "Mapped" : "Decoded and cached") << " teapot.jpg: "
+            << image->width() << " x " << image->height() << " planar in "
+            << load.elapsed_ms() << " ms (" << cache.path_for(source) << ")"
+            << std::endl;
+  return 0;
+}
 
-  // Total number of pixels (each pixel gets processed by one workitem).
-  int num_pixels = width * height;
+int
+kernel_002_color_to_grayscale_planar(Engine &engine,
+                                     const hansa::RunOptions &options,
+                                     hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  hansa::MappedImage image;
+  if (0 != load_teapot_planar(&image)) return -1;
+  const int width = image.width();
+  const int height = image.height();
+
+  hansa::DeviceBuffer<unsigned char> device_input =
+      image_input(engine, options, image.pixels(), image.bytes());
+  hansa::DeviceBuffer<unsigned char> device_output(engine, width * height,
+                                                   buffer_kind(options));
+  if (!device_input.data() || !device_output.data()) return -1;
 
-  // Configure the kernel dispatch.
   Engine::KernelDispatchConfig d_param(
-      "libkernels.so",          // Kernel compiled object.
-      "color_to_grayscale.kd",  // Kernel name.
-      {num_pixels, 1, 1},       // Grid size.
-      {64, 1, 1},               // Workgroup size.
-      sizeof(args_t));
+      "libkernels.so", "color_to_grayscale_planar.kd",
+      {width * height, 1, 1}, Engine::KernelDispatchConfig::kAutoWorkgroup);
 
-  rtn = engine.setup_dispatch(&d_param, args);
-  if (rtn) return -1;
-  std::cout << "Setup dispatch: OK" << std::endl;
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_output.data(), device_input.data(), width, height)) {
+    return -1;
+  }
 
-  // Launch the kernel.
-  engine.dispatch();
-  std::cout << "Dispatch: OK" << std::endl;
+  std::vector<unsigned char> staging_out;
+  unsigned char *host_out = device_output.host_view(&staging_out);
+  if (device_output.copy_to(host_out)) return -1;
+
+  // The reference reads interleaved RGB, as the kernel's other forms do.
+  std::vector<unsigned char> rgb(image.bytes());
+  hansa::interleave(rgb.data(), image.pixels(), size_t(width) * height, 3);
+  std::vector<unsigned char> expected(width * height);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::color_to_grayscale(expected.data(), rgb.data(), width,
+                                   height);
+  });
+  if (hansa::ref::compare("color_to_grayscale_planar", host_out,
+                          expected.data(), expected.size(), 1)) {
+    return -1;
+  }
+  hansa::ref::report_speedup("color_to_grayscale_planar",
+                             report->median_run_ms(), host_ms);
+  return 0;
+}
 
-  rtn = engine.wait();
-  if (rtn) return -1;
-  std::cout << "Wait: OK" << std::endl;
+const hansa::KernelRegistrar register_002_planar(
+    {"color_to_grayscale_planar",
+     "kernels/002-color-to-grayscale.c on cached planar teapot.jpg", 0,
+     kernel_002_color_to_grayscale_planar});
 
-  // Copy the grayscale output from device back to host memory.
-  memcpy(host_out.data(), device_output,
-         width * height * sizeof(unsigned char));
+int
+kernel_003_image_blur_planar(Engine &engine, const hansa::RunOptions &options,
+                             hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  hansa::MappedImage image;
+  if (0 != load_teapot_planar(&image)) return -1;
+  const int width = image.width();
+  const int height = image.height();
+
+  hansa::DeviceBuffer<unsigned char> device_input =
+      image_input(engine, options, image.pixels(), image.bytes());
+  hansa::DeviceBuffer<unsigned char> device_output(engine, image.bytes(),
+                                                   buffer_kind(options));
+  if (!device_input.data() || !device_output.data()) return -1;
+
+  // One work-item per pixel of each plane.
+  Engine::KernelDispatchConfig d_param(
+      "libkernels.so", "image_blur_planar.kd", {width, height, 3},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
 
-  if (stbi_write_png("teapot_grayscale.png", width, height, 1, host_out.data(),
-                     width)) {
-    std::cout << "Grayscale image saved as teapot_grayscale.png" << std::endl;
-  } else {
-    std::cout << "Failed to save grayscale image" << std::endl;
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_output.data(), device_input.data(), width, height)) {
+    return -1;
   }
 
+  std::vector<unsigned char> staging_out;
+  unsigned char *host_out = device_output.host_view(&staging_out);
+  if (device_output.copy_to(host_out)) return -1;
+
+  const size_t pixels = size_t(width) * height;
+  std::vector<unsigned char> rgb(image.bytes()), blurred(image.bytes());
+  hansa::interleave(rgb.data(), image.pixels(), pixels, 3);
+  hansa::interleave(blurred.data(), host_out, pixels, 3);
+  std::vector<unsigned char> expected(image.bytes());
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::image_blur_rgb(expected.data(), rgb.data(), width, height);
+  });
+  if (hansa::ref::compare("image_blur_planar", blurred.data(),
+                          expected.data(), expected.size())) {
+    return -1;
+  }
+  hansa::ref::report_speedup("image_blur_planar", report->median_run_ms(),
+                             host_ms);
   return 0;
 }
 
-int
-kernel_003_image_blur_rgb() {
-  int width, height, channels;
-
-  unsigned char *host_img =
-      stbi_load("../data/images/teapot.jpg", &width, &height, &channels, 0);
+const hansa::KernelRegistrar register_003_planar(
+    {"image_blur_planar",
+     "kernels/003-image-blur.c on cached planar teapot.jpg", 0,
+     kernel_003_image_blur_planar});
 
-  if (!host_img) {
-    std::cout << "Failed to load image teapot.jpg" << std::endl;
+/// kernels/043-image-blur-separable.c on teapot.jpg, with options.size as
+/// the radius. With fused_grayscale, grayscale and blur are one dispatch.
+int
+run_separable_blur(Engine &engine, const hansa::RunOptions &options,
+                   hansa::RunReport *report, bool fused_grayscale) {
+  hansa::Stopwatch setup;
+  hansa::SeparableBlur blur;
+  blur.fused_grayscale = fused_grayscale;
+  blur.radius = options.size;
+  if (0 != blur.check(engine.limits())) return -1;
+  int width, height;
+  StbImage host_img = load_teapot(&width, &height);
+  if (!host_img) return -1;
+
+  const size_t out_bytes = size_t(width) * height * blur.channels();
+  hansa::DeviceBuffer<unsigned char> device_input =
+      image_input(engine, options, host_img.get(), width * height * 3);
+  hansa::DeviceBuffer<unsigned char> device_output(engine, out_bytes,
+                                                   buffer_kind(options));
+  if (!device_input.data() || !device_output.data()) return -1;
+
+  const Engine::KernelDispatchConfig d_param =
+      blur.dispatch_config(width, height);
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_output.data(), device_input.data(), width, height,
+                  blur.radius, int(blur.planar))) {
     return -1;
   }
 
-  if (channels < 3) {
-    std::cout << "Image does not have enough channels (expected at least 3)"
-              << std::endl;
-    stbi_image_free(host_img);
+  std::vector<unsigned char> staging_out;
+  unsigned char *host_out = device_output.host_view(&staging_out);
+  if (device_output.copy_to(host_out)) return -1;
+
+  const char *name =
+      fused_grayscale ? "grayscale_blur_fused" : "image_blur_separable";
+  std::vector<unsigned char> expected(out_bytes);
+  const double host_ms = hansa::ref::time_ms([&] {
+    if (fused_grayscale) {
+      hansa::ref::grayscale_blur(expected.data(), host_img.get(), width,
+                                 height, blur.radius);
+    } else {
+      hansa::ref::box_blur(expected.data(), host_img.get(), width, height, 3,
+                           blur.radius);
+    }
+  });
+  // A gray value may round differently once contracted into FMAs, which
+  // can move the mean of a window by one.
+  if (hansa::ref::compare(name, host_out, expected.data(), expected.size(),
+                          fused_grayscale ? 1 : 0)) {
     return -1;
   }
+  hansa::ref::report_speedup(name, report->median_run_ms(), host_ms);
 
-  std::cout << "Loaded image teapot.jpg: " << width << " x " << height
-            << ", channels: " << channels << std::endl;
-
-  std::vector<unsigned char> host_out(width * height * 3);
+  save_image(fused_grayscale ? "teapot_grayscale_blurred"
+                             : "teapot_blurred_separable",
+             options, host_out, width, height, blur.channels());
+  return 0;
+}
 
-  Engine engine;
-  long rtn = engine.init();
+int
+kernel_043_image_blur_separable(Engine &engine,
+                                const hansa::RunOptions &options,
+                                hansa::RunReport *report) {
+  return run_separable_blur(engine, options, report, false);
+}
 
-  if (rtn) {
-    std::cout << "Failed to initialize engine" << std::endl;
-    stbi_image_free(host_img);
-    return -1;
-  }
-  std::cout << "Engine init: OK" << std::endl;
+const hansa::KernelRegistrar register_043(
+    {"image_blur_separable",
+     "kernels/043-image-blur-separable.c on teapot.jpg, size is the radius",
+     4, kernel_043_image_blur_separable});
 
-  auto device_input = (unsigned char *)engine.alloc_local(
-      width * height * 3 * sizeof(unsigned char));
-  auto device_output = (unsigned char *)engine.alloc_local(
-      width * height * 3 * sizeof(unsigned char));
+int
+kernel_043_grayscale_blur_fused(Engine &engine,
+                                const hansa::RunOptions &options,
+                                hansa::RunReport *report) {
+  return run_separable_blur(engine, options, report, true);
+}
 
-  memcpy(device_input, host_img, width * height * 3 * sizeof(unsigned char));
+const hansa::KernelRegistrar register_043_fused(
+    {"grayscale_blur_fused",
+     "kernels/043-image-blur-separable.c grayscale and blur in one dispatch",
+     4, kernel_043_grayscale_blur_fused});
 
-  stbi_image_free(host_img);
+/// kernels/002-color-to-grayscale.c, then the planar blur of
+/// kernels/003-image-blur.c over its one plane, captured once as a
+/// two-node DispatchGraph and replayed. Runs alternate between two
+/// outputs, rebinding the blur with set_args the way a loop that hands off
+/// one result while computing the next would.
+int
+graph_grayscale_blur(Engine &engine, const hansa::RunOptions &options,
+                     hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  int width, height;
+  StbImage host_img = load_teapot(&width, &height);
+  if (!host_img) return -1;
+  const int pixels = width * height;
+
+  hansa::DeviceBuffer<unsigned char> device_input =
+      image_input(engine, options, host_img.get(), size_t(pixels) * 3);
+  hansa::DeviceBuffer<unsigned char> device_gray(engine, pixels);
+  hansa::DeviceBuffer<unsigned char> device_output(engine, pixels,
+                                                   buffer_kind(options));
+  hansa::DeviceBuffer<unsigned char> device_output_alt(engine, pixels,
+                                                       buffer_kind(options));
+  if (!device_input.data() || !device_gray.data() || !device_output.data() ||
+      !device_output_alt.data()) {
+    return -1;
+  }
+  unsigned char *const outputs[2] = {device_output.data(),
+                                     device_output_alt.data()};
 
   struct args_t {
     unsigned char *img_out;
-    unsigned char *img_in;
-
+    const unsigned char *img_in;
     int width;
     int height;
   };
+  const Engine::KernelDispatchConfig gray_cfg(
+      "libkernels.so", "color_to_grayscale.kd", {pixels, 1, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  // The planar blur takes the plane in z; the gray image is the only one.
+  const Engine::KernelDispatchConfig blur_cfg(
+      "libkernels.so", "image_blur_planar.kd", {width, height, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  hansa::DispatchGraph graph;
+  hansa::DispatchGraph::NodeId gray, blur;
+  if (0 != engine.capture(&graph, &gray_cfg,
+                          args_t{device_gray.data(), device_input.data(),
+                                 width, height},
+                          {}, &gray) ||
+      0 != engine.capture(&graph, &blur_cfg,
+                          args_t{outputs[0], device_gray.data(), width,
+                                 height},
+                          {gray}, &blur)) {
+    return -1;
+  }
+  report->setup_ms = setup.elapsed_ms();
+
+  // The first replay also plans the graph.
+  for (int r = 0; r < options.repeats; ++r) {
+    hansa::Stopwatch run;
+    if (r > 0 && 0 != graph.set_args(blur, args_t{outputs[r % 2],
+                                                  device_gray.data(), width,
+                                                  height})) {
+      return -1;
+    }
+    if (0 != engine.replay(&graph)) return -1;
+    if (0 != engine.wait(graph)) return -1;
+    report->run_ms.push_back(run.elapsed_ms());
+  }
 
-  args_t args{.img_out = device_output,
-              .img_in = device_input,
-              .width = width,
-              .height = height};
-
-  int num_pixels = width * height;
-
-  Engine::KernelDispatchConfig d_param(
-      "libkernels.so", "image_blur_rgb.kd",
-      {width, height, 1},  // Grid size:  Match image dimensions.
-      {16, 16, 1},         // Workgroup size: Example 16x16.
-      sizeof(args_t));
-
-  rtn = engine.setup_dispatch(&d_param, args);
-  if (rtn) return -1;
-  std::cout << "Setup dispatch: OK" << std::endl;
-
-  engine.dispatch();
-
-  std::cout << "Dispatch: OK" << std::endl;
-
-  rtn = engine.wait();
-  if (rtn) return -1;
-  std::cout << "Wait: OK" << std::endl;
-
-  memcpy(host_out.data(), device_output,
-         width * height * 3 * sizeof(unsigned char));
-
-  if (stbi_write_png("teapot_blurred.png", width, height, 3, host_out.data(),
-                     width * 3)) {
-    std::cout << "Blurred image saved as teapot_blurred.png" << std::endl;
-  } else {
-    std::cout << "Failed to save blurred image" << std::endl;
+  std::vector<unsigned char> gray_expected(pixels), expected(pixels);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::color_to_grayscale(gray_expected.data(), host_img.get(),
+                                   width, height);
+    hansa::ref::box_blur(expected.data(), gray_expected.data(), width, height,
+                         1, 1);
+  });
+  // Gray values may round differently once contracted into FMAs, which can
+  // move the mean of a window by one.
+  std::vector<unsigned char> staging_out;
+  unsigned char *host_out = nullptr;
+  for (int i = 0; i < std::min(options.repeats, 2); ++i) {
+    hansa::DeviceBuffer<unsigned char> &output =
+        i ? device_output_alt : device_output;
+    host_out = output.host_view(&staging_out);
+    if (output.copy_to(host_out)) return -1;
+    if (hansa::ref::compare("graph_grayscale_blur", host_out, expected.data(),
+                            expected.size(), 1)) {
+      return -1;
+    }
   }
+  hansa::ref::report_speedup("graph_grayscale_blur", report->median_run_ms(),
+                             host_ms);
 
+  if (host_out) {
+    save_image("teapot_grayscale_blurred_graph", options, host_out, width,
+               height, 1);
+  }
   return 0;
 }
 
+const hansa::KernelRegistrar register_graph(
+    {"graph_grayscale_blur",
+     "kernels/002 then kernels/003 on teapot.jpg as a replayed DispatchGraph",
+     0, graph_grayscale_blur});
+
 void
-print_matrix(const std::vector<int> &matrix, int rows, int cols) {
+print_matrix(const int *matrix, int rows, int cols) {
   for (int i = 0; i < rows; ++i) {
     for (int j = 0; j < cols; ++j) {
       std::cout << std::setw(5) << matrix[i * cols + j] << " ";
@@ -724,14 +730,23 @@ print_matrix(const std::vector<int> &matrix, int rows, int cols) {
 }
 
 int
-kernel_004_matrix_multiply_naive() {
-  constexpr int N = 8;
-  constexpr int M = 8;
-  constexpr int K = 8;
-
-  std::vector<int> host_a(N * M);
-  std::vector<int> host_b(M * K);
-  std::vector<int> host_c(N * K);
+kernel_004_matrix_multiply_naive(Engine &engine,
+                                 const hansa::RunOptions &options,
+                                 hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  const int N = options.size;
+  const int M = options.size;
+  const int K = options.size;
+
+  const hansa::MemoryKind kind = buffer_kind(options);
+  hansa::DeviceBuffer<int> device_a(engine, N * M, kind);
+  hansa::DeviceBuffer<int> device_b(engine, M * K, kind);
+  hansa::DeviceBuffer<int> device_c(engine, N * K, kind);
+
+  std::vector<int> staging_a, staging_b, staging_c;
+  int *host_a = device_a.host_view(&staging_a);
+  int *host_b = device_b.host_view(&staging_b);
+  int *host_c = device_c.host_view(&staging_c);
 
   std::random_device rd;
   std::mt19937 gen(rd());
@@ -741,62 +756,605 @@ kernel_004_matrix_multiply_naive() {
   for (int i = 0; i < N * M; ++i) host_a[i] = dist(gen);
   for (int i = 0; i < M * K; ++i) host_b[i] = dist(gen);
 
-  Engine engine;
-  long rtn = engine.init();
-  if (rtn) {
+  if (device_a.copy_from(host_a) || device_b.copy_from(host_b)) {
     return -1;
   }
 
-  auto device_a = (int *)engine.alloc_local(N * M * sizeof(int));
-  auto device_b = (int *)engine.alloc_local(M * K * sizeof(int));
-  auto device_c = (int *)engine.alloc_local(N * K * sizeof(int));
+  Engine::KernelDispatchConfig d_param("libkernels.so",
+                                       "matrix_multiply_naive.kd", {K, N, 1},
+                                       {64, 1, 1});
 
-  memcpy(device_a, host_a.data(), N * M * sizeof(int));
-  memcpy(device_b, host_b.data(), M * K * sizeof(int));
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_c.data(), device_a.data(), device_b.data(), N, M, K)) {
+    return -1;
+  }
 
-  struct args_t {
-    int *c;
-    int *a;
-    int *b;
-    int n;
-    int m;
-    int k;
-  };
+  if (device_c.copy_to(host_c)) return -1;
 
-  args_t args{
-      .c = device_c, .a = device_a, .b = device_b, .n = N, .m = M, .k = K};
+  // Only small matrices are worth printing.
+  if (N <= 8 && K <= 8) {
+    std::cout << "Matrix A:" << std::endl;
+    print_matrix(host_a, N, M);
+    std::cout << "Matrix B:" << std::endl;
+    print_matrix(host_b, M, K);
+    std::cout << "Matrix C (Result):" << std::endl;
+    print_matrix(host_c, N, K);
+  }
 
-  Engine::KernelDispatchConfig d_param(
-      "libkernels.so", "matrix_multiply_naive.kd",
-      {(uint32_t)K, (uint32_t)N, 1}, {64, 1, 1}, sizeof(args_t));
+  std::vector<int> expected(N * K);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::matrix_multiply_naive(expected.data(), host_a, host_b, N, M,
+                                      K);
+  });
+  if (hansa::ref::compare("matrix_multiply_naive", host_c, expected.data(),
+                          expected.size())) {
+    return -1;
+  }
+  hansa::ref::report_speedup("matrix_multiply_naive", report->median_run_ms(),
+                             host_ms);
 
-  rtn = engine.setup_dispatch(&d_param, args);
-  if (rtn) return -1;
+  return 0;
+}
+
+const hansa::KernelRegistrar register_004(
+    {"matrix_multiply_naive", "kernels/004-matrix-multiply-naive.c, NxN int",
+     8, kernel_004_matrix_multiply_naive});
 
-  std::cout << "Matrix A:" << std::endl;
-  print_matrix(host_a, N, M);
-  std::cout << "Matrix B:" << std::endl;
-  print_matrix(host_b, M, K);
+int
+kernel_005_matrix_multiply_tiled(Engine &engine,
+                                 const hansa::RunOptions &options,
+                                 hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  // Multiples of the kernel's TILE_SIZE; partial tiles would skip barriers.
+  const int N = (options.size + 15) / 16 * 16;
+  const int M = N;
+  const int K = N;
+
+  const hansa::MemoryKind kind = buffer_kind(options);
+  hansa::DeviceBuffer<float> device_a(engine, N * M, kind);
+  hansa::DeviceBuffer<float> device_b(engine, M * K, kind);
+  hansa::DeviceBuffer<float> device_c(engine, N * K, kind);
+
+  std::vector<float> staging_a, staging_b, staging_c;
+  float *host_a = device_a.host_view(&staging_a);
+  float *host_b = device_b.host_view(&staging_b);
+  float *host_c = device_c.host_view(&staging_c);
+
+  std::mt19937 gen(std::random_device{}());
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  for (int i = 0; i < N * M; ++i) host_a[i] = dist(gen);
+  for (int i = 0; i < M * K; ++i) host_b[i] = dist(gen);
 
-  engine.dispatch();
+  std::vector<float> expected(N * K);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::matrix_multiply_tiled2(expected.data(), host_a, host_b, N, M,
+                                       K);
+  });
+
+  if (device_b.copy_from(host_b)) return -1;
+  if (kind == hansa::MemoryKind::kDeviceLocal) {
+    // Multiply each band of A's rows as soon as it lands instead of after
+    // the whole upload; the runs below repeat the product over all of A.
+    struct args_t {
+      float *c;
+      const float *a;
+      const float *b;
+      int n;
+      int m;
+      int k;
+    };
+    hansa::Stopwatch streamed;
+    const size_t row = M * sizeof(float);
+    const int status = engine.stream_upload<1>(
+        {device_a.data()}, {host_a}, N * row, 16 * row,
+        [&](size_t offset, size_t bytes, Engine::DispatchHandle *last) {
+          const int first = offset / row;
+          const int rows = bytes / row;
+          const Engine::KernelDispatchConfig cfg(
+              "libkernels.so", "matrix_multiply_tiled2.kd", {K, rows, 1},
+              {16, 16, 1});
+          const args_t args{device_c.data() + size_t(first) * K,
+                            device_a.data() + size_t(first) * M,
+                            device_b.data(), rows, M, K};
+          return engine.post(&cfg, args, last);
+        });
+    if (status != 0 || device_c.copy_to(host_c)) return -1;
+    report->streamed_ms = streamed.elapsed_ms();
+    if (hansa::ref::compare("matrix_multiply_tiled2 streamed", host_c,
+                            expected.data(), expected.size(), 0, 1e-4)) {
+      return -1;
+    }
+  } else if (device_a.copy_from(host_a)) {
+    return -1;
+  }
 
-  rtn = engine.wait();
-  if (rtn) return -1;
+  Engine::KernelDispatchConfig d_param("libkernels.so",
+                                       "matrix_multiply_tiled2.kd", {K, N, 1},
+                                       {16, 16, 1});
 
-  memcpy(host_c.data(), device_c, N * K * sizeof(int));
+  if (0 != launch(engine, d_param, options, setup, report,
+                  device_c.data(), device_a.data(), device_b.data(), N, M, K)) {
+    return -1;
+  }
 
-  std::cout << "Matrix C (Result):" << std::endl;
+  if (device_c.copy_to(host_c)) return -1;
 
-  print_matrix(host_c, N, K);
+  if (hansa::ref::compare("matrix_multiply_tiled2", host_c, expected.data(),
+                          expected.size(), 0, 1e-4)) {
+    return -1;
+  }
+  hansa::ref::report_speedup("matrix_multiply_tiled2",
+                             report->median_run_ms(), host_ms);
 
   return 0;
 }
 
+const hansa::KernelRegistrar register_005(
+    {"matrix_multiply_tiled", "kernels/005-matrix-multiply-tiled.c, NxN float",
+     512, kernel_005_matrix_multiply_tiled});
+
+/// Tiled matmul in the variant the autotuner picks for the shape, timed
+/// on first use of the shape's bucket and read from the tuning cache after.
 int
-main(int argc, char **argv) {
-  kernel_001_vector_add();
-  kernel_002_color_to_grayscale();
-  kernel_003_image_blur_rgb();
-  kernel_004_matrix_multiply_naive();
+kernel_005_matrix_multiply_tuned(Engine &engine,
+                                 const hansa::RunOptions &options,
+                                 hansa::RunReport *report) {
+  hansa::Stopwatch setup;
+  const int N = options.size;
+  const int M = N;
+  const int K = N;
+
+  const hansa::MemoryKind kind = buffer_kind(options);
+  hansa::DeviceBuffer<float> device_a(engine, N * M, kind);
+  hansa::DeviceBuffer<float> device_b(engine, M * K, kind);
+  hansa::DeviceBuffer<float> device_c(engine, N * K, kind);
+
+  std::vector<float> staging_a, staging_b, staging_c;
+  float *host_a = device_a.host_view(&staging_a);
+  float *host_b = device_b.host_view(&staging_b);
+  float *host_c = device_c.host_view(&staging_c);
+
+  std::mt19937 gen(std::random_device{}());
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  for (int i = 0; i < N * M; ++i) host_a[i] = dist(gen);
+  for (int i = 0; i < M * K; ++i) host_b[i] = dist(gen);
+
+  if (device_a.copy_from(host_a) || device_b.copy_from(host_b)) {
+    return -1;
+  }
+
+  hansa::TuningCache cache(hansa::TuningCache::default_path());
+  cache.load();
+  hansa::MatmulTuner tuner(engine, &cache);
+  hansa::MatmulConfig config;
+  bool cached;
+  if (0 != tuner.select(device_c.data(), device_a.data(), device_b.data(), N,
+                        M, K, &config, &cached)) {
+    return -1;
+  }
+  std::cout << "matrix_multiply_tuned: " << config.name()
+            << (cached ? " from " : ", tuned and saved to ") << cache.path()
+            << std::endl;
+
+  if (0 != launch(engine, config.dispatch_config(N, K), options, setup,
+                  report, device_c.data(), device_a.data(), device_b.data(),
+                  N, M, K)) {
+    return -1;
+  }
+
+  if (device_c.copy_to(host_c)) return -1;
+
+  std::vector<float> expected(N * K);
+  const double host_ms = hansa::ref::time_ms([&] {
+    hansa::ref::matrix_multiply_tiled2(expected.data(), host_a, host_b, N, M,
+                                       K);
+  });
+  if (hansa::ref::compare("matrix_multiply_tuned", host_c, expected.data(),
+                          expected.size(), 0, 1e-4)) {
+    return -1;
+  }
+  hansa::ref::report_speedup("matrix_multiply_tuned", report->median_run_ms(),
+                             host_ms);
+  return 0;
+}
+
+const hansa::KernelRegistrar register_005_tuned(
+    {"matrix_multiply_tuned",
+     "kernels/templates/matrix-multiply-tiled.c.in, autotuned, NxN float",
+     256, kernel_005_matrix_multiply_tuned});
+
+void
+usage() {
+  std::cerr << "usage: hansa [--list] [--repeat N] [--zero-copy] "
+               "[--persistent] [--profile-workgroups[=DIR]] "
+               "[--image-format png|png-stored|qoi] [--trace FILE] "
+               "[kernel[:size] ...]\n"
+               "Runs every registered kernel at its default size when no "
+               "kernel is named. --zero-copy keeps host data in pinned or "
+               "host-coherent memory the kernels access in place. "
+               "--persistent launches grid-stride kernels on only as many "
+               "workgroups as the device holds at once. "
+               "--profile-workgroups reports per-workgroup times and CU "
+               "residency, from kernels built with HANSA_PROFILE_WORKGROUPS, "
+               "and saves the traces to DIR. --image-format picks how image "
+               "outputs are saved: PNG deflated in parallel, PNG left "
+               "uncompressed, or QOI. --trace writes a Chrome trace of setup, "
+               "dispatch, wait, copy and image I/O spans, with kernel times "
+               "on the device where the agent records them, to FILE; it "
+               "needs a build with HANSA_TRACE."
+            << std::endl;
+  std::cerr << "       hansa --analyze-workgroups trace ...\n"
+               "Reports on traces saved by --profile-workgroups."
+            << std::endl;
+  std::cerr << "       hansa --bundle [isa ...]\n"
+               "Lists the embedded code objects and which one each ISA "
+               "name, such as gfx90a:xnack+, would load."
+            << std::endl;
+  std::cerr << "       hansa --batch grayscale|blur|grayscale-blur "
+               "[--radius N] [--out DIR] "
+               "[--decoders N] [--encoders N] [--in-flight N] "
+               "[--image-cache[=DIR]] [--image-format png|png-stored|qoi] "
+               "[--trace FILE] image|dir ...\n"
+               "Streams images through a decode, dispatch and encode "
+               "pipeline, writing images to DIR. --image-cache decodes each "
+               "image once into a planar cache, $HANSA_IMAGE_CACHE by "
+               "default, and maps it on later runs. grayscale-blur runs "
+               "both steps as one fused dispatch."
+            << std::endl;
+}
+
+/// Starts recording for --trace: host spans on every thread, and kernel
+/// times where the agent can record them.
+int
+start_trace(Engine &engine) {
+#ifdef HANSA_TRACE
+  hansa::Tracer::instance().enable();
+  if (0 != engine.enable_profiling()) {
+    std::cout << "No dispatch timestamps on " << engine.agent_name()
+              << ", tracing host spans only" << std::endl;
+  }
   return 0;
+#else
+  static_cast<void>(engine);
+  std::cerr << "ERROR: --trace needs a build configured with HANSA_TRACE=ON"
+            << std::endl;
+  return -1;
+#endif
+}
+
+/// hansa --batch: pushes a list of images through one kernel.
+int
+batch_main(int argc, char **argv) {
+  hansa::BatchOptions options;
+  const std::string op = argc > 2 ? argv[2] : "";
+  if (op == "grayscale") {
+    options.op = hansa::ImageOp::kGrayscale;
+  } else if (op == "blur") {
+    options.op = hansa::ImageOp::kBlur;
+  } else if (op == "grayscale-blur") {
+    options.op = hansa::ImageOp::kGrayscaleBlur;
+  } else {
+    usage();
+    return 1;
+  }
+
+  std::vector<std::string> inputs;
+  std::string trace_path;
+  for (int i = 3; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--out" && has_value) {
+      options.output_dir = argv[++i];
+    } else if (arg == "--decoders" && has_value) {
+      options.decoders = std::atoi(argv[++i]);
+    } else if (arg == "--encoders" && has_value) {
+      options.encoders = std::atoi(argv[++i]);
+    } else if (arg == "--in-flight" && has_value) {
+      options.in_flight = std::atoi(argv[++i]);
+    } else if (arg == "--radius" && has_value) {
+      options.blur_radius = std::atoi(argv[++i]);
+    } else if (arg == "--trace" && has_value) {
+      trace_path = argv[++i];
+    } else if (arg == "--image-cache") {
+      options.image_cache = hansa::ImageCache::default_dir();
+    } else if (arg.rfind("--image-cache=", 0) == 0) {
+      options.image_cache = arg.substr(arg.find('=') + 1);
+    } else if (arg == "--image-format" && has_value) {
+      if (!hansa::parse_image_format(argv[++i], &options.format)) {
+        usage();
+        return 1;
+      }
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  const std::vector<std::string> paths = hansa::collect_images(inputs);
+  if (paths.empty()) {
+    usage();
+    return 1;
+  }
+
+  Engine *engine = hansa::Runtime::engine();
+  if (!engine) {
+    std::cout << "Failed to initialize engine" << std::endl;
+    return 1;
+  }
+  if (!trace_path.empty() && 0 != start_trace(*engine)) return 1;
+  hansa::ImageBatch batch(*engine, options);
+  hansa::BatchReport report;
+  int status = batch.run(paths, &report);
+  hansa::print_batch_report(report);
+  if (!trace_path.empty() &&
+      0 != hansa::Tracer::instance().write_chrome_json(trace_path)) {
+    status = -1;
+  }
+  return status == 0 && report.failed == 0 ? 0 : 1;
+}
+
+/// Reports on the workgroup trace of each kernel's last dispatch, saving
+/// each to dir unless it is empty.
+int
+report_workgroups(const Engine &engine, const std::string &dir) {
+  int failures = 0;
+  for (const auto &[symbol, trace] : engine.workgroup_traces()) {
+    hansa::print_workgroup_report(trace, hansa::analyze_workgroups(trace),
+                                  std::cout);
+    if (!dir.empty() && 0 != trace.save(dir + "/" + symbol + ".wgtrace")) {
+      ++failures;
+    }
+  }
+  return failures;
+}
+
+/// hansa --analyze-workgroups: reports on saved traces, with no agent.
+int
+analyze_main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+  int failures = 0;
+  for (int i = 2; i < argc; ++i) {
+    hansa::WorkgroupTrace trace;
+    if (0 != hansa::WorkgroupTrace::load(argv[i], &trace)) {
+      ++failures;
+      continue;
+    }
+    hansa::print_workgroup_report(trace, hansa::analyze_workgroups(trace),
+                                  std::cout);
+  }
+  return failures ? 1 : 0;
+}
+
+/// hansa --bundle: lists the embedded code objects and picks among them
+/// for each ISA name given, with no agent.
+int
+bundle_main(int argc, char **argv) {
+  const hansa::CodeObjectBundle bundle = hansa::CodeObjectBundle::embedded();
+  for (const hansa::CodeObjectBundle::Entry &entry : bundle.entries()) {
+    std::cout << std::left << std::setw(24) << entry.isa << std::right
+              << std::setw(10) << entry.size << " bytes" << std::endl;
+  }
+  if (bundle.entries().empty()) {
+    std::cout << "No embedded code objects; kernels load from "
+              << Engine::kKernelLibrary << std::endl;
+  }
+  int unmatched = 0;
+  for (int i = 2; i < argc; ++i) {
+    const hansa::CodeObjectBundle::Entry *entry = bundle.select(argv[i]);
+    std::cout << argv[i] << " -> "
+              << (entry ? entry->isa : Engine::kKernelLibrary) << std::endl;
+    unmatched += entry == nullptr;
+  }
+  return unmatched ? 1 : 0;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc > 1 && std::string(argv[1]) == "--bundle") {
+    return bundle_main(argc, argv);
+  }
+  if (argc > 1 && std::string(argv[1]) == "--batch") {
+    return batch_main(argc, argv);
+  }
+  if (argc > 1 && std::string(argv[1]) == "--analyze-workgroups") {
+    return analyze_main(argc, argv);
+  }
+  struct Selection {
+    const hansa::RegisteredKernel *kernel;
+    int size;
+  };
+  std::vector<Selection> selected;
+  int repeats = 1;
+  bool zero_copy = false;
+  bool persistent = false;
+  bool profile_workgroups = false;
+  std::string trace_dir;
+  std::string trace_path;
+  hansa::ImageFormat image_format = hansa::ImageFormat::kPng;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--list") {
+      for (const hansa::RegisteredKernel &k : hansa::kernel_registry()) {
+        std::cout << std::left << std::setw(hansa::kernel_name_width())
+                  << k.name << k.description;
+        if (k.default_size) std::cout << " (size " << k.default_size << ")";
+        std::cout << std::endl;
+      }
+      return 0;
+    }
+    if (arg == "--repeat" && i + 1 < argc) {
+      repeats = std::atoi(argv[++i]);
+      if (repeats < 1) {
+        usage();
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--zero-copy") {
+      zero_copy = true;
+      continue;
+    }
+    if (arg == "--persistent") {
+      persistent = true;
+      continue;
+    }
+    if (arg == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+      continue;
+    }
+    if (arg == "--image-format" && i + 1 < argc) {
+      if (!hansa::parse_image_format(argv[++i], &image_format)) {
+        usage();
+        return 1;
+      }
+      continue;
+    }
+    if (arg.rfind("--profile-workgroups", 0) == 0) {
+      profile_workgroups = true;
+      const size_t equals = arg.find('=');
+      if (equals != std::string::npos) trace_dir = arg.substr(equals + 1);
+      continue;
+    }
+    const size_t colon = arg.find(':');
+    const hansa::RegisteredKernel *kernel =
+        hansa::find_kernel(arg.substr(0, colon));
+    if (!kernel) {
+      std::cerr << "ERROR: unknown kernel " << arg << std::endl;
+      usage();
+      return 1;
+    }
+    int size = kernel->default_size;
+    if (colon != std::string::npos) size = std::atoi(arg.c_str() + colon + 1);
+    if (kernel->default_size && size < 1) {
+      usage();
+      return 1;
+    }
+    selected.push_back({kernel, size});
+  }
+  if (selected.empty()) {
+    for (const hansa::RegisteredKernel &k : hansa::kernel_registry()) {
+      selected.push_back({&k, k.default_size});
+    }
+  }
+
+  Engine *engine = hansa::Runtime::engine();
+  if (!engine) {
+    std::cout << "Failed to initialize engine" << std::endl;
+    return 1;
+  }
+  if (profile_workgroups) engine->enable_workgroup_profiling();
+  if (!trace_path.empty() && 0 != start_trace(*engine)) return 1;
+
+  struct Row {
+    const Selection *selection;
+    hansa::RunReport report;
+    int status;
+  };
+  std::vector<Row> rows;
+  for (const Selection &s : selected) {
+    std::cout << "== " << s.kernel->name << std::endl;
+    Row row{&s, {}, 0};
+    HANSA_TRACE_SPAN(s.kernel->name);
+    const uint64_t copied = engine->bytes_copied();
+    row.status =
+        s.kernel->launch(*engine,
+                         {s.size, repeats, zero_copy, persistent, image_format},
+                         &row.report);
+    row.report.bytes_copied = engine->bytes_copied() - copied;
+    rows.push_back(std::move(row));
+  }
+
+  const int name_width = hansa::kernel_name_width();
+  std::cout << std::fixed << std::setprecision(3)
+            << "Cold start: " << hansa::Runtime::cold_start_ms()
+            << " ms (hsa_init, agent and region discovery, queue)\n"
+            << std::left << std::setw(name_width) << "kernel" << std::right
+            << std::setw(8) << "size" << std::setw(12) << "setup ms"
+            << std::setw(13) << "streamed ms" << std::setw(12) << "first ms"
+            << std::setw(12) << "median ms" << std::setw(12) << "copied MB"
+            << std::endl;
+  int failures = 0;
+  for (const Row &row : rows) {
+    const std::string size = row.selection->kernel->default_size
+                                 ? std::to_string(row.selection->size)
+                                 : "-";
+    std::cout << std::left << std::setw(name_width)
+              << row.selection->kernel->name
+              << std::right << std::setw(8) << size;
+    if (row.status != 0) {
+      ++failures;
+      std::cout << "  FAILED" << std::endl;
+      continue;
+    }
+    std::cout << std::setw(12) << row.report.setup_ms << std::setw(13);
+    if (row.report.streamed_ms > 0) {
+      std::cout << row.report.streamed_ms;
+    } else {
+      std::cout << "-";
+    }
+    std::cout << std::setw(12) << row.report.run_ms.front() << std::setw(12)
+              << row.report.median_run_ms() << std::setw(12)
+              << row.report.bytes_copied / 1e6 << std::endl;
+  }
+
+  const hansa::ChunkedTransfer &transfer = engine->transfer();
+  // Streamed uploads are timed with the kernels they overlapped.
+  for (const auto &[direction, stats] :
+       {std::pair{"H2D", transfer.h2d()},
+        std::pair{"H2D streamed", transfer.streamed()},
+        std::pair{"D2H", transfer.d2h()}}) {
+    std::cout << std::left << std::setw(16) << direction << std::right
+              << std::setw(10) << stats.bytes / 1e6 << " MB in "
+              << stats.chunks << " chunks, " << stats.gb_per_s() << " GB/s"
+              << std::endl;
+  }
+
+  std::cout << std::left << std::setw(16) << "memory" << std::right
+            << std::setw(10) << "hit rate" << std::setw(16) << "peak in use"
+            << std::setw(16) << "peak reserved" << std::setw(15)
+            << "driver allocs"
+            << std::endl;
+  for (hansa::MemoryKind kind :
+       {hansa::MemoryKind::kDeviceLocal, hansa::MemoryKind::kHostCoherent,
+        hansa::MemoryKind::kStaging}) {
+    const hansa::CachingAllocator::Stats stats =
+        engine->allocator(kind).stats();
+    if (stats.requests == 0) continue;
+    std::cout << std::left << std::setw(16) << hansa::memory_kind_name(kind)
+              << std::right << std::setw(10) << stats.hit_rate()
+              << std::setw(12) << stats.peak_in_use / 1048576.0 << " MiB"
+              << std::setw(12) << stats.peak_reserved / 1048576.0 << " MiB"
+              << std::setw(15) << stats.backing_allocations << std::endl;
+  }
+
+  // Achieved is the share of the agent's wave slots the grid can fill,
+  // estimated from its size; there are no hardware counters to read.
+  const hansa::AgentLimits &limits = engine->limits();
+  std::cout << "occupancy on " << engine->agent_name() << ": "
+            << limits.compute_units << " CUs, wave" << limits.wavefront_size
+            << "\n"
+            << std::left << std::setw(34) << "kernel" << std::right
+            << std::setw(12) << "workgroup" << std::setw(10) << "waves/CU"
+            << std::setw(13) << "theoretical" << std::setw(10) << "achieved"
+            << std::setw(12) << "limiter" << std::endl;
+  for (const auto &[symbol, o] : engine->occupancy()) {
+    const std::string shape = std::to_string(o.workgroup[0]) + "x" +
+                              std::to_string(o.workgroup[1]) + "x" +
+                              std::to_string(o.workgroup[2]);
+    const std::string waves = std::to_string(o.waves_per_cu) + "/" +
+                              std::to_string(o.max_waves_per_cu);
+    std::cout << std::left << std::setw(34) << symbol << std::right
+              << std::setw(12) << shape << std::setw(10) << waves
+              << std::setw(12) << o.theoretical * 100 << "%" << std::setw(9)
+              << o.achieved * 100 << "%" << std::setw(12) << o.limiter
+              << std::endl;
+  }
+  failures += report_workgroups(*engine, trace_dir);
+  if (!trace_path.empty() &&
+      0 != hansa::Tracer::instance().write_chrome_json(trace_path)) {
+    ++failures;
+  }
+  return failures ? 1 : 0;
 }
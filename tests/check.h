@@ -0,0 +1,39 @@
+#pragma once
+
+#include <iostream>
+
+// Minimal checks for the host-only tests: a failed CHECK reports where and
+// carries on, and the test's main returns test::result().
+
+namespace hansa::test {
+
+inline int failures = 0;
+
+inline int
+result() {
+  if (failures) std::cerr << failures << " check(s) failed" << std::endl;
+  return failures ? 1 : 0;
+}
+
+}  // namespace hansa::test
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ")" \
+                << " failed" << std::endl;                              \
+      ++hansa::test::failures;                                          \
+    }                                                                   \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                \
+  do {                                                                \
+    const auto &check_a = (a);                                        \
+    const auto &check_b = (b);                                        \
+    if (!(check_a == check_b)) {                                      \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #a    \
+                << ", " #b ") failed: " << check_a << " != " << check_b \
+                << std::endl;                                         \
+      ++hansa::test::failures;                                        \
+    }                                                                 \
+  } while (0)
@@ -0,0 +1,161 @@
+// TargetId::parse and CodeObjectBundle::select across feature settings:
+// pinned xnack+ and xnack-, sramecc, and targets that leave both as any.
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hansa/code_object_bundle.h"
+#include "tests/check.h"
+
+namespace {
+
+using hansa::CodeObjectBundle;
+using hansa::TargetId;
+
+void
+test_parse() {
+  TargetId id;
+  CHECK(TargetId::parse("gfx90a", &id));
+  CHECK_EQ(id.processor, "gfx90a");
+  CHECK_EQ(id.sramecc, 0);
+  CHECK_EQ(id.xnack, 0);
+  CHECK_EQ(id.specificity(), 0);
+
+  CHECK(TargetId::parse("gfx90a:xnack+", &id));
+  CHECK_EQ(id.xnack, '+');
+  CHECK_EQ(id.sramecc, 0);
+  CHECK_EQ(id.specificity(), 1);
+
+  CHECK(TargetId::parse("gfx90a:sramecc-:xnack+", &id));
+  CHECK_EQ(id.sramecc, '-');
+  CHECK_EQ(id.xnack, '+');
+  CHECK_EQ(id.specificity(), 2);
+
+  // Features in either order, and the full ISA name HSA reports.
+  CHECK(TargetId::parse("gfx90a:xnack-:sramecc+", &id));
+  CHECK_EQ(id.sramecc, '+');
+  CHECK_EQ(id.xnack, '-');
+  CHECK(TargetId::parse("amdgcn-amd-amdhsa--gfx942:sramecc+:xnack-", &id));
+  CHECK_EQ(id.processor, "gfx942");
+  CHECK_EQ(id.sramecc, '+');
+  CHECK_EQ(id.xnack, '-');
+  CHECK(TargetId::parse("amdgcn-amd-amdhsa--gfx1103", &id));
+  CHECK_EQ(id.processor, "gfx1103");
+  CHECK_EQ(id.specificity(), 0);
+
+  // Rejected names leave *out alone.
+  const char *const bad[] = {
+      "",
+      "sm_80",
+      "gfx90a:",
+      "gfx90a:xnack",
+      "gfx90a:x+",
+      "gfx90a:xnack*",
+      "gfx90a::xnack+",
+      "gfx1100:wavefrontsize64+",
+  };
+  for (const char *name : bad) {
+    TargetId untouched;
+    untouched.processor = "unchanged";
+    CHECK(!TargetId::parse(name, &untouched));
+    CHECK_EQ(untouched.processor, "unchanged");
+  }
+}
+
+void
+test_runs_on() {
+  TargetId any, plus, minus, agent;
+  TargetId::parse("gfx90a", &any);
+  TargetId::parse("gfx90a:xnack+", &plus);
+  TargetId::parse("gfx90a:xnack-", &minus);
+
+  TargetId::parse("gfx90a:sramecc+:xnack+", &agent);
+  CHECK(any.runs_on(agent));
+  CHECK(plus.runs_on(agent));
+  CHECK(!minus.runs_on(agent));
+
+  // An agent that does not report xnack only runs code that leaves it any.
+  TargetId::parse("gfx90a", &agent);
+  CHECK(any.runs_on(agent));
+  CHECK(!plus.runs_on(agent));
+  CHECK(!minus.runs_on(agent));
+
+  TargetId::parse("gfx908:xnack+", &agent);
+  CHECK(!plus.runs_on(agent));
+}
+
+const uint8_t kCode[6] = {};
+
+/// Entries whose data pointers tell them apart.
+CodeObjectBundle
+bundle(const std::vector<std::string> &isas) {
+  std::vector<CodeObjectBundle::Entry> entries;
+  for (size_t i = 0; i < isas.size(); ++i) {
+    entries.push_back({isas[i], kCode + i, 1});
+  }
+  return CodeObjectBundle(std::move(entries));
+}
+
+/// The isa of the entry select picks, or "none".
+std::string
+selected(const CodeObjectBundle &b, const std::string &agent) {
+  const CodeObjectBundle::Entry *entry = b.select(agent);
+  return entry ? entry->isa : "none";
+}
+
+void
+test_select() {
+  const CodeObjectBundle b = bundle({
+      "gfx90a",
+      "gfx90a:xnack-",
+      "gfx90a:xnack+",
+      "gfx90a:sramecc+:xnack-",
+      "gfx1103",
+  });
+  CHECK_EQ(selected(b, "amdgcn-amd-amdhsa--gfx90a:sramecc+:xnack-"),
+           "gfx90a:sramecc+:xnack-");
+  CHECK_EQ(selected(b, "amdgcn-amd-amdhsa--gfx90a:sramecc-:xnack-"),
+           "gfx90a:xnack-");
+  CHECK_EQ(selected(b, "amdgcn-amd-amdhsa--gfx90a:sramecc+:xnack+"),
+           "gfx90a:xnack+");
+  CHECK_EQ(selected(b, "amdgcn-amd-amdhsa--gfx90a"), "gfx90a");
+  CHECK_EQ(selected(b, "amdgcn-amd-amdhsa--gfx1103"), "gfx1103");
+  CHECK_EQ(selected(b, "amdgcn-amd-amdhsa--gfx1100"), "none");
+  CHECK_EQ(selected(b, "not an isa"), "none");
+  const CodeObjectBundle::Entry *entry = b.select("gfx1103");
+  CHECK(entry && entry->data == kCode + 4);
+
+  // Without an any build, an agent with the other xnack setting gets none.
+  const CodeObjectBundle pinned = bundle({"gfx90a:xnack+"});
+  CHECK_EQ(selected(pinned, "gfx90a:sramecc+:xnack-"), "none");
+  CHECK_EQ(selected(pinned, "gfx90a:sramecc+:xnack+"), "gfx90a:xnack+");
+
+  // Equally specific matches go to the first; unparseable entries are
+  // skipped.
+  const CodeObjectBundle ties =
+      bundle({"garbage", "gfx90a:xnack-", "gfx90a:sramecc+"});
+  entry = ties.select("gfx90a:sramecc+:xnack-");
+  CHECK(entry && entry->data == kCode + 1);
+}
+
+void
+test_targets() {
+  CHECK_EQ(bundle({"gfx1100", "gfx90a:xnack-"}).targets(),
+           "gfx1100, gfx90a:xnack-");
+  CHECK_EQ(CodeObjectBundle().targets(), "none");
+  // This binary links no bundle, so the weak table is absent.
+  CHECK(CodeObjectBundle::embedded().entries().empty());
+}
+
+}  // namespace
+
+int
+main() {
+  test_parse();
+  test_runs_on();
+  test_select();
+  test_targets();
+  return hansa::test::result();
+}
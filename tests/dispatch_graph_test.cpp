@@ -0,0 +1,166 @@
+// DispatchGraph on the host backend: a grayscale node feeding a blur node
+// is captured once, replayed, rebound with set_args and replayed again,
+// and set_args refuses args of a size the node was not captured with.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/engine.h"
+#include "hansa/ref.h"
+#include "tests/check.h"
+
+using hansa::DispatchGraph;
+using hansa::Engine;
+
+namespace {
+
+constexpr int kWidth = 13;
+constexpr int kHeight = 7;
+constexpr size_t kPixels = size_t(kWidth) * kHeight;
+
+struct args_t {
+  unsigned char *img_out;
+  const unsigned char *img_in;
+  int width;
+  int height;
+};
+
+std::vector<unsigned char>
+random_image(unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<unsigned char> rgb(kPixels * 3);
+  for (unsigned char &v : rgb) v = rng();
+  return rgb;
+}
+
+/// The blurred gray image the graph should produce from rgb.
+std::vector<unsigned char>
+expected(const std::vector<unsigned char> &rgb) {
+  std::vector<unsigned char> gray(kPixels), blurred(kPixels);
+  hansa::ref::color_to_grayscale(gray.data(), rgb.data(), kWidth, kHeight);
+  hansa::ref::box_blur(blurred.data(), gray.data(), kWidth, kHeight, 1, 1);
+  return blurred;
+}
+
+std::vector<unsigned char>
+contents(const hansa::DeviceBuffer<unsigned char> &buffer) {
+  std::vector<unsigned char> host(buffer.count());
+  if (buffer.copy_to(host.data())) host.clear();
+  return host;
+}
+
+void
+test_replay_and_rebind(Engine &engine) {
+  const std::vector<unsigned char> first = random_image(1);
+  const std::vector<unsigned char> second = random_image(2);
+  hansa::DeviceBuffer<unsigned char> input(engine, first.size());
+  hansa::DeviceBuffer<unsigned char> input_alt(engine, second.size());
+  hansa::DeviceBuffer<unsigned char> gray(engine, kPixels);
+  hansa::DeviceBuffer<unsigned char> output(engine, kPixels);
+  hansa::DeviceBuffer<unsigned char> output_alt(engine, kPixels);
+  CHECK_EQ(input.copy_from(first.data()), 0);
+  CHECK_EQ(input_alt.copy_from(second.data()), 0);
+
+  const Engine::KernelDispatchConfig gray_cfg(
+      "libkernels.so", "color_to_grayscale.kd", {int(kPixels), 1, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  const Engine::KernelDispatchConfig blur_cfg(
+      "libkernels.so", "image_blur_planar.kd", {kWidth, kHeight, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  DispatchGraph graph;
+  DispatchGraph::NodeId gray_node, blur_node;
+  CHECK_EQ(engine.capture(&graph, &gray_cfg,
+                          args_t{gray.data(), input.data(), kWidth, kHeight},
+                          {}, &gray_node),
+           0);
+  CHECK_EQ(engine.capture(&graph, &blur_cfg,
+                          args_t{output.data(), gray.data(), kWidth, kHeight},
+                          {gray_node}, &blur_node),
+           0);
+  CHECK_EQ(graph.node_count(), 2u);
+  CHECK(graph.ordered());
+
+  CHECK_EQ(engine.replay(&graph), 0);
+  CHECK_EQ(engine.wait(graph), 0);
+  CHECK(contents(output) == expected(first));
+
+  // Both nodes rebound: the second image into the other output.
+  CHECK_EQ(graph.set_args(gray_node, args_t{gray.data(), input_alt.data(),
+                                            kWidth, kHeight}),
+           0);
+  CHECK_EQ(graph.set_args(blur_node, args_t{output_alt.data(), gray.data(),
+                                            kWidth, kHeight}),
+           0);
+  CHECK_EQ(engine.replay(&graph), 0);
+  CHECK_EQ(engine.wait(graph), 0);
+  CHECK(contents(output_alt) == expected(second));
+  CHECK(contents(output) == expected(first));
+
+  // An unordered graph gives the same result.
+  graph.set_ordered(false);
+  CHECK(!graph.ordered());
+  CHECK_EQ(graph.set_args(gray_node, args_t{gray.data(), input.data(),
+                                            kWidth, kHeight}),
+           0);
+  CHECK_EQ(engine.replay(&graph), 0);
+  CHECK_EQ(engine.wait(graph), 0);
+  CHECK(contents(output_alt) == expected(first));
+}
+
+void
+test_rejected_args(Engine &engine) {
+  hansa::DeviceBuffer<unsigned char> input(engine, kPixels * 3);
+  hansa::DeviceBuffer<unsigned char> gray(engine, kPixels);
+  const Engine::KernelDispatchConfig cfg(
+      "libkernels.so", "color_to_grayscale.kd", {int(kPixels), 1, 1},
+      Engine::KernelDispatchConfig::kAutoWorkgroup);
+  DispatchGraph graph;
+  DispatchGraph::NodeId node;
+  CHECK_EQ(engine.capture(&graph, &cfg,
+                          args_t{gray.data(), input.data(), kWidth, kHeight},
+                          {}, &node),
+           0);
+
+  // The blur's wider args, and a lone pointer, are not this node's.
+  struct blur_args_t {
+    unsigned char *img_out;
+    const unsigned char *img_in;
+    int width;
+    int height;
+    int radius;
+    int planar;
+  };
+  CHECK(graph.set_args(node, blur_args_t{gray.data(), input.data(), kWidth,
+                                         kHeight, 1, 0}) != 0);
+  CHECK(graph.set_args(node, gray.data()) != 0);
+
+  // set_arg stays within the explicit args, clear of the hidden ones.
+  const int width = kWidth;
+  CHECK_EQ(graph.set_arg(node, offsetof(args_t, width), &width, sizeof(int)),
+           0);
+  CHECK(graph.set_arg(node, sizeof(args_t), &width, sizeof(int)) != 0);
+  CHECK(graph.set_args(node + 1, args_t{}) != 0);
+
+  // Dependencies must already be in the graph.
+  DispatchGraph::NodeId later;
+  CHECK(engine.capture(&graph, &cfg,
+                       args_t{gray.data(), input.data(), kWidth, kHeight},
+                       {node + 1}, &later) != 0);
+}
+
+}  // namespace
+
+int
+main() {
+  // The host backend runs the same kernels on any machine.
+  setenv("HANSA_BACKEND", "host", 1);
+  Engine engine;
+  if (0 != engine.init()) return 1;
+  test_replay_and_rebind(engine);
+  test_rejected_args(engine);
+  return hansa::test::result();
+}
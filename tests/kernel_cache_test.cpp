@@ -0,0 +1,258 @@
+// KernelCache over a stub HSA runtime that counts calls: a code file is
+// deserialized once, an executable is created and frozen once per (code
+// file, agent), and a repeated lookup makes no HSA call at all.
+
+#include <hsa/hsa.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "hansa/kernel_cache.h"
+#include "tests/check.h"
+
+namespace {
+
+struct Calls {
+  int deserialize = 0;
+  int code_object_destroy = 0;
+  int executable_create = 0;
+  int load = 0;
+  int freeze = 0;
+  int executable_destroy = 0;
+  int get_symbol = 0;
+};
+
+Calls calls;
+bool fail_freeze = false;
+size_t deserialized_size = 0;
+uint64_t next_handle = 1;
+
+const char *const kSymbols[] = {"add.kd", "scale.kd"};
+constexpr uint32_t kKernargSize = 24;
+
+}  // namespace
+
+extern "C" {
+
+hsa_status_t
+hsa_status_string(hsa_status_t, const char **status_string) {
+  *status_string = "stub";
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+hsa_code_object_deserialize(void *, size_t size, const char *,
+                            hsa_code_object_t *code_object) {
+  ++calls.deserialize;
+  deserialized_size = size;
+  code_object->handle = next_handle++;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+hsa_code_object_destroy(hsa_code_object_t) {
+  ++calls.code_object_destroy;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+hsa_executable_create(hsa_profile_t, hsa_executable_state_t, const char *,
+                      hsa_executable_t *executable) {
+  ++calls.executable_create;
+  executable->handle = next_handle++;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+hsa_executable_load_code_object(hsa_executable_t, hsa_agent_t,
+                                hsa_code_object_t, const char *) {
+  ++calls.load;
+  return HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+hsa_executable_freeze(hsa_executable_t, const char *) {
+  ++calls.freeze;
+  return fail_freeze ? HSA_STATUS_ERROR : HSA_STATUS_SUCCESS;
+}
+
+hsa_status_t
+hsa_executable_destroy(hsa_executable_t) {
+  ++calls.executable_destroy;
+  return HSA_STATUS_SUCCESS;
+}
+
+/// The symbol handle is the executable's handle times 16 plus the index
+/// into kSymbols, so kernel objects differ per executable and per symbol.
+hsa_status_t
+hsa_executable_get_symbol(hsa_executable_t executable, const char *,
+                          const char *symbol_name, hsa_agent_t, int32_t,
+                          hsa_executable_symbol_t *symbol) {
+  ++calls.get_symbol;
+  for (uint64_t i = 0; i < std::size(kSymbols); ++i) {
+    if (std::strcmp(symbol_name, kSymbols[i]) == 0) {
+      symbol->handle = executable.handle * 16 + i;
+      return HSA_STATUS_SUCCESS;
+    }
+  }
+  return HSA_STATUS_ERROR_INVALID_SYMBOL_NAME;
+}
+
+hsa_status_t
+hsa_executable_symbol_get_info(hsa_executable_symbol_t symbol,
+                               hsa_executable_symbol_info_t attribute,
+                               void *value) {
+  switch (attribute) {
+    case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_OBJECT:
+      *static_cast<uint64_t *>(value) = symbol.handle;
+      return HSA_STATUS_SUCCESS;
+    case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_KERNARG_SEGMENT_SIZE:
+      *static_cast<uint32_t *>(value) = kKernargSize;
+      return HSA_STATUS_SUCCESS;
+    case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_GROUP_SEGMENT_SIZE:
+    case HSA_EXECUTABLE_SYMBOL_INFO_KERNEL_PRIVATE_SEGMENT_SIZE:
+      *static_cast<uint32_t *>(value) = 0;
+      return HSA_STATUS_SUCCESS;
+    default:
+      return HSA_STATUS_ERROR_INVALID_ARGUMENT;
+  }
+}
+
+}  // extern "C"
+
+namespace {
+
+const hsa_agent_t kAgent{1};
+const hsa_agent_t kOtherAgent{2};
+// Not an ELF, so the cache finds no metadata or descriptor; the stub does
+// not look inside it.
+const char kImage[] = "stub code object";
+
+/// Lookups from one code file, on one agent and then on a second.
+void
+test_loads_once_per_agent() {
+  calls = {};
+  hansa::KernelCache cache;
+  cache.add_image("kernels.co", kImage, sizeof(kImage));
+
+  hansa::KernelObject add, scale, again;
+  CHECK_EQ(cache.lookup("kernels.co", "add.kd", kAgent, &add), 0);
+  CHECK_EQ(cache.lookup("kernels.co", "scale.kd", kAgent, &scale), 0);
+  CHECK_EQ(cache.lookup("kernels.co", "add.kd", kAgent, &again), 0);
+  CHECK_EQ(calls.deserialize, 1);
+  CHECK_EQ(deserialized_size, sizeof(kImage));
+  CHECK_EQ(calls.executable_create, 1);
+  CHECK_EQ(calls.load, 1);
+  CHECK_EQ(calls.freeze, 1);
+  CHECK_EQ(calls.get_symbol, 2);
+
+  CHECK(add.handle != scale.handle);
+  CHECK_EQ(again.handle, add.handle);
+  CHECK_EQ(add.kernarg_segment_size, kKernargSize);
+  CHECK(add.metadata == nullptr);
+  CHECK(add.descriptor == nullptr);
+  // Interned once on resolution: the same pointer on every lookup.
+  CHECK(add.name != nullptr);
+  CHECK_EQ(std::string(add.name), "add.kd");
+  CHECK(again.name == add.name);
+
+  hansa::KernelObject other;
+  CHECK_EQ(cache.lookup("kernels.co", "add.kd", kOtherAgent, &other), 0);
+  CHECK_EQ(calls.deserialize, 1);
+  CHECK_EQ(calls.executable_create, 2);
+  CHECK_EQ(calls.freeze, 2);
+  CHECK(other.handle != add.handle);
+
+  cache.clear();
+  CHECK_EQ(calls.executable_destroy, 2);
+  CHECK_EQ(calls.code_object_destroy, 1);
+
+  // The image stays bound across clear(), and is deserialized again.
+  CHECK_EQ(cache.lookup("kernels.co", "add.kd", kAgent, &add), 0);
+  CHECK_EQ(calls.deserialize, 2);
+  CHECK_EQ(calls.freeze, 3);
+}
+
+/// A symbol the executable lacks fails without reloading anything, and is
+/// looked up again next time rather than cached as missing.
+void
+test_unknown_symbol() {
+  calls = {};
+  hansa::KernelCache cache;
+  cache.add_image("kernels.co", kImage, sizeof(kImage));
+
+  hansa::KernelObject kernel;
+  CHECK(cache.lookup("kernels.co", "missing.kd", kAgent, &kernel) != 0);
+  CHECK(cache.lookup("kernels.co", "missing.kd", kAgent, &kernel) != 0);
+  CHECK_EQ(calls.get_symbol, 2);
+  CHECK_EQ(calls.deserialize, 1);
+  CHECK_EQ(calls.freeze, 1);
+}
+
+/// An executable that fails to freeze is destroyed and not cached; the
+/// code object is, so the retry only creates and freezes again.
+void
+test_failed_freeze() {
+  calls = {};
+  hansa::KernelCache cache;
+  cache.add_image("kernels.co", kImage, sizeof(kImage));
+
+  hansa::KernelObject kernel;
+  fail_freeze = true;
+  CHECK(cache.lookup("kernels.co", "add.kd", kAgent, &kernel) != 0);
+  fail_freeze = false;
+  CHECK_EQ(calls.executable_destroy, 1);
+  CHECK_EQ(calls.get_symbol, 0);
+
+  CHECK_EQ(cache.lookup("kernels.co", "add.kd", kAgent, &kernel), 0);
+  CHECK_EQ(calls.deserialize, 1);
+  CHECK_EQ(calls.executable_create, 2);
+  CHECK_EQ(calls.freeze, 2);
+}
+
+/// Code files on disk are mapped and deserialized once; a missing one
+/// fails before reaching HSA.
+void
+test_code_file() {
+  calls = {};
+  char path[] = "/tmp/kernel_cache_testXXXXXX";
+  const int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  if (fd < 0) return;
+  close(fd);
+  const std::string contents(4096 + 17, 'x');
+  std::ofstream(path, std::ios::binary) << contents;
+
+  {
+    hansa::KernelCache cache;
+    hansa::KernelObject kernel;
+    CHECK_EQ(cache.lookup(path, "add.kd", kAgent, &kernel), 0);
+    CHECK_EQ(cache.lookup(path, "scale.kd", kAgent, &kernel), 0);
+    CHECK_EQ(calls.deserialize, 1);
+    CHECK_EQ(deserialized_size, contents.size());
+
+    CHECK(cache.lookup("/nonexistent/kernels.co", "add.kd", kAgent,
+                       &kernel) != 0);
+    CHECK_EQ(calls.deserialize, 1);
+  }
+  // The destructor clears.
+  CHECK_EQ(calls.executable_destroy, 1);
+  CHECK_EQ(calls.code_object_destroy, 1);
+  unlink(path);
+}
+
+}  // namespace
+
+int
+main() {
+  test_loads_once_per_agent();
+  test_unknown_symbol();
+  test_failed_freeze();
+  test_code_file();
+  return hansa::test::result();
+}
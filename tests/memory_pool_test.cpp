@@ -0,0 +1,217 @@
+// CachingAllocator over HostMemoryPool: freed blocks are reused without
+// reaching the backing pool, trim() gives back only what holds nothing
+// live, and an exhausted pool is retried once the cache has been trimmed.
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "hansa/memory_pool.h"
+#include "tests/check.h"
+
+namespace {
+
+using hansa::CachingAllocator;
+
+/// A HostMemoryPool that fails once it would hold more than cap bytes.
+class CappedPool : public hansa::HostMemoryPool {
+ public:
+  explicit CappedPool(size_t cap) : cap_(cap) {}
+
+  void *
+  allocate(size_t size) override {
+    if (held_ + size > cap_) return nullptr;
+    void *ptr = HostMemoryPool::allocate(size);
+    if (ptr) held_ += size;
+    return ptr;
+  }
+
+  void
+  release(void *ptr, size_t size) override {
+    held_ -= size;
+    HostMemoryPool::release(ptr, size);
+  }
+
+  [[nodiscard]]
+  size_t
+  held() const {
+    return held_;
+  }
+
+ private:
+  size_t cap_;
+  size_t held_ = 0;
+};
+
+void
+test_empty_request() {
+  hansa::HostMemoryPool pool;
+  CachingAllocator allocator(pool);
+  CHECK(allocator.allocate(0) == nullptr);
+  CHECK(!allocator.allocate_buffer(0));
+  CHECK_EQ(pool.allocations(), 0u);
+  CHECK_EQ(allocator.stats().requests, 0u);
+}
+
+/// One request per size class, freed and asked for again: the same block
+/// comes back and the backing pool is not asked twice.
+void
+test_reuse() {
+  hansa::HostMemoryPool pool;
+  CachingAllocator allocator(pool);
+  const size_t sizes[] = {
+      1,                                    // smallest slab class
+      1000,                                 // a larger slab class
+      CachingAllocator::kMaxSlabBlock + 1,  // buddy
+      CachingAllocator::kArenaSize + 1,     // huge
+  };
+  for (size_t size : sizes) {
+    void *first = allocator.allocate(size);
+    CHECK(first != nullptr);
+    allocator.free(first);
+    void *again = allocator.allocate(size);
+    CHECK(again == first);
+    allocator.free(again);
+  }
+  CHECK_EQ(pool.allocations(), 4u);
+  const CachingAllocator::Stats stats = allocator.stats();
+  CHECK_EQ(stats.requests, 8u);
+  CHECK_EQ(stats.hits, 4u);
+  CHECK_EQ(stats.in_use, 0u);
+
+  // A slab serves its block size until it runs out.
+  std::vector<void *> blocks;
+  const size_t per_slab = CachingAllocator::kSlabSize / 2048;
+  for (size_t i = 0; i < per_slab; ++i) {
+    blocks.push_back(allocator.allocate(2048));
+  }
+  CHECK_EQ(pool.allocations(), 5u);
+  blocks.push_back(allocator.allocate(2048));
+  CHECK_EQ(pool.allocations(), 6u);
+  for (void *block : blocks) allocator.free(block);
+
+  // A cached huge block serves requests it exceeds by at most a quarter.
+  void *huge = allocator.allocate(CachingAllocator::kArenaSize * 2);
+  allocator.free(huge);
+  CHECK(allocator.allocate(CachingAllocator::kArenaSize * 7 / 4) == huge);
+  allocator.free(huge);
+  void *other = allocator.allocate(CachingAllocator::kArenaSize * 5 / 4);
+  CHECK(other != huge);
+  allocator.free(other);
+}
+
+/// Buddy blocks coalesce on free, so an arena split for small requests
+/// can serve a whole-arena one again.
+void
+test_buddy_coalescing() {
+  hansa::HostMemoryPool pool;
+  CachingAllocator allocator(pool);
+  std::vector<void *> blocks;
+  for (int i = 0; i < 8; ++i) {
+    blocks.push_back(allocator.allocate(CachingAllocator::kMinBuddyBlock));
+  }
+  CHECK_EQ(pool.allocations(), 1u);
+  for (void *block : blocks) allocator.free(block);
+  void *whole = allocator.allocate(CachingAllocator::kArenaSize);
+  CHECK(whole == blocks.front());
+  CHECK_EQ(pool.allocations(), 1u);
+  allocator.free(whole);
+}
+
+/// trim() releases free slabs, arenas and huge blocks and keeps any that
+/// still hold a live allocation.
+void
+test_trim() {
+  hansa::HostMemoryPool pool;
+  CachingAllocator allocator(pool);
+  void *live_small = allocator.allocate(512);
+  void *free_small = allocator.allocate(4096);
+  void *free_buddy = allocator.allocate(1024 * 1024);
+  void *free_huge = allocator.allocate(CachingAllocator::kArenaSize + 1);
+  allocator.free(free_small);
+  allocator.free(free_buddy);
+  allocator.free(free_huge);
+  CHECK_EQ(pool.allocations(), 4u);
+
+  allocator.trim();
+  CHECK_EQ(pool.releases(), 3u);
+  CHECK_EQ(allocator.stats().reserved, CachingAllocator::kSlabSize);
+
+  // The kept slab still serves its class, and freed ones start over.
+  void *next_small = allocator.allocate(512);
+  CHECK(next_small != nullptr);
+  CHECK_EQ(pool.allocations(), 4u);
+  CHECK(allocator.allocate(4096) != nullptr);
+  CHECK_EQ(pool.allocations(), 5u);
+
+  allocator.free(live_small);
+  allocator.free(next_small);
+}
+
+/// A request the capped pool cannot serve while the cache holds free
+/// blocks of another size trims and succeeds; one it cannot serve at all
+/// fails without disturbing live allocations.
+void
+test_exhaustion() {
+  CappedPool pool(CachingAllocator::kArenaSize);
+  CachingAllocator allocator(pool);
+
+  void *small = allocator.allocate(1000);
+  CHECK(small != nullptr);
+  allocator.free(small);
+  CHECK_EQ(pool.held(), CachingAllocator::kSlabSize);
+
+  // An arena does not fit beside the cached slab until the slab goes.
+  void *buddy = allocator.allocate(1024 * 1024);
+  CHECK(buddy != nullptr);
+  CHECK_EQ(pool.releases(), 1u);
+  CHECK_EQ(pool.held(), CachingAllocator::kArenaSize);
+
+  // Nothing is free to give back: the request fails and the arena stays.
+  CHECK(allocator.allocate(1000) == nullptr);
+  CHECK(allocator.allocate(CachingAllocator::kArenaSize + 1) == nullptr);
+  CHECK_EQ(pool.releases(), 1u);
+  CHECK_EQ(allocator.stats().in_use, size_t(1024 * 1024));
+
+  // Once the arena is free, it is given back to make room.
+  allocator.free(buddy);
+  small = allocator.allocate(1000);
+  CHECK(small != nullptr);
+  CHECK_EQ(pool.releases(), 2u);
+  CHECK_EQ(pool.held(), CachingAllocator::kSlabSize);
+  allocator.free(small);
+}
+
+/// PoolBuffer hands its block back to the cache when it goes away.
+void
+test_pool_buffer() {
+  hansa::HostMemoryPool pool;
+  CachingAllocator allocator(pool);
+  void *first;
+  {
+    hansa::PoolBuffer buffer = allocator.allocate_buffer(300);
+    CHECK(buffer);
+    CHECK_EQ(buffer.size(), 300u);
+    first = buffer.get();
+    hansa::PoolBuffer moved = std::move(buffer);
+    CHECK(!buffer);
+    CHECK(moved.get() == first);
+  }
+  CHECK_EQ(allocator.stats().in_use, 0u);
+  hansa::PoolBuffer again = allocator.allocate_buffer(300);
+  CHECK(again.get() == first);
+}
+
+}  // namespace
+
+int
+main() {
+  test_empty_request();
+  test_reuse();
+  test_buddy_coalescing();
+  test_trim();
+  test_exhaustion();
+  test_pool_buffer();
+  return hansa::test::result();
+}
@@ -0,0 +1,220 @@
+// estimate_occupancy and choose_workgroup on fixed agent limits and kernel
+// resources, against occupancies worked out by hand.
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "hansa/occupancy.h"
+#include "tests/check.h"
+
+namespace {
+
+using hansa::AgentLimits;
+using hansa::KernelResources;
+using hansa::Occupancy;
+
+bool
+near(double a, double b) {
+  return std::fabs(a - b) < 1e-9;
+}
+
+AgentLimits
+agent(const std::string &isa, uint32_t compute_units) {
+  AgentLimits limits = AgentLimits::for_isa(isa);
+  limits.compute_units = compute_units;
+  return limits;
+}
+
+KernelResources
+kernel(uint32_t vgprs, uint32_t sgprs = 32, uint32_t lds_bytes = 0) {
+  KernelResources r;
+  r.vgprs = vgprs;
+  r.sgprs = sgprs;
+  r.lds_bytes = lds_bytes;
+  return r;
+}
+
+void
+test_register_files() {
+  const AgentLimits gfx906 = AgentLimits::for_isa("gfx906");
+  CHECK_EQ(gfx906.wavefront_size, 64u);
+  CHECK_EQ(gfx906.max_waves_per_simd, 10u);
+  CHECK_EQ(gfx906.vgprs_per_simd, 256u);
+  CHECK_EQ(gfx906.vgpr_granule, 4u);
+
+  const AgentLimits gfx90a = AgentLimits::for_isa("gfx90a");
+  CHECK_EQ(gfx90a.max_waves_per_simd, 8u);
+  CHECK_EQ(gfx90a.vgprs_per_simd, 512u);
+  CHECK_EQ(gfx90a.vgpr_granule, 8u);
+
+  const AgentLimits gfx1103 = AgentLimits::for_isa("gfx1103");
+  CHECK_EQ(gfx1103.wavefront_size, 32u);
+  CHECK_EQ(gfx1103.simds_per_cu, 2u);
+  CHECK_EQ(gfx1103.max_waves_per_simd, 16u);
+  CHECK_EQ(gfx1103.vgprs_per_simd, 1024u);
+  CHECK_EQ(gfx1103.vgpr_granule, 8u);
+  CHECK_EQ(gfx1103.sgprs_per_simd, 0u);
+
+  const AgentLimits gfx1100 = AgentLimits::for_isa("gfx1100", 64);
+  CHECK_EQ(gfx1100.wavefront_size, 64u);
+  CHECK_EQ(gfx1100.vgprs_per_simd, 768u);
+  CHECK_EQ(gfx1100.vgpr_granule, 24u);
+}
+
+void
+test_limiters() {
+  // gfx90a, 128 VGPRs: 512 / 128 = 4 waves per SIMD, 16 of 32 per CU.
+  const AgentLimits gfx90a = agent("gfx90a", 104);
+  Occupancy o = estimate_occupancy(gfx90a, kernel(128, 40), {1 << 20, 1, 1},
+                                   {256, 1, 1});
+  CHECK_EQ(std::string(o.limiter), "vgpr");
+  CHECK_EQ(o.waves_per_workgroup, 4u);
+  CHECK_EQ(o.workgroups_per_cu, 4u);
+  CHECK_EQ(o.waves_per_cu, 16u);
+  CHECK_EQ(o.max_waves_per_cu, 32u);
+  CHECK(near(o.theoretical, 0.5));
+  CHECK(near(o.achieved, 0.5));
+
+  // AGPRs share the unified file on gfx90a.
+  KernelResources split = kernel(64, 40);
+  split.agprs = 64;
+  o = estimate_occupancy(gfx90a, split, {1 << 20, 1, 1}, {256, 1, 1});
+  CHECK_EQ(std::string(o.limiter), "vgpr");
+  CHECK_EQ(o.waves_per_cu, 16u);
+
+  // gfx906, 100 SGPRs round to 112: 800 / 112 = 7 waves per SIMD.
+  const AgentLimits gfx906 = agent("gfx906", 60);
+  o = estimate_occupancy(gfx906, kernel(24, 100), {1 << 20, 1, 1},
+                         {256, 1, 1});
+  CHECK_EQ(std::string(o.limiter), "sgpr");
+  CHECK_EQ(o.workgroups_per_cu, 7u);
+  CHECK(near(o.theoretical, 28.0 / 40));
+
+  // Single-wave workgroups run into the workgroup slots first.
+  o = estimate_occupancy(gfx906, kernel(24), {1 << 20, 1, 1}, {64, 1, 1});
+  CHECK_EQ(std::string(o.limiter), "workgroups");
+  CHECK_EQ(o.waves_per_cu, 16u);
+
+  // gfx1103, 20000 bytes of LDS: 65536 / 20000 = 3 workgroups of 8 waves.
+  const AgentLimits gfx1103 = agent("gfx1103", 12);
+  o = estimate_occupancy(gfx1103, kernel(64, 0, 20000), {4096, 4096, 1},
+                         {16, 16, 1});
+  CHECK_EQ(std::string(o.limiter), "lds");
+  CHECK_EQ(o.waves_per_workgroup, 8u);
+  CHECK_EQ(o.waves_per_cu, 24u);
+  CHECK(near(o.theoretical, 0.75));
+
+  // A wave64 kernel on gfx1103 gets half the wave32 register file: 512 / 64
+  // = 8 waves per SIMD.
+  KernelResources wave64 = kernel(64);
+  wave64.wavefront_size = 64;
+  o = estimate_occupancy(gfx1103, wave64, {1 << 20, 1, 1}, {64, 1, 1});
+  CHECK_EQ(std::string(o.limiter), "vgpr");
+  CHECK_EQ(o.waves_per_workgroup, 1u);
+  CHECK_EQ(o.waves_per_cu, 16u);
+}
+
+void
+test_achieved() {
+  // Four workgroups of 256 for 1000 items: 16 waves on a machine of 3328
+  // wave slots, 1000 of their 1024 lanes busy.
+  const AgentLimits gfx90a = agent("gfx90a", 104);
+  const Occupancy o =
+      estimate_occupancy(gfx90a, kernel(32), {1000, 1, 1}, {256, 1, 1});
+  CHECK_EQ(std::string(o.limiter), "waves");
+  CHECK(near(o.theoretical, 1.0));
+  CHECK(near(o.achieved, 16 * (1000.0 / 1024) / (32 * 104)));
+}
+
+void
+test_descriptor() {
+  // GRANULATED_WORKITEM_VGPR_COUNT 7, GRANULATED_WAVEFRONT_SGPR_COUNT 2.
+  uint8_t descriptor[64] = {};
+  const uint32_t lds = 4096;
+  const uint32_t rsrc1 = 7 | (2 << 6);
+  std::memcpy(descriptor, &lds, 4);
+  std::memcpy(descriptor + 48, &rsrc1, 4);
+
+  KernelResources r = KernelResources::from_descriptor(
+      descriptor, AgentLimits::for_isa("gfx906"));
+  CHECK_EQ(r.lds_bytes, 4096u);
+  CHECK_EQ(r.wavefront_size, 64u);
+  CHECK_EQ(r.vgprs, 32u);
+  CHECK_EQ(r.sgprs, 24u);
+
+  r = KernelResources::from_descriptor(descriptor,
+                                       AgentLimits::for_isa("gfx90a"));
+  CHECK_EQ(r.vgprs, 64u);
+
+  const uint16_t wave32 = 1 << 10;
+  std::memcpy(descriptor + 56, &wave32, 2);
+  r = KernelResources::from_descriptor(descriptor,
+                                       AgentLimits::for_isa("gfx1103"));
+  CHECK_EQ(r.wavefront_size, 32u);
+  CHECK_EQ(r.vgprs, 64u);
+  CHECK_EQ(r.sgprs, 0u);
+}
+
+void
+test_metadata() {
+  hansa::KernelMetadata meta;
+  meta.vgpr_count = 40;
+  meta.agpr_count = 8;
+  meta.sgpr_count = 20;
+  meta.group_segment_fixed_size = 1024;
+  meta.wavefront_size = 32;
+  KernelResources r = KernelResources::from_metadata(meta);
+  CHECK_EQ(r.vgprs, 40u);
+  CHECK_EQ(r.agprs, 8u);
+  CHECK_EQ(r.sgprs, 20u);
+  CHECK_EQ(r.lds_bytes, 1024u);
+  CHECK_EQ(r.wavefront_size, 32u);
+  CHECK_EQ(r.max_workgroup_size, 1024u);
+  meta.max_flat_workgroup_size = 256;
+  CHECK_EQ(KernelResources::from_metadata(meta).max_workgroup_size, 256u);
+}
+
+void
+test_choose_workgroup() {
+  // Two waves fill the 16 workgroup slots of a gfx90a CU; larger shapes do
+  // no better, so the smallest wins.
+  const AgentLimits gfx90a = agent("gfx90a", 104);
+  Occupancy o = choose_workgroup(gfx90a, kernel(32), {1 << 20, 1, 1});
+  CHECK((o.workgroup == std::array<int, 3>{128, 1, 1}));
+  CHECK(near(o.achieved, 1.0));
+
+  // The kernel's own limit caps the shape.
+  KernelResources capped = kernel(32);
+  capped.max_workgroup_size = 64;
+  o = choose_workgroup(gfx90a, capped, {1 << 20, 1, 1});
+  CHECK((o.workgroup == std::array<int, 3>{64, 1, 1}));
+  CHECK_EQ(std::string(o.limiter), "workgroups");
+
+  // A grid narrower than a wave still gets one whole wave.
+  o = choose_workgroup(gfx90a, kernel(32), {10, 1, 1});
+  CHECK((o.workgroup == std::array<int, 3>{64, 1, 1}));
+
+  // 16 KiB of LDS allows 4 workgroups per CU, so 8 waves each are needed to
+  // fill it; the first such shape at least a wave wide divides 1920x1080.
+  const AgentLimits gfx1103 = agent("gfx1103", 12);
+  o = choose_workgroup(gfx1103, kernel(64, 0, 16384), {1920, 1080, 1});
+  CHECK((o.workgroup == std::array<int, 3>{32, 8, 1}));
+  CHECK_EQ(o.workgroups_per_cu, 4u);
+  CHECK(near(o.achieved, 1.0));
+}
+
+}  // namespace
+
+int
+main() {
+  test_register_files();
+  test_limiters();
+  test_achieved();
+  test_descriptor();
+  test_metadata();
+  test_choose_workgroup();
+  return hansa::test::result();
+}
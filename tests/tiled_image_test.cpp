@@ -0,0 +1,164 @@
+// TiledImage on the host backend: every tile shape, down to tiles one
+// pixel wide and so narrower than the halo, must stitch to exactly what
+// one pass over the whole image gives, and write nothing past the image.
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define HANSA_HOST_IMPLEMENTATION
+#include "hansa/engine.h"
+#include "hansa/ref.h"
+#include "hansa/tiled_image.h"
+#include "tests/check.h"
+
+using hansa::Engine;
+
+namespace {
+
+constexpr size_t kCanary = 64;
+constexpr unsigned char kCanaryByte = 0xAB;
+
+struct Case {
+  std::string name;
+  hansa::TileFilter filter;
+  /// The host reference for the whole image.
+  std::function<void(uint8_t *, const uint8_t *, int, int)> reference;
+};
+
+std::vector<Case>
+cases(Engine &engine) {
+  std::vector<Case> all;
+  all.push_back({"image_blur_rgb", hansa::blur_rgb_filter(engine),
+                 [](uint8_t *out, const uint8_t *in, int w, int h) {
+                   hansa::ref::image_blur_rgb(out, in, w, h);
+                 }});
+  for (int radius : {1, 3, 5}) {
+    hansa::SeparableBlur blur;
+    blur.radius = radius;
+    all.push_back({"image_blur_separable r" + std::to_string(radius),
+                   hansa::separable_blur_filter(engine, blur),
+                   [radius](uint8_t *out, const uint8_t *in, int w, int h) {
+                     hansa::ref::box_blur(out, in, w, h, 3, radius);
+                   }});
+  }
+  hansa::SeparableBlur gray;
+  gray.fused_grayscale = true;
+  gray.radius = 3;
+  all.push_back({"grayscale_blur_fused r3",
+                 hansa::separable_blur_filter(engine, gray),
+                 [](uint8_t *out, const uint8_t *in, int w, int h) {
+                   hansa::ref::grayscale_blur(out, in, w, h, 3);
+                 }});
+  return all;
+}
+
+/// Runs c over in with the given tiles into a buffer with a canary past
+/// the image; empty if the run fails.
+std::vector<unsigned char>
+run(Engine &engine, const Case &c, const std::vector<unsigned char> &in,
+    int width, int height, int tile_width, int tile_height,
+    unsigned in_flight) {
+  hansa::TileOptions options;
+  options.tile_width = tile_width;
+  options.tile_height = tile_height;
+  options.max_in_flight = in_flight;
+  hansa::TiledImage tiled(engine, c.filter, options);
+  const size_t bytes = size_t(width) * height * c.filter.out_channels;
+  std::vector<unsigned char> out(bytes + kCanary, kCanaryByte);
+  if (0 != tiled.run(out.data(), in.data(), width, height)) return {};
+  return out;
+}
+
+/// Output bytes that differ from expected, and canary bytes overwritten.
+size_t
+mismatches(const std::vector<unsigned char> &out,
+           const std::vector<unsigned char> &expected) {
+  if (out.size() != expected.size()) return SIZE_MAX;
+  size_t bad = 0;
+  for (size_t i = 0; i < out.size(); ++i) bad += out[i] != expected[i];
+  return bad;
+}
+
+void
+test_tiles_match_one_pass(Engine &engine) {
+  std::mt19937 rng(1);
+  const int sizes[][2] = {{10, 9}, {17, 12}, {33, 7}};
+  for (const Case &c : cases(engine)) {
+    for (const auto &[width, height] : sizes) {
+      std::vector<unsigned char> in(size_t(width) * height * 3);
+      for (unsigned char &v : in) v = rng();
+
+      // One tile covering the image is one pass of the filter over it.
+      const std::vector<unsigned char> one_pass =
+          run(engine, c, in, width, height, width, height, 1);
+      CHECK(!one_pass.empty());
+      if (one_pass.empty()) continue;
+      std::vector<unsigned char> expected(one_pass.size(), kCanaryByte);
+      c.reference(expected.data(), in.data(), width, height);
+      CHECK_EQ(mismatches(one_pass, expected), 0u);
+
+      for (int tile_width : {1, 2, 3, 4, 5, 6, 7, width - 1}) {
+        for (int tile_height : {1, 4, 9}) {
+          for (unsigned in_flight : {1u, 3u}) {
+            const size_t bad =
+                mismatches(run(engine, c, in, width, height, tile_width,
+                               tile_height, in_flight),
+                           one_pass);
+            if (bad) {
+              std::cerr << c.name << " " << width << "x" << height
+                        << " in " << tile_width << "x" << tile_height
+                        << " tiles, " << in_flight << " in flight: " << bad
+                        << " bytes differ" << std::endl;
+            }
+            CHECK_EQ(bad, 0u);
+          }
+        }
+      }
+    }
+  }
+}
+
+/// A filter that fails partway fails the run, which then waits out the
+/// tiles still in flight before returning.
+void
+test_failed_tile(Engine &engine) {
+  hansa::SeparableBlur blur;
+  blur.radius = 2;
+  hansa::TileFilter filter = hansa::separable_blur_filter(engine, blur);
+  int posts = 0;
+  filter.post = [post = filter.post, &posts](
+                    unsigned char *out, const unsigned char *in, int width,
+                    int height, Engine::DispatchHandle *handle) {
+    return ++posts == 4 ? -1 : post(out, in, width, height, handle);
+  };
+  hansa::TileOptions options;
+  options.tile_width = 4;
+  options.tile_height = 4;
+  hansa::TiledImage tiled(engine, filter, options);
+  std::vector<unsigned char> in(16 * 16 * 3, 7), out(in.size());
+  CHECK(tiled.run(out.data(), in.data(), 16, 16) != 0);
+  CHECK_EQ(posts, 4);
+
+  // The same object runs cleanly once the filter stops failing.
+  posts = 100;
+  CHECK_EQ(tiled.run(out.data(), in.data(), 16, 16), 0);
+  CHECK(out == in);
+}
+
+}  // namespace
+
+int
+main() {
+  // The host backend runs the same kernels on any machine.
+  setenv("HANSA_BACKEND", "host", 1);
+  Engine engine;
+  if (0 != engine.init()) return 1;
+  test_tiles_match_one_pass(engine);
+  test_failed_tile(engine);
+  return hansa::test::result();
+}
@@ -0,0 +1,175 @@
+// analyze_workgroups on a checked-in trace of eight workgroups, seven of
+// them recorded, on three CUs of a gfx90a, with figures worked out by hand.
+//
+//   workgroup_profile_test tests/data/workgroups_gfx90a.txt
+
+#include <unistd.h>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hansa/workgroup_profile.h"
+#include "tests/check.h"
+
+namespace {
+
+using hansa::HwLocation;
+using hansa::WorkgroupAnalysis;
+using hansa::WorkgroupTrace;
+
+bool
+near(double a, double b) {
+  return std::fabs(a - b) < 1e-9;
+}
+
+void
+test_statistics(const WorkgroupTrace &trace) {
+  CHECK_EQ(trace.symbol, "matrix_multiply_tiled2.kd");
+  CHECK_EQ(trace.isa, "gfx90a");
+  CHECK_EQ(trace.records.size(), 8u);
+
+  // Durations of 1, 2, 3, 4, 5, 6 and 10 us at 10 ns a tick; the last
+  // record never started.
+  const WorkgroupAnalysis a = hansa::analyze_workgroups(trace, 11);
+  CHECK_EQ(a.workgroups, 8u);
+  CHECK_EQ(a.recorded, 7u);
+  CHECK(near(a.span_us, 11));
+  CHECK(near(a.min_us, 1));
+  CHECK(near(a.median_us, 4));
+  CHECK(near(a.p95_us, 10));
+  CHECK(near(a.p99_us, 10));
+  CHECK(near(a.max_us, 10));
+  CHECK(near(a.imbalance(), 2.5));
+  CHECK((a.slowest == std::vector<size_t>{6, 5, 4}));
+
+  // Twelve bins of 0.75 us from 1 us; 10 us lands in the last.
+  CHECK(near(a.bin_us, 0.75));
+  const std::vector<size_t> histogram{1, 1, 1, 0, 1, 1, 1, 0, 0, 0, 0, 1};
+  CHECK(a.histogram == histogram);
+
+  CHECK_EQ(a.units.size(), 3u);
+  if (a.units.size() != 3) return;
+  CHECK_EQ(a.units[0].where.name(), "se0.sh0.cu0");
+  CHECK_EQ(a.units[1].where.name(), "se0.sh0.cu1");
+  CHECK_EQ(a.units[2].where.name(), "se1.sh0.cu2");
+  CHECK_EQ(a.units[0].workgroups, 2u);
+  CHECK_EQ(a.units[1].workgroups, 2u);
+  CHECK_EQ(a.units[2].workgroups, 3u);
+  CHECK(near(a.units[0].busy_us, 3));
+  CHECK(near(a.units[1].busy_us, 7));
+  CHECK(near(a.units[2].busy_us, 21));
+
+  // Eleven slices of 1 us each.
+  const std::vector<double> cu0{1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+  const std::vector<double> cu1{2, 2, 2, 1, 0, 0, 0, 0, 0, 0, 0};
+  const std::vector<double> cu2{0, 1, 2, 3, 3, 3, 3, 2, 2, 1, 1};
+  CHECK(a.units[0].timeline == cu0);
+  CHECK(a.units[1].timeline == cu1);
+  CHECK(a.units[2].timeline == cu2);
+
+  // With slices that do not divide the span, residency still adds up to
+  // the time each CU was busy.
+  const WorkgroupAnalysis b = hansa::analyze_workgroups(trace);
+  const double slice_us = a.span_us / 48;
+  for (const WorkgroupAnalysis::Unit &u : b.units) {
+    const double resident =
+        std::accumulate(u.timeline.begin(), u.timeline.end(), 0.0);
+    CHECK(std::fabs(resident * slice_us - u.busy_us) < 1e-6);
+  }
+}
+
+void
+test_report(const WorkgroupTrace &trace) {
+  std::ostringstream out;
+  hansa::print_workgroup_report(trace, hansa::analyze_workgroups(trace),
+                                out);
+  const std::string report = out.str();
+  CHECK(report.find("7/8 recorded, span 11.00 us") != std::string::npos);
+  CHECK(report.find("imbalance 2.50x") != std::string::npos);
+  CHECK(report.find("slow: workgroup (2,1,0) 10.00 us on se1.sh0.cu2") !=
+        std::string::npos);
+
+  // A trace where nothing was recorded says why instead.
+  WorkgroupTrace blank = trace;
+  blank.records = hansa::blank_workgroup_records(trace.records.size());
+  std::ostringstream none;
+  hansa::print_workgroup_report(blank, hansa::analyze_workgroups(blank),
+                                none);
+  CHECK(none.str().find("HANSA_PROFILE_WORKGROUPS") != std::string::npos);
+}
+
+void
+test_hw_id() {
+  // gfx9 HW_ID: wave 3, simd 2, cu 5, sh 1, se 2.
+  HwLocation where = HwLocation::decode(3 | 2 << 4 | 5 << 8 | 1 << 12 | 2 << 13,
+                                        "gfx90a");
+  CHECK_EQ(where.wave, 3u);
+  CHECK_EQ(where.simd, 2u);
+  CHECK_EQ(where.name(), "se2.sh1.cu5");
+
+  // gfx10+ HW_ID1: wave 17, simd 1, wgp 9, sa 1, se 3.
+  where = HwLocation::decode(17 | 1 << 8 | 9 << 10 | 1 << 16 | 3 << 18,
+                             "gfx1103");
+  CHECK_EQ(where.wave, 17u);
+  CHECK_EQ(where.simd, 1u);
+  CHECK_EQ(where.name(), "se3.sh1.cu9");
+
+  // The host backend records its worker thread.
+  CHECK_EQ(HwLocation::decode(6, "host").name(), "se0.sh0.cu6");
+}
+
+void
+test_save_and_load(const WorkgroupTrace &trace) {
+  char path[] = "/tmp/workgroup_profile_testXXXXXX";
+  const int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  if (fd < 0) return;
+  close(fd);
+
+  CHECK_EQ(trace.save(path), 0);
+  WorkgroupTrace loaded;
+  CHECK_EQ(WorkgroupTrace::load(path, &loaded), 0);
+  CHECK_EQ(loaded.symbol, trace.symbol);
+  CHECK_EQ(loaded.tick_ns, trace.tick_ns);
+  CHECK((loaded.blocks == trace.blocks));
+  CHECK_EQ(loaded.records.size(), trace.records.size());
+  for (size_t i = 0; i < loaded.records.size(); ++i) {
+    CHECK_EQ(loaded.records[i].start, trace.records[i].start);
+    CHECK_EQ(loaded.records[i].end, trace.records[i].end);
+    CHECK_EQ(loaded.records[i].hw_id, trace.records[i].hw_id);
+  }
+
+  // One record short of the 4x2x1 blocks the header declares.
+  WorkgroupTrace short_trace = trace;
+  short_trace.records.pop_back();
+  CHECK_EQ(short_trace.save(path), 0);
+  CHECK(WorkgroupTrace::load(path, &loaded) != 0);
+
+  std::ofstream(path, std::ios::trunc) << "not a trace\n";
+  CHECK(WorkgroupTrace::load(path, &loaded) != 0);
+  unlink(path);
+}
+
+}  // namespace
+
+int
+main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "usage: workgroup_profile_test TRACE" << std::endl;
+    return 1;
+  }
+  WorkgroupTrace trace;
+  if (0 != WorkgroupTrace::load(argv[1], &trace)) return 1;
+  test_statistics(trace);
+  test_report(trace);
+  test_hw_id();
+  test_save_and_load(trace);
+  return hansa::test::result();
+}